@@ -7,14 +7,9 @@
 #ifndef __AST_INTERNAL_H
 #define __AST_INTERNAL_H
 
-/*
- * For simplicity, we limit the maximum number of children any node can have.
- * Note that this is *very* limiting, e.g. it limits the number of statements
- * within a block or program.  We'd definitely want to do something different
- * to handle bigger programs, e.g. store the children of a node in a dynamic
- * array/vector.
- */
-#define AST_NODE_MAX_CHILDREN 16
+#include <stdint.h>
+
+#include "ast.h"
 
 /*
  * This enumeration provides a numerical code for each different type of AST
@@ -33,23 +28,39 @@ enum _ast_node_type {
     BLOCK
 };
 
+/*
+ * The types a variable can be inferred to have (see ast_types.c), in
+ * increasing order, so that a mix of them has the greatest of their types.
+ */
+enum _ast_var_type {
+    TYPE_BOOL,
+    TYPE_INT,
+    TYPE_FLOAT
+};
+
 /*****************************************************************************
  **
  ** AST node structures
  **
+ ** Each node is a fixed 16 bytes: a type tag and an operator, followed by a
+ ** payload of up to three 32-bit fields stored inline.  Children are referred
+ ** to by their index in the AST's node array, and identifiers by their symbol
+ ** ID.
+ **
  *****************************************************************************/
 
 /*
- * This is an AST node specifically representing an identifier expression.
+ * This is the payload of an identifier expression node.
  *
- * @var id The text of the identifier represented by this node.
+ * @var name The symbol ID of the identifier, i.e. the index of its text in
+ *   the AST's name table.
  */
 struct _id_expr_node {
-    char* id;
+    uint32_t name;
 };
 
 /*
- * This is an AST node specifically representing a float expression.
+ * This is the payload of a float expression node.
  *
  * @var val The floating point value represented by this node.
  */
@@ -58,113 +69,190 @@ struct _float_expr_node {
 };
 
 /*
- * This is an AST node specifically representing an integer expression.
+ * This is the payload of an integer expression node.
  *
  * @var val The integer point value represented by this node.
  */
 struct _int_expr_node {
-    int val;
+    int32_t val;
 };
 
 /*
- * This is an AST node specifically representing a boolean expression.
+ * This is the payload of a boolean expression node.
  *
  * @var val The boolean point value represented by this node.
  */
 struct _bool_expr_node {
-    int val;
+    int32_t val;
 };
 
 /*
- * This is an AST node specifically representing a binary operation expression.
+ * This is the payload of a binary operation expression node.  The operation
+ * itself is stored in the node's `op` field.
  *
- * @var op An integer value representing the type of operation being
- *   performed in this expression.  This value should come from parser.h
- *   (e.g. PLUS, MINUS, GTE, etc.).
- * @var lhs The AST node representing the left-hand side of this expression.
- * @var rhs The AST node representing the right-hand side of this expression.
+ * @var lhs The node representing the left-hand side of this expression.
+ * @var rhs The node representing the right-hand side of this expression.
+ * @var first The lowest-numbered node in this expression's subtree.  Because
+ *   nodes are created bottom-up, the subtree occupies exactly the nodes from
+ *   `first` through this one, with every child before its parent.  After
+ *   ast_fold(), the range may also contain constants that are no longer part
+ *   of the subtree; they generate no code.
  */
 struct _binop_expr_node {
-    int op;
-    struct ast_node* lhs;
-    struct ast_node* rhs;
+    uint32_t lhs;
+    uint32_t rhs;
+    uint32_t first;
 };
 
 /*
- * This is an AST node specifically representing an assignment statement.
+ * This is the payload of an assignment statement node.
  *
- * @var lhs The string representing the identifier on the left-hand side of
- *   this statement.
- * @var rhs The AST node representing the right-hand side of this statement.
+ * @var lhs The symbol ID of the identifier on the left-hand side of this
+ *   statement.
+ * @var rhs The node representing the right-hand side of this statement.
  */
 struct _assign_stmt_node {
-    char* lhs;
-    struct ast_node* rhs;
+    uint32_t lhs;
+    uint32_t rhs;
 };
 
 /*
- * This is an AST node specifically representing a block of statements.
+ * This is the payload of a block node.
  *
- * @var stmts An array containing the statements within this block.
+ * @var stmts The index in the AST's statement list array of the first
+ *   statement in this block.  The block's statements are stored there
+ *   contiguously.
  * @var n_stmts The number of statements in this block.
  */
 struct _block_node {
-    struct ast_node* stmts[AST_NODE_MAX_CHILDREN];
-    int n_stmts;
+    uint32_t stmts;
+    uint32_t n_stmts;
 };
 
 /*
- * This is an AST node specifically representing an assignment statement.
+ * This is the payload of an if statement node.
  *
  * @var condition The conditional expression attached to the if block of this
  *   if statement.
  * @var if_block The block of statements representing the if branch of this
  *   if statement.
  * @var else_block The block of statements representing the else branch of this
- *   if statement.
+ *   if statement, or AST_NONE if there is none.
  */
 struct _if_stmt_node {
-    struct ast_node* condition;
-    struct ast_node* if_block;
-    struct ast_node* else_block;
+    uint32_t condition;
+    uint32_t if_block;
+    uint32_t else_block;
 };
 
 /*
- * This is an AST node specifically representing a while statement.
+ * This is the payload of a while statement node.
  *
  * @var condition The conditional expression attached to this while statement.
  * @var block The block of statements representing the body of this while
  *   statement.
  */
 struct _while_stmt_node {
-    struct ast_node* condition;
-    struct ast_node* block;
+    uint32_t condition;
+    uint32_t block;
 };
 
 
 /*
- * This structure is used to represent a node in an AST.  It is generic, and
- * there are more specialized structures defined in ast.c.
+ * This structure is used to represent a node in an AST.
  *
- * @var type An integer value from `enum ast_node_type` above denoting the
- *   type of this AST node.
- * @var node The actual underlying AST node data for this node.  This is
- *   represented as a union so it can represent any specific type of node.
+ * @var type A value from `enum _ast_node_type` above denoting the type of
+ *   this AST node.
+ * @var op For a binary operation expression, a value from parser.h (e.g.
+ *   PLUS, MINUS, GTE, etc.) representing the type of operation performed.
+ * @var node_data The payload specific to this type of node, stored inline.
  */
 struct ast_node {
-    int type;
+    uint16_t type;
+    uint16_t op;
     union ast_nodes {
-        struct _id_expr_node* id_expr;
-        struct _float_expr_node* float_expr;
-        struct _int_expr_node* int_expr;
-        struct _bool_expr_node* bool_expr;
-        struct _binop_expr_node* binop_expr;
-        struct _assign_stmt_node* assign_stmt;
-        struct _block_node* block;
-        struct _if_stmt_node* if_stmt;
-        struct _while_stmt_node* while_stmt;
+        struct _id_expr_node id_expr;
+        struct _float_expr_node float_expr;
+        struct _int_expr_node int_expr;
+        struct _bool_expr_node bool_expr;
+        struct _binop_expr_node binop_expr;
+        struct _assign_stmt_node assign_stmt;
+        struct _block_node block;
+        struct _if_stmt_node if_stmt;
+        struct _while_stmt_node while_stmt;
     } node_data;
 };
 
+/*
+ * Fail to compile if a node ever grows past 16 bytes, or if node types are
+ * added without updating AST_N_NODE_TYPES.
+ */
+typedef char _ast_node_size_check[sizeof(struct ast_node) == 16 ? 1 : -1];
+typedef char _ast_node_types_check[BLOCK + 1 == AST_N_NODE_TYPES ? 1 : -1];
+
+
+/*
+ * This structure represents an entire AST.  Every array here grows by
+ * doubling.
+ *
+ * @var nodes All of the AST's nodes, in the order they were created, so every
+ *   node comes after its children.  Node 0 is a placeholder, so that index
+ *   can serve as AST_NONE.
+ * @var n_nodes The number of nodes in `nodes`, including the placeholder.
+ * @var nodes_capacity The allocated length of `nodes`.
+ * @var stmts The statement lists of all blocks, as node indices.
+ * @var n_stmts The number of entries in use in `stmts`.
+ * @var stmts_capacity The allocated length of `stmts`.
+ * @var names The text of each distinct identifier in the program, indexed
+ *   by symbol ID.  Entry 0 is unused, so that ID can mean "no symbol".  The
+ *   strings themselves are owned by the AST's creator.
+ * @var n_names The number of entries in `names`.
+ * @var names_capacity The allocated length of `names`.
+ * @var root The root node of the AST, or AST_NONE.
+ * @var n_heap_allocs The number of times any of the arrays above was
+ *   allocated or grown.
+ * @var n_nodes_cleared The number of nodes removed by ast_clear().
+ * @var peak_bytes The largest number of bytes used by the arrays above at the
+ *   time of any call to ast_clear().
+ * @var types The type of each variable, as a value from `enum
+ *   _ast_var_type` indexed by symbol ID, or NULL if ast_infer_types() hasn't
+ *   been called, in which case every variable is a float.
+ * @var wide_ops For each node, 1 if it's an addition, subtraction, or
+ *   multiplication whose result might not fit in 32 bits, which is done on
+ *   floats (see ast_types.c), indexed by node, or NULL if
+ *   ast_infer_types() hasn't been called, in which case all of them are.
+ * @var n_nodes_by_type The number of nodes of each type ever created,
+ *   including the placeholder and nodes removed by ast_clear().
+ */
+struct ast {
+    struct ast_node* nodes;
+    uint32_t n_nodes;
+    uint32_t nodes_capacity;
+    uint32_t* stmts;
+    uint32_t n_stmts;
+    uint32_t stmts_capacity;
+    char** names;
+    uint32_t n_names;
+    uint32_t names_capacity;
+    uint32_t root;
+    size_t n_heap_allocs;
+    size_t n_nodes_cleared;
+    size_t peak_bytes;
+    uint8_t* types;
+    uint8_t* wide_ops;
+    size_t n_nodes_by_type[AST_N_NODE_TYPES];
+};
+
+/*
+ * Returns a pointer to the node with the given index in an AST.
+ */
+#define AST_NODE(ast, index) (&(ast)->nodes[(index)])
+
+/*
+ * Returns the text of the identifier with the given index in an AST's name
+ * table.
+ */
+#define AST_NAME(ast, index) ((ast)->names[(index)])
+
 
 #endif
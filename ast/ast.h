@@ -1,184 +1,512 @@
 /*
  * This file contains the public interface of the AST implementation used by
- * the parser defined here.  It contains a structure representing an AST node
- * along with functions for creating different kinds of AST nodes and a
- * function for freeing all the memory belonging to an AST node.
+ * the parser defined here.  It contains a structure representing an AST along
+ * with functions for creating different kinds of AST nodes within it.
  */
 
 #ifndef __AST_H
 #define __AST_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * This structure is used to represent an entire AST.  Its nodes are stored
+ * contiguously and are referred to by 32-bit indices rather than pointers.
+ * The structures representing specific types of constructs are defined in
+ * _ast_internal.h.
+ */
+struct ast;
+
+/**
+ * The node index used to mean "no node", e.g. for a missing else block or a
+ * subtree that couldn't be built because of an error.
+ */
+#define AST_NONE 0
+
+/**
+ * The number of different types of AST node (see ast_node_type_name()).
+ */
+#define AST_N_NODE_TYPES 10
+
+/**
+ * This structure reports how much memory an AST takes up.
+ *
+ * @var n_nodes The number of nodes created in the AST, including any since
+ *   removed by ast_clear().
+ * @var n_nodes_by_type The number of those nodes of each type, indexed by
+ *   node type.  These count nodes as the parser created them, before any
+ *   were rewritten by ast_fold().
+ * @var n_symbols The number of distinct identifiers in the AST.
+ * @var bytes The peak number of bytes used to store the AST's nodes,
+ *   statement lists, and name table.
+ * @var n_heap_allocs The number of heap allocations made to store them.
+ */
+struct ast_stats {
+    size_t n_nodes;
+    size_t n_nodes_by_type[AST_N_NODE_TYPES];
+    size_t n_symbols;
+    size_t bytes;
+    size_t n_heap_allocs;
+};
+
+/**
+ * Allocate and initialize a new, empty AST.
+ */
+struct ast* ast_create();
+
+/**
+ * Frees all memory belonging to an AST.  The identifier strings it refers to
+ * are owned by the caller.
+ */
+void ast_free(struct ast* ast);
+
+/**
+ * Sets the root node of an AST.
+ */
+void ast_set_root(struct ast* ast, uint32_t root);
+
+/**
+ * Returns the root node of an AST, or AST_NONE if it has none.
+ */
+uint32_t ast_get_root(struct ast* ast);
+
+/**
+ * Removes every node and statement list from an AST, keeping its name table
+ * and the memory it has already allocated.  This lets one AST be reused for
+ * each top-level statement of a program that is compiled as it is parsed, so
+ * that it never holds more than one of them at a time.  Node indices from
+ * before the call are no longer valid.
+ */
+void ast_clear(struct ast* ast);
+
+/**
+ * Fills `stats` with statistics about the memory used by an AST.
+ */
+void ast_get_stats(struct ast* ast, struct ast_stats* stats);
+
+/**
+ * Returns the name of a type of AST node (e.g. "binop_expr"), given its
+ * index in `struct ast_stats`'s `n_nodes_by_type`.
+ */
+const char* ast_node_type_name(int type);
+
 /**
- * This structure is used to represent a node in an AST.  It is generic, and
- * there are more specialized structures defined in ast.c to represent
- * specific types of constructs within the AST implementation.
+ * Adds a new symbol, i.e. a distinct identifier, to an AST's name table.
+ * Identifiers are meant to be interned as they are scanned, so this should be
+ * called once per distinct identifier.  Symbol IDs are dense and start at 1,
+ * so 0 can mean "no symbol".
+ *
+ * @param ast The AST to which to add the symbol.
+ * @param name The text of the identifier.  It must remain valid for as long
+ *   as the AST.
+ *
+ * @return Returns the new symbol's ID.
  */
-struct ast_node;
+uint32_t ast_add_symbol(struct ast* ast, char* name);
 
 /**
- * Frees all memory belonging to an AST node, including all nodes in its
- * subtree.
+ * Returns the text of the symbol with the given ID in an AST.
  */
-void ast_node_free(struct ast_node* node);
+const char* ast_symbol_name(struct ast* ast, uint32_t symbol);
 
 /**
- * Allocate, initialize, and return a new identifier expression AST node.
+ * Create a new identifier expression AST node.
  *
- * @param id The text of the identifier represented by the new node.  The
- *   returned node should be considered to have taken ownership of this
- *   string.  It will be freed by ast_node_free().
+ * @param ast The AST to which to add the new node.
+ * @param symbol The symbol ID of the identifier represented by the new node.
  */
-struct ast_node* id_expr_node_create(char* id);
+uint32_t id_expr_node_create(struct ast* ast, uint32_t symbol);
 
 /**
- * Allocate, initialize, and return a new float expression AST node.
+ * Create a new float expression AST node.
  *
+ * @param ast The AST to which to add the new node.
  * @param val The value of the float represented by the new node.
  */
-struct ast_node* float_expr_node_create(float val);
+uint32_t float_expr_node_create(struct ast* ast, float val);
 
 /**
- * Allocate, initialize, and return a new integer expression AST node.
+ * Create a new integer expression AST node.
  *
+ * @param ast The AST to which to add the new node.
  * @param val The value of the integer represented by the new node.
  */
-struct ast_node* int_expr_node_create(int val);
+uint32_t int_expr_node_create(struct ast* ast, int val);
 
 /**
- * Allocate, initialize, and return a new boolean expression AST node.
+ * Create a new boolean expression AST node.
  *
+ * @param ast The AST to which to add the new node.
  * @param val The value of the boolean represented by the new node.
  */
-struct ast_node* bool_expr_node_create(int val);
+uint32_t bool_expr_node_create(struct ast* ast, int val);
 
 /**
- * Allocate, initialize, and return a new binary operation expression AST node.
+ * Create a new binary operation expression AST node.
  *
+ * @param ast The AST to which to add the new node.
  * @param op An integer value representing the type of operation being
  *   performed in this expression.  This value should come from parser.h
  *   (e.g. PLUS, MINUS, GTE, etc.).
  * @param lhs The AST node representing the left-hand side of the new node.
- *   The returned node should be considered to have taken ownership of this
- *   node.  It will be freed by ast_node_free().  It is also freed by this
- *   function if `rhs` is NULL and NULL is returned here.
  * @param rhs The AST node representing the right-hand side of the new node.
- *   The returned node should be considered to have taken ownership of this
- *   node.  It will be freed by ast_node_free().  It is also freed by this
- *   function if `lhs` is NULL and NULL is returned here.
  *
- * @return If `lsh` or `rhs` is NULL, this function returns NULL.  Otherwise,
- *   it returns an AST node representing the binary operation expression.
+ * @return If `lsh` or `rhs` is AST_NONE, this function returns AST_NONE.
+ *   Otherwise, it returns an AST node representing the binary operation
+ *   expression.
  */
-struct ast_node* binop_expr_node_create(
+uint32_t binop_expr_node_create(
+    struct ast* ast,
     int op,
-    struct ast_node* lhs,
-    struct ast_node* rhs
+    uint32_t lhs,
+    uint32_t rhs
 );
 
 /**
- * Allocate, initialize, and return a new assignment statement AST node.
+ * Create a new assignment statement AST node.
  *
- * @param lhs The text of the identifier on the left-hand side of the
- *   assignment statement represented by the new node.  The returned node
- *   should be considered to have taken ownership of this string.  It will be
- *   freed by ast_node_free().  It is also freed by this function if `rhs` is
- *   NULL and NULL is returned here.
+ * @param ast The AST to which to add the new node.
+ * @param lhs The symbol ID of the identifier on the left-hand side of the
+ *   assignment statement represented by the new node.
  * @param rhs The AST node representing the right-hand side of the new node.
- *   The returned node should be considered to have taken ownership of this
- *   node.  It will be freed by ast_node_free().
  *
- * @return If `rhs` is NULL, this function returns NULL.  Otherwise, it returns
- *   an AST node representing the assignment statement.
+ * @return If `rhs` is AST_NONE, this function returns AST_NONE.  Otherwise,
+ *   it returns an AST node representing the assignment statement.
  */
-struct ast_node* assign_stmt_node_create(char* lhs, struct ast_node* rhs);
+uint32_t assign_stmt_node_create(struct ast* ast, uint32_t lhs, uint32_t rhs);
 
 /**
- * Allocate, initialize, and return a new if statement AST node.
+ * Create a new if statement AST node.
  *
+ * @param ast The AST to which to add the new node.
  * @param condition The AST node representing the conditional expression
- *   attached to the if block of the new node.  The returned node should be
- *   considered to have taken ownership of this node.  It will be freed by
- *   ast_node_free().
+ *   attached to the if block of the new node.
  * @param if_block The AST node representing the block of statements attached
- *   to the if branch of the new node.  The returned node should be considered
- *   to have taken ownership of this node.  It will be freed by ast_node_free().
- *   It is also freed by this function if `condition` is NULL and NULL is
- *   returned here.
+ *   to the if branch of the new node.
  * @param else_block The AST node representing the block of statements attached
- *   to the else branch of the new node.  The returned node should be considered
- *   to have taken ownership of this node.  It will be freed by ast_node_free().
- *   It is also freed by this function if `condition` is NULL and NULL is
- *   returned here.
- *
- * @return If `condition` is NULL, this function returns NULL.  Otherwise, it
- *   returns an AST node representing the if statement.
- */
-struct ast_node* if_stmt_node_create(
-    struct ast_node* condition,
-    struct ast_node* if_block,
-    struct ast_node* else_block
-);
-
-/**
- * Allocate, initialize, and return a new block AST node.
+ *   to the else branch of the new node, or AST_NONE if there is no else
+ *   branch.
  *
- * @param first_stmt The AST node representing the first statement within the
- *   new node.  The returned node should be considered to have taken ownership
- *   of this node.  It will be freed by ast_node_free().  If this argument is
- *   NULL, it is ignored.
+ * @return If `condition` is AST_NONE, this function returns AST_NONE.
+ *   Otherwise, it returns an AST node representing the if statement.
  */
-struct ast_node* block_node_create(struct ast_node* first_stmt);
+uint32_t if_stmt_node_create(
+    struct ast* ast,
+    uint32_t condition,
+    uint32_t if_block,
+    uint32_t else_block
+);
 
 /**
- * Adds a single new statement to the end of the list of statements contained
- * within a block.
+ * Create a new block AST node containing a list of statements, which is
+ * copied.  There is no limit on the number of statements in a block.
  *
- * @param block The AST node representing an existing block to which to add a
- *   statement.
- * @param stmt The AST node representing the statement to be added to the list
- *   of statements represented by `block`.  The node `block` should be
- *   considered to have taken ownership of this node.  It will be freed by
- *   ast_node_free().  If this argument is NULL, it is ignored.
+ * @param ast The AST to which to add the new node.
+ * @param stmts The AST nodes representing the statements within the new
+ *   node, in order.
+ * @param n_stmts The number of statements in `stmts`.
  */
-void block_node_append_stmt(struct ast_node* block, struct ast_node* stmt);
+uint32_t block_node_create(
+    struct ast* ast,
+    const uint32_t* stmts,
+    uint32_t n_stmts
+);
 
 /**
- * Allocate, initialize, and return a new while statement AST node.
+ * Create a new while statement AST node.
  *
+ * @param ast The AST to which to add the new node.
  * @param condition The AST node representing the conditional expression
- *   attached to the new node.  The returned node should be considered to have
- *   taken ownership of this node.  It will be freed by ast_node_free().
+ *   attached to the new node.
  * @param block The AST node representing the block of statements attached
- *   to the new node.  The returned node should be considered to have taken
- *   ownership of this node.  It will be freed by ast_node_free().  It is also
- *   freed by this function if `condition` is NULL and NULL is returned here.
+ *   to the new node.
  *
- * @return If `condition` is NULL, this function returns NULL.  Otherwise, it
- *   returns an AST node representing the if statement.
+ * @return If `condition` is AST_NONE, this function returns AST_NONE.
+ *   Otherwise, it returns an AST node representing the while statement.
  */
-struct ast_node* while_stmt_node_create(
-    struct ast_node* condition,
-    struct ast_node* block
+uint32_t while_stmt_node_create(
+    struct ast* ast,
+    uint32_t condition,
+    uint32_t block
 );
 
 /**
- * Allocate, initialize, and return a new break statement AST node.
+ * Create a new break statement AST node.
+ *
+ * @param ast The AST to which to add the new node.
+ */
+uint32_t break_stmt_node_create(struct ast* ast);
+
+/**
+ * Constant-folds and simplifies every node in an AST in place.  Binary
+ * operations over constants are evaluated, identities that hold for every
+ * value (e.g. `x * 1`) are applied, if statements whose conditions fold to a
+ * constant are replaced by the branch they would take, and while loops whose
+ * conditions fold to false are removed.  No node's index changes, so
+ * references to nodes made before the call remain valid.
  */
-struct ast_node* break_stmt_node_create();
+void ast_fold(struct ast* ast);
 
 /**
- * This function generates a GraphViz digraph specification for the AST
- * represented by a given root node.
+ * Infers the type of every variable in an AST, so that the code generator
+ * can keep variables that only ever hold booleans or integers in `i1` or
+ * `i32` values instead of floats.  This must see the whole program, since
+ * any later assignment may widen a variable's type.  Until it is called,
+ * every variable is a float.
+ */
+void ast_infer_types(struct ast* ast);
+
+/**
+ * This function writes a GraphViz digraph specification for an AST to a
+ * stream, as it's generated, in time linear in the size of the AST.
  *
- * @param root The root node of an AST for which to generate a digraph.
+ * @param ast The AST for which to generate a digraph.
+ * @param stream The stream to write the digraph to.
  *
- * @return Returns a string containing the complete GraphViz digraph
- *   specification for `root` and its entire subtree.
+ * @return Returns 0 on success or nonzero if writing to `stream` failed.
+ */
+int write_graphviz(struct ast* ast, FILE* stream);
+
+/*
+ * Optimization levels accepted by generate_llvm_ir(), corresponding to the
+ * -O0, -O1, -O2, -O3, and -Os command-line options.
  */
-char* generate_graphviz(struct ast_node* n);
+enum opt_level {
+    OPT_O0,
+    OPT_O1,
+    OPT_O2,
+    OPT_O3,
+    OPT_OS
+};
 
-char* generate_llvm_ir(struct ast_node* root);
+/*
+ * Options controlling LLVM code generation.
+ *
+ * @var opt_level A value from `enum opt_level` selecting the LLVM pass
+ *   pipeline run on the module.  The same level is used for object code
+ *   generation.
+ * @var cpu The name of the CPU to generate code for (e.g. "skylake"),
+ *   "native" for the host's CPU, or NULL for a generic CPU.
+ * @var features The LLVM target features to enable or disable (e.g.
+ *   "+avx2,-avx512f"), "native" for all of the host's features, or NULL for
+ *   the CPU's own features, which are the host's if `cpu` is "native".
+ * @var profile_generate If not NULL, the generated code counts how often each
+ *   of its conditional branches goes each way, and writes the counts to the
+ *   file at this path each time its entry function returns (see ast_llvm.c).
+ * @var profile_use If not NULL, the text of a profile written by code
+ *   generated with `profile_generate` from the same program, used to weight
+ *   its branches.  It's parsed when the code generator is created, and
+ *   ignored, with a warning, if it's malformed or doesn't match the program.
+ */
+struct codegen_options {
+    int opt_level;
+    const char* cpu;
+    const char* features;
+    const char* profile_generate;
+    const char* profile_use;
+};
 
-void generate_object_code(const char* llvm_ir, const char* output_file);
+/**
+ * This structure holds all of the LLVM state belonging to one code generator:
+ * its context, target machine, and the module currently being built.  Nothing
+ * is shared between code generators, so different threads may each use their
+ * own concurrently.
+ */
+struct codegen;
+
+/*
+ * The LLVM module type (LLVMModuleRef is a pointer to this), declared here so
+ * this header doesn't depend on the LLVM headers.
+ */
+struct LLVMOpaqueModule;
+
+/**
+ * Allocate and initialize a new code generator.  Its LLVM context and target
+ * machine are created here and reused for every program it compiles.
+ *
+ * @param options Options controlling code generation.  They are copied.
+ */
+struct codegen* codegen_create(const struct codegen_options* options);
+
+/**
+ * Frees all memory belonging to a code generator, including its current
+ * module, LLVM context, and target machine.
+ */
+void codegen_free(struct codegen* cg);
+
+/**
+ * Describes everything besides the program itself that determines the code a
+ * code generator created with the given options produces: the version of
+ * LLVM, the target triple, the CPU and features (with "native" resolved to
+ * the host's), the optimization level, and the profile options.  Code
+ * generated from the same AST with options whose descriptions are equal is
+ * the same.  No code generator needs to be created.
+ *
+ * @return Returns the description.  Memory is allocated for the returned
+ *   string, which must be freed by the caller.
+ */
+char* codegen_fingerprint(const struct codegen_options* options);
+
+/**
+ * This function generates an LLVM module containing a single function that
+ * performs the computation represented by a given AST.  The module stays alive
+ * after this call so that IR or object code can be emitted from it directly;
+ * it is replaced by the next call and released by codegen_free().
+ *
+ * @param cg The code generator to use.
+ * @param ast The AST for which to generate LLVM IR.
+ * @param entry_name The symbol name of the generated function, or NULL to use
+ *   `target`.  The string must outlive the generated module.
+ *
+ * @return Returns 0 on success or nonzero on failure.
+ */
+int generate_llvm_ir(struct codegen* cg, struct ast* ast,
+    const char* entry_name);
+
+/**
+ * These functions build a module incrementally, so that a program can be
+ * compiled while it is still being parsed: codegen_begin() starts a new module
+ * with an empty entry function, codegen_stmt() appends the code for one
+ * top-level statement to it, and codegen_end() finishes and optimizes it.
+ * generate_llvm_ir() is equivalent to calling all three with the AST's root.
+ * Each statement's nodes are no longer needed once codegen_stmt() returns, but
+ * the AST's name table must keep every symbol until codegen_end().
+ *
+ * @param cg The code generator to use.
+ * @param ast The AST containing the statement.  Symbols may be added to it
+ *   between calls.
+ * @param stmt The AST node representing the statement.
+ * @param entry_name As for generate_llvm_ir().
+ *
+ * @return codegen_begin() and codegen_end() return 0 on success or nonzero on
+ *   failure.
+ */
+int codegen_begin(struct codegen* cg, const char* entry_name);
+void codegen_stmt(struct codegen* cg, struct ast* ast, uint32_t stmt);
+int codegen_end(struct codegen* cg, struct ast* ast);
+
+/**
+ * Abandons a module started by codegen_begin() without finishing it, e.g.
+ * because the program turned out to have a syntax error.
+ */
+void codegen_discard(struct codegen* cg);
+
+/**
+ * This structure reports on the most recent module built by a code generator.
+ *
+ * @var generate_seconds The time spent generating the module's IR, not
+ *   counting its optimization.
+ * @var optimize_start The time on clock_now() (see lib/clock.h) at which
+ *   optimization began.
+ * @var optimize_seconds The time spent running the optimization pipeline.
+ * @var n_blocks The number of basic blocks in the module as generated.
+ * @var n_instructions The number of IR instructions in the module as
+ *   generated.
+ * @var n_blocks_optimized The number of basic blocks after optimization.
+ * @var n_instructions_optimized The number of IR instructions after
+ *   optimization.
+ */
+struct codegen_stats {
+    double generate_seconds;
+    double optimize_start;
+    double optimize_seconds;
+    size_t n_blocks;
+    size_t n_instructions;
+    size_t n_blocks_optimized;
+    size_t n_instructions_optimized;
+};
+
+/**
+ * Fills `stats` with statistics about the most recent module finished by
+ * codegen_end() or generate_llvm_ir().
+ */
+void codegen_get_stats(struct codegen* cg, struct codegen_stats* stats);
+
+/**
+ * Returns the textual representation of the module most recently built by
+ * generate_llvm_ir().  The string must be freed by the caller.
+ */
+char* generate_llvm_ir_string(struct codegen* cg);
+
+/**
+ * Releases the module most recently built by generate_llvm_ir() to the
+ * caller, who becomes responsible for disposing of it.  The module belongs to
+ * the code generator's LLVM context, so it must be disposed of before
+ * codegen_free() is called.
+ *
+ * @return Returns the module, or NULL if there is none.
+ */
+struct LLVMOpaqueModule* codegen_take_module(struct codegen* cg);
+
+/**
+ * This function emits object code for the module most recently built by
+ * generate_llvm_ir() into memory.
+ *
+ * @param data Set to a buffer holding the object code.  The buffer must be
+ *   freed by the caller.
+ * @param size Set to the size of the object code in bytes.
+ *
+ * @return Returns 0 on success or nonzero if object code could not be
+ *   generated.
+ */
+int generate_object_code_buffer(struct codegen* cg, char** data, size_t* size);
+
+/*
+ * The kinds of output that generate_output_file() can write.
+ */
+enum output_kind {
+    OUTPUT_IR,
+    OUTPUT_BITCODE,
+    OUTPUT_ASM,
+    OUTPUT_OBJECT
+};
+
+/**
+ * This function writes the module most recently built by generate_llvm_ir()
+ * straight to a file as textual IR, bitcode, assembly, or object code, without
+ * building the whole output in memory first.
+ *
+ * @param kind A value from `enum output_kind`.
+ * @param path The path of the file, which is replaced if it exists, or "-"
+ *   for stdout.  Anything buffered in C's stdout should be flushed first.
+ *   Object code for stdout is built in memory after all, since stdout may
+ *   be a pipe, which the object writer can't seek in.
+ *
+ * @return Returns 0 on success or nonzero if the output could not be
+ *   generated or written.
+ */
+int generate_output_file(struct codegen* cg, int kind, const char* path);
+
+/*
+ * The type of a program's entry function.
+ */
+typedef float (*entry_function)(void);
+
+/**
+ * This function JIT-compiles the module most recently built by
+ * generate_llvm_ir() and returns its entry function, which can then be called
+ * in-process any number of times.  The module is consumed by the JIT, as
+ * with run_target().  The code stays valid until the next call to
+ * codegen_begin() or to this function, or until codegen_free().
+ *
+ * @return Returns the entry function, or NULL if the module could not be
+ *   JIT-compiled.
+ */
+entry_function jit_target(struct codegen* cg);
+
+/**
+ * This function JIT-compiles the module most recently built by
+ * generate_llvm_ir() and calls its entry function in-process.  The
+ * module is consumed by the JIT, so object code can't be generated from it
+ * afterwards.
+ *
+ * @param return_value Set to the value returned by the entry function.
+ *
+ * @return Returns 0 on success or nonzero if the module could not be
+ *   JIT-compiled.
+ */
+int run_target(struct codegen* cg, float* return_value);
 
 #endif
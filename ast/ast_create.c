@@ -1,409 +1,388 @@
 /*
- * This file contains implementations of functions for creating and freeing
- * AST nodes.  Many of the functions defined in this file are part of the
- * public interface of the AST.  However, there are also some internal
- * functions defined here.  Internal functions are marked `static`, and their
- * names begin with an underscore.
+ * This file contains implementations of functions for creating ASTs and AST
+ * nodes.  Many of the functions defined in this file are part of the public
+ * interface of the AST.  However, there are also some internal functions
+ * defined here.  Internal functions are marked `static`, and their names begin
+ * with an underscore.
+ *
+ * An AST is flat: its nodes are stored by value in a single contiguous array
+ * and refer to each other by index (see _ast_internal.h), so there is no
+ * per-node allocation, and the whole AST is freed at once by ast_free().
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <assert.h>
 
 #include "ast.h"
 #include "_ast_internal.h"
 
 /*
- * Allocate, initialize, and return a new identifier expression AST node.
- *
- * @param id The text of the identifier represented by the new node.  The
- *   returned node should be considered to have taken ownership of this
- *   string.  It will be freed by ast_node_free().
+ * The initial capacity of each of an AST's arrays.
  */
-struct ast_node* id_expr_node_create(char* id) {
-    struct _id_expr_node* id_expr_node = malloc(sizeof(struct _id_expr_node));
-    id_expr_node->id = id;
-    struct ast_node* node = malloc(sizeof(struct ast_node));
-    node->type = ID_EXPR;
-    node->node_data.id_expr = id_expr_node;
-    return node;
-}
+#define INITIAL_CAPACITY 64
 
 /*
- * Allocate, initialize, and return a new float expression AST node.
- *
- * @param val The value of the float represented by the new node.
+ * Helper function to make sure an array with `*capacity` elements of
+ * `elem_size` bytes each has room for `n` elements, doubling its capacity as
+ * many times as needed.  Returns the (possibly moved) array.
  */
-struct ast_node* float_expr_node_create(float val) {
-    struct _float_expr_node* float_expr_node =
-        malloc(sizeof(struct _float_expr_node));
-    float_expr_node->val = val;
-    struct ast_node* node = malloc(sizeof(struct ast_node));
-    node->type = FLOAT_EXPR;
-    node->node_data.float_expr = float_expr_node;
-    return node;
+static void* _ast_array_reserve(struct ast* ast, void* array,
+        uint32_t* capacity, uint32_t n, size_t elem_size) {
+    if (n <= *capacity) {
+        return array;
+    }
+    uint32_t new_capacity = *capacity ? *capacity : INITIAL_CAPACITY;
+    while (new_capacity < n) {
+        new_capacity *= 2;
+    }
+    array = realloc(array, new_capacity * elem_size);
+    assert(array);
+    *capacity = new_capacity;
+    ast->n_heap_allocs++;
+    return array;
 }
 
 /*
- * Allocate, initialize, and return a new integer expression AST node.
- *
- * @param val The value of the integer represented by the new node.
+ * Appends a new node of the given type to an AST and returns its index.  The
+ * node's payload is zeroed.
  */
-struct ast_node* int_expr_node_create(int val) {
-    struct _int_expr_node* int_expr_node =
-        malloc(sizeof(struct _int_expr_node));
-    int_expr_node->val = val;
-    struct ast_node* node = malloc(sizeof(struct ast_node));
-    node->type = INT_EXPR;
-    node->node_data.int_expr = int_expr_node;
-    return node;
+static uint32_t _ast_node_alloc(struct ast* ast, int type) {
+    ast->nodes = _ast_array_reserve(ast, ast->nodes, &ast->nodes_capacity,
+        ast->n_nodes + 1, sizeof(struct ast_node));
+    uint32_t index = ast->n_nodes++;
+    struct ast_node* node = AST_NODE(ast, index);
+    memset(node, 0, sizeof(struct ast_node));
+    node->type = type;
+    ast->n_nodes_by_type[type]++;
+    return index;
 }
 
+
 /*
- * Allocate, initialize, and return a new boolean expression AST node.
- *
- * @param val The value of the boolean represented by the new node.
+ * Allocate and initialize a new, empty AST.
  */
-struct ast_node* bool_expr_node_create(int val) {
-    struct _bool_expr_node* bool_expr_node =
-        malloc(sizeof(struct _bool_expr_node));
-    bool_expr_node->val = val;
-    struct ast_node* node = malloc(sizeof(struct ast_node));
-    node->type = BOOL_EXPR;
-    node->node_data.bool_expr = bool_expr_node;
-    return node;
+struct ast* ast_create() {
+    struct ast* ast = calloc(1, sizeof(struct ast));
+    assert(ast);
+    ast->root = AST_NONE;
+
+    /*
+     * Reserve node 0 and symbol 0, so those indices can mean "no node" and
+     * "no symbol".
+     */
+    _ast_node_alloc(ast, BREAK_STMT);
+    ast_add_symbol(ast, NULL);
+    return ast;
 }
 
 /*
- * Allocate, initialize, and return a new binary operation expression AST node.
- *
- * @param op An integer value representing the type of operation being
- *   performed in this expression.  This value should come from parser.h
- *   (e.g. PLUS, MINUS, GTE, etc.).
- * @param lhs The AST node representing the left-hand side of the new node.
- *   The returned node should be considered to have taken ownership of this
- *   node.  It will be freed by ast_node_free().  It is also freed by this
- *   function if `rhs` is NULL and NULL is returned here.
- * @param rhs The AST node representing the right-hand side of the new node.
- *   The returned node should be considered to have taken ownership of this
- *   node.  It will be freed by ast_node_free().  It is also freed by this
- *   function if `lhs` is NULL and NULL is returned here.
- *
- * @return If `lsh` or `rhs` is NULL, this function returns NULL.  Otherwise,
- *   it returns an AST node representing the binary operation expression.
+ * Frees all memory belonging to an AST.  The identifier strings it refers to
+ * are owned by the caller.
  */
-struct ast_node* binop_expr_node_create(
-    int op,
-    struct ast_node* lhs,
-    struct ast_node* rhs
-) {
-    if (!lhs || !rhs) {
-        ast_node_free(lhs);
-        ast_node_free(rhs);
-        return NULL;
-    } else {
-        struct _binop_expr_node* binop_expr_node =
-            malloc(sizeof(struct _binop_expr_node));
-        binop_expr_node->op = op;
-        binop_expr_node->lhs = lhs;
-        binop_expr_node->rhs = rhs;
-        struct ast_node* node = malloc(sizeof(struct ast_node));
-        node->type = BINOP_EXPR;
-        node->node_data.binop_expr = binop_expr_node;
-        return node;
+void ast_free(struct ast* ast) {
+    if (!ast) {
+        return;
     }
-
+    free(ast->nodes);
+    free(ast->stmts);
+    free(ast->names);
+    free(ast->types);
+    free(ast->wide_ops);
+    free(ast);
 }
 
 /*
- * Allocate, initialize, and return a new assignment statement AST node.
- *
- * @param lhs The text of the identifier on the left-hand side of the
- *   assignment statement represented by the new node.  The returned node
- *   should be considered to have taken ownership of this string.  It will be
- *   freed by ast_node_free().  It is also freed by this function if `rhs` is
- *   NULL and NULL is returned here.
- * @param rhs The AST node representing the right-hand side of the new node.
- *   The returned node should be considered to have taken ownership of this
- *   node.  It will be freed by ast_node_free().
- *
- * @return If `rhs` is NULL, this function returns NULL.  Otherwise, it returns
- *   an AST node representing the assignment statement.
+ * Sets the root node of an AST.
  */
-struct ast_node* assign_stmt_node_create(char* lhs, struct ast_node* rhs) {
-    if (!rhs) {
-        free(lhs);
-        return NULL;
-    } else {
-        struct _assign_stmt_node* assign_stmt_node =
-            malloc(sizeof(struct _assign_stmt_node));
-        assign_stmt_node->lhs = lhs;
-        assign_stmt_node->rhs = rhs;
-        struct ast_node* node = malloc(sizeof(struct ast_node));
-        node->type = ASSIGN_STMT;
-        node->node_data.assign_stmt = assign_stmt_node;
-        return node;
-    }
+void ast_set_root(struct ast* ast, uint32_t root) {
+    ast->root = root;
 }
 
 /*
- * Allocate, initialize, and return a new if statement AST node.
- *
- * @param condition The AST node representing the conditional expression
- *   attached to the if block of the new node.  The returned node should be
- *   considered to have taken ownership of this node.  It will be freed by
- *   ast_node_free().
- * @param if_block The AST node representing the block of statements attached
- *   to the if branch of the new node.  The returned node should be considered
- *   to have taken ownership of this node.  It will be freed by ast_node_free().
- *   It is also freed by this function if `condition` is NULL and NULL is
- *   returned here.
- * @param else_block The AST node representing the block of statements attached
- *   to the else branch of the new node.  The returned node should be considered
- *   to have taken ownership of this node.  It will be freed by ast_node_free().
- *   It is also freed by this function if `condition` is NULL and NULL is
- *   returned here.
- *
- * @return If `condition` is NULL, this function returns NULL.  Otherwise, it
- *   returns an AST node representing the if statement.
+ * Returns the root node of an AST.
  */
-struct ast_node* if_stmt_node_create(
-    struct ast_node* condition,
-    struct ast_node* if_block,
-    struct ast_node* else_block
-) {
-    if (!condition) {
-        ast_node_free(if_block);
-        ast_node_free(else_block);
-        return NULL;
-    } else {
-        struct _if_stmt_node* if_stmt_node =
-            malloc(sizeof(struct _if_stmt_node));
-        if_stmt_node->condition = condition;
-        if_stmt_node->if_block = if_block;
-        if_stmt_node->else_block = else_block;
-        struct ast_node* node = malloc(sizeof(struct ast_node));
-        node->type = IF_STMT;
-        node->node_data.if_stmt = if_stmt_node;
-        return node;
-    }
+uint32_t ast_get_root(struct ast* ast) {
+    return ast->root;
 }
 
 /*
- * Allocate, initialize, and return a new block AST node.
- *
- * @param first_stmt The AST node representing the first statement within the
- *   new node.  The returned node should be considered to have taken ownership
- *   of this node.  It will be freed by ast_node_free().  If this argument is
- *   NULL, it is ignored.
+ * Returns the number of bytes currently used by an AST's arrays.
  */
-struct ast_node* block_node_create(struct ast_node* first_stmt) {
-    struct _block_node* block_node = malloc(sizeof(struct _block_node));
-    if (first_stmt) {
-        block_node->stmts[0] = first_stmt;
-        block_node->n_stmts = 1;
-    } else {
-        block_node->n_stmts = 0;
-    }
-    struct ast_node* node = malloc(sizeof(struct ast_node));
-    node->type = BLOCK;
-    node->node_data.block = block_node;
-    return node;
+static size_t _ast_bytes(struct ast* ast) {
+    return ast->n_nodes * sizeof(struct ast_node)
+        + ast->n_stmts * sizeof(uint32_t) + ast->n_names * sizeof(char*);
 }
 
 /*
- * Adds a single new statement to the end of the list of statements contained
- * within a block.
- *
- * @param block The AST node representing an existing block to which to add a
- *   statement.
- * @param stmt The AST node representing the statement to be added to the list
- *   of statements represented by `block`.  The node `block` should be
- *   considered to have taken ownership of this node.  It will be freed by
- *   ast_node_free().  If this argument is NULL, it is ignored.
+ * Removes every node except the placeholder and every statement list from an
+ * AST, keeping its names and its arrays' memory.
  */
-void block_node_append_stmt(struct ast_node* block, struct ast_node* stmt) {
-    struct _block_node* block_node = block->node_data.block;
-    if (block_node->n_stmts >= AST_NODE_MAX_CHILDREN) {
-        fprintf(stderr, "FATAL ERROR: too many statements added to block\n");
-        exit(1);
-    }
-    if (stmt) {
-        block_node->stmts[block_node->n_stmts] = stmt;
-        block_node->n_stmts++;
+void ast_clear(struct ast* ast) {
+    size_t bytes = _ast_bytes(ast);
+    if (bytes > ast->peak_bytes) {
+        ast->peak_bytes = bytes;
     }
+    ast->n_nodes_cleared += ast->n_nodes - 1;
+    ast->n_nodes = 1;
+    ast->n_stmts = 0;
+    ast->root = AST_NONE;
 }
 
 /*
- * Allocate, initialize, and return a new while statement AST node.
- *
- * @param condition The AST node representing the conditional expression
- *   attached to the new node.  The returned node should be considered to have
- *   taken ownership of this node.  It will be freed by ast_node_free().
- * @param block The AST node representing the block of statements attached
- *   to the new node.  The returned node should be considered to have taken
- *   ownership of this node.  It will be freed by ast_node_free().  It is also
- *   freed by this function if `condition` is NULL and NULL is returned here.
- *
- * @return If `condition` is NULL, this function returns NULL.  Otherwise, it
- *   returns an AST node representing the if statement.
+ * Reports how much memory an AST takes up.
  */
-struct ast_node* while_stmt_node_create(
-    struct ast_node* condition,
-    struct ast_node* block
-) {
-    if (condition) {
-        struct _while_stmt_node* while_stmt_node =
-            malloc(sizeof(struct _while_stmt_node));
-        while_stmt_node->condition = condition;
-        while_stmt_node->block = block;
-        struct ast_node* node = malloc(sizeof(struct ast_node));
-        node->type = WHILE_STMT;
-        node->node_data.while_stmt = while_stmt_node;
-        return node;
-    } else {
-        ast_node_free(block);
-        return NULL;
-    }
+void ast_get_stats(struct ast* ast, struct ast_stats* stats) {
+    size_t bytes = _ast_bytes(ast);
+    stats->n_nodes = ast->n_nodes_cleared + ast->n_nodes - 1;
+    memcpy(stats->n_nodes_by_type, ast->n_nodes_by_type,
+        sizeof(stats->n_nodes_by_type));
+    stats->n_nodes_by_type[BREAK_STMT]--;
+    stats->n_symbols = ast->n_names - 1;
+    stats->bytes = bytes > ast->peak_bytes ? bytes : ast->peak_bytes;
+    stats->n_heap_allocs = ast->n_heap_allocs;
 }
 
 /*
- * Allocate, initialize, and return a new break statement AST node.
+ * Returns the name of a type of AST node.
  */
-struct ast_node* break_stmt_node_create() {
-    struct ast_node* node = malloc(sizeof(struct ast_node));
-    node->type = BREAK_STMT;
-    return node;
+const char* ast_node_type_name(int type) {
+    static const char* names[] = {
+        [ID_EXPR] = "id_expr", [FLOAT_EXPR] = "float_expr",
+        [INT_EXPR] = "int_expr", [BOOL_EXPR] = "bool_expr",
+        [BINOP_EXPR] = "binop_expr", [ASSIGN_STMT] = "assign_stmt",
+        [IF_STMT] = "if_stmt", [WHILE_STMT] = "while_stmt",
+        [BREAK_STMT] = "break_stmt", [BLOCK] = "block"
+    };
+    return type >= 0 && type < AST_N_NODE_TYPES ? names[type] : NULL;
 }
 
-
-/*****************************************************************************
- **
- ** AST node freeing functions
- **
- *****************************************************************************/
-
 /*
- * Frees all memory belonging to an identifier expression AST node, including
- * the string representing the text of the identifier.
+ * Adds a new symbol to an AST's name table and returns its ID, which is its
+ * index in the table.
+ *
+ * @param ast The AST to which to add the symbol.
+ * @param name The text of the identifier.  It must remain valid for as long
+ *   as the AST.
  */
-static void _id_expr_node_free(struct _id_expr_node* node) {
-    free(node->id);
-    free(node);
+uint32_t ast_add_symbol(struct ast* ast, char* name) {
+    ast->names = _ast_array_reserve(ast, ast->names, &ast->names_capacity,
+        ast->n_names + 1, sizeof(char*));
+    ast->names[ast->n_names] = name;
+    return ast->n_names++;
 }
 
 /*
- * Frees all memory belonging to a float expression AST node.
+ * Returns the text of the symbol with the given ID in an AST.
  */
-static void _float_expr_node_free(struct _float_expr_node* node) {
-    free(node);
+const char* ast_symbol_name(struct ast* ast, uint32_t symbol) {
+    return AST_NAME(ast, symbol);
 }
 
 /*
- * Frees all memory belonging to a integer expression AST node.
+ * Create a new identifier expression AST node.
+ *
+ * @param ast The AST to which to add the new node.
+ * @param symbol The symbol ID of the identifier represented by the new node.
  */
-static void _int_expr_node_free(struct _int_expr_node* node) {
-    free(node);
+uint32_t id_expr_node_create(struct ast* ast, uint32_t symbol) {
+    uint32_t index = _ast_node_alloc(ast, ID_EXPR);
+    AST_NODE(ast, index)->node_data.id_expr.name = symbol;
+    return index;
 }
 
 /*
- * Frees all memory belonging to a boolean expression AST node.
+ * Create a new float expression AST node.
+ *
+ * @param ast The AST to which to add the new node.
+ * @param val The value of the float represented by the new node.
  */
-static void _bool_expr_node_free(struct _bool_expr_node* node) {
-    free(node);
+uint32_t float_expr_node_create(struct ast* ast, float val) {
+    uint32_t index = _ast_node_alloc(ast, FLOAT_EXPR);
+    AST_NODE(ast, index)->node_data.float_expr.val = val;
+    return index;
 }
 
 /*
- * Frees all memory belonging to a binary operation expression AST node,
- * including its descendents.
+ * Create a new integer expression AST node.
+ *
+ * @param ast The AST to which to add the new node.
+ * @param val The value of the integer represented by the new node.
  */
-static void _binop_expr_node_free(struct _binop_expr_node* node) {
-    ast_node_free(node->lhs);
-    ast_node_free(node->rhs);
-    free(node);
+uint32_t int_expr_node_create(struct ast* ast, int val) {
+    uint32_t index = _ast_node_alloc(ast, INT_EXPR);
+    AST_NODE(ast, index)->node_data.int_expr.val = val;
+    return index;
 }
 
 /*
- * Frees all memory belonging to an assignment statement AST node, including
- * its descendents.
+ * Create a new boolean expression AST node.
+ *
+ * @param ast The AST to which to add the new node.
+ * @param val The value of the boolean represented by the new node.
  */
-static void _assign_stmt_node_free(struct _assign_stmt_node* node) {
-    free(node->lhs);
-    ast_node_free(node->rhs);
-    free(node);
+uint32_t bool_expr_node_create(struct ast* ast, int val) {
+    uint32_t index = _ast_node_alloc(ast, BOOL_EXPR);
+    AST_NODE(ast, index)->node_data.bool_expr.val = val;
+    return index;
 }
 
 /*
- * Frees all memory belonging to an if statement AST node, including its
- * descendents.
+ * Create a new binary operation expression AST node.
+ *
+ * @param ast The AST to which to add the new node.
+ * @param op An integer value representing the type of operation being
+ *   performed in this expression.  This value should come from parser.h
+ *   (e.g. PLUS, MINUS, GTE, etc.).
+ * @param lhs The AST node representing the left-hand side of the new node.
+ * @param rhs The AST node representing the right-hand side of the new node.
+ *
+ * @return If `lsh` or `rhs` is AST_NONE, this function returns AST_NONE.
+ *   Otherwise, it returns an AST node representing the binary operation
+ *   expression.
  */
-static void _if_stmt_node_free(struct _if_stmt_node* node) {
-    ast_node_free(node->condition);
-    ast_node_free(node->if_block);
-    if (node->else_block) {
-        ast_node_free(node->else_block);
+uint32_t binop_expr_node_create(
+    struct ast* ast,
+    int op,
+    uint32_t lhs,
+    uint32_t rhs
+) {
+    if (lhs == AST_NONE || rhs == AST_NONE) {
+        return AST_NONE;
+    } else {
+        struct ast_node* lhs_node = AST_NODE(ast, lhs);
+        uint32_t first = lhs_node->type == BINOP_EXPR ?
+            lhs_node->node_data.binop_expr.first : lhs;
+
+        uint32_t index = _ast_node_alloc(ast, BINOP_EXPR);
+        struct ast_node* node = AST_NODE(ast, index);
+        node->op = op;
+        node->node_data.binop_expr.lhs = lhs;
+        node->node_data.binop_expr.rhs = rhs;
+        node->node_data.binop_expr.first = first;
+        return index;
     }
-    free(node);
+
 }
 
 /*
- * Frees all memory belonging to an AST node representing a block, including
- * its descendents.
+ * Create a new assignment statement AST node.
+ *
+ * @param ast The AST to which to add the new node.
+ * @param lhs The symbol ID of the identifier on the left-hand side of the
+ *   assignment statement represented by the new node.
+ * @param rhs The AST node representing the right-hand side of the new node.
+ *
+ * @return If `rhs` is AST_NONE, this function returns AST_NONE.  Otherwise,
+ *   it returns an AST node representing the assignment statement.
  */
-static void _block_node_free(struct _block_node* node) {
-    for (int i = 0; i < node->n_stmts; i++) {
-        ast_node_free(node->stmts[i]);
+uint32_t assign_stmt_node_create(struct ast* ast, uint32_t lhs, uint32_t rhs) {
+    if (rhs == AST_NONE) {
+        return AST_NONE;
+    } else {
+        uint32_t index = _ast_node_alloc(ast, ASSIGN_STMT);
+        struct ast_node* node = AST_NODE(ast, index);
+        node->node_data.assign_stmt.lhs = lhs;
+        node->node_data.assign_stmt.rhs = rhs;
+        return index;
     }
-    free(node);
 }
 
 /*
- * Frees all memory belonging to an while statement AST node, including its
- * descendents.
+ * Create a new if statement AST node.
+ *
+ * @param ast The AST to which to add the new node.
+ * @param condition The AST node representing the conditional expression
+ *   attached to the if block of the new node.
+ * @param if_block The AST node representing the block of statements attached
+ *   to the if branch of the new node.
+ * @param else_block The AST node representing the block of statements attached
+ *   to the else branch of the new node, or AST_NONE if there is no else
+ *   branch.
+ *
+ * @return If `condition` is AST_NONE, this function returns AST_NONE.
+ *   Otherwise, it returns an AST node representing the if statement.
  */
-static void _while_stmt_node_free(struct _while_stmt_node* node) {
-    ast_node_free(node->condition);
-    ast_node_free(node->block);
-    free(node);
+uint32_t if_stmt_node_create(
+    struct ast* ast,
+    uint32_t condition,
+    uint32_t if_block,
+    uint32_t else_block
+) {
+    if (condition == AST_NONE) {
+        return AST_NONE;
+    } else {
+        uint32_t index = _ast_node_alloc(ast, IF_STMT);
+        struct ast_node* node = AST_NODE(ast, index);
+        node->node_data.if_stmt.condition = condition;
+        node->node_data.if_stmt.if_block = if_block;
+        node->node_data.if_stmt.else_block = else_block;
+        return index;
+    }
 }
 
 /*
- * Frees all memory belonging to an AST node, including all nodes in its
- * subtree.
+ * Create a new block AST node containing a list of statements, which is
+ * copied to the end of the AST's statement list array.
+ *
+ * @param ast The AST to which to add the new node.
+ * @param stmts The AST nodes representing the statements within the new
+ *   node, in order.
+ * @param n_stmts The number of statements in `stmts`.
  */
-void ast_node_free(struct ast_node* node) {
-    if (!node) {
-        return;
+uint32_t block_node_create(
+    struct ast* ast,
+    const uint32_t* stmts,
+    uint32_t n_stmts
+) {
+    if (n_stmts > 0) {
+        ast->stmts = _ast_array_reserve(ast, ast->stmts, &ast->stmts_capacity,
+            ast->n_stmts + n_stmts, sizeof(uint32_t));
+        memcpy(ast->stmts + ast->n_stmts, stmts, n_stmts * sizeof(uint32_t));
     }
-    switch (node->type) {
-        case ID_EXPR:
-            _id_expr_node_free(node->node_data.id_expr);
-            break;
-        case FLOAT_EXPR:
-            _float_expr_node_free(node->node_data.float_expr);
-            break;
-        case INT_EXPR:
-            _int_expr_node_free(node->node_data.int_expr);
-            break;
-        case BOOL_EXPR:
-            _bool_expr_node_free(node->node_data.bool_expr);
-            break;
-        case BINOP_EXPR:
-            _binop_expr_node_free(node->node_data.binop_expr);
-            break;
-        case ASSIGN_STMT:
-            _assign_stmt_node_free(node->node_data.assign_stmt);
-            break;
-        case IF_STMT:
-            _if_stmt_node_free(node->node_data.if_stmt);
-            break;
-        case BLOCK:
-            _block_node_free(node->node_data.block);
-            break;
-        case WHILE_STMT:
-            _while_stmt_node_free(node->node_data.while_stmt);
-            break;
-        default:
-            break;
+
+    uint32_t index = _ast_node_alloc(ast, BLOCK);
+    struct ast_node* node = AST_NODE(ast, index);
+    node->node_data.block.stmts = ast->n_stmts;
+    node->node_data.block.n_stmts = n_stmts;
+    ast->n_stmts += n_stmts;
+    return index;
+}
+
+/*
+ * Create a new while statement AST node.
+ *
+ * @param ast The AST to which to add the new node.
+ * @param condition The AST node representing the conditional expression
+ *   attached to the new node.
+ * @param block The AST node representing the block of statements attached
+ *   to the new node.
+ *
+ * @return If `condition` is AST_NONE, this function returns AST_NONE.
+ *   Otherwise, it returns an AST node representing the while statement.
+ */
+uint32_t while_stmt_node_create(
+    struct ast* ast,
+    uint32_t condition,
+    uint32_t block
+) {
+    if (condition != AST_NONE) {
+        uint32_t index = _ast_node_alloc(ast, WHILE_STMT);
+        struct ast_node* node = AST_NODE(ast, index);
+        node->node_data.while_stmt.condition = condition;
+        node->node_data.while_stmt.block = block;
+        return index;
+    } else {
+        return AST_NONE;
     }
-    free(node);
+}
+
+/*
+ * Create a new break statement AST node.
+ *
+ * @param ast The AST to which to add the new node.
+ */
+uint32_t break_stmt_node_create(struct ast* ast) {
+    return _ast_node_alloc(ast, BREAK_STMT);
 }
@@ -0,0 +1,356 @@
+/*
+ * This file contains the implementation of constant folding and algebraic
+ * simplification over an AST.  The only function defined here that is part
+ * of the public interface of the AST is ast_fold().  Internal functions are
+ * marked `static`, and their names begin with an underscore.
+ *
+ * Folding computes exactly what the generated code would at run time:
+ * comparisons over integers and booleans are done on 32-bit integers, and so
+ * is arithmetic over them whose result fits in 32 bits.  Everything else,
+ * including arithmetic that would overflow and all division, is done in
+ * single-precision float arithmetic, with comparisons following the
+ * unordered predicates the code generator uses (e.g. a comparison involving
+ * NaN is true).  Only identities that hold for every value, including NaN,
+ * infinities, and -0.0, are applied.  In particular, `x + 0` and `0 + x` are
+ * left alone, since -0.0 + 0.0 is +0.0.  Nor may an identity change an
+ * expression's type: `x / 1` is only simplified when `x` is itself a
+ * division, since otherwise it would turn an integer into a float, and
+ * `x * 1.0`, `1.0 * x`, and `x - 0.0` only when the constant is an integer or
+ * `x` is known to be a float, since otherwise they would turn a float into an
+ * integer, whose arithmetic is exact where the float's would round.
+ *
+ * Because nodes are created bottom-up, every node comes after its children,
+ * so the whole AST is simplified in a single forward pass over its node
+ * array, with no recursion.  Nodes are rewritten in place, so no reference to
+ * a node ever needs to change.  Nodes that fall out of the AST this way are
+ * turned into constants, which generate no code, so an expression's `first`
+ * range (see _ast_internal.h) may still safely include them.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ast.h"
+#include "_ast_internal.h"
+#include "../parser.h"
+
+/*
+ * Returns 1 if a node is a float, integer, or boolean constant.
+ */
+static int _is_const(struct ast_node* node) {
+    return node->type == FLOAT_EXPR || node->type == INT_EXPR
+        || node->type == BOOL_EXPR;
+}
+
+/*
+ * Returns 1 if a node is an integer or boolean constant, i.e. one whose
+ * Python value is an integer.
+ */
+static int _is_integral(struct ast_node* node) {
+    return node->type == INT_EXPR || node->type == BOOL_EXPR;
+}
+
+/*
+ * Returns 1 if a node is known to be a float whatever the types of the
+ * variables in it, i.e. if it's a float constant or a division.
+ */
+static int _is_float(struct ast_node* node) {
+    return node->type == FLOAT_EXPR
+        || (node->type == BINOP_EXPR && node->op == DIVIDEDBY);
+}
+
+/*
+ * Returns 1 if replacing a binary operation on the nodes `operand` and
+ * `constant` with `operand` alone keeps the type of its result, i.e. if the
+ * constant is an integer or boolean, or the operand is a float anyway.
+ */
+static int _keeps_type(struct ast_node* operand, struct ast_node* constant) {
+    return _is_integral(constant) || _is_float(operand);
+}
+
+/*
+ * Returns the value of a constant node as the float the code generator
+ * would produce for it.
+ */
+static float _const_value(struct ast_node* node) {
+    switch (node->type) {
+    case FLOAT_EXPR:
+        return node->node_data.float_expr.val;
+    case INT_EXPR:
+        return (float)node->node_data.int_expr.val;
+    default:
+        return (float)node->node_data.bool_expr.val;
+    }
+}
+
+/*
+ * Returns the value of an integer or boolean constant node.
+ */
+static int64_t _integral_value(struct ast_node* node) {
+    return node->type == INT_EXPR ? node->node_data.int_expr.val :
+        node->node_data.bool_expr.val;
+}
+
+/*
+ * Returns 1 if a node is a constant equal to `val`.  A zero only matches
+ * +0.0.
+ */
+static int _is_const_equal(struct ast_node* node, float val) {
+    if (!_is_const(node)) {
+        return 0;
+    }
+    float v = _const_value(node);
+    return v == val && !signbit(v);
+}
+
+/*
+ * These functions turn a node into a constant of the given type, discarding
+ * whatever it was before.
+ */
+static void _make_float(struct ast_node* node, float val) {
+    node->type = FLOAT_EXPR;
+    node->op = 0;
+    memset(&node->node_data, 0, sizeof(node->node_data));
+    node->node_data.float_expr.val = val;
+}
+
+static void _make_int(struct ast_node* node, int32_t val) {
+    node->type = INT_EXPR;
+    node->op = 0;
+    memset(&node->node_data, 0, sizeof(node->node_data));
+    node->node_data.int_expr.val = val;
+}
+
+static void _make_bool(struct ast_node* node, int val) {
+    node->type = BOOL_EXPR;
+    node->op = 0;
+    memset(&node->node_data, 0, sizeof(node->node_data));
+    node->node_data.bool_expr.val = val;
+}
+
+/*
+ * Turns a node into a block with no statements, i.e. a statement that does
+ * nothing.
+ */
+static void _make_empty_block(struct ast_node* node) {
+    node->type = BLOCK;
+    node->op = 0;
+    memset(&node->node_data, 0, sizeof(node->node_data));
+}
+
+/*
+ * Replaces the node at index `index` with its child at index `child`, which
+ * is then dead.  The dead child is made a constant so that it generates no
+ * code if it's still within an enclosing expression's range.
+ */
+static void _replace_with_child(struct ast* ast, uint32_t index,
+        uint32_t child) {
+    *AST_NODE(ast, index) = *AST_NODE(ast, child);
+    _make_float(AST_NODE(ast, child), 0.0f);
+}
+
+/*
+ * Evaluates a binary operation over two constants, turning `node` into the
+ * resulting constant.
+ */
+static void _fold_binop_consts(struct ast_node* node, struct ast_node* l,
+        struct ast_node* r) {
+    float a = _const_value(l);
+    float b = _const_value(r);
+    int unordered = isnan(a) || isnan(b);
+
+    if (node->op == DIVIDEDBY) {
+        _make_float(node, a / b);
+        return;
+    }
+
+    /*
+     * Integers are added, subtracted, and multiplied exactly in 64 bits.  A
+     * result that doesn't fit in 32 is instead computed on floats below, as
+     * the code generator does for arithmetic that might overflow.
+     */
+    if (_is_integral(l) && _is_integral(r)) {
+        int64_t x = _integral_value(l);
+        int64_t y = _integral_value(r);
+        int64_t v = node->op == PLUS ? x + y : node->op == MINUS ? x - y :
+            x * y;
+        switch (node->op) {
+        case PLUS:
+        case MINUS:
+        case TIMES:
+            if (v >= INT32_MIN && v <= INT32_MAX) {
+                _make_int(node, (int32_t)v);
+                return;
+            }
+            break;
+        case EQ:
+            _make_bool(node, x == y);
+            return;
+        case NEQ:
+            _make_bool(node, x != y);
+            return;
+        case GT:
+            _make_bool(node, x > y);
+            return;
+        case GTE:
+            _make_bool(node, x >= y);
+            return;
+        case LT:
+            _make_bool(node, x < y);
+            return;
+        case LTE:
+            _make_bool(node, x <= y);
+            return;
+        default:
+            return;
+        }
+    }
+
+    switch (node->op) {
+    case PLUS:
+        _make_float(node, a + b);
+        return;
+    case MINUS:
+        _make_float(node, a - b);
+        return;
+    case TIMES:
+        _make_float(node, a * b);
+        return;
+    case EQ:
+        _make_bool(node, unordered || a == b);
+        return;
+    case NEQ:
+        _make_bool(node, unordered || a != b);
+        return;
+    case GT:
+        _make_bool(node, unordered || a > b);
+        return;
+    case GTE:
+        _make_bool(node, unordered || a >= b);
+        return;
+    case LT:
+        _make_bool(node, unordered || a < b);
+        return;
+    case LTE:
+        _make_bool(node, unordered || a <= b);
+        return;
+    default:
+        return;
+    }
+}
+
+/*
+ * Simplifies the binary operation expression at index `index`, whose
+ * operands have already been simplified.
+ */
+static void _fold_binop(struct ast* ast, uint32_t index) {
+    struct ast_node* node = AST_NODE(ast, index);
+    uint32_t lhs = node->node_data.binop_expr.lhs;
+    uint32_t rhs = node->node_data.binop_expr.rhs;
+    struct ast_node* l = AST_NODE(ast, lhs);
+    struct ast_node* r = AST_NODE(ast, rhs);
+
+    /*
+     * The left operand may have shrunk, so its range may now start later.
+     */
+    node->node_data.binop_expr.first = l->type == BINOP_EXPR ?
+        l->node_data.binop_expr.first : lhs;
+
+    if (_is_const(l) && _is_const(r)) {
+        _fold_binop_consts(node, l, r);
+        return;
+    }
+
+    int op = node->op;
+    if (op == TIMES && _is_const_equal(r, 1.0f) && _keeps_type(l, r)) {
+        _replace_with_child(ast, index, lhs);
+    } else if (op == DIVIDEDBY && _is_const_equal(r, 1.0f)
+            && l->type == BINOP_EXPR && l->op == DIVIDEDBY) {
+        _replace_with_child(ast, index, lhs);
+    } else if (op == MINUS && _is_const_equal(r, 0.0f) && _keeps_type(l, r)) {
+        _replace_with_child(ast, index, lhs);
+    } else if (op == TIMES && _is_const_equal(l, 1.0f) && _keeps_type(r, l)) {
+        _replace_with_child(ast, index, rhs);
+    } else if ((op == EQ || op == GTE || op == LTE)
+            && l->type == ID_EXPR && r->type == ID_EXPR
+            && l->node_data.id_expr.name == r->node_data.id_expr.name) {
+        /*
+         * A variable compared with itself is equal to itself, or unordered
+         * if it's NaN, either of which makes these comparisons true.
+         */
+        _make_bool(node, 1);
+        _make_float(l, 0.0f);
+        _make_float(r, 0.0f);
+    }
+}
+
+/*
+ * Returns 1 if a constant condition is true, i.e. if it's neither zero nor
+ * NaN, matching the code generator's comparison with 0.0.
+ */
+static int _const_truth(struct ast_node* node) {
+    float v = _const_value(node);
+    return !isnan(v) && v != 0.0f;
+}
+
+/*
+ * Removes the statements that have been simplified away entirely (i.e. that
+ * are now empty blocks) from the block at index `index`.
+ */
+static void _fold_block(struct ast* ast, uint32_t index) {
+    struct ast_node* node = AST_NODE(ast, index);
+    uint32_t* stmts = &ast->stmts[node->node_data.block.stmts];
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < node->node_data.block.n_stmts; i++) {
+        struct ast_node* stmt = AST_NODE(ast, stmts[i]);
+        if (stmt->type != BLOCK || stmt->node_data.block.n_stmts > 0) {
+            stmts[n++] = stmts[i];
+        }
+    }
+    node->node_data.block.n_stmts = n;
+}
+
+/*
+ * Constant-folds and simplifies every node in an AST in place.  An if
+ * statement whose condition folds to a constant is replaced by the branch it
+ * would always take, and a while loop whose condition folds to false is
+ * removed.
+ */
+void ast_fold(struct ast* ast) {
+    for (uint32_t i = 1; i < ast->n_nodes; i++) {
+        struct ast_node* node = AST_NODE(ast, i);
+        switch (node->type) {
+        case BINOP_EXPR:
+            _fold_binop(ast, i);
+            break;
+
+        case IF_STMT: {
+            struct ast_node* cond = AST_NODE(ast, node->node_data.if_stmt.condition);
+            if (_is_const(cond)) {
+                uint32_t taken = _const_truth(cond) ?
+                    node->node_data.if_stmt.if_block :
+                    node->node_data.if_stmt.else_block;
+                if (taken != AST_NONE) {
+                    *node = *AST_NODE(ast, taken);
+                } else {
+                    _make_empty_block(node);
+                }
+            }
+            break;
+        }
+
+        case WHILE_STMT: {
+            struct ast_node* cond = AST_NODE(ast, node->node_data.while_stmt.condition);
+            if (_is_const(cond) && !_const_truth(cond)) {
+                _make_empty_block(node);
+            }
+            break;
+        }
+
+        case BLOCK:
+            _fold_block(ast, i);
+            break;
+        }
+    }
+}
@@ -7,182 +7,1153 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <llvm-c/BitWriter.h>
 #include <llvm-c/Core.h>
+#include <llvm-c/LLJIT.h>
+#include <llvm-c/Orc.h>
+#include <llvm-c/Target.h>
+#include <llvm-c/TargetMachine.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+#include <llvm/Config/llvm-config.h>
 
+#include "ast.h"
 #include "_ast_internal.h"
-#include "../lib/hash.h"
+#include "../lib/clock.h"
 #include "../parser.h"
 
-// Global LLVM state
-static LLVMContextRef context;
-static LLVMModuleRef module;
-static LLVMBuilderRef builder;
-static LLVMValueRef target_function;
-static LLVMBasicBlockRef break_target = NULL;
+// All of the LLVM state for one compilation.  The context is owned by a thread-safe
+// context so the module can be handed to the JIT.  The context and target machine are
+// reused for every program compiled with the same codegen object.
+struct codegen {
+    struct codegen_options options;
+    LLVMOrcThreadSafeContextRef ts_context;
+    LLVMContextRef context;
+    LLVMTargetMachineRef target_machine;
+    char* cpu;                  // the CPU and features code is generated for, "native"
+    char* features;             // already resolved to the host's
+    char* profile_path;         // options.profile_generate, copied
 
-extern struct hash* symbols;
+    // The profile read from options.profile_use, if one is used (see the section on profiles
+    // below): the checksum of the branches it was counted for, the number of calls to the
+    // entry function, and the number of times each branch went each way, two per branch
+    int use_profile;
+    uint64_t profile_checksum;
+    uint64_t profile_entry_count;
+    uint64_t* profile_counts;
+    uint32_t n_profile_branches;
 
-static LLVMValueRef gen_expr(struct ast_node* node);
-static void gen_stmt(struct ast_node* node);
+    // Per-program state
+    LLVMModuleRef module;
+    LLVMBuilderRef builder;
+    LLVMValueRef target_function;
+    const char* entry_name;
+    struct ast* ast;            // the AST being compiled
+    LLVMOrcLLJITRef jit;        // the JIT holding the code from jit_target(), if any
 
-// Generate LLVM IR for expressions
-static LLVMValueRef gen_expr(struct ast_node* node) {
+    // The current SSA definition of each variable (NULL until it has one), and the last
+    // join each was pushed for, both indexed by symbol ID
+    LLVMValueRef* variables;
+    uint32_t* stamps;
+    uint32_t n_variables;
+    uint32_t stamp;
+
+    // The variables of the ifs and whiles being generated, innermost last
+    struct join_var* joins;
+    uint32_t n_joins;
+    uint32_t joins_capacity;
+
+    // The innermost loop being generated, and the block and variables' values at each break
+    // within the loops being generated, innermost last
+    struct loop* loop;
+    LLVMBasicBlockRef* break_blocks;
+    uint32_t n_breaks;
+    uint32_t breaks_capacity;
+    LLVMValueRef* break_values;
+    uint32_t n_break_values;
+    uint32_t break_values_capacity;
+
+    // The program's conditional branches so far, in order, with a checksum of their kinds:
+    // their counters when generating a profile, or the branches themselves when using one
+    LLVMValueRef* branches;
+    uint32_t n_branches;
+    uint32_t branches_capacity;
+    uint64_t branch_checksum;
+    LLVMValueRef entry_counter;
+
+    // Scratch space for the values of an expression's nodes, reused across expressions
+    LLVMValueRef* values;
+    uint32_t values_capacity;
+
+    struct codegen_stats stats;
+};
+
+// A variable that an if or while may change, with its values where control flow splits and
+// meets again.  For an if, `then` and `other` are its values at the end of each branch; for a
+// while, `then` is its phi in the loop header.
+struct join_var {
+    uint32_t var;
+    LLVMValueRef before;
+    LLVMValueRef then;
+    LLVMValueRef other;
+};
+
+// A loop being generated.  Its `n_vars` variables start at `vars` on the join stack, and its
+// breaks at `breaks` on the break stack, each with one value per variable from `break_values`
+// on.
+struct loop {
+    uint32_t vars;
+    uint32_t n_vars;
+    uint32_t breaks;
+    uint32_t break_values;
+    LLVMBasicBlockRef exit;
+    struct loop* outer;
+};
+
+// LLVM's target registry isn't thread-safe, so it's initialized exactly once per process
+static pthread_once_t native_target_once = PTHREAD_ONCE_INIT;
+
+static void initialize_native_target() {
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+}
+
+static void gen_stmt(struct codegen* cg, uint32_t index);
+
+// Branch to dest unless the current block was already terminated (e.g. by a break)
+static void build_br_if_open(struct codegen* cg, LLVMBasicBlockRef dest) {
+    if (!LLVMGetBasicBlockTerminator(LLVMGetInsertBlock(cg->builder)))
+        LLVMBuildBr(cg->builder, dest);
+}
+
+// Print an LLVM error to stderr and consume it
+static int report_llvm_error(const char* what, LLVMErrorRef err) {
+    char* msg = LLVMGetErrorMessage(err);
+    fprintf(stderr, "Error: %s: %s\n", what, msg);
+    LLVMDisposeErrorMessage(msg);
+    return 1;
+}
+
+// Create a new host target machine tuned for the given optimization level
+static LLVMTargetMachineRef create_target_machine(struct codegen* cg) {
+    pthread_once(&native_target_once, initialize_native_target);
+
+    char* triple = LLVMGetDefaultTargetTriple();
+    char* err = NULL;
+    LLVMTargetRef target;
+    if (LLVMGetTargetFromTriple(triple, &target, &err)) {
+        fprintf(stderr, "Error: could not find target for %s: %s\n", triple, err);
+        LLVMDisposeMessage(err);
+        LLVMDisposeMessage(triple);
+        return NULL;
+    }
+
+    LLVMCodeGenOptLevel cg_level[] = {
+        [OPT_O0]=LLVMCodeGenLevelNone, [OPT_O1]=LLVMCodeGenLevelLess,
+        [OPT_O2]=LLVMCodeGenLevelDefault, [OPT_O3]=LLVMCodeGenLevelAggressive,
+        [OPT_OS]=LLVMCodeGenLevelDefault
+    };
+    LLVMTargetMachineRef tm = LLVMCreateTargetMachine(target, triple, cg->cpu, cg->features,
+        cg_level[cg->options.opt_level], LLVMRelocPIC, LLVMCodeModelDefault);
+    LLVMDisposeMessage(triple);
+    return tm;
+}
+
+// Count the basic blocks and instructions in a module
+static void count_instructions(LLVMModuleRef module, size_t* n_blocks, size_t* n_instructions) {
+    *n_blocks = *n_instructions = 0;
+    for (LLVMValueRef f = LLVMGetFirstFunction(module); f; f = LLVMGetNextFunction(f)) {
+        for (LLVMBasicBlockRef bb = LLVMGetFirstBasicBlock(f); bb; bb = LLVMGetNextBasicBlock(bb)) {
+            (*n_blocks)++;
+            for (LLVMValueRef inst = LLVMGetFirstInstruction(bb); inst; inst = LLVMGetNextInstruction(inst))
+                (*n_instructions)++;
+        }
+    }
+}
+
+// Run the standard new-pass-manager pipeline for the given optimization level, returning
+// nonzero if it fails
+static int optimize_module(struct codegen* cg) {
+    int opt_level = cg->options.opt_level;
+    if (opt_level == OPT_O0)
+        return 0;
+
+    const char* pipelines[] = {
+        [OPT_O1]="default<O1>", [OPT_O2]="default<O2>",
+        [OPT_O3]="default<O3>", [OPT_OS]="default<Os>"
+    };
+    LLVMPassBuilderOptionsRef options = LLVMCreatePassBuilderOptions();
+    LLVMPassBuilderOptionsSetLoopVectorization(options, opt_level >= OPT_O2);
+    LLVMPassBuilderOptionsSetSLPVectorization(options, opt_level >= OPT_O2);
+    LLVMPassBuilderOptionsSetLoopUnrolling(options, opt_level != OPT_OS);
+
+    LLVMErrorRef err = LLVMRunPasses(cg->module, pipelines[opt_level], cg->target_machine, options);
+    LLVMDisposePassBuilderOptions(options);
+    return err ? report_llvm_error("optimization pipeline failed", err) : 0;
+}
+
+// The LLVM type used for each inferred variable type
+static LLVMTypeRef llvm_type(struct codegen* cg, int type) {
+    if (type == TYPE_BOOL) return LLVMInt1TypeInContext(cg->context);
+    if (type == TYPE_INT) return LLVMInt32TypeInContext(cg->context);
+    return LLVMFloatTypeInContext(cg->context);
+}
+
+// The inferred type of a variable; without inference every variable is a float
+static int var_type(struct ast* ast, uint32_t var) {
+    return ast->types ? ast->types[var] : TYPE_FLOAT;
+}
+
+// The type of a generated value, which is always an i1, an i32, or a float
+static int value_type(LLVMValueRef value) {
+    LLVMTypeRef type = LLVMTypeOf(value);
+    if (LLVMGetTypeKind(type) == LLVMFloatTypeKind) return TYPE_FLOAT;
+    return LLVMGetIntTypeWidth(type) == 1 ? TYPE_BOOL : TYPE_INT;
+}
+
+// Widen a value to the given type.  Booleans are unsigned and integers signed.
+static LLVMValueRef convert(struct codegen* cg, LLVMValueRef value, int type) {
+    int from = value_type(value);
+    if (from >= type)
+        return value;
+    if (type == TYPE_INT)
+        return LLVMBuildZExt(cg->builder, value, llvm_type(cg, TYPE_INT), "inttmp");
+    if (from == TYPE_BOOL)
+        return LLVMBuildUIToFP(cg->builder, value, llvm_type(cg, TYPE_FLOAT), "booltmp");
+    return LLVMBuildSIToFP(cg->builder, value, llvm_type(cg, TYPE_FLOAT), "floattmp");
+}
+
+// The current definition of a variable; one that's undefined on every path here is undef
+static LLVMValueRef read_var(struct codegen* cg, uint32_t var) {
+    LLVMValueRef value = cg->variables[var];
+    return value ? value : LLVMGetUndef(llvm_type(cg, var_type(cg->ast, var)));
+}
+
+// Generate LLVM IR for a single expression node whose operands' values are already known.
+// Arithmetic and comparisons are done on integers when both operands are integers or
+// booleans and on floats otherwise.  Division is always done on floats, and so is wide
+// arithmetic, whose result might not fit in 32 bits, so integers never wrap around.
+static LLVMValueRef gen_expr_node(struct codegen* cg, struct ast_node* node, LLVMValueRef l, LLVMValueRef r, int wide) {
     if (node->type == ID_EXPR)
-        return LLVMBuildLoad2(builder, LLVMFloatTypeInContext(context), (LLVMValueRef)hash_get(symbols, node->node_data.id_expr->id), "");
-    
+        return read_var(cg, node->node_data.id_expr.name);
+
     if (node->type == FLOAT_EXPR)
-        return LLVMConstReal(LLVMFloatTypeInContext(context), node->node_data.float_expr->val);
-    
+        return LLVMConstReal(llvm_type(cg, TYPE_FLOAT), node->node_data.float_expr.val);
+
     if (node->type == INT_EXPR)
-        return LLVMConstReal(LLVMFloatTypeInContext(context), node->node_data.int_expr->val);
-    
+        return LLVMConstInt(llvm_type(cg, TYPE_INT), (uint32_t)node->node_data.int_expr.val, 0);
+
     if (node->type == BOOL_EXPR)
-        return LLVMConstReal(LLVMFloatTypeInContext(context), node->node_data.bool_expr->val);
-    
+        return LLVMConstInt(llvm_type(cg, TYPE_BOOL), node->node_data.bool_expr.val != 0, 0);
+
     // Binary operations
     if (node->type == BINOP_EXPR) {
-        LLVMValueRef l = gen_expr(node->node_data.binop_expr->lhs);
-        LLVMValueRef r = gen_expr(node->node_data.binop_expr->rhs);
-        
-        int op = node->node_data.binop_expr->op;
-        if (op == PLUS) return LLVMBuildFAdd(builder, l, r, "addtmp");
-        if (op == MINUS) return LLVMBuildFSub(builder, l, r, "subtmp");
-        if (op == TIMES) return LLVMBuildFMul(builder, l, r, "multmp");
-        if (op == DIVIDEDBY) return LLVMBuildFDiv(builder, l, r, "divtmp");
-        
-        // Comparison operations
-        LLVMRealPredicate pred[] = {[EQ]=LLVMRealUEQ, [NEQ]=LLVMRealUNE, [GT]=LLVMRealUGT, [GTE]=LLVMRealUGE, [LT]=LLVMRealULT, [LTE]=LLVMRealULE};
-        
+        int op = node->op;
+        int type = value_type(l) > value_type(r) ? value_type(l) : value_type(r);
+        if (op == DIVIDEDBY || (wide && (op == PLUS || op == MINUS || op == TIMES)))
+            type = TYPE_FLOAT;
+        else if (type == TYPE_BOOL)
+            type = TYPE_INT;
+        l = convert(cg, l, type);
+        r = convert(cg, r, type);
+
+        if (type == TYPE_INT) {
+            if (op == PLUS) return LLVMBuildAdd(cg->builder, l, r, "addtmp");
+            if (op == MINUS) return LLVMBuildSub(cg->builder, l, r, "subtmp");
+            if (op == TIMES) return LLVMBuildMul(cg->builder, l, r, "multmp");
+        } else {
+            if (op == PLUS) return LLVMBuildFAdd(cg->builder, l, r, "addtmp");
+            if (op == MINUS) return LLVMBuildFSub(cg->builder, l, r, "subtmp");
+            if (op == TIMES) return LLVMBuildFMul(cg->builder, l, r, "multmp");
+            if (op == DIVIDEDBY) return LLVMBuildFDiv(cg->builder, l, r, "divtmp");
+        }
+
+        // Comparison operations, which give an i1
         const char* names[] = {[EQ]="eqtmp", [NEQ]="neqtmp", [GT]="gttmp", [GTE]="gtetmp", [LT]="lttmp", [LTE]="ltetmp"};
-        
-        LLVMValueRef cmp = LLVMBuildFCmp(builder, pred[op], l, r, names[op]);
-        return LLVMBuildUIToFP(builder, cmp, LLVMFloatTypeInContext(context), "booltmp");
+        if (type == TYPE_INT) {
+            LLVMIntPredicate pred[] = {[EQ]=LLVMIntEQ, [NEQ]=LLVMIntNE, [GT]=LLVMIntSGT, [GTE]=LLVMIntSGE, [LT]=LLVMIntSLT, [LTE]=LLVMIntSLE};
+            return LLVMBuildICmp(cg->builder, pred[op], l, r, names[op]);
+        }
+        LLVMRealPredicate pred[] = {[EQ]=LLVMRealUEQ, [NEQ]=LLVMRealUNE, [GT]=LLVMRealUGT, [GTE]=LLVMRealUGE, [LT]=LLVMRealULT, [LTE]=LLVMRealULE};
+        return LLVMBuildFCmp(cg->builder, pred[op], l, r, names[op]);
     }
     return NULL;
 }
 
-// Generate LLVM IR for statements
-static void gen_stmt(struct ast_node* node) {
-    // Variable assignment
-    if (node->type == ASSIGN_STMT) {
-        char* var = node->node_data.assign_stmt->lhs;
-        LLVMValueRef alloca = (LLVMValueRef)hash_get(symbols, var);
-        if (!alloca) {
-            alloca = LLVMBuildAlloca(builder, LLVMFloatTypeInContext(context), var);
-            hash_insert(symbols, var, alloca);
+// Generate LLVM IR for an expression.  Its nodes occupy a contiguous range of the node array
+// in post-order, so they're visited in one linear sweep with no recursion, keeping each
+// node's value in the scratch array until its parent needs it.  Without type inference,
+// all arithmetic is wide.
+static LLVMValueRef gen_expr(struct codegen* cg, uint32_t expr) {
+    struct ast_node* root = AST_NODE(cg->ast, expr);
+    uint32_t first = root->type == BINOP_EXPR ? root->node_data.binop_expr.first : expr;
+    uint32_t n = expr - first + 1;
+
+    if (n > cg->values_capacity) {
+        cg->values_capacity = n > 2 * cg->values_capacity ? n : 2 * cg->values_capacity;
+        cg->values = realloc(cg->values, cg->values_capacity * sizeof(LLVMValueRef));
+    }
+
+    for (uint32_t i = first; i <= expr; i++) {
+        struct ast_node* node = AST_NODE(cg->ast, i);
+        LLVMValueRef l = NULL, r = NULL;
+        if (node->type == BINOP_EXPR) {
+            l = cg->values[node->node_data.binop_expr.lhs - first];
+            r = cg->values[node->node_data.binop_expr.rhs - first];
         }
-        LLVMBuildStore(builder, gen_expr(node->node_data.assign_stmt->rhs), alloca);
+        int wide = !cg->ast->wide_ops || cg->ast->wide_ops[i];
+        cg->values[i - first] = gen_expr_node(cg, node, l, r, wide);
+    }
+    return cg->values[n - 1];
+}
+
+// Generate an i1 for a condition.  Booleans are used directly; anything else is true when
+// it's nonzero (and, for floats, not NaN).
+static LLVMValueRef gen_cond(struct codegen* cg, uint32_t expr, const char* name) {
+    LLVMValueRef value = gen_expr(cg, expr);
+    int type = value_type(value);
+    if (type == TYPE_BOOL)
+        return value;
+    if (type == TYPE_INT)
+        return LLVMBuildICmp(cg->builder, LLVMIntNE, value, LLVMConstInt(llvm_type(cg, TYPE_INT), 0, 0), name);
+    return LLVMBuildFCmp(cg->builder, LLVMRealONE, value, LLVMConstReal(llvm_type(cg, TYPE_FLOAT), 0.0), name);
+}
+
+// Make sure a growable array has room for n elements
+static void* reserve(void* array, uint32_t* capacity, uint32_t n, size_t size) {
+    if (n <= *capacity)
+        return array;
+    *capacity = n > 2 * *capacity ? n : 2 * *capacity;
+    return realloc(array, *capacity * size);
+}
+
+/*
+ * Profiles.  With options.profile_generate, every conditional branch gen_stmt() emits
+ * counts how many times it goes each way, and the entry function counts its calls.  Each
+ * time the entry function returns, it writes the counts to the profile_generate path:
+ *
+ *     # pycompile profile
+ *     <checksum, in hex> <number of branches> <number of calls>
+ *     <times taken> <times not taken>        (one line per branch, in order)
+ *
+ * With options.profile_use, the same program's branches are then weighted with those
+ * counts as !prof branch_weights metadata, and the entry function with its number of calls
+ * as its function_entry_count.  For a while loop, the weights of its condition are its
+ * iterations against its exits, from which LLVM estimates its trip count when deciding
+ * whether to unroll or peel it, and block placement keeps the hot side of each branch on
+ * the fall-through path.  Branches are matched up by their order, so the profile is only
+ * used if it has as many branches, of the same kinds, as the program.
+ */
+
+// FNV-1a, for the checksum of the kinds of a program's branches
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// Parse a profile into the code generator.  Returns 0 on success or nonzero if it's malformed.
+static int parse_profile(struct codegen* cg, const char* text) {
+    while (*text == '#') {
+        text = strchr(text, '\n');
+        if (!text)
+            return 1;
+        text++;
+    }
+    char* end;
+    cg->profile_checksum = strtoull(text, &end, 16);
+    if (end == text)
+        return 1;
+    unsigned long n = strtoul(text = end, &end, 10);
+    if (end == text || n > UINT32_MAX / 2)
+        return 1;
+    cg->profile_entry_count = strtoull(text = end, &end, 10);
+    if (end == text)
+        return 1;
+    cg->n_profile_branches = n;
+    cg->profile_counts = malloc(2 * n * sizeof(uint64_t));
+    for (unsigned long i = 0; i < 2 * n; i++) {
+        cg->profile_counts[i] = strtoull(text = end, &end, 10);
+        if (end == text)
+            return 1;
+    }
+    while (*end == ' ' || *end == '\n' || *end == '\r' || *end == '\t')
+        end++;
+    return *end != '\0';
+}
+
+// Add one to the i64 at ptr
+static void build_increment(struct codegen* cg, LLVMValueRef ptr) {
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+    LLVMValueRef count = LLVMBuildLoad2(cg->builder, i64, ptr, "count");
+    LLVMBuildStore(cg->builder, LLVMBuildAdd(cg->builder, count, LLVMConstInt(i64, 1, 0), "count"), ptr);
+}
+
+// Branch on the condition of an if (kind 'i') or a while (kind 'w'), counting which way it
+// goes when generating a profile, or recording it to be weighted when using one
+static void build_cond_br(struct codegen* cg, LLVMValueRef cond, LLVMBasicBlockRef then_bb, LLVMBasicBlockRef else_bb, char kind) {
+    LLVMValueRef counter = NULL;
+    if (cg->options.profile_generate) {
+        // counter[0] counts the times the branch is taken, and counter[1] the times it isn't
+        LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+        LLVMTypeRef counter_type = LLVMArrayType(i64, 2);
+        counter = LLVMAddGlobal(cg->module, counter_type, "branch_counter");
+        LLVMSetLinkage(counter, LLVMPrivateLinkage);
+        LLVMSetInitializer(counter, LLVMConstNull(counter_type));
+        LLVMValueRef indices[] = {
+            LLVMConstInt(i64, 0, 0),
+            LLVMBuildZExt(cg->builder, LLVMBuildNot(cg->builder, cond, "not_taken"), i64, "not_taken")
+        };
+        build_increment(cg, LLVMBuildGEP2(cg->builder, counter_type, counter, indices, 2, "counter"));
+    }
+    LLVMValueRef br = LLVMBuildCondBr(cg->builder, cond, then_bb, else_bb);
+    if (counter || cg->use_profile) {
+        cg->branches = reserve(cg->branches, &cg->branches_capacity, cg->n_branches + 1, sizeof(LLVMValueRef));
+        cg->branches[cg->n_branches] = counter ? counter : br;
+    }
+    cg->n_branches++;
+    cg->branch_checksum = (cg->branch_checksum ^ (unsigned char)kind) * FNV_PRIME;
+}
+
+// Declare a C library function, unless it already has been
+static LLVMValueRef libc_function(struct codegen* cg, const char* name, LLVMTypeRef type) {
+    LLVMValueRef fn = LLVMGetNamedFunction(cg->module, name);
+    return fn ? fn : LLVMAddFunction(cg->module, name, type);
+}
+
+// Define the function that writes the profile, which the entry function calls before each
+// return.  If the file can't be opened, the reason is printed with perror().
+static LLVMValueRef build_profile_writer(struct codegen* cg, LLVMTypeRef writer_type) {
+    LLVMContextRef ctx = cg->context;
+    LLVMTypeRef i8p = LLVMPointerType(LLVMInt8TypeInContext(ctx), 0);
+    LLVMTypeRef i32 = LLVMInt32TypeInContext(ctx);
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(ctx);
+    LLVMTypeRef counter_type = LLVMArrayType(i64, 2);
+    LLVMTypeRef counter_ptr = LLVMPointerType(counter_type, 0);
+    LLVMTypeRef fopen_type = LLVMFunctionType(i8p, (LLVMTypeRef[]){ i8p, i8p }, 2, 0);
+    LLVMTypeRef fprintf_type = LLVMFunctionType(i32, (LLVMTypeRef[]){ i8p, i8p }, 2, 1);
+    LLVMTypeRef fclose_type = LLVMFunctionType(i32, &i8p, 1, 0);
+    LLVMTypeRef perror_type = LLVMFunctionType(LLVMVoidTypeInContext(ctx), &i8p, 1, 0);
+
+    // A table of the branches' counters, which the writer loops over
+    LLVMTypeRef table_type = LLVMArrayType(counter_ptr, cg->n_branches);
+    LLVMValueRef table = LLVMAddGlobal(cg->module, table_type, "branch_counters");
+    LLVMSetLinkage(table, LLVMPrivateLinkage);
+    LLVMSetGlobalConstant(table, 1);
+    LLVMSetInitializer(table, LLVMConstArray(counter_ptr, cg->branches, cg->n_branches));
+
+    LLVMValueRef writer = LLVMAddFunction(cg->module, "write_profile", writer_type);
+    LLVMSetLinkage(writer, LLVMPrivateLinkage);
+    LLVMBasicBlockRef entry_bb = LLVMAppendBasicBlockInContext(ctx, writer, "entry");
+    LLVMBasicBlockRef error_bb = LLVMAppendBasicBlockInContext(ctx, writer, "error");
+    LLVMBasicBlockRef write_bb = LLVMAppendBasicBlockInContext(ctx, writer, "write");
+    LLVMBasicBlockRef loop_bb = cg->n_branches ? LLVMAppendBasicBlockInContext(ctx, writer, "loop") : NULL;
+    LLVMBasicBlockRef close_bb = LLVMAppendBasicBlockInContext(ctx, writer, "close");
+    LLVMBuilderRef b = LLVMCreateBuilderInContext(ctx);
+
+    LLVMPositionBuilderAtEnd(b, entry_bb);
+    LLVMValueRef path = LLVMBuildGlobalStringPtr(b, cg->options.profile_generate, "profile_path");
+    LLVMValueRef fopen_args[] = { path, LLVMBuildGlobalStringPtr(b, "w", "mode") };
+    LLVMValueRef file = LLVMBuildCall2(b, fopen_type, libc_function(cg, "fopen", fopen_type), fopen_args, 2, "file");
+    LLVMBuildCondBr(b, LLVMBuildIsNull(b, file, "failed"), error_bb, write_bb);
+
+    LLVMPositionBuilderAtEnd(b, error_bb);
+    LLVMBuildCall2(b, perror_type, libc_function(cg, "perror", perror_type), &path, 1, "");
+    LLVMBuildRetVoid(b);
+
+    LLVMPositionBuilderAtEnd(b, write_bb);
+    LLVMValueRef header_args[] = {
+        file, LLVMBuildGlobalStringPtr(b, "# pycompile profile\n%llx %u %llu\n", "header"),
+        LLVMConstInt(i64, cg->branch_checksum, 0), LLVMConstInt(i32, cg->n_branches, 0),
+        LLVMBuildLoad2(b, i64, cg->entry_counter, "calls")
+    };
+    LLVMValueRef fprintf_fn = libc_function(cg, "fprintf", fprintf_type);
+    LLVMBuildCall2(b, fprintf_type, fprintf_fn, header_args, 5, "");
+    LLVMValueRef line = LLVMBuildGlobalStringPtr(b, "%llu %llu\n", "line");
+    LLVMBuildBr(b, loop_bb ? loop_bb : close_bb);
+
+    // Then one line per branch, if there are any
+    if (loop_bb) {
+        LLVMPositionBuilderAtEnd(b, loop_bb);
+        LLVMValueRef i = LLVMBuildPhi(b, i32, "i");
+        LLVMValueRef table_indices[] = { LLVMConstInt(i32, 0, 0), i };
+        LLVMValueRef counter = LLVMBuildLoad2(b, counter_ptr, LLVMBuildGEP2(b, table_type, table, table_indices, 2, ""), "counter");
+        LLVMValueRef line_args[] = { file, line, NULL, NULL };
+        for (int way = 0; way < 2; way++) {
+            LLVMValueRef indices[] = { LLVMConstInt(i32, 0, 0), LLVMConstInt(i32, way, 0) };
+            line_args[2 + way] = LLVMBuildLoad2(b, i64, LLVMBuildGEP2(b, counter_type, counter, indices, 2, ""), "count");
+        }
+        LLVMBuildCall2(b, fprintf_type, fprintf_fn, line_args, 4, "");
+        LLVMValueRef next = LLVMBuildAdd(b, i, LLVMConstInt(i32, 1, 0), "next");
+        LLVMValueRef zero = LLVMConstInt(i32, 0, 0);
+        LLVMAddIncoming(i, &zero, &write_bb, 1);
+        LLVMAddIncoming(i, &next, &loop_bb, 1);
+        LLVMBuildCondBr(b, LLVMBuildICmp(b, LLVMIntULT, next, LLVMConstInt(i32, cg->n_branches, 0), "more"), loop_bb, close_bb);
+    }
+
+    LLVMPositionBuilderAtEnd(b, close_bb);
+    LLVMBuildCall2(b, fclose_type, libc_function(cg, "fclose", fclose_type), &file, 1, "");
+    LLVMBuildRetVoid(b);
+    LLVMDisposeBuilder(b);
+    return writer;
+}
+
+// Build branch_weights or function_entry_count metadata
+static LLVMMetadataRef profile_metadata(struct codegen* cg, const char* name, LLVMTypeRef type, const uint64_t* values, int n) {
+    LLVMMetadataRef operands[3] = { LLVMMDStringInContext2(cg->context, name, strlen(name)) };
+    for (int i = 0; i < n; i++)
+        operands[1 + i] = LLVMValueAsMetadata(LLVMConstInt(type, values[i], 0));
+    return LLVMMDNodeInContext2(cg->context, operands, 1 + n);
+}
+
+// Weight each branch with the profile's counts, which must fit in 32 bits, and are one more
+// than the actual counts so that a branch never taken while profiling still has a chance
+static void apply_profile(struct codegen* cg) {
+    if (cg->n_branches != cg->n_profile_branches || cg->branch_checksum != cg->profile_checksum) {
+        fprintf(stderr, "Warning: the profile doesn't match the program, so it isn't used\n");
         return;
     }
-    
+    unsigned prof = LLVMGetMDKindIDInContext(cg->context, "prof", 4);
+    uint64_t max = 0;
+    for (uint32_t i = 0; i < 2 * cg->n_branches; i++)
+        max = cg->profile_counts[i] > max ? cg->profile_counts[i] : max;
+    uint64_t scale = max / (UINT32_MAX - 1) + 1;
+    for (uint32_t i = 0; i < cg->n_branches; i++) {
+        uint64_t weights[] = { cg->profile_counts[2 * i] / scale + 1, cg->profile_counts[2 * i + 1] / scale + 1 };
+        LLVMMetadataRef md = profile_metadata(cg, "branch_weights", LLVMInt32TypeInContext(cg->context), weights, 2);
+        LLVMSetMetadata(cg->branches[i], prof, LLVMMetadataAsValue(cg->context, md));
+    }
+    if (cg->profile_entry_count > 0) {
+        LLVMMetadataRef md = profile_metadata(cg, "function_entry_count", LLVMInt64TypeInContext(cg->context), &cg->profile_entry_count, 1);
+        LLVMGlobalSetMetadata(cg->target_function, prof, md);
+    }
+}
+
+// Record the start of an if or while statement: push each variable its nodes (lo, hi] assign
+// onto the join stack, once each, along with its current value.  A statement's nodes are
+// contiguous, so these are exactly the variables whose values may differ where control flow
+// meets again.  Returns the position of the first one on the stack.
+static uint32_t push_join_vars(struct codegen* cg, uint32_t lo, uint32_t hi) {
+    uint32_t start = cg->n_joins;
+    cg->stamp++;
+    for (uint32_t i = lo + 1; i <= hi; i++) {
+        struct ast_node* node = AST_NODE(cg->ast, i);
+        if (node->type != ASSIGN_STMT)
+            continue;
+        uint32_t var = node->node_data.assign_stmt.lhs;
+        if (cg->stamps[var] == cg->stamp)
+            continue;
+        cg->stamps[var] = cg->stamp;
+        cg->joins = reserve(cg->joins, &cg->joins_capacity, cg->n_joins + 1, sizeof(struct join_var));
+        struct join_var* join = &cg->joins[cg->n_joins++];
+        join->var = var;
+        join->before = cg->variables[var];
+        join->then = join->other = NULL;
+    }
+    return start;
+}
+
+// A phi at the start of the current block for a variable
+static LLVMValueRef build_phi(struct codegen* cg, uint32_t var) {
+    return LLVMBuildPhi(cg->builder, llvm_type(cg, var_type(cg->ast, var)), AST_NAME(cg->ast, var));
+}
+
+// Merge the values of a variable arriving from two blocks, with a phi only if they differ.
+// A value that's undefined on one path is simply taken from the other if it's a constant;
+// an instruction from only one path doesn't dominate the merge, so it still needs a phi.
+static LLVMValueRef merge(struct codegen* cg, uint32_t var, LLVMValueRef a, LLVMBasicBlockRef a_bb, LLVMValueRef b, LLVMBasicBlockRef b_bb) {
+    if (a == b)
+        return a;
+    if ((!a || LLVMIsUndef(a)) && (!b || LLVMIsConstant(b)))
+        return b;
+    if ((!b || LLVMIsUndef(b)) && (!a || LLVMIsConstant(a)))
+        return a;
+    LLVMValueRef undef = LLVMGetUndef(llvm_type(cg, var_type(cg->ast, var)));
+    LLVMValueRef phi = build_phi(cg, var);
+    LLVMValueRef values[] = {a ? a : undef, b ? b : undef};
+    LLVMBasicBlockRef blocks[] = {a_bb, b_bb};
+    LLVMAddIncoming(phi, values, blocks, 2);
+    return phi;
+}
+
+// If all of a phi's incoming values other than itself are one and the same, the value it
+// stands for; otherwise NULL
+static LLVMValueRef trivial_phi_value(LLVMValueRef phi) {
+    LLVMValueRef same = NULL;
+    for (unsigned i = 0; i < LLVMCountIncoming(phi); i++) {
+        LLVMValueRef value = LLVMGetIncomingValue(phi, i);
+        if (value == phi || value == same)
+            continue;
+        if (same)
+            return NULL;
+        same = value;
+    }
+    return same;
+}
+
+// Remove the trivial phis from a finished loop's header (Braun et al.), e.g. for a variable
+// only ever assigned its own value in the loop, or when the body always breaks.  Replacing
+// one phi can make another trivial, so this repeats until nothing changes.  Only the loop's
+// own variables can have been defined as one of its phis.
+static void remove_trivial_phis(struct codegen* cg, LLVMBasicBlockRef header, uint32_t vars) {
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (LLVMValueRef phi = LLVMGetFirstInstruction(header); phi && LLVMIsAPHINode(phi); phi = LLVMGetNextInstruction(phi)) {
+            LLVMValueRef same = trivial_phi_value(phi);
+            if (same && LLVMGetFirstUse(phi)) {
+                LLVMReplaceAllUsesWith(phi, same);
+                changed = 1;
+            }
+        }
+    }
+
+    for (uint32_t i = vars; i < cg->n_joins; i++) {
+        LLVMValueRef value = cg->variables[cg->joins[i].var];
+        if (value && LLVMIsAPHINode(value) && LLVMGetInstructionParent(value) == header) {
+            LLVMValueRef same = trivial_phi_value(value);
+            if (same)
+                cg->variables[cg->joins[i].var] = same;
+        }
+    }
+
+    LLVMValueRef phi = LLVMGetFirstInstruction(header);
+    while (phi && LLVMIsAPHINode(phi)) {
+        LLVMValueRef next = LLVMGetNextInstruction(phi);
+        if (trivial_phi_value(phi))
+            LLVMInstructionEraseFromParent(phi);
+        phi = next;
+    }
+}
+
+// Generate LLVM IR for statements.  Variables live in SSA registers: each one's current
+// definition is tracked as code is generated, and phis are placed where control flow meets,
+// so no allocas (and no mem2reg) are needed.
+static void gen_stmt(struct codegen* cg, uint32_t index) {
+    if (index == AST_NONE)
+        return;
+    struct ast_node* node = AST_NODE(cg->ast, index);
+
+    // Variable assignment just gives the variable a new definition
+    if (node->type == ASSIGN_STMT) {
+        uint32_t var = node->node_data.assign_stmt.lhs;
+        cg->variables[var] = convert(cg, gen_expr(cg, node->node_data.assign_stmt.rhs), var_type(cg->ast, var));
+        return;
+    }
+
     // Conditional statements
     if (node->type == IF_STMT) {
-        LLVMValueRef cond = LLVMBuildFCmp(builder, LLVMRealONE, gen_expr(node->node_data.if_stmt->condition), LLVMConstReal(LLVMFloatTypeInContext(context), 0.0), "ifcond");
-        
+        uint32_t if_block = node->node_data.if_stmt.if_block;
+        uint32_t else_block = node->node_data.if_stmt.else_block;
+        uint32_t vars = push_join_vars(cg, node->node_data.if_stmt.condition, else_block != AST_NONE ? else_block : if_block);
+        LLVMValueRef cond = gen_cond(cg, node->node_data.if_stmt.condition, "ifcond");
+
         // Create basic blocks for control flow
-        LLVMBasicBlockRef if_bb = LLVMAppendBasicBlockInContext(context, target_function, "ifBlock");
-        LLVMBasicBlockRef else_bb = node->node_data.if_stmt->else_block ? LLVMAppendBasicBlockInContext(context, target_function, "elseBlock") : NULL;
-        LLVMBasicBlockRef cont_bb = LLVMAppendBasicBlockInContext(context, target_function, "ifContinueBlock");
-        
+        LLVMBasicBlockRef if_bb = LLVMAppendBasicBlockInContext(cg->context, cg->target_function, "ifBlock");
+        LLVMBasicBlockRef else_bb = else_block != AST_NONE ? LLVMAppendBasicBlockInContext(cg->context, cg->target_function, "elseBlock") : NULL;
+        LLVMBasicBlockRef cont_bb = LLVMAppendBasicBlockInContext(cg->context, cg->target_function, "ifContinueBlock");
+
         // Branch based on condition
-        LLVMBuildCondBr(builder, cond, if_bb, else_bb ?: cont_bb);
-        
-        // Generate if block
-        LLVMPositionBuilderAtEnd(builder, if_bb);
-        gen_stmt(node->node_data.if_stmt->if_block);
-        LLVMBuildBr(builder, cont_bb);
-        
+        LLVMBasicBlockRef cond_end = LLVMGetInsertBlock(cg->builder);
+        build_cond_br(cg, cond, if_bb, else_bb ? else_bb : cont_bb, 'i');
+
+        // Generate if block, then go back to the variables' values before it
+        LLVMPositionBuilderAtEnd(cg->builder, if_bb);
+        gen_stmt(cg, if_block);
+        LLVMBasicBlockRef if_end = LLVMGetInsertBlock(cg->builder);
+        int if_open = !LLVMGetBasicBlockTerminator(if_end);
+        build_br_if_open(cg, cont_bb);
+        for (uint32_t i = vars; i < cg->n_joins; i++) {
+            cg->joins[i].then = cg->variables[cg->joins[i].var];
+            cg->variables[cg->joins[i].var] = cg->joins[i].before;
+        }
+
         // Generate else block if present
+        LLVMBasicBlockRef else_end = cond_end;
+        int else_open = 1;
         if (else_bb) {
-            LLVMPositionBuilderAtEnd(builder, else_bb);
-            gen_stmt(node->node_data.if_stmt->else_block);
-            LLVMBuildBr(builder, cont_bb);
+            LLVMPositionBuilderAtEnd(cg->builder, else_bb);
+            gen_stmt(cg, else_block);
+            else_end = LLVMGetInsertBlock(cg->builder);
+            else_open = !LLVMGetBasicBlockTerminator(else_end);
+            build_br_if_open(cg, cont_bb);
+        }
+
+        // Continue execution after if/else with the values from whichever branches get here
+        LLVMPositionBuilderAtEnd(cg->builder, cont_bb);
+        for (uint32_t i = vars; i < cg->n_joins; i++) {
+            struct join_var* join = &cg->joins[i];
+            join->other = cg->variables[join->var];
+            if (if_open && else_open)
+                cg->variables[join->var] = merge(cg, join->var, join->then, if_end, join->other, else_end);
+            else if (if_open)
+                cg->variables[join->var] = join->then;
         }
-        
-        // Continue execution after if/else
-        LLVMPositionBuilderAtEnd(builder, cont_bb);
+        cg->n_joins = vars;
         return;
     }
-    
+
     // While loops
     if (node->type == WHILE_STMT) {
+        uint32_t vars = push_join_vars(cg, node->node_data.while_stmt.condition, node->node_data.while_stmt.block);
+
         // Create basic blocks for loop structure
-        LLVMBasicBlockRef cond_bb = LLVMAppendBasicBlockInContext(context, target_function, "whileCondBlock");
-        LLVMBasicBlockRef body_bb = LLVMAppendBasicBlockInContext(context, target_function, "whileBlock");
-        LLVMBasicBlockRef cont_bb = LLVMAppendBasicBlockInContext(context, target_function, "whileContinueBlock");
-        
-        // Save and set break target for nested breaks
-        LLVMBasicBlockRef old_break = break_target;
-        break_target = cont_bb;
-        
-        // Jump to condition check
-        LLVMBuildBr(builder, cond_bb);
-        LLVMPositionBuilderAtEnd(builder, cond_bb);
-        
+        LLVMBasicBlockRef cond_bb = LLVMAppendBasicBlockInContext(cg->context, cg->target_function, "whileCondBlock");
+        LLVMBasicBlockRef body_bb = LLVMAppendBasicBlockInContext(cg->context, cg->target_function, "whileBlock");
+        LLVMBasicBlockRef cont_bb = LLVMAppendBasicBlockInContext(cg->context, cg->target_function, "whileContinueBlock");
+
+        // Jump to condition check, where each variable the loop may change gets a phi, whose
+        // value from the end of the body is filled in once that's been generated
+        LLVMBasicBlockRef pre_bb = LLVMGetInsertBlock(cg->builder);
+        LLVMBuildBr(cg->builder, cond_bb);
+        LLVMPositionBuilderAtEnd(cg->builder, cond_bb);
+        for (uint32_t i = vars; i < cg->n_joins; i++) {
+            struct join_var* join = &cg->joins[i];
+            LLVMValueRef before = read_var(cg, join->var);
+            join->then = build_phi(cg, join->var);
+            LLVMAddIncoming(join->then, &before, &pre_bb, 1);
+            cg->variables[join->var] = join->then;
+        }
+
         // Evaluate condition and branch
-        LLVMValueRef cond = LLVMBuildFCmp(builder, LLVMRealONE, gen_expr(node->node_data.while_stmt->condition), LLVMConstReal(LLVMFloatTypeInContext(context), 0.0), "whilecond");
-        LLVMBuildCondBr(builder, cond, body_bb, cont_bb);
-        
-        // Generate loop body and jump back to condition
-        LLVMPositionBuilderAtEnd(builder, body_bb);
-        gen_stmt(node->node_data.while_stmt->block);
-        LLVMBuildBr(builder, cond_bb);
-        
-        // Restore previous break target and continue execution
-        break_target = old_break;
-        LLVMPositionBuilderAtEnd(builder, cont_bb);
+        LLVMValueRef cond = gen_cond(cg, node->node_data.while_stmt.condition, "whilecond");
+        build_cond_br(cg, cond, body_bb, cont_bb, 'w');
+
+        // Generate loop body, recording the variables' values at each break, and jump back to
+        // the condition
+        struct loop loop = { vars, cg->n_joins - vars, cg->n_breaks, cg->n_break_values, cont_bb, cg->loop };
+        cg->loop = &loop;
+        LLVMPositionBuilderAtEnd(cg->builder, body_bb);
+        gen_stmt(cg, node->node_data.while_stmt.block);
+        LLVMBasicBlockRef body_end = LLVMGetInsertBlock(cg->builder);
+        if (!LLVMGetBasicBlockTerminator(body_end)) {
+            for (uint32_t i = vars; i < cg->n_joins; i++) {
+                LLVMValueRef value = read_var(cg, cg->joins[i].var);
+                LLVMAddIncoming(cg->joins[i].then, &value, &body_end, 1);
+            }
+            LLVMBuildBr(cg->builder, cond_bb);
+        }
+        cg->loop = loop.outer;
+
+        // Continue execution after the loop with the values from the condition check or from
+        // whichever break got here
+        LLVMPositionBuilderAtEnd(cg->builder, cont_bb);
+        uint32_t n_vars = loop.n_vars;
+        uint32_t n_breaks = cg->n_breaks - loop.breaks;
+        for (uint32_t i = 0; i < n_vars; i++) {
+            struct join_var* join = &cg->joins[vars + i];
+            LLVMValueRef* break_values = &cg->break_values[loop.break_values + i];
+            LLVMValueRef value = join->then;
+            for (uint32_t b = 0; b < n_breaks; b++) {
+                if (break_values[b * n_vars] != join->then) {
+                    value = build_phi(cg, join->var);
+                    LLVMAddIncoming(value, &join->then, &cond_bb, 1);
+                    for (b = 0; b < n_breaks; b++)
+                        LLVMAddIncoming(value, &break_values[b * n_vars], &cg->break_blocks[loop.breaks + b], 1);
+                    break;
+                }
+            }
+            cg->variables[join->var] = value;
+        }
+        cg->n_breaks = loop.breaks;
+        cg->n_break_values = loop.break_values;
+
+        remove_trivial_phis(cg, cond_bb, vars);
+        cg->n_joins = vars;
         return;
     }
-    
-    // Break statements
+
+    // Break statements (a break outside of any loop is a no-op), which record the values of
+    // the loop's variables for its exit
     if (node->type == BREAK_STMT) {
-        LLVMBuildBr(builder, break_target);
+        if (cg->loop) {
+            uint32_t n_vars = cg->loop->n_vars;
+            cg->break_blocks = reserve(cg->break_blocks, &cg->breaks_capacity, cg->n_breaks + 1, sizeof(LLVMBasicBlockRef));
+            cg->break_blocks[cg->n_breaks++] = LLVMGetInsertBlock(cg->builder);
+            cg->break_values = reserve(cg->break_values, &cg->break_values_capacity, cg->n_break_values + n_vars, sizeof(LLVMValueRef));
+            for (uint32_t i = 0; i < n_vars; i++)
+                cg->break_values[cg->n_break_values++] = read_var(cg, cg->joins[cg->loop->vars + i].var);
+            LLVMBuildBr(cg->builder, cg->loop->exit);
+        }
         return;
     }
-    
-    // Statement blocks
+
+    // Statement blocks, whose statements are listed contiguously; code following a break in
+    // the same block is unreachable
     if (node->type == BLOCK) {
-        for (int i = 0; i < node->node_data.block->n_stmts; i++)
-            gen_stmt(node->node_data.block->stmts[i]);
+        uint32_t* stmts = &cg->ast->stmts[node->node_data.block.stmts];
+        for (uint32_t i = 0; i < node->node_data.block.n_stmts; i++) {
+            if (LLVMGetBasicBlockTerminator(LLVMGetInsertBlock(cg->builder)))
+                break;
+            gen_stmt(cg, stmts[i]);
+        }
+        return;
+    }
+}
+
+// Tag the entry function with the CPU or features it's compiled for, like clang does, so
+// they're kept with the IR and any tool given it later generates code for the same target
+static void add_target_attribute(struct codegen* cg, const char* name, const char* value) {
+    if (!*value)
         return;
+    LLVMAttributeRef attr = LLVMCreateStringAttribute(cg->context, name, strlen(name), value, strlen(value));
+    LLVMAddAttributeAtIndex(cg->target_function, LLVMAttributeFunctionIndex, attr);
+}
+
+// Free the state kept on the program's variables and branches while its statements are
+// generated
+static void free_variables(struct codegen* cg) {
+    free(cg->variables);
+    free(cg->stamps);
+    free(cg->joins);
+    free(cg->break_blocks);
+    free(cg->break_values);
+    cg->variables = NULL;
+    cg->stamps = NULL;
+    cg->joins = NULL;
+    cg->break_blocks = NULL;
+    cg->break_values = NULL;
+    cg->n_variables = cg->stamp = 0;
+    cg->n_joins = cg->joins_capacity = 0;
+    cg->n_breaks = cg->breaks_capacity = 0;
+    cg->n_break_values = cg->break_values_capacity = 0;
+    free(cg->branches);
+    cg->branches = NULL;
+    cg->n_branches = cg->branches_capacity = 0;
+}
+
+// Discard the code from jit_target(), if any
+static void dispose_jit(struct codegen* cg) {
+    if (cg->jit)
+        LLVMOrcDisposeLLJIT(cg->jit);
+    cg->jit = NULL;
+}
+
+// The CPU and features to generate code for, with "native" resolved to the host's.  Both
+// must be freed with LLVMDisposeMessage().
+static void resolve_target(const struct codegen_options* options, char** cpu, char** features) {
+    int native_cpu = options->cpu && !strcmp(options->cpu, "native");
+    int native_features = options->features ? !strcmp(options->features, "native") : native_cpu;
+    *cpu = native_cpu ? LLVMGetHostCPUName() : LLVMCreateMessage(options->cpu ? options->cpu : "generic");
+    *features = native_features ? LLVMGetHostCPUFeatures() : LLVMCreateMessage(options->features ? options->features : "");
+}
+
+// Create a code generator; its context and target machine are created here, once
+struct codegen* codegen_create(const struct codegen_options* options) {
+    struct codegen* cg = calloc(1, sizeof(struct codegen));
+    cg->options = *options;
+    cg->ts_context = LLVMOrcCreateNewThreadSafeContext();
+    cg->context = LLVMOrcThreadSafeContextGetContext(cg->ts_context);
+    cg->options.cpu = cg->options.features = NULL;
+
+    // Resolve "native" to the host's CPU and features once, for every target machine
+    resolve_target(options, &cg->cpu, &cg->features);
+    cg->target_machine = create_target_machine(cg);
+
+    // A profile is parsed once, for every program, and isn't used when generating one
+    if (options->profile_generate)
+        cg->options.profile_generate = cg->profile_path = LLVMCreateMessage(options->profile_generate);
+    cg->options.profile_use = NULL;
+    if (options->profile_use && !options->profile_generate) {
+        cg->use_profile = !parse_profile(cg, options->profile_use);
+        if (!cg->use_profile)
+            fprintf(stderr, "Warning: the profile is malformed, so it isn't used\n");
     }
+    return cg;
+}
+
+// Describe everything about the options and LLVM that determines the code generated, for
+// identifying outputs in a cache
+char* codegen_fingerprint(const struct codegen_options* options) {
+    char* cpu;
+    char* features;
+    resolve_target(options, &cpu, &features);
+    char* triple = LLVMGetDefaultTargetTriple();
+
+    // The profile paths and text are length-prefixed, so no two sets of options run together
+    const char* generate = options->profile_generate ? options->profile_generate : "";
+    const char* use = options->profile_use && !options->profile_generate ? options->profile_use : "";
+    const char* format = "llvm %s\ntriple %s\ncpu %s\nfeatures %s\nopt %d\n"
+        "profile_generate %zu %s\nprofile_use %zu %s\n";
+    int len = snprintf(NULL, 0, format, LLVM_VERSION_STRING, triple, cpu, features,
+        options->opt_level, strlen(generate), generate, strlen(use), use);
+    char* fingerprint = malloc(len + 1);
+    snprintf(fingerprint, len + 1, format, LLVM_VERSION_STRING, triple, cpu, features,
+        options->opt_level, strlen(generate), generate, strlen(use), use);
+
+    LLVMDisposeMessage(triple);
+    LLVMDisposeMessage(cpu);
+    LLVMDisposeMessage(features);
+    return fingerprint;
 }
 
-// Main entry point
-char* generate_llvm_ir(struct ast_node* root) {
-    // Initialize LLVM context and module
-    context = LLVMContextCreate();
-    module = LLVMModuleCreateWithNameInContext("Python compiler", context);
-    builder = LLVMCreateBuilderInContext(context);
-    
+// Release the module, context, and target machine
+void codegen_free(struct codegen* cg) {
+    if (!cg)
+        return;
+    dispose_jit(cg);
+    if (cg->module)
+        LLVMDisposeModule(cg->module);
+    if (cg->ts_context)
+        LLVMOrcDisposeThreadSafeContext(cg->ts_context);
+    if (cg->target_machine)
+        LLVMDisposeTargetMachine(cg->target_machine);
+    LLVMDisposeMessage(cg->cpu);
+    LLVMDisposeMessage(cg->features);
+    LLVMDisposeMessage(cg->profile_path);
+    free(cg->profile_counts);
+    free(cg->values);
+    free_variables(cg);
+    free(cg);
+}
+
+// Start a new module whose entry function is then filled in one top-level statement at a
+// time by codegen_stmt().  The module is kept alive for the output functions below until
+// the next program or codegen_free().
+int codegen_begin(struct codegen* cg, const char* entry_name) {
+    cg->entry_name = entry_name ? entry_name : "target";
+
+    // Fresh module for this program in the shared context
+    dispose_jit(cg);
+    if (cg->module)
+        LLVMDisposeModule(cg->module);
+    cg->module = LLVMModuleCreateWithNameInContext("Python compiler", cg->context);
+    cg->builder = LLVMCreateBuilderInContext(cg->context);
+    cg->loop = NULL;
+
+    // Tag the module with the host triple and data layout so it can be emitted directly
+    if (cg->target_machine) {
+        char* triple = LLVMGetTargetMachineTriple(cg->target_machine);
+        LLVMTargetDataRef data_layout = LLVMCreateTargetDataLayout(cg->target_machine);
+        LLVMSetTarget(cg->module, triple);
+        LLVMSetModuleDataLayout(cg->module, data_layout);
+        LLVMDisposeTargetData(data_layout);
+        LLVMDisposeMessage(triple);
+    }
+
     // Create target function with float return type
-    LLVMTypeRef float_type = LLVMFloatTypeInContext(context);
-    target_function = LLVMAddFunction(module, "target", LLVMFunctionType(float_type, NULL, 0, 0));
-    
-    // Generate function body from AST
-    LLVMPositionBuilderAtEnd(builder, LLVMAppendBasicBlockInContext(context, target_function, "entry"));
-    gen_stmt(root);
-    
-    // Return value handling
-    LLVMValueRef ret_var = (LLVMValueRef)hash_get(symbols, "return_value");
-    LLVMBuildRet(builder, ret_var ? LLVMBuildLoad2(builder, float_type, ret_var, "") : LLVMConstReal(float_type, 0.0));
-    
-    // Convert to string and cleanup
-    char* ir = LLVMPrintModuleToString(module);
-    LLVMDisposeBuilder(builder);
-    LLVMDisposeModule(module);
-    LLVMContextDispose(context);
-    return ir;
-}
-
-// Generate object file from LLVM IR
-void generate_object_code(const char* llvm_ir, const char* output_file) {
-    FILE* f = fopen("temp.ll", "w");
-    fprintf(f, "%s", llvm_ir);
-    fclose(f);
-    
-    char cmd[256];
-    snprintf(cmd, sizeof(cmd), "llc -filetype=obj -o=%s temp.ll", output_file);
-    system(cmd);
-    remove("temp.ll");
+    LLVMTypeRef float_type = LLVMFloatTypeInContext(cg->context);
+    memset(&cg->stats, 0, sizeof(cg->stats));
+    cg->target_function = LLVMAddFunction(cg->module, cg->entry_name, LLVMFunctionType(float_type, NULL, 0, 0));
+    add_target_attribute(cg, "target-cpu", strcmp(cg->cpu, "generic") ? cg->cpu : "");
+    add_target_attribute(cg, "target-features", cg->features);
+    LLVMPositionBuilderAtEnd(cg->builder, LLVMAppendBasicBlockInContext(cg->context, cg->target_function, "entry"));
+
+    // Count the calls to the entry function when generating a profile
+    cg->branch_checksum = FNV_OFFSET;
+    if (cg->options.profile_generate) {
+        LLVMTypeRef i64 = LLVMInt64TypeInContext(cg->context);
+        cg->entry_counter = LLVMAddGlobal(cg->module, i64, "entry_counter");
+        LLVMSetLinkage(cg->entry_counter, LLVMPrivateLinkage);
+        LLVMSetInitializer(cg->entry_counter, LLVMConstNull(i64));
+        build_increment(cg, cg->entry_counter);
+    }
+    return 0;
+}
+
+// Append the code for one statement to the entry function.  Nothing refers back to the
+// statement's nodes afterwards, so the caller may drop them as soon as this returns.
+void codegen_stmt(struct codegen* cg, struct ast* ast, uint32_t stmt) {
+    // Symbols may have been added since the last statement
+    if (ast->n_names > cg->n_variables) {
+        cg->variables = realloc(cg->variables, ast->n_names * sizeof(LLVMValueRef));
+        cg->stamps = realloc(cg->stamps, ast->n_names * sizeof(uint32_t));
+        memset(cg->variables + cg->n_variables, 0, (ast->n_names - cg->n_variables) * sizeof(LLVMValueRef));
+        memset(cg->stamps + cg->n_variables, 0, (ast->n_names - cg->n_variables) * sizeof(uint32_t));
+        cg->n_variables = ast->n_names;
+    }
+    double start = clock_now();
+    cg->ast = ast;
+    if (!LLVMGetBasicBlockTerminator(LLVMGetInsertBlock(cg->builder)))
+        gen_stmt(cg, stmt);
+    cg->ast = NULL;
+    cg->stats.generate_seconds += clock_now() - start;
+}
+
+// Return value handling and optimization.  This is the only name looked up as a string,
+// once per program, and the only place a value must be converted to a float.
+int codegen_end(struct codegen* cg, struct ast* ast) {
+    double start = clock_now();
+    LLVMValueRef ret = LLVMConstReal(llvm_type(cg, TYPE_FLOAT), 0.0);
+    for (uint32_t i = 1; i < ast->n_names && i < cg->n_variables; i++) {
+        if (cg->variables[i] && !strcmp(AST_NAME(ast, i), "return_value"))
+            ret = convert(cg, cg->variables[i], TYPE_FLOAT);
+    }
+    if (cg->options.profile_generate) {
+        LLVMTypeRef writer_type = LLVMFunctionType(LLVMVoidTypeInContext(cg->context), NULL, 0, 0);
+        LLVMBuildCall2(cg->builder, writer_type, build_profile_writer(cg, writer_type), NULL, 0, "");
+    }
+    if (cg->use_profile)
+        apply_profile(cg);
+    LLVMBuildRet(cg->builder, ret);
+
+    LLVMDisposeBuilder(cg->builder);
+    cg->builder = NULL;
+    free_variables(cg);
+    cg->stats.generate_seconds += clock_now() - start;
+
+    count_instructions(cg->module, &cg->stats.n_blocks, &cg->stats.n_instructions);
+    cg->stats.optimize_start = clock_now();
+    int status = optimize_module(cg);
+    cg->stats.optimize_seconds = clock_now() - cg->stats.optimize_start;
+    if (status) {
+        // Don't leave a half-optimized module for the output functions
+        LLVMDisposeModule(cg->module);
+        cg->module = NULL;
+        return status;
+    }
+    count_instructions(cg->module, &cg->stats.n_blocks_optimized, &cg->stats.n_instructions_optimized);
+    return 0;
+}
+
+// Report on the most recent module
+void codegen_get_stats(struct codegen* cg, struct codegen_stats* stats) {
+    *stats = cg->stats;
+}
+
+// Abandon a module started by codegen_begin(), e.g. after a syntax error
+void codegen_discard(struct codegen* cg) {
+    if (cg->builder)
+        LLVMDisposeBuilder(cg->builder);
+    cg->builder = NULL;
+    free_variables(cg);
+    if (cg->module)
+        LLVMDisposeModule(cg->module);
+    cg->module = NULL;
+}
+
+// Main entry point: the whole AST is compiled as a single statement
+int generate_llvm_ir(struct codegen* cg, struct ast* ast, const char* entry_name) {
+    if (codegen_begin(cg, entry_name))
+        return 1;
+    codegen_stmt(cg, ast, ast_get_root(ast));
+    return codegen_end(cg, ast);
+}
+
+// Textual IR for the current module
+char* generate_llvm_ir_string(struct codegen* cg) {
+    return cg->module ? LLVMPrintModuleToString(cg->module) : NULL;
+}
+
+// Hand the current module over to the caller; it still lives in this generator's context
+LLVMModuleRef codegen_take_module(struct codegen* cg) {
+    LLVMModuleRef module = cg->module;
+    cg->module = NULL;
+    return module;
+}
+
+// Emit an object file for the current module into a malloc'd buffer
+int generate_object_code_buffer(struct codegen* cg, char** data, size_t* size) {
+    if (!cg->target_machine || !cg->module)
+        return 1;
+
+    char* err = NULL;
+    LLVMMemoryBufferRef buf;
+    if (LLVMTargetMachineEmitToMemoryBuffer(cg->target_machine, cg->module, LLVMObjectFile, &err, &buf)) {
+        fprintf(stderr, "Error: could not generate object code: %s\n", err);
+        LLVMDisposeMessage(err);
+        return 1;
+    }
+    *size = LLVMGetBufferSize(buf);
+    *data = malloc(*size);
+    memcpy(*data, LLVMGetBufferStart(buf), *size);
+    LLVMDisposeMemoryBuffer(buf);
+    return 0;
+}
+
+// Write the current module to a file, letting LLVM stream each kind of output straight to it
+int generate_output_file(struct codegen* cg, int kind, const char* path) {
+    if (!cg->module)
+        return 1;
+
+    char* err = NULL;
+    int status;
+    if (kind == OUTPUT_IR) {
+        status = LLVMPrintModuleToFile(cg->module, path, &err);
+    } else if (kind == OUTPUT_BITCODE) {
+        status = LLVMWriteBitcodeToFile(cg->module, path);
+    } else if (kind == OUTPUT_OBJECT && !strcmp(path, "-")) {
+        // The object writer seeks back to patch headers, which stdout may not
+        // support when it's a pipe, so object code for it goes through memory
+        char* data;
+        size_t size;
+        status = generate_object_code_buffer(cg, &data, &size);
+        if (status)
+            return status;
+        status = fwrite(data, 1, size, stdout) != size || fflush(stdout);
+        free(data);
+    } else if (cg->target_machine) {
+        LLVMCodeGenFileType type = kind == OUTPUT_ASM ? LLVMAssemblyFile : LLVMObjectFile;
+        status = LLVMTargetMachineEmitToFile(cg->target_machine, cg->module, (char*)path, type, &err);
+    } else {
+        status = 1;
+    }
+
+    if (status) {
+        fprintf(stderr, "Error: could not write %s%s%s\n", strcmp(path, "-") ? path : "stdout",
+            err ? ": " : "", err ? err : "");
+        LLVMDisposeMessage(err);
+    }
+    return status;
+}
+
+// JIT-compile the current module with ORC LLJIT and return its entry function, which
+// stays callable until the JIT is disposed of
+entry_function jit_target(struct codegen* cg) {
+    if (!cg->module)
+        return NULL;
+    dispose_jit(cg);
+
+    // Give the JIT its own target machine configured like the one used for object files
+    LLVMOrcLLJITBuilderRef jit_builder = LLVMOrcCreateLLJITBuilder();
+    LLVMTargetMachineRef jit_tm = create_target_machine(cg);
+    if (jit_tm)
+        LLVMOrcLLJITBuilderSetJITTargetMachineBuilder(jit_builder,
+            LLVMOrcJITTargetMachineBuilderCreateFromTargetMachine(jit_tm));
+
+    LLVMErrorRef err = LLVMOrcCreateLLJIT(&cg->jit, jit_builder);
+    if (err) {
+        cg->jit = NULL;
+        report_llvm_error("could not create JIT", err);
+        return NULL;
+    }
+
+    // The generated code may call the C library (e.g. to write a profile), which is found in
+    // this process
+    LLVMOrcDefinitionGeneratorRef process_symbols;
+    err = LLVMOrcCreateDynamicLibrarySearchGeneratorForProcess(&process_symbols, LLVMOrcLLJITGetGlobalPrefix(cg->jit), NULL, NULL);
+    if (err) {
+        dispose_jit(cg);
+        report_llvm_error("could not look up symbols for JIT", err);
+        return NULL;
+    }
+    LLVMOrcJITDylibAddGenerator(LLVMOrcLLJITGetMainJITDylib(cg->jit), process_symbols);
+
+    // The JIT takes ownership of the module
+    LLVMOrcThreadSafeModuleRef ts_module = LLVMOrcCreateNewThreadSafeModule(cg->module, cg->ts_context);
+    cg->module = NULL;
+    err = LLVMOrcLLJITAddLLVMIRModule(cg->jit, LLVMOrcLLJITGetMainJITDylib(cg->jit), ts_module);
+    if (err) {
+        dispose_jit(cg);
+        report_llvm_error("could not add module to JIT", err);
+        return NULL;
+    }
+
+    LLVMOrcJITTargetAddress addr;
+    err = LLVMOrcLLJITLookup(cg->jit, &addr, cg->entry_name);
+    if (err) {
+        dispose_jit(cg);
+        report_llvm_error("could not find entry point in JIT", err);
+        return NULL;
+    }
+    return (entry_function)(uintptr_t)addr;
+}
+
+// JIT-compile the current module and call target() in-process
+int run_target(struct codegen* cg, float* return_value) {
+    entry_function target = jit_target(cg);
+    if (!target)
+        return 1;
+    *return_value = target();
+    dispose_jit(cg);
+    return 0;
 }
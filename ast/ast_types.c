@@ -0,0 +1,1273 @@
+/*
+ * This file contains the implementation of type inference over an AST.  The
+ * only function defined here that is part of the public interface of the AST
+ * is ast_infer_types().  Internal functions are marked `static`, and their
+ * names begin with an underscore.
+ *
+ * Each variable gets the single type that can hold every value assigned to
+ * it anywhere in the program: boolean, integer, or float, in that order (see
+ * `enum _ast_var_type`).  An expression's type is that of its literals and
+ * variables, except that arithmetic always gives at least an integer,
+ * division always gives a float, and comparisons always give a boolean.  So
+ * a variable's type is the greatest of
+ *
+ *   - the types contributed directly by the expressions assigned to it, i.e.
+ *     by their literals and operators, and
+ *   - the types of the variables whose values flow into it, i.e. those that
+ *     appear in its expressions other than as operands of a comparison or
+ *     division.
+ *
+ * The first part is found in one pass over the assignments, which also
+ * records the flow of types between variables as a graph.  The second is
+ * then propagated over that graph with a worklist.  A variable's type can
+ * only be raised twice, so this is linear in the size of the program,
+ * however variables depend on each other.
+ *
+ * Integers are 32 bits, but a program's values aren't, so integer arithmetic
+ * must never wrap around.  An addition, subtraction, or multiplication that
+ * might overflow is "wide": it's done on floats, like division, and so gives
+ * a float.  Which arithmetic is wide is found by a range analysis, which
+ * runs over the program's statements in order, tracking the range of values
+ * each variable may hold, narrowed by the conditions of ifs and whiles.  A
+ * while loop is run over until the ranges at its condition stop growing.
+ * When a counter bounds how many times it can run, e.g. `i` in
+ * `while i < 10: i = i + 1`, it's run over at most that many times, so a sum
+ * accumulated in it stays bounded too.  Otherwise, any range that keeps
+ * growing is widened to be unbounded.  Only the ranges of integers are
+ * trusted, since floats round, and which variables are floats depends in
+ * turn on which arithmetic is wide, so the two are alternated until the
+ * types settle.
+ *
+ * A loop nested in another is run over again each time the outer one is, so
+ * the work of doing so is capped at a fixed multiple of the size of the
+ * program.  Past that, while an outer loop's ranges are still settling, the
+ * loops in it are skipped, leaving every variable they assign unbounded, and
+ * only analyzed once the outer loop's ranges have settled.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "ast.h"
+#include "_ast_internal.h"
+#include "../parser.h"
+
+/*
+ * How many times the range analysis may run over each node of the program,
+ * on top of a fixed allowance for small programs, before it starts skipping
+ * nested loops (see above).
+ */
+#define _RANGE_BUDGET_PER_NODE 4
+#define _RANGE_BUDGET_BASE 65536
+
+/*
+ * How many times a loop without a known trip count is run over before the
+ * ranges that keep growing are made unbounded.
+ */
+#define _RANGE_WIDENINGS 3
+
+/*
+ * How many times the range analysis and the inference of variables' types
+ * are alternated before all arithmetic is taken to be wide.
+ */
+#define _RANGE_PASSES 4
+
+/*
+ * This structure represents the flow of one variable's type into another's.
+ *
+ * @var from The symbol ID of the variable whose type flows.
+ * @var to The symbol ID of the variable into which it flows.
+ */
+struct _type_edge {
+    uint32_t from;
+    uint32_t to;
+};
+
+/*
+ * This structure holds the state of one run of type inference.
+ *
+ * @var types The type inferred so far for each variable, indexed by symbol
+ *   ID.
+ * @var wide_ops Which arithmetic nodes are wide, indexed by node.
+ * @var edges The flow of types between variables.
+ * @var n_edges The number of entries in `edges`.
+ * @var edges_capacity The allocated length of `edges`.
+ * @var reached Scratch space marking the nodes of the expression currently
+ *   being scanned whose types flow into the variable it's assigned to.
+ * @var reached_capacity The allocated length of `reached`.
+ */
+struct _inference {
+    uint8_t* types;
+    const uint8_t* wide_ops;
+    struct _type_edge* edges;
+    size_t n_edges;
+    size_t edges_capacity;
+    uint8_t* reached;
+    uint32_t reached_capacity;
+};
+
+/*
+ * This structure represents the values an integer or boolean may take, from
+ * `lo` through `hi`.  A range whose `lo` is greater than its `hi` is empty,
+ * e.g. that of a variable not assigned yet.  A float's value is unbounded,
+ * i.e. from INT64_MIN, which no integer's range ever reaches.
+ */
+struct _range {
+    int64_t lo;
+    int64_t hi;
+};
+
+static const struct _range _empty = {1, 0};
+static const struct _range _unbounded = {INT64_MIN, INT64_MAX};
+
+/*
+ * This structure holds what the range analysis knows of one variable that
+ * an if or while statement may change, i.e. that it assigns or that one of
+ * the conditions in it narrows.
+ *
+ * @var var The symbol ID of the variable.
+ * @var n_assigns The number of times the statement assigns the variable.
+ * @var step For a while statement, if the variable's one assignment is a
+ *   statement of the loop's body of the form `var = var + step`, the step
+ *   it's counted up by; otherwise 0.
+ * @var before The variable's range before the statement.
+ * @var then For an if statement, the variable's range at the end of the if
+ *   branch.  For a while statement, its range each time the condition is
+ *   checked.
+ * @var exit For a while statement, the variable's range at any break out of
+ *   the loop.
+ */
+struct _frame_var {
+    uint32_t var;
+    uint32_t n_assigns;
+    int64_t step;
+    struct _range before;
+    struct _range then;
+    struct _range exit;
+};
+
+/*
+ * This structure represents one variable that an if or while statement may
+ * change, i.e. that it assigns or that one of the conditions in it compares.
+ *
+ * @var var The symbol ID of the variable.
+ * @var n_assigns The number of times the statement assigns the variable.
+ */
+struct _stmt_var {
+    uint32_t var;
+    uint32_t n_assigns;
+};
+
+/*
+ * This structure holds the variables that each if and while statement in an
+ * AST may change.  They're found once, bottom up, and shared by every run of
+ * the range analysis, which would otherwise have to look through a
+ * statement's nodes each time it analyzes it.
+ *
+ * @var vars The variables of all the statements, each statement's together.
+ * @var n_vars The number of entries in `vars`.
+ * @var vars_capacity The allocated length of `vars`.
+ * @var offsets For each node, the position in `vars` of its first variable,
+ *   indexed by node.  Those of node `i` end where those of node `i + 1`
+ *   start, so nodes other than if and while statements have none.
+ * @var stamps The statement whose variables each variable was last added
+ *   to, indexed by symbol ID, while they're being found.
+ * @var slots The position in `vars` at which each variable was last added,
+ *   indexed by symbol ID, while they're being found.
+ */
+struct _stmt_vars {
+    struct _stmt_var* vars;
+    uint32_t n_vars;
+    uint32_t vars_capacity;
+    uint32_t* offsets;
+    uint32_t* stamps;
+    uint32_t* slots;
+};
+
+/*
+ * This structure represents a while loop being analyzed, for its breaks.
+ *
+ * @var vars The position in the frame of the loop's first variable.
+ * @var n_vars The number of the loop's variables.
+ * @var broken Whether a break out of the loop has been reached.
+ * @var outer The loop this one is nested in, or NULL.
+ */
+struct _loop {
+    uint32_t vars;
+    uint32_t n_vars;
+    int broken;
+    struct _loop* outer;
+};
+
+/*
+ * This structure holds what a condition says about the operands of the
+ * comparison it makes when it's false (index 0) and when it's true (index
+ * 1).
+ *
+ * @var possible Whether the condition can be false or true at all.
+ * @var vars The symbol IDs of the variables compared on the left and right,
+ *   or 0 for operands that aren't variables.
+ * @var ranges The ranges the operands are narrowed to.
+ */
+struct _narrowing {
+    int possible[2];
+    uint32_t vars[2];
+    struct _range ranges[2][2];
+};
+
+/*
+ * This structure holds the state of one run of the range analysis.
+ *
+ * @var ast The AST being analyzed.
+ * @var types The type of each variable, indexed by symbol ID.
+ * @var wide_ops Which arithmetic nodes are wide, indexed by node.
+ * @var stmt_vars The variables each if and while statement may change.
+ * @var vars The range of each variable at the current point of the program,
+ *   indexed by symbol ID.
+ * @var reachable Whether the current point of the program can be reached.
+ * @var recording Whether wide arithmetic is being recorded, i.e. whether the
+ *   ranges of every enclosing loop have settled.
+ * @var budget How many more nodes may be run over before nested loops are
+ *   skipped.
+ * @var stamps The frame in which each variable was last added to the frame
+ *   (see _push_frame()), indexed by symbol ID.
+ * @var slots The position in the frame at which each variable was last
+ *   added, indexed by symbol ID.
+ * @var stamp The number of frames pushed so far.
+ * @var frame The variables of the if and while statements being analyzed.
+ * @var n_frame The number of entries in `frame`.
+ * @var frame_capacity The allocated length of `frame`.
+ * @var values Scratch space for the ranges of the nodes of the expression
+ *   being analyzed.
+ * @var values_capacity The allocated length of `values`.
+ * @var loop The innermost loop being analyzed, or NULL.
+ */
+struct _ranges {
+    struct ast* ast;
+    const uint8_t* types;
+    uint8_t* wide_ops;
+    const struct _stmt_vars* stmt_vars;
+    struct _range* vars;
+    int reachable;
+    int recording;
+    int64_t budget;
+    uint32_t* stamps;
+    uint32_t* slots;
+    uint32_t stamp;
+    struct _frame_var* frame;
+    uint32_t n_frame;
+    uint32_t frame_capacity;
+    struct _range* values;
+    uint32_t values_capacity;
+    struct _loop* loop;
+};
+
+/*
+ * Raises the type of variable `var` to at least `type`.
+ */
+static void _raise(struct _inference* inf, uint32_t var, int type) {
+    if (inf->types[var] < type) {
+        inf->types[var] = type;
+    }
+}
+
+/*
+ * Records that the type of variable `from` flows into variable `to`.
+ */
+static void _add_edge(struct _inference* inf, uint32_t from, uint32_t to) {
+    if (inf->n_edges == inf->edges_capacity) {
+        inf->edges_capacity = inf->edges_capacity ?
+            2 * inf->edges_capacity : 64;
+        inf->edges = realloc(inf->edges,
+            inf->edges_capacity * sizeof(struct _type_edge));
+        assert(inf->edges);
+    }
+    inf->edges[inf->n_edges].from = from;
+    inf->edges[inf->n_edges].to = to;
+    inf->n_edges++;
+}
+
+/*
+ * Returns 1 if a binary operation is an addition, subtraction, or
+ * multiplication, i.e. one that may be wide.
+ */
+static int _is_arithmetic(int op) {
+    return op == PLUS || op == MINUS || op == TIMES;
+}
+
+/*
+ * Returns the lowest-numbered node of the expression `expr`.
+ */
+static uint32_t _expr_first(struct ast* ast, uint32_t expr) {
+    struct ast_node* root = AST_NODE(ast, expr);
+    return root->type == BINOP_EXPR ? root->node_data.binop_expr.first : expr;
+}
+
+/*
+ * Scans the expression `expr` assigned to variable `var`.  Its nodes occupy
+ * a contiguous range in post-order, so they're visited from the root down in
+ * one sweep backwards over that range, marking which of them the result's
+ * type depends on.
+ */
+static void _scan_assignment(struct ast* ast, struct _inference* inf,
+        uint32_t var, uint32_t expr) {
+    uint32_t first = _expr_first(ast, expr);
+    uint32_t n = expr - first + 1;
+
+    if (n > inf->reached_capacity) {
+        inf->reached_capacity = n > 2 * inf->reached_capacity ?
+            n : 2 * inf->reached_capacity;
+        inf->reached = realloc(inf->reached, inf->reached_capacity);
+        assert(inf->reached);
+    }
+    memset(inf->reached, 0, n);
+    inf->reached[n - 1] = 1;
+
+    for (uint32_t i = expr + 1; i-- > first; ) {
+        if (!inf->reached[i - first]) {
+            continue;
+        }
+        struct ast_node* node = AST_NODE(ast, i);
+        switch (node->type) {
+        case ID_EXPR:
+            _add_edge(inf, node->node_data.id_expr.name, var);
+            break;
+        case INT_EXPR:
+            _raise(inf, var, TYPE_INT);
+            break;
+        case FLOAT_EXPR:
+            _raise(inf, var, TYPE_FLOAT);
+            break;
+        case BINOP_EXPR:
+            if (node->op == DIVIDEDBY || inf->wide_ops[i]) {
+                _raise(inf, var, TYPE_FLOAT);
+            } else if (_is_arithmetic(node->op)) {
+                _raise(inf, var, TYPE_INT);
+                inf->reached[node->node_data.binop_expr.lhs - first] = 1;
+                inf->reached[node->node_data.binop_expr.rhs - first] = 1;
+            }
+            break;
+        }
+    }
+}
+
+/*
+ * Propagates types along the edges recorded while scanning.  The edges are
+ * first sorted by source variable into a compact adjacency list.
+ */
+static void _propagate(struct _inference* inf, uint32_t n_vars) {
+    uint32_t* offsets = calloc(n_vars + 1, sizeof(uint32_t));
+    uint32_t* targets = malloc((inf->n_edges + 1) * sizeof(uint32_t));
+    uint32_t* worklist = malloc(3 * n_vars * sizeof(uint32_t));
+    assert(offsets && targets && worklist);
+
+    /*
+     * Count each variable's edges, turn the counts into offsets, and place
+     * the targets, which leaves each offset at the start of the next
+     * variable's edges, so they're shifted back afterwards.
+     */
+    for (size_t i = 0; i < inf->n_edges; i++) {
+        offsets[inf->edges[i].from + 1]++;
+    }
+    for (uint32_t v = 0; v < n_vars; v++) {
+        offsets[v + 1] += offsets[v];
+    }
+    for (size_t i = 0; i < inf->n_edges; i++) {
+        targets[offsets[inf->edges[i].from]++] = inf->edges[i].to;
+    }
+    for (uint32_t v = n_vars; v > 0; v--) {
+        offsets[v] = offsets[v - 1];
+    }
+    offsets[0] = 0;
+
+    /*
+     * Each variable is pushed once to begin with and once more each time its
+     * type is raised, which happens at most twice.
+     */
+    uint32_t n_work = 0;
+    for (uint32_t v = 1; v < n_vars; v++) {
+        if (inf->types[v] > TYPE_BOOL) {
+            worklist[n_work++] = v;
+        }
+    }
+    while (n_work > 0) {
+        uint32_t from = worklist[--n_work];
+        for (uint32_t i = offsets[from]; i < offsets[from + 1]; i++) {
+            uint32_t to = targets[i];
+            if (inf->types[to] < inf->types[from]) {
+                inf->types[to] = inf->types[from];
+                worklist[n_work++] = to;
+            }
+        }
+    }
+
+    free(offsets);
+    free(targets);
+    free(worklist);
+}
+
+/*
+ * Infers the type of every variable in an AST, given which of its arithmetic
+ * is wide, and returns them indexed by symbol ID.
+ */
+static uint8_t* _infer_var_types(struct ast* ast, const uint8_t* wide_ops) {
+    struct _inference inf;
+    memset(&inf, 0, sizeof(inf));
+    inf.types = calloc(ast->n_names, sizeof(uint8_t));
+    inf.wide_ops = wide_ops;
+    assert(inf.types);
+
+    /*
+     * Every statement comes after the expression assigned in it, so the
+     * assignments are found by sweeping over the node array.
+     */
+    for (uint32_t i = 1; i < ast->n_nodes; i++) {
+        struct ast_node* node = AST_NODE(ast, i);
+        if (node->type == ASSIGN_STMT) {
+            _scan_assignment(ast, &inf, node->node_data.assign_stmt.lhs,
+                node->node_data.assign_stmt.rhs);
+        }
+    }
+    _propagate(&inf, ast->n_names);
+
+    free(inf.edges);
+    free(inf.reached);
+    return inf.types;
+}
+
+/*
+ * Returns the smallest range holding both `a` and `b`.
+ */
+static struct _range _join(struct _range a, struct _range b) {
+    if (a.lo > a.hi) {
+        return b;
+    }
+    if (b.lo > b.hi) {
+        return a;
+    }
+    a.lo = b.lo < a.lo ? b.lo : a.lo;
+    a.hi = b.hi > a.hi ? b.hi : a.hi;
+    return a;
+}
+
+/*
+ * Returns 1 if the range `a` lies within the range `b`.
+ */
+static int _within(struct _range a, struct _range b) {
+    return a.lo > a.hi || (b.lo <= b.hi && a.lo >= b.lo && a.hi <= b.hi);
+}
+
+/*
+ * Returns the range of variable `var` at the current point of the program,
+ * which is unbounded if it's a float and otherwise lies within what its
+ * type can hold.
+ */
+static struct _range _read(struct _ranges* rg, uint32_t var) {
+    struct _range r = rg->vars[var];
+    int type = rg->types[var];
+    if (r.lo > r.hi) {
+        return r;
+    }
+    if (type == TYPE_FLOAT) {
+        return _unbounded;
+    }
+    int64_t lo = type == TYPE_BOOL ? 0 : INT32_MIN;
+    int64_t hi = type == TYPE_BOOL ? 1 : INT32_MAX;
+    if (r.lo < lo || r.lo > hi) {
+        r.lo = lo;
+    }
+    if (r.hi > hi || r.hi < lo) {
+        r.hi = hi;
+    }
+    return r;
+}
+
+/*
+ * Returns the range of the result of a binary operation on operands with the
+ * ranges `l` and `r`, computed exactly.
+ */
+static struct _range _binop_range(int op, struct _range l, struct _range r) {
+    if (op == DIVIDEDBY) {
+        return _unbounded;
+    }
+    if (!_is_arithmetic(op)) {
+        return (struct _range){0, 1};
+    }
+    if (l.lo > l.hi || r.lo > r.hi) {
+        return _empty;
+    }
+    if (l.lo == INT64_MIN || r.lo == INT64_MIN) {
+        return _unbounded;
+    }
+
+    struct _range result;
+    if (op == PLUS) {
+        result.lo = l.lo + r.lo;
+        result.hi = l.hi + r.hi;
+    } else if (op == MINUS) {
+        result.lo = l.lo - r.hi;
+        result.hi = l.hi - r.lo;
+    } else {
+        int64_t products[] = {l.lo * r.lo, l.lo * r.hi, l.hi * r.lo,
+            l.hi * r.hi};
+        result.lo = result.hi = products[0];
+        for (int i = 1; i < 4; i++) {
+            result.lo = products[i] < result.lo ? products[i] : result.lo;
+            result.hi = products[i] > result.hi ? products[i] : result.hi;
+        }
+    }
+    return result;
+}
+
+/*
+ * Finds the range of every node of the expression `expr` in one sweep over
+ * its nodes, leaving them in `rg->values` from its first node, and returns
+ * that of the whole expression.  Arithmetic whose result might not fit in 32
+ * bits is wide, and so unbounded, since it's done on floats.
+ */
+static struct _range _range_expr(struct _ranges* rg, uint32_t expr) {
+    uint32_t first = _expr_first(rg->ast, expr);
+    uint32_t n = expr - first + 1;
+
+    if (n > rg->values_capacity) {
+        rg->values_capacity = n > 2 * rg->values_capacity ?
+            n : 2 * rg->values_capacity;
+        rg->values = realloc(rg->values,
+            rg->values_capacity * sizeof(struct _range));
+        assert(rg->values);
+    }
+    rg->budget -= n;
+
+    for (uint32_t i = first; i <= expr; i++) {
+        struct ast_node* node = AST_NODE(rg->ast, i);
+        struct _range* value = &rg->values[i - first];
+        switch (node->type) {
+        case ID_EXPR:
+            *value = _read(rg, node->node_data.id_expr.name);
+            break;
+        case INT_EXPR:
+            value->lo = value->hi = node->node_data.int_expr.val;
+            break;
+        case BOOL_EXPR:
+            value->lo = value->hi = node->node_data.bool_expr.val != 0;
+            break;
+        case BINOP_EXPR:
+            *value = _binop_range(node->op,
+                rg->values[node->node_data.binop_expr.lhs - first],
+                rg->values[node->node_data.binop_expr.rhs - first]);
+            if (rg->wide_ops[i]) {
+                *value = _unbounded;
+            } else if (value->lo != INT64_MIN && value->lo <= value->hi
+                    && (value->lo < INT32_MIN || value->hi > INT32_MAX)) {
+                if (rg->recording) {
+                    rg->wide_ops[i] = 1;
+                }
+                *value = _unbounded;
+            }
+            break;
+        default:
+            *value = _unbounded;
+            break;
+        }
+    }
+    return rg->values[n - 1];
+}
+
+/*
+ * Returns the comparison that's true exactly when `op` is false, for
+ * integers.
+ */
+static int _negate(int op) {
+    switch (op) {
+    case EQ:
+        return NEQ;
+    case NEQ:
+        return EQ;
+    case GT:
+        return LTE;
+    case GTE:
+        return LT;
+    case LT:
+        return GTE;
+    default:
+        return GT;
+    }
+}
+
+/*
+ * Narrows the ranges `l` and `r` of two integers to the values for which
+ * `l op r` can be true.
+ */
+static void _narrow_comparison(int op, struct _range* l, struct _range* r) {
+    struct _range a = *l;
+    struct _range b = *r;
+    switch (op) {
+    case EQ:
+        l->lo = r->lo = a.lo > b.lo ? a.lo : b.lo;
+        l->hi = r->hi = a.hi < b.hi ? a.hi : b.hi;
+        break;
+    case NEQ:
+        if (b.lo == b.hi) {
+            l->lo += a.lo == b.lo;
+            l->hi -= a.hi == b.lo;
+        }
+        if (a.lo == a.hi) {
+            r->lo += b.lo == a.lo;
+            r->hi -= b.hi == a.lo;
+        }
+        break;
+    case LT:
+    case LTE:
+        if (a.hi > b.hi - (op == LT)) {
+            l->hi = b.hi - (op == LT);
+        }
+        if (b.lo < a.lo + (op == LT)) {
+            r->lo = a.lo + (op == LT);
+        }
+        break;
+    default:
+        _narrow_comparison(op == GT ? LT : LTE, r, l);
+        break;
+    }
+}
+
+/*
+ * Works out what the condition `cond`, whose nodes' ranges have just been
+ * found, says when it's false and when it's true.  Only comparisons of
+ * integers and booleans narrow anything, along with a variable tested on its
+ * own, which is compared with 0.
+ */
+static void _narrow_cond(struct _ranges* rg, uint32_t cond,
+        struct _narrowing* narrowing) {
+    struct ast_node* node = AST_NODE(rg->ast, cond);
+    uint32_t first = _expr_first(rg->ast, cond);
+    memset(narrowing, 0, sizeof(*narrowing));
+    narrowing->possible[0] = narrowing->possible[1] = 1;
+
+    int op = NEQ;
+    uint32_t operands[2] = {cond, AST_NONE};
+    struct _range values[2] = {rg->values[cond - first], {0, 0}};
+    if (node->type == BINOP_EXPR) {
+        if (node->op == DIVIDEDBY || _is_arithmetic(node->op)) {
+            return;
+        }
+        op = node->op;
+        operands[0] = node->node_data.binop_expr.lhs;
+        operands[1] = node->node_data.binop_expr.rhs;
+        values[0] = rg->values[operands[0] - first];
+        values[1] = rg->values[operands[1] - first];
+    } else if (node->type == FLOAT_EXPR) {
+        float val = node->node_data.float_expr.val;
+        narrowing->possible[isnan(val) || val == 0.0f] = 0;
+        return;
+    } else if (node->type != ID_EXPR && node->type != INT_EXPR
+            && node->type != BOOL_EXPR) {
+        return;
+    }
+
+    for (int side = 0; side < 2; side++) {
+        if (values[side].lo > values[side].hi
+                || values[side].lo == INT64_MIN) {
+            return;
+        }
+    }
+    for (int side = 0; side < 2; side++) {
+        struct ast_node* operand = AST_NODE(rg->ast, operands[side]);
+        if (operands[side] != AST_NONE && operand->type == ID_EXPR) {
+            narrowing->vars[side] = operand->node_data.id_expr.name;
+        }
+    }
+    for (int holds = 0; holds < 2; holds++) {
+        struct _range* ranges = narrowing->ranges[holds];
+        ranges[0] = values[0];
+        ranges[1] = values[1];
+        _narrow_comparison(holds ? op : _negate(op), &ranges[0], &ranges[1]);
+        narrowing->possible[holds] = ranges[0].lo <= ranges[0].hi
+            && ranges[1].lo <= ranges[1].hi;
+    }
+}
+
+/*
+ * Narrows the current ranges of the variables compared by a condition to
+ * those for which it's true (`holds` = 1) or false (`holds` = 0).  If it
+ * can't be, the current point of the program is unreachable.
+ */
+static void _narrow(struct _ranges* rg, struct _narrowing* narrowing,
+        int holds) {
+    if (!narrowing->possible[holds]) {
+        rg->reachable = 0;
+        return;
+    }
+    for (int side = 0; side < 2; side++) {
+        uint32_t var = narrowing->vars[side];
+        if (var) {
+            struct _range r = _read(rg, var);
+            struct _range narrowed = narrowing->ranges[holds][side];
+            r.lo = narrowed.lo > r.lo ? narrowed.lo : r.lo;
+            r.hi = narrowed.hi < r.hi ? narrowed.hi : r.hi;
+            rg->vars[var] = r;
+            rg->reachable &= r.lo <= r.hi;
+        }
+    }
+}
+
+/*
+ * Adds `n_assigns` assignments of variable `var` to the variables of the
+ * statement at `stmt`, adding it to them if it isn't among them yet.
+ */
+static void _stmt_var_add(struct _stmt_vars* sv, uint32_t stmt, uint32_t var,
+        uint32_t n_assigns) {
+    if (sv->stamps[var] != stmt) {
+        if (sv->n_vars == sv->vars_capacity) {
+            sv->vars_capacity = sv->vars_capacity ?
+                2 * sv->vars_capacity : 256;
+            sv->vars = realloc(sv->vars,
+                sv->vars_capacity * sizeof(struct _stmt_var));
+            assert(sv->vars);
+        }
+        sv->vars[sv->n_vars].var = var;
+        sv->vars[sv->n_vars].n_assigns = 0;
+        sv->stamps[var] = stmt;
+        sv->slots[var] = sv->n_vars++;
+    }
+    sv->vars[sv->slots[var]].n_assigns += n_assigns;
+}
+
+/*
+ * Adds the variables compared by the condition `cond` to the variables of
+ * the statement at `stmt`.
+ */
+static void _stmt_var_add_cond(struct ast* ast, struct _stmt_vars* sv,
+        uint32_t stmt, uint32_t cond) {
+    struct ast_node* node = AST_NODE(ast, cond);
+    if (node->type == ID_EXPR) {
+        _stmt_var_add(sv, stmt, node->node_data.id_expr.name, 0);
+    } else if (node->type == BINOP_EXPR) {
+        struct ast_node* l = AST_NODE(ast, node->node_data.binop_expr.lhs);
+        struct ast_node* r = AST_NODE(ast, node->node_data.binop_expr.rhs);
+        if (l->type == ID_EXPR) {
+            _stmt_var_add(sv, stmt, l->node_data.id_expr.name, 0);
+        }
+        if (r->type == ID_EXPR) {
+            _stmt_var_add(sv, stmt, r->node_data.id_expr.name, 0);
+        }
+    }
+}
+
+/*
+ * Adds the variables that the statement at `index`, nested in the one at
+ * `stmt`, may change to those of `stmt`.  An if or while statement's own
+ * have already been found, since it comes before `stmt` in the AST.
+ */
+static void _stmt_vars_add_stmt(struct ast* ast, struct _stmt_vars* sv,
+        uint32_t stmt, uint32_t index) {
+    if (index == AST_NONE) {
+        return;
+    }
+    struct ast_node* node = AST_NODE(ast, index);
+    switch (node->type) {
+    case ASSIGN_STMT:
+        _stmt_var_add(sv, stmt, node->node_data.assign_stmt.lhs, 1);
+        break;
+    case IF_STMT:
+    case WHILE_STMT:
+        for (uint32_t i = sv->offsets[index]; i < sv->offsets[index + 1];
+                i++) {
+            struct _stmt_var v = sv->vars[i];
+            _stmt_var_add(sv, stmt, v.var, v.n_assigns);
+        }
+        break;
+    case BLOCK: {
+        uint32_t* stmts = &ast->stmts[node->node_data.block.stmts];
+        for (uint32_t i = 0; i < node->node_data.block.n_stmts; i++) {
+            _stmt_vars_add_stmt(ast, sv, stmt, stmts[i]);
+        }
+        break;
+    }
+    }
+}
+
+/*
+ * Finds the variables that each if and while statement in an AST may
+ * change: those assigned in it and those compared by its condition and the
+ * conditions of the statements in it.  The AST's nodes come after their
+ * children, so each statement's are put together from those of the ones
+ * nested in it, and it takes time proportional to how many there are.
+ */
+static void _find_stmt_vars(struct ast* ast, struct _stmt_vars* sv) {
+    memset(sv, 0, sizeof(*sv));
+    sv->offsets = malloc((ast->n_nodes + 1) * sizeof(uint32_t));
+    sv->stamps = calloc(ast->n_names, sizeof(uint32_t));
+    sv->slots = malloc(ast->n_names * sizeof(uint32_t));
+    assert(sv->offsets && sv->stamps && sv->slots);
+    sv->offsets[0] = 0;
+    for (uint32_t i = 1; i < ast->n_nodes; i++) {
+        struct ast_node* node = AST_NODE(ast, i);
+        sv->offsets[i] = sv->n_vars;
+        if (node->type == IF_STMT) {
+            _stmt_var_add_cond(ast, sv, i, node->node_data.if_stmt.condition);
+            _stmt_vars_add_stmt(ast, sv, i, node->node_data.if_stmt.if_block);
+            _stmt_vars_add_stmt(ast, sv, i,
+                node->node_data.if_stmt.else_block);
+        } else if (node->type == WHILE_STMT) {
+            _stmt_var_add_cond(ast, sv, i,
+                node->node_data.while_stmt.condition);
+            _stmt_vars_add_stmt(ast, sv, i, node->node_data.while_stmt.block);
+        }
+    }
+    sv->offsets[ast->n_nodes] = sv->n_vars;
+    free(sv->stamps);
+    free(sv->slots);
+}
+
+/*
+ * Adds variable `var` to the frame, unless it's already been added to the
+ * current one, and returns its position in the frame.
+ */
+static uint32_t _frame_add(struct _ranges* rg, uint32_t var) {
+    if (rg->stamps[var] == rg->stamp) {
+        return rg->slots[var];
+    }
+    if (rg->n_frame == rg->frame_capacity) {
+        rg->frame_capacity = rg->frame_capacity ?
+            2 * rg->frame_capacity : 64;
+        rg->frame = realloc(rg->frame,
+            rg->frame_capacity * sizeof(struct _frame_var));
+        assert(rg->frame);
+    }
+    struct _frame_var* fv = &rg->frame[rg->n_frame];
+    memset(fv, 0, sizeof(*fv));
+    fv->var = var;
+    fv->before = rg->vars[var];
+    rg->stamps[var] = rg->stamp;
+    rg->slots[var] = rg->n_frame;
+    return rg->n_frame++;
+}
+
+/*
+ * Starts the analysis of the if or while statement at `index`: pushes each
+ * variable it may change onto the frame, along with its current range and
+ * its number of assignments.  Returns the position of the first one in the
+ * frame.
+ */
+static uint32_t _push_frame(struct _ranges* rg, uint32_t index) {
+    const struct _stmt_vars* sv = rg->stmt_vars;
+    uint32_t start = rg->n_frame;
+    rg->stamp++;
+    for (uint32_t i = sv->offsets[index]; i < sv->offsets[index + 1]; i++) {
+        uint32_t slot = _frame_add(rg, sv->vars[i].var);
+        rg->frame[slot].n_assigns = sv->vars[i].n_assigns;
+    }
+    return start;
+}
+
+static void _range_stmt(struct _ranges* rg, uint32_t index);
+
+/*
+ * Analyzes an if statement.  Each branch starts from the ranges before it,
+ * narrowed by the condition, and the ranges after it are the joins of those
+ * at the ends of whichever branches can get there.
+ */
+static void _range_if(struct _ranges* rg, uint32_t index) {
+    struct _if_stmt_node* stmt = &AST_NODE(rg->ast, index)->node_data.if_stmt;
+    uint32_t vars = _push_frame(rg, index);
+    struct _narrowing narrowing;
+    _range_expr(rg, stmt->condition);
+    _narrow_cond(rg, stmt->condition, &narrowing);
+
+    _narrow(rg, &narrowing, 1);
+    _range_stmt(rg, stmt->if_block);
+    int then_reachable = rg->reachable;
+    for (uint32_t i = vars; i < rg->n_frame; i++) {
+        rg->frame[i].then = rg->vars[rg->frame[i].var];
+        rg->vars[rg->frame[i].var] = rg->frame[i].before;
+    }
+
+    rg->reachable = 1;
+    _narrow(rg, &narrowing, 0);
+    _range_stmt(rg, stmt->else_block);
+    for (uint32_t i = vars; i < rg->n_frame; i++) {
+        struct _frame_var* fv = &rg->frame[i];
+        if (then_reachable && rg->reachable) {
+            rg->vars[fv->var] = _join(fv->then, rg->vars[fv->var]);
+        } else if (then_reachable) {
+            rg->vars[fv->var] = fv->then;
+        }
+    }
+    rg->reachable |= then_reachable;
+    rg->n_frame = vars;
+}
+
+/*
+ * Returns an upper bound on the number of times a loop can run through its
+ * body to the end, given that it only keeps going while `cond` is true
+ * (`holds` = 1) or false (`holds` = 0), or -1 if that doesn't bound it.  It
+ * does if it compares a counter with an integer that the loop doesn't change,
+ * e.g. `i < n`, where the counter is a variable whose only assignment in the
+ * loop is a statement of its body that counts it up by a constant step.
+ * Each time through, the counter is then at least `step` higher, starting
+ * from its current range.
+ */
+static int64_t _trip_bound(struct _ranges* rg, uint32_t cond, int holds) {
+    struct ast_node* node = AST_NODE(rg->ast, cond);
+    if (node->type != BINOP_EXPR || node->op == DIVIDEDBY
+            || _is_arithmetic(node->op)) {
+        return -1;
+    }
+    int op = holds ? node->op : _negate(node->op);
+    uint32_t counter, limit;
+    if (op == LT || op == LTE) {
+        counter = node->node_data.binop_expr.lhs;
+        limit = node->node_data.binop_expr.rhs;
+    } else if (op == GT || op == GTE) {
+        counter = node->node_data.binop_expr.rhs;
+        limit = node->node_data.binop_expr.lhs;
+    } else {
+        return -1;
+    }
+
+    struct ast_node* c = AST_NODE(rg->ast, counter);
+    struct ast_node* l = AST_NODE(rg->ast, limit);
+    if (c->type != ID_EXPR) {
+        return -1;
+    }
+    uint32_t var = c->node_data.id_expr.name;
+    if (rg->stamps[var] != rg->stamp || rg->frame[rg->slots[var]].step <= 0) {
+        return -1;
+    }
+    int64_t step = rg->frame[rg->slots[var]].step;
+
+    int64_t max;
+    if (l->type == INT_EXPR) {
+        max = l->node_data.int_expr.val;
+    } else if (l->type == ID_EXPR) {
+        uint32_t limit_var = l->node_data.id_expr.name;
+        if (rg->stamps[limit_var] == rg->stamp
+                && rg->frame[rg->slots[limit_var]].n_assigns > 0) {
+            return -1;
+        }
+        struct _range r = _read(rg, limit_var);
+        if (r.lo > r.hi || r.lo == INT64_MIN) {
+            return -1;
+        }
+        max = r.hi;
+    } else {
+        return -1;
+    }
+
+    struct _range start = _read(rg, var);
+    if (start.lo > start.hi || start.lo == INT64_MIN) {
+        return -1;
+    }
+    int64_t span = max - (op == LT || op == GT) - start.lo;
+    return span < 0 ? 0 : span / step + 1;
+}
+
+/*
+ * Returns an upper bound on the number of times the while loop at `index`
+ * can run through its body to the end, or -1 if none is found, by its
+ * condition or by an if statement in its body that breaks out of it (see
+ * _trip_bound()).  The loop's variables must have just been pushed.
+ */
+static int64_t _loop_trip_bound(struct _ranges* rg, uint32_t index) {
+    struct _while_stmt_node* stmt =
+        &AST_NODE(rg->ast, index)->node_data.while_stmt;
+    struct ast_node* block = AST_NODE(rg->ast, stmt->block);
+    if (block->type != BLOCK) {
+        return -1;
+    }
+    uint32_t* stmts = &rg->ast->stmts[block->node_data.block.stmts];
+    uint32_t n_stmts = block->node_data.block.n_stmts;
+
+    /*
+     * First find the counters, i.e. the variables assigned only once in the
+     * loop, by a statement of the form `var = var + step` in its body.
+     */
+    for (uint32_t i = 0; i < n_stmts; i++) {
+        struct ast_node* s = AST_NODE(rg->ast, stmts[i]);
+        if (s->type != ASSIGN_STMT) {
+            continue;
+        }
+        uint32_t var = s->node_data.assign_stmt.lhs;
+        struct ast_node* rhs = AST_NODE(rg->ast, s->node_data.assign_stmt.rhs);
+        if (rg->frame[rg->slots[var]].n_assigns != 1
+                || rhs->type != BINOP_EXPR || rhs->op != PLUS) {
+            continue;
+        }
+        struct ast_node* l = AST_NODE(rg->ast, rhs->node_data.binop_expr.lhs);
+        struct ast_node* r = AST_NODE(rg->ast, rhs->node_data.binop_expr.rhs);
+        if (l->type == INT_EXPR) {
+            struct ast_node* t = l;
+            l = r;
+            r = t;
+        }
+        if (l->type == ID_EXPR && l->node_data.id_expr.name == var
+                && r->type == INT_EXPR && r->node_data.int_expr.val > 0) {
+            rg->frame[rg->slots[var]].step = r->node_data.int_expr.val;
+        }
+    }
+
+    int64_t bound = _trip_bound(rg, stmt->condition, 1);
+    for (uint32_t i = 0; i < n_stmts; i++) {
+        struct ast_node* s = AST_NODE(rg->ast, stmts[i]);
+        if (s->type != IF_STMT || s->node_data.if_stmt.else_block != AST_NONE) {
+            continue;
+        }
+        struct ast_node* if_block = AST_NODE(rg->ast,
+            s->node_data.if_stmt.if_block);
+        if (if_block->type != BLOCK) {
+            continue;
+        }
+        uint32_t* if_stmts = &rg->ast->stmts[if_block->node_data.block.stmts];
+        for (uint32_t j = 0; j < if_block->node_data.block.n_stmts; j++) {
+            if (AST_NODE(rg->ast, if_stmts[j])->type == BREAK_STMT) {
+                int64_t trips = _trip_bound(rg, s->node_data.if_stmt.condition,
+                    0);
+                if (trips >= 0 && (bound < 0 || trips < bound)) {
+                    bound = trips;
+                }
+                break;
+            }
+        }
+    }
+    return bound;
+}
+
+/*
+ * Runs once through a while loop, from the ranges at its condition, leaving
+ * those at the end of its body, and what its condition says in `narrowing`.
+ */
+static void _range_iteration(struct _ranges* rg, uint32_t index,
+        uint32_t vars, struct _narrowing* narrowing) {
+    struct _while_stmt_node* stmt =
+        &AST_NODE(rg->ast, index)->node_data.while_stmt;
+    for (uint32_t i = vars; i < rg->n_frame; i++) {
+        rg->vars[rg->frame[i].var] = rg->frame[i].then;
+    }
+    rg->reachable = 1;
+    _range_expr(rg, stmt->condition);
+    _narrow_cond(rg, stmt->condition, narrowing);
+    _narrow(rg, narrowing, 1);
+    _range_stmt(rg, stmt->block);
+}
+
+/*
+ * Analyzes a while loop.  The ranges at its condition start as those before
+ * it, and it's run through, joining them with those at the end of its body,
+ * until they stop growing or, if its trip count is bounded, it's been run
+ * through that many times.  Otherwise, any that still grow are widened to be
+ * unbounded in that direction, which is given a few tries before they're all
+ * made unbounded.  Once they've settled, it's run through once more, this
+ * time recording wide arithmetic, and the ranges after it are the joins of
+ * those where its condition is false and at each break.
+ */
+static void _range_while(struct _ranges* rg, uint32_t index) {
+    uint32_t cond = AST_NODE(rg->ast, index)->node_data.while_stmt.condition;
+    uint32_t lo = _expr_first(rg->ast, cond) - 1;
+
+    /*
+     * Out of budget, a loop nested in one whose ranges are still settling is
+     * skipped.
+     */
+    if (!rg->recording && rg->budget <= 0) {
+        const struct _stmt_vars* sv = rg->stmt_vars;
+        for (uint32_t i = sv->offsets[index]; i < sv->offsets[index + 1];
+                i++) {
+            if (sv->vars[i].n_assigns > 0) {
+                rg->vars[sv->vars[i].var] = _unbounded;
+            }
+        }
+        return;
+    }
+
+    uint32_t vars = _push_frame(rg, index);
+    for (uint32_t i = vars; i < rg->n_frame; i++) {
+        rg->frame[i].then = rg->frame[i].before;
+    }
+    int64_t trips = _loop_trip_bound(rg, index);
+    int exact = trips >= 0 && trips <= rg->budget / (index - lo);
+    int recording = rg->recording;
+    struct _narrowing narrowing;
+    struct _loop loop = {vars, rg->n_frame - vars, 0, rg->loop};
+    rg->loop = &loop;
+    rg->recording = 0;
+
+    for (int64_t round = 0; !exact || round < trips; round++) {
+        _range_iteration(rg, index, vars, &narrowing);
+        int grew = 0;
+        for (uint32_t i = vars; i < rg->n_frame; i++) {
+            struct _frame_var* fv = &rg->frame[i];
+            struct _range next = rg->reachable ?
+                _join(fv->before, rg->vars[fv->var]) : fv->before;
+            grew |= !_within(next, fv->then);
+        }
+
+        for (uint32_t i = vars; i < rg->n_frame; i++) {
+            struct _frame_var* fv = &rg->frame[i];
+            struct _range next = rg->reachable ?
+                _join(fv->before, rg->vars[fv->var]) : fv->before;
+            if (!grew || exact) {
+                fv->then = next;
+            } else if (round + 1 == _RANGE_WIDENINGS) {
+                fv->then = _unbounded;
+            } else if (fv->then.lo > fv->then.hi) {
+                fv->then = next;
+            } else {
+                if (next.lo < fv->then.lo) {
+                    fv->then.lo = INT64_MIN;
+                }
+                if (next.hi > fv->then.hi) {
+                    fv->then.hi = INT64_MAX;
+                }
+            }
+        }
+        if (!grew || (!exact && round + 1 == _RANGE_WIDENINGS)) {
+            break;
+        }
+    }
+
+    rg->recording = recording;
+    for (uint32_t i = vars; i < rg->n_frame; i++) {
+        rg->frame[i].exit = _empty;
+    }
+    _range_iteration(rg, index, vars, &narrowing);
+    rg->loop = loop.outer;
+
+    for (uint32_t i = vars; i < rg->n_frame; i++) {
+        rg->vars[rg->frame[i].var] = rg->frame[i].then;
+    }
+    rg->reachable = 1;
+    _narrow(rg, &narrowing, 0);
+    int exits = rg->reachable;
+    for (uint32_t i = vars; i < rg->n_frame; i++) {
+        struct _frame_var* fv = &rg->frame[i];
+        rg->vars[fv->var] = _join(exits ? rg->vars[fv->var] : _empty,
+            loop.broken ? fv->exit : _empty);
+    }
+    rg->reachable = exits || loop.broken;
+    rg->n_frame = vars;
+}
+
+/*
+ * Analyzes a statement, unless the current point of the program can't be
+ * reached.  As in the code generator, a break outside of any loop does
+ * nothing.
+ */
+static void _range_stmt(struct _ranges* rg, uint32_t index) {
+    if (index == AST_NONE || !rg->reachable) {
+        return;
+    }
+    struct ast_node* node = AST_NODE(rg->ast, index);
+    rg->budget--;
+    switch (node->type) {
+    case ASSIGN_STMT:
+        rg->vars[node->node_data.assign_stmt.lhs] =
+            _range_expr(rg, node->node_data.assign_stmt.rhs);
+        break;
+    case IF_STMT:
+        _range_if(rg, index);
+        break;
+    case WHILE_STMT:
+        _range_while(rg, index);
+        break;
+    case BREAK_STMT:
+        if (rg->loop) {
+            for (uint32_t i = 0; i < rg->loop->n_vars; i++) {
+                struct _frame_var* fv = &rg->frame[rg->loop->vars + i];
+                fv->exit = _join(fv->exit, rg->vars[fv->var]);
+            }
+            rg->loop->broken = 1;
+            rg->reachable = 0;
+        }
+        break;
+    case BLOCK: {
+        uint32_t* stmts = &rg->ast->stmts[node->node_data.block.stmts];
+        for (uint32_t i = 0; i < node->node_data.block.n_stmts; i++) {
+            _range_stmt(rg, stmts[i]);
+        }
+        break;
+    }
+    }
+}
+
+/*
+ * Runs the range analysis over an AST whose variables have the given types,
+ * and whose if and while statements may change those in `sv`, marking the
+ * arithmetic it finds to be wide in `wide_ops`.  Arithmetic already marked
+ * is taken to be wide.
+ */
+static void _find_wide_ops(struct ast* ast, const struct _stmt_vars* sv,
+        const uint8_t* types, uint8_t* wide_ops) {
+    struct _ranges rg;
+    memset(&rg, 0, sizeof(rg));
+    rg.ast = ast;
+    rg.types = types;
+    rg.wide_ops = wide_ops;
+    rg.stmt_vars = sv;
+    rg.vars = malloc(ast->n_names * sizeof(struct _range));
+    rg.stamps = calloc(ast->n_names, sizeof(uint32_t));
+    rg.slots = malloc(ast->n_names * sizeof(uint32_t));
+    assert(rg.vars && rg.stamps && rg.slots);
+    for (uint32_t v = 0; v < ast->n_names; v++) {
+        rg.vars[v] = _empty;
+    }
+    rg.reachable = 1;
+    rg.recording = 1;
+    rg.budget = (int64_t)_RANGE_BUDGET_PER_NODE * ast->n_nodes
+        + _RANGE_BUDGET_BASE;
+
+    _range_stmt(&rg, ast->root);
+
+    free(rg.vars);
+    free(rg.stamps);
+    free(rg.slots);
+    free(rg.frame);
+    free(rg.values);
+}
+
+/*
+ * Infers the type of every variable in an AST, and which of its arithmetic
+ * is wide, storing them in the AST for the code generator.
+ */
+void ast_infer_types(struct ast* ast) {
+    free(ast->types);
+    free(ast->wide_ops);
+    uint8_t* wide_ops = calloc(ast->n_nodes, sizeof(uint8_t));
+    assert(wide_ops);
+    uint8_t* types = _infer_var_types(ast, wide_ops);
+    struct _stmt_vars sv;
+    _find_stmt_vars(ast, &sv);
+
+    /*
+     * Marking arithmetic wide can only make more variables floats, whose
+     * ranges are unbounded, which can only make more arithmetic wide, so
+     * this settles.  If it takes too long, all arithmetic is made wide.
+     */
+    for (int pass = 0; ; pass++) {
+        if (pass == _RANGE_PASSES) {
+            for (uint32_t i = 1; i < ast->n_nodes; i++) {
+                struct ast_node* node = AST_NODE(ast, i);
+                wide_ops[i] = node->type == BINOP_EXPR
+                    && _is_arithmetic(node->op);
+            }
+            free(types);
+            types = _infer_var_types(ast, wide_ops);
+            break;
+        }
+        _find_wide_ops(ast, &sv, types, wide_ops);
+        uint8_t* next = _infer_var_types(ast, wide_ops);
+        int settled = !memcmp(next, types, ast->n_names);
+        free(types);
+        types = next;
+        if (settled) {
+            break;
+        }
+    }
+
+    free(sv.vars);
+    free(sv.offsets);
+    ast->types = types;
+    ast->wide_ops = wide_ops;
+}
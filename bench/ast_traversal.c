@@ -0,0 +1,309 @@
+/*
+ * This is a benchmark comparing traversals of the flat, index-based AST with
+ * traversals of the pointer-based layout it replaced, in which each node was
+ * a type tag plus a pointer to a separately allocated payload.
+ *
+ * It builds the same randomly generated expressions in both layouts, in the
+ * bottom-up order the parser creates them, and then times evaluating every
+ * expression: recursively in both layouts, and with the single linear sweep
+ * over the node array that the code generator uses for the flat AST.
+ *
+ * Usage: ast_traversal [n_nodes]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../ast/ast.h"
+#include "../ast/_ast_internal.h"
+#include "../parser.h"
+
+/*
+ * The default number of nodes to build and the number of leaves in each
+ * generated expression.
+ */
+#define DEFAULT_N_NODES 2000000
+#define LEAVES_PER_EXPR 32
+
+/*
+ * Each traversal is repeated this many times, and the fastest is reported.
+ */
+#define N_RUNS 5
+
+/*****************************************************************************
+ **
+ ** The pointer-based layout
+ **
+ *****************************************************************************/
+
+struct old_id_expr_node {
+    char* id;
+};
+
+struct old_float_expr_node {
+    float val;
+};
+
+struct old_binop_expr_node {
+    int op;
+    struct old_ast_node* lhs;
+    struct old_ast_node* rhs;
+};
+
+struct old_ast_node {
+    int type;
+    union {
+        struct old_id_expr_node* id_expr;
+        struct old_float_expr_node* float_expr;
+        struct old_binop_expr_node* binop_expr;
+    } node_data;
+};
+
+static struct old_ast_node* old_id_expr_node_create(char* id) {
+    struct old_id_expr_node* id_expr_node = malloc(sizeof(struct old_id_expr_node));
+    id_expr_node->id = id;
+    struct old_ast_node* node = malloc(sizeof(struct old_ast_node));
+    node->type = ID_EXPR;
+    node->node_data.id_expr = id_expr_node;
+    return node;
+}
+
+static struct old_ast_node* old_float_expr_node_create(float val) {
+    struct old_float_expr_node* float_expr_node =
+        malloc(sizeof(struct old_float_expr_node));
+    float_expr_node->val = val;
+    struct old_ast_node* node = malloc(sizeof(struct old_ast_node));
+    node->type = FLOAT_EXPR;
+    node->node_data.float_expr = float_expr_node;
+    return node;
+}
+
+static struct old_ast_node* old_binop_expr_node_create(int op,
+        struct old_ast_node* lhs, struct old_ast_node* rhs) {
+    struct old_binop_expr_node* binop_expr_node =
+        malloc(sizeof(struct old_binop_expr_node));
+    binop_expr_node->op = op;
+    binop_expr_node->lhs = lhs;
+    binop_expr_node->rhs = rhs;
+    struct old_ast_node* node = malloc(sizeof(struct old_ast_node));
+    node->type = BINOP_EXPR;
+    node->node_data.binop_expr = binop_expr_node;
+    return node;
+}
+
+static void old_ast_node_free(struct old_ast_node* node) {
+    if (node->type == ID_EXPR) {
+        free(node->node_data.id_expr->id);
+    } else if (node->type == BINOP_EXPR) {
+        old_ast_node_free(node->node_data.binop_expr->lhs);
+        old_ast_node_free(node->node_data.binop_expr->rhs);
+    }
+    free(node->node_data.id_expr);
+    free(node);
+}
+
+/*****************************************************************************
+ **
+ ** Evaluation
+ **
+ *****************************************************************************/
+
+static float apply(int op, float l, float r) {
+    switch (op) {
+        case PLUS:
+            return l + r;
+        case MINUS:
+            return l - r;
+        default:
+            return l * r;
+    }
+}
+
+/*
+ * Identifiers evaluate to a value derived from their text, so each visit
+ * touches the identifier's string just as a symbol lookup would.
+ */
+static float id_value(const char* id) {
+    return (id[1] - '0') * 0.125f;
+}
+
+static float old_eval(struct old_ast_node* node) {
+    switch (node->type) {
+        case ID_EXPR:
+            return id_value(node->node_data.id_expr->id);
+        case FLOAT_EXPR:
+            return node->node_data.float_expr->val;
+        default:
+            return apply(node->node_data.binop_expr->op,
+                old_eval(node->node_data.binop_expr->lhs),
+                old_eval(node->node_data.binop_expr->rhs));
+    }
+}
+
+static float flat_eval(struct ast* ast, uint32_t index) {
+    struct ast_node* node = AST_NODE(ast, index);
+    switch (node->type) {
+        case ID_EXPR:
+            return id_value(AST_NAME(ast, node->node_data.id_expr.name));
+        case FLOAT_EXPR:
+            return node->node_data.float_expr.val;
+        default:
+            return apply(node->op,
+                flat_eval(ast, node->node_data.binop_expr.lhs),
+                flat_eval(ast, node->node_data.binop_expr.rhs));
+    }
+}
+
+/*
+ * Evaluates every node in one pass over the node array.  Children always come
+ * before their parents, so their values are ready when a parent is reached.
+ */
+static void flat_sweep(struct ast* ast, float* values) {
+    for (uint32_t i = 1; i < ast->n_nodes; i++) {
+        struct ast_node* node = AST_NODE(ast, i);
+        switch (node->type) {
+            case ID_EXPR:
+                values[i] = id_value(AST_NAME(ast, node->node_data.id_expr.name));
+                break;
+            case FLOAT_EXPR:
+                values[i] = node->node_data.float_expr.val;
+                break;
+            default:
+                values[i] = apply(node->op,
+                    values[node->node_data.binop_expr.lhs],
+                    values[node->node_data.binop_expr.rhs]);
+                break;
+        }
+    }
+}
+
+/*****************************************************************************
+ **
+ ** Driver
+ **
+ *****************************************************************************/
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+    long n_nodes = argc > 1 ? atol(argv[1]) : DEFAULT_N_NODES;
+    long n_exprs = n_nodes / (2 * LEAVES_PER_EXPR - 1);
+    if (n_exprs < 1) {
+        n_exprs = 1;
+    }
+
+    struct ast* ast = ast_create();
+    uint32_t* flat_roots = malloc(n_exprs * sizeof(uint32_t));
+    struct old_ast_node** old_roots = malloc(n_exprs * sizeof(struct old_ast_node*));
+    uint32_t flat_stack[LEAVES_PER_EXPR];
+    struct old_ast_node* old_stack[LEAVES_PER_EXPR];
+    int ops[] = { PLUS, MINUS, TIMES };
+    char* names[8];
+    uint32_t symbols[8];
+    for (int v = 0; v < 8; v++) {
+        names[v] = malloc(3);
+        snprintf(names[v], 3, "v%d", v);
+        symbols[v] = ast_add_symbol(ast, names[v]);
+    }
+    srand(1);
+
+    /*
+     * Each expression is built like a shift-reduce parser would: leaves are
+     * pushed, and at random points the top two entries are reduced into a
+     * binary operation, until a single root remains.
+     */
+    for (long e = 0; e < n_exprs; e++) {
+        int top = 0, leaves = 0;
+        while (leaves < LEAVES_PER_EXPR || top > 1) {
+            if (leaves < LEAVES_PER_EXPR && (top < 2 || rand() % 2)) {
+                if (rand() % 2) {
+                    int v = rand() % 8;
+                    flat_stack[top] = id_expr_node_create(ast, symbols[v]);
+                    old_stack[top] = old_id_expr_node_create(strdup(names[v]));
+                } else {
+                    float val = (rand() % 16) * 0.0625f;
+                    flat_stack[top] = float_expr_node_create(ast, val);
+                    old_stack[top] = old_float_expr_node_create(val);
+                }
+                top++;
+                leaves++;
+            } else {
+                int op = ops[rand() % 3];
+                top--;
+                flat_stack[top - 1] = binop_expr_node_create(ast, op,
+                    flat_stack[top - 1], flat_stack[top]);
+                old_stack[top - 1] = old_binop_expr_node_create(op,
+                    old_stack[top - 1], old_stack[top]);
+            }
+        }
+        flat_roots[e] = flat_stack[0];
+        old_roots[e] = old_stack[0];
+    }
+
+    struct ast_stats stats;
+    ast_get_stats(ast, &stats);
+    printf("%zu nodes in %ld expressions\n", stats.n_nodes, n_exprs);
+    printf("node size: pointer-based %zu + %zu bytes in 2 heap objects, flat %zu bytes\n",
+        sizeof(struct old_ast_node), sizeof(struct old_binop_expr_node),
+        sizeof(struct ast_node));
+
+    float* values = malloc(ast->n_nodes * sizeof(float));
+    double best_old = 1e30, best_flat = 1e30, best_sweep = 1e30;
+    float sum_old = 0, sum_flat = 0, sum_sweep = 0;
+    for (int run = 0; run < N_RUNS; run++) {
+        double t0 = now();
+        sum_old = 0;
+        for (long e = 0; e < n_exprs; e++) {
+            sum_old += old_eval(old_roots[e]);
+        }
+        double t1 = now();
+        sum_flat = 0;
+        for (long e = 0; e < n_exprs; e++) {
+            sum_flat += flat_eval(ast, flat_roots[e]);
+        }
+        double t2 = now();
+        flat_sweep(ast, values);
+        sum_sweep = 0;
+        for (long e = 0; e < n_exprs; e++) {
+            sum_sweep += values[flat_roots[e]];
+        }
+        double t3 = now();
+
+        best_old = t1 - t0 < best_old ? t1 - t0 : best_old;
+        best_flat = t2 - t1 < best_flat ? t2 - t1 : best_flat;
+        best_sweep = t3 - t2 < best_sweep ? t3 - t2 : best_sweep;
+    }
+
+    if (sum_old != sum_flat || sum_old != sum_sweep) {
+        fprintf(stderr, "Error: traversals disagree (%f, %f, %f)\n",
+            sum_old, sum_flat, sum_sweep);
+        return 1;
+    }
+
+    double ns = 1e9 / stats.n_nodes;
+    printf("recursive walk, pointer-based AST: %6.2f ns/node\n", best_old * ns);
+    printf("recursive walk, flat AST:          %6.2f ns/node (%.2fx)\n",
+        best_flat * ns, best_old / best_flat);
+    printf("linear sweep, flat AST:            %6.2f ns/node (%.2fx)\n",
+        best_sweep * ns, best_old / best_sweep);
+
+    for (long e = 0; e < n_exprs; e++) {
+        old_ast_node_free(old_roots[e]);
+    }
+    for (int v = 0; v < 8; v++) {
+        free(names[v]);
+    }
+    ast_free(ast);
+    free(values);
+    free(flat_roots);
+    free(old_roots);
+    return 0;
+}
@@ -0,0 +1,147 @@
+#!/bin/bash
+#
+# This is a benchmark of how the compiler's own running time scales with the
+# size of its input.  It compiles programs from gen_program (see
+# bench/gen_program.c) of each shape at several sizes, with --time-report,
+# and reports for each the fastest of a few runs: lines and tokens compiled
+# per second, peak memory, and the time spent in each phase.
+#
+# Two things are checked.  Within a run, each shape's compile time should
+# grow linearly with its size, so for each step up in size the growth is
+# reported as an exponent, t2/t1 = (n2/n1)^k, and a k over
+# $BENCH_MAX_EXPONENT is flagged as superlinear.  Across runs, each result is
+# compared with the stored baseline (bench/baseline.tsv), and time per token
+# more than $BENCH_TOLERANCE times the baseline's is flagged as a regression.
+# Times that small are mostly noise, so neither check applies below
+# $BENCH_MIN_MS.  The script exits with status 1 if anything was flagged.
+#
+# Times depend on the machine, so the baseline is only meaningful on the
+# machine it was recorded on; rerun with --update-baseline (`make
+# bench-baseline`) to record a new one.
+#
+# Usage: bench/compile_bench.sh [--update-baseline]
+#
+
+set -o pipefail
+
+COMPILE=${COMPILE:-./compile}
+GEN=${GEN:-./gen_program}
+BENCH_SHAPES=${BENCH_SHAPES:-"straight nested vars chain"}
+BENCH_SIZES=${BENCH_SIZES:-"1000 10000 100000"}
+BENCH_OPT=${BENCH_OPT:--O0}
+BENCH_RUNS=${BENCH_RUNS:-5}
+BENCH_BASELINE=${BENCH_BASELINE:-bench/baseline.tsv}
+BENCH_TOLERANCE=${BENCH_TOLERANCE:-1.5}
+BENCH_MAX_EXPONENT=${BENCH_MAX_EXPONENT:-1.25}
+BENCH_MIN_MS=${BENCH_MIN_MS:-50}
+
+update_baseline=0
+if [ "$1" = "--update-baseline" ]; then
+    update_baseline=1
+elif [ $# -gt 0 ]; then
+    echo "Usage: $0 [--update-baseline]" >&2
+    exit 1
+fi
+
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+
+#
+# Compiles a program $BENCH_RUNS times and prints one tab-separated line from
+# the fastest run's report: the compile time, i.e. the total less the
+# driver's own load and create_compiler phases, the tokens, the peak RSS in
+# KiB, and then "phase=ms" for each phase.
+#
+measure() {
+    local program=$1 run
+    for ((run = 0; run < BENCH_RUNS; run++)); do
+        "$COMPILE" $BENCH_OPT --time-report -i "$program" 2>&1 >/dev/null \
+            || { echo "Error: $COMPILE failed on $program" >&2; return 1; }
+    done | awk '
+        NF == 3 && $3 ~ /%$/ && $1 != "load" && $1 != "create_compiler" {
+            compile += $2
+            phases = phases "\t" $1 "=" $2
+        }
+        $1 == "tokens" { tokens = $2 }
+        # The peak RSS is the last line of each report.
+        $1 == "peak" {
+            if (best == "" || compile < best) {
+                best = compile; best_phases = phases
+                best_tokens = tokens; best_rss = $4
+            }
+            compile = 0; phases = ""
+        }
+        END { printf "%.3f\t%s\t%s%s\n", best, best_tokens, best_rss, best_phases }
+    '
+}
+
+declare -A baseline
+if [ $update_baseline -eq 0 ] && [ -f "$BENCH_BASELINE" ]; then
+    while IFS=$'\t' read -r shape size ms ns_per_token rss; do
+        [[ $shape == \#* ]] && continue
+        baseline[$shape/$size]=$ns_per_token
+    done < "$BENCH_BASELINE"
+fi
+
+if [ $update_baseline -eq 1 ]; then
+    printf "# shape\tsize\tcompile_ms\tns_per_token\tpeak_rss_kib\n" > "$BENCH_BASELINE"
+fi
+
+flagged=0
+printf "%-9s %7s %8s %9s %10s %11s %12s %9s %-16s  %s\n" shape size lines tokens \
+    "time (ms)" "lines/s" "tokens/s" "RSS (KiB)" "vs. base" "scaling / phases (ms)"
+for shape in $BENCH_SHAPES; do
+    prev_size=
+    prev_ms=
+    for size in $BENCH_SIZES; do
+        program=$workdir/$shape-$size.py
+        "$GEN" "$shape" "$size" > "$program" || exit 1
+        lines=$(wc -l < "$program")
+        result=$(measure "$program") || exit 1
+        IFS=$'\t' read -r ms tokens rss phases <<< "$result"
+
+        read -r ns_per_token lines_per_s tokens_per_s <<< "$(awk -v ms="$ms" \
+            -v tokens="$tokens" -v lines="$lines" 'BEGIN {
+                s = ms > 0 ? ms / 1e3 : 1e-9
+                printf "%.1f %.0f %.0f\n", 1e9 * s / tokens, lines / s, tokens / s
+            }')"
+
+        vs_base="-"
+        base=${baseline[$shape/$size]}
+        if [ -n "$base" ]; then
+            vs_base=$(awk -v a="$ns_per_token" -v b="$base" 'BEGIN { printf "%.2fx", a / b }')
+            if awk -v a="$ns_per_token" -v b="$base" -v ms="$ms" -v tol="$BENCH_TOLERANCE" \
+                    -v min="$BENCH_MIN_MS" 'BEGIN { exit !(ms >= min && a > tol * b) }'; then
+                vs_base="$vs_base REGRESSION"
+                flagged=1
+            fi
+        fi
+
+        scaling=
+        if [ -n "$prev_size" ]; then
+            scaling=$(awk -v t1="$prev_ms" -v t2="$ms" -v n1="$prev_size" -v n2="$size" \
+                'BEGIN { printf "k=%.2f", (t1 > 0 && t2 > 0 ? log(t2 / t1) / log(n2 / n1) : 0) }')
+            if awk -v k="${scaling#k=}" -v ms="$ms" -v max="$BENCH_MAX_EXPONENT" \
+                    -v min="$BENCH_MIN_MS" 'BEGIN { exit !(ms >= min && k > max) }'; then
+                scaling="$scaling SUPERLINEAR"
+                flagged=1
+            fi
+        fi
+
+        printf "%-9s %7s %8s %9s %10s %11s %12s %9s %-16s  %s\n" "$shape" "$size" \
+            "$lines" "$tokens" "$ms" "$lines_per_s" "$tokens_per_s" "$rss" \
+            "$vs_base" "${scaling:+$scaling }${phases//$'\t'/ }"
+
+        if [ $update_baseline -eq 1 ]; then
+            printf "%s\t%s\t%s\t%s\t%s\n" "$shape" "$size" "$ms" "$ns_per_token" \
+                "$rss" >> "$BENCH_BASELINE"
+        fi
+        prev_size=$size
+        prev_ms=$ms
+    done
+done
+
+if [ $update_baseline -eq 1 ]; then
+    echo "Baseline written to $BENCH_BASELINE"
+fi
+exit $flagged
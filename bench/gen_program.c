@@ -0,0 +1,147 @@
+/*
+ * This is a generator of synthetic Python programs for measuring how the
+ * compiler scales with the size and shape of its input.  Each shape stresses
+ * a different part of the compiler:
+ *
+ *   straight   N assignments of short expressions, in one long block.
+ *   nested     N statements in ifs and whiles nested as deeply as the scanner
+ *              allows (MAX_DEPTH levels), over and over.
+ *   vars       N assignments, each to a different variable.
+ *   chain      A single assignment whose expression has N operands.
+ *
+ * The program is written to stdout.  Every program terminates, so it can also
+ * be run with --run, and its result doesn't depend on the optimization level.
+ * The same shape, size, and seed always give the same program.
+ *
+ * Usage: gen_program straight|nested|vars|chain N [seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The number of variables the straight, nested, and chain shapes use.
+ */
+#define N_VARS 16
+
+/*
+ * How deeply the nested shape nests its blocks.  The scanner allows at most
+ * 128 levels of indentation.
+ */
+#define MAX_DEPTH 100
+
+/*
+ * Prints the indentation for a line `depth` levels deep.
+ */
+static void indent(int depth) {
+    for (int i = 0; i < depth; i++) {
+        fputs("    ", stdout);
+    }
+}
+
+/*
+ * Prints an expression of a few terms over the first N_VARS variables.  Each
+ * variable is scaled down, so repeated assignments can't overflow.
+ */
+static void print_terms(int n_terms) {
+    static const char* const scales[] = { "0.5", "0.25", "0.125" };
+    for (int i = 0; i < n_terms; i++) {
+        if (i > 0) {
+            fputs(rand() % 2 ? " + " : " - ", stdout);
+        }
+        printf("v%d * %s", rand() % N_VARS, scales[rand() % 3]);
+    }
+}
+
+static void gen_straight(long n) {
+    for (long i = 0; i < n; i++) {
+        printf("v%d = ", rand() % N_VARS);
+        print_terms(2);
+        printf(" + %d\n", rand() % 10);
+    }
+}
+
+/*
+ * Each nest alternates between ifs and whiles, with an assignment at every
+ * level.  Every while runs exactly once: its counter is reset before it, and
+ * it counts to 1.
+ */
+static void gen_nested(long n) {
+    while (n > 0) {
+        int depth = 0;
+        for (; depth < MAX_DEPTH && n > 0; depth++) {
+            indent(depth);
+            printf("v%d = ", rand() % N_VARS);
+            print_terms(2);
+            printf("\n");
+            n--;
+            if (depth % 2 == 0) {
+                indent(depth);
+                printf("if v%d < v%d:\n", rand() % N_VARS, rand() % N_VARS);
+                n--;
+            } else {
+                indent(depth);
+                printf("n%d = 0\n", depth);
+                indent(depth);
+                printf("while n%d < 1:\n", depth);
+                indent(depth + 1);
+                printf("n%d = n%d + 1\n", depth, depth);
+                n -= 3;
+            }
+        }
+        indent(depth);
+        printf("v%d = v%d + 1\n", rand() % N_VARS, rand() % N_VARS);
+        n--;
+    }
+}
+
+static void gen_vars(long n) {
+    printf("x0 = v0 + 1\n");
+    for (long i = 1; i < n; i++) {
+        printf("x%ld = x%ld + %d\n", i, rand() % i, rand() % 10);
+    }
+    printf("v0 = x%ld\n", n > 1 ? n - 1 : 0);
+}
+
+static void gen_chain(long n) {
+    printf("v0 = ");
+    print_terms(n > 0 ? n : 1);
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: %s straight|nested|vars|chain N [seed]\n", argv[0]);
+        return 1;
+    }
+    const char* shape = argv[1];
+    long n = atol(argv[2]);
+    srand(argc > 3 ? atoi(argv[3]) : 1);
+
+    /*
+     * The variables are assigned in a loop, so that to the compiler their
+     * values are unknown and nothing after it can be constant-folded away.
+     */
+    for (int v = 0; v < N_VARS; v++) {
+        printf("v%d = %d\n", v, v);
+    }
+    printf("i = 0\nwhile i < 1:\n    i = i + 1\n");
+    for (int v = 0; v < N_VARS; v++) {
+        printf("    v%d = v%d + 1\n", v, v);
+    }
+    if (!strcmp(shape, "straight")) {
+        gen_straight(n);
+    } else if (!strcmp(shape, "nested")) {
+        gen_nested(n);
+    } else if (!strcmp(shape, "vars")) {
+        gen_vars(n);
+    } else if (!strcmp(shape, "chain")) {
+        gen_chain(n);
+    } else {
+        fprintf(stderr, "Error: unknown shape '%s'\n", shape);
+        return 1;
+    }
+    printf("return_value = v0\n");
+    return 0;
+}
@@ -0,0 +1,359 @@
+/*
+ * This is a benchmark of the code the compiler generates, rather than of the
+ * compiler itself (see compile_bench.sh).  Each program given to it is
+ * compiled at each of the optimization levels asked for, JIT-compiled, and
+ * its target() function called over and over, so the levels can be compared
+ * side by side.
+ *
+ * A single call to target() can take less time than reading the clock, so
+ * calls are timed in batches, sized for each program and level so that a
+ * batch takes at least MIN_BATCH_NS.  After a number of warmup batches, each
+ * sample is the time taken by one batch divided by the calls in it, and the
+ * minimum, median, and 99th percentile of the samples are reported.
+ *
+ * Over all of the samples, the CPU's cycles, instructions, branch misses,
+ * and cache misses in user space are also counted with perf_event_open(),
+ * and reported per call.  A counter that can't be opened, e.g. in a virtual
+ * machine without a PMU, or because of /proc/sys/kernel/perf_event_paranoid,
+ * is reported as "-".
+ *
+ * Usage: run_bench [-n samples] [-w warmup] [-O0|-O1|-O2|-O3|-Os]...
+ *                  [--mcpu CPU] [--mattr FEATURES] program.py...
+ *
+ * Without any optimization levels, all five are compared.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../pycompile.h"
+
+/*
+ * The default numbers of samples and of warmup batches run before them.
+ */
+#define DEFAULT_N_SAMPLES 1000
+#define DEFAULT_N_WARMUP 100
+
+/*
+ * The shortest time a batch of calls may take, in nanoseconds.
+ */
+#define MIN_BATCH_NS 10000
+
+/*****************************************************************************
+ **
+ ** Hardware performance counters
+ **
+ *****************************************************************************/
+
+/*
+ * A hardware event counted with perf_event_open().
+ *
+ * @var name The name reported for the counter.
+ * @var config The event's PERF_COUNT_HW_* value.
+ * @var fd The counter's file descriptor, or -1 if it couldn't be opened.
+ */
+struct counter {
+    const char* name;
+    uint64_t config;
+    int fd;
+};
+
+static struct counter counters[] = {
+    { "cycles", PERF_COUNT_HW_CPU_CYCLES, -1 },
+    { "instructions", PERF_COUNT_HW_INSTRUCTIONS, -1 },
+    { "branch-misses", PERF_COUNT_HW_BRANCH_MISSES, -1 },
+    { "cache-misses", PERF_COUNT_HW_CACHE_MISSES, -1 },
+};
+
+#define N_COUNTERS (sizeof(counters) / sizeof(counters[0]))
+
+/*
+ * Opens each counter for this thread, in user space only, and initially
+ * disabled.  Counters are opened separately rather than as a group, so any
+ * that are available can be used even if others aren't.  If the kernel has
+ * to share the hardware between them, each count is scaled up by the
+ * fraction of the time it was actually running.
+ */
+static void open_counters() {
+    for (size_t i = 0; i < N_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = counters[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        counters[i].fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+static void close_counters() {
+    for (size_t i = 0; i < N_COUNTERS; i++) {
+        if (counters[i].fd >= 0) {
+            close(counters[i].fd);
+        }
+    }
+}
+
+static void start_counters() {
+    for (size_t i = 0; i < N_COUNTERS; i++) {
+        if (counters[i].fd >= 0) {
+            ioctl(counters[i].fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+/*
+ * Stops the counters and sets each entry of `counts` to a counter's count,
+ * or to -1 if it isn't available.
+ */
+static void stop_counters(double* counts) {
+    for (size_t i = 0; i < N_COUNTERS; i++) {
+        counts[i] = -1;
+        if (counters[i].fd >= 0) {
+            ioctl(counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (size_t i = 0; i < N_COUNTERS; i++) {
+        uint64_t values[3];     /* the count, time enabled, and time running */
+        if (counters[i].fd >= 0 && read(counters[i].fd, values, sizeof(values)) == sizeof(values)
+                && values[2] > 0) {
+            counts[i] = (double)values[0] * values[1] / values[2];
+        }
+    }
+}
+
+/*****************************************************************************
+ **
+ ** Driver
+ **
+ *****************************************************************************/
+
+/*
+ * The result of benchmarking a program at one optimization level.
+ *
+ * @var value The value returned by target().
+ * @var batch The number of calls timed together in each sample.
+ * @var min, median, p99 Statistics of the samples, in nanoseconds per call.
+ * @var counts Each counter's count per call, or -1 if it isn't available.
+ */
+struct result {
+    float value;
+    long batch;
+    double min, median, p99;
+    double counts[N_COUNTERS];
+};
+
+/*
+ * Results are accumulated here, so the calls can't be optimized away.
+ */
+static volatile float sink;
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Returns the time taken by a batch of calls to `target`, in nanoseconds.
+ */
+static double time_batch(pycompile_entry target, long batch) {
+    float sum = 0;
+    double t0 = now_ns();
+    for (long i = 0; i < batch; i++) {
+        sum += target();
+    }
+    double t1 = now_ns();
+    sink = sum;
+    return t1 - t0;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Sizes the batches for `target`, runs the warmup batches, and then takes
+ * the samples, counting events over all of them.
+ */
+static void measure(pycompile_entry target, int n_samples, int n_warmup,
+        struct result* result) {
+    result->value = target();
+    result->batch = 1;
+    while (result->batch < (1L << 30) && time_batch(target, result->batch) < MIN_BATCH_NS) {
+        result->batch *= 2;
+    }
+    for (int i = 0; i < n_warmup; i++) {
+        time_batch(target, result->batch);
+    }
+
+    double* samples = malloc(n_samples * sizeof(double));
+    start_counters();
+    for (int i = 0; i < n_samples; i++) {
+        samples[i] = time_batch(target, result->batch) / result->batch;
+    }
+    stop_counters(result->counts);
+    for (size_t i = 0; i < N_COUNTERS; i++) {
+        if (result->counts[i] >= 0) {
+            result->counts[i] /= (double)n_samples * result->batch;
+        }
+    }
+
+    qsort(samples, n_samples, sizeof(double), compare_doubles);
+    result->min = samples[0];
+    result->median = samples[n_samples / 2];
+    result->p99 = samples[(n_samples * 99L) / 100];
+    free(samples);
+}
+
+/*
+ * Reads a whole file into memory.  Returns NULL if it can't be read.
+ */
+static char* read_file(const char* path, size_t* len) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    size_t capacity = 4096;
+    char* data = malloc(capacity);
+    *len = 0;
+    size_t n;
+    while ((n = fread(data + *len, 1, capacity - *len, f)) > 0) {
+        *len += n;
+        if (*len == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+    }
+    fclose(f);
+    return data;
+}
+
+/*
+ * The optimization levels' values are the indices of their flags in main().
+ */
+typedef char level_check[PYCOMPILE_O0 == 0 && PYCOMPILE_OS == 4 ? 1 : -1];
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-n samples] [-w warmup] [-O0|-O1|-O2|-O3|-Os]... [--mcpu CPU] [--mattr FEATURES] program.py...\n", prog);
+}
+
+int main(int argc, char** argv) {
+    static const char* const level_flags[] = { "-O0", "-O1", "-O2", "-O3", "-Os" };
+    int levels[5], n_levels = 0;
+    int n_samples = DEFAULT_N_SAMPLES, n_warmup = DEFAULT_N_WARMUP;
+    const char* cpu = NULL;
+    const char* features = NULL;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        int level = -1;
+        for (int l = 0; l < 5; l++) {
+            if (!strcmp(argv[arg], level_flags[l])) {
+                level = l;
+            }
+        }
+        if (level >= 0) {
+            if (n_levels < 5) {
+                levels[n_levels++] = level;
+            }
+        } else if (!strcmp(argv[arg], "-n") && arg + 1 < argc) {
+            n_samples = atoi(argv[++arg]);
+        } else if (!strcmp(argv[arg], "-w") && arg + 1 < argc) {
+            n_warmup = atoi(argv[++arg]);
+        } else if (!strcmp(argv[arg], "--mcpu") && arg + 1 < argc) {
+            cpu = argv[++arg];
+        } else if (!strcmp(argv[arg], "--mattr") && arg + 1 < argc) {
+            features = argv[++arg];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (arg == argc || n_samples < 1 || n_warmup < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (n_levels == 0) {
+        for (; n_levels < 5; n_levels++) {
+            levels[n_levels] = n_levels;
+        }
+    }
+
+    open_counters();
+    int status = 0;
+    for (; arg < argc; arg++) {
+        size_t len;
+        char* source = read_file(argv[arg], &len);
+        if (!source) {
+            fprintf(stderr, "Error: could not read %s\n", argv[arg]);
+            status = 1;
+            continue;
+        }
+
+        printf("%s: %d samples after %d warmup batches, times in ns/call, counters per call\n",
+            argv[arg], n_samples, n_warmup);
+        printf("%-6s %12s %9s %10s %10s %10s %8s", "level", "result", "batch",
+            "min", "median", "p99", "speedup");
+        for (size_t i = 0; i < N_COUNTERS; i++) {
+            printf(" %13s", counters[i].name);
+        }
+        printf("\n");
+
+        double base_median = 0;
+        for (int l = 0; l < n_levels; l++) {
+            struct pycompile_options options = { levels[l], 0, cpu, features };
+            struct pycompiler* compiler = pycompiler_create(&options);
+            pycompile_entry target = NULL;
+            if (!pycompile(compiler, source, len, NULL)) {
+                target = pycompile_jit(compiler);
+            }
+            if (!target) {
+                fprintf(stderr, "Error: could not compile %s at %s\n", argv[arg],
+                    level_flags[levels[l]]);
+                pycompiler_free(compiler);
+                status = 1;
+                break;
+            }
+
+            struct result result;
+            measure(target, n_samples, n_warmup, &result);
+            if (l == 0) {
+                base_median = result.median;
+            }
+            printf("%-6s %12.3f %9ld %10.2f %10.2f %10.2f %7.2fx", level_flags[levels[l]],
+                result.value, result.batch, result.min, result.median, result.p99,
+                base_median / result.median);
+            for (size_t i = 0; i < N_COUNTERS; i++) {
+                if (result.counts[i] >= 0) {
+                    printf(" %13.1f", result.counts[i]);
+                } else {
+                    printf(" %13s", "-");
+                }
+            }
+            printf("\n");
+            fflush(stdout);
+            pycompiler_free(compiler);
+        }
+        printf("\n");
+        free(source);
+    }
+    close_counters();
+    return status;
+}
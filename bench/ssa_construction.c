@@ -0,0 +1,228 @@
+/*
+ * This is a benchmark measuring what building SSA form directly in the code
+ * generator saves over the alloca-based IR it replaced, in which every
+ * variable lived in a stack slot that LLVM's SROA/mem2reg passes then had to
+ * promote to registers.
+ *
+ * It compiles a randomly generated program of nested ifs and loops at -O0,
+ * which gives the register-form IR the code generator now produces directly.
+ * The alloca-based form is reconstructed from that by LLVM's reg2mem pass,
+ * which demotes every value that lives across blocks back to a stack slot.
+ * That gives a slot per value rather than per variable, but the same kind
+ * of loads and stores for the passes to remove.  Then it times, on each
+ * form, the promotion to registers alone and the whole -O2 pipeline, which
+ * begins with it.
+ *
+ * Usage: ssa_construction [n_stmts]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <llvm-c/Core.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+
+#include "../pycompile.h"
+
+/*
+ * The default number of statements to generate, and the number of variables
+ * they use.
+ */
+#define DEFAULT_N_STMTS 2000
+#define N_VARS 16
+
+/*
+ * Each measurement is repeated this many times, and the fastest is reported.
+ */
+#define N_RUNS 5
+
+/*****************************************************************************
+ **
+ ** The program generator
+ **
+ *****************************************************************************/
+
+/*
+ * A growing buffer of generated source, which stays null-terminated.
+ */
+struct source {
+    char* text;
+    size_t len;
+    size_t capacity;
+    int n_loops;
+};
+
+/*
+ * Appends a line to the source, indented by `indent` spaces.
+ */
+static void append(struct source* src, int indent, const char* fmt, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+
+    if (src->len + indent + n + 2 > src->capacity) {
+        src->capacity = 2 * (src->len + indent + n + 2);
+        src->text = realloc(src->text, src->capacity);
+    }
+    memset(src->text + src->len, ' ', indent);
+    memcpy(src->text + src->len + indent, line, n);
+    src->len += indent + n;
+    src->text[src->len++] = '\n';
+    src->text[src->len] = '\0';
+}
+
+/*
+ * Generates a block of `n` statements at the given nesting depth, or fewer
+ * once `n_stmts` statements have been generated in total, though never an
+ * empty block.  Every loop counts up to a small bound, so the program
+ * terminates.
+ */
+static void gen_block(struct source* src, int depth, long* n_stmts, int n) {
+    for (int i = 0; i < n && (i == 0 || *n_stmts > 0); i++) {
+        int a = rand() % N_VARS, b = rand() % N_VARS, c = rand() % N_VARS;
+        int kind = depth < 4 && *n_stmts > 0 ? rand() % 8 : 0;
+        (*n_stmts)--;
+        if (kind == 1) {
+            append(src, 4 * depth, "if v%d < v%d:", a, b);
+            gen_block(src, depth + 1, n_stmts, 1 + rand() % 4);
+            append(src, 4 * depth, "else:");
+            gen_block(src, depth + 1, n_stmts, 1 + rand() % 4);
+        } else if (kind == 2) {
+            int loop = src->n_loops++;
+            append(src, 4 * depth, "n%d = 0", loop);
+            append(src, 4 * depth, "while n%d < %d:", loop, 1 + rand() % 4);
+            append(src, 4 * (depth + 1), "n%d = n%d + 1", loop, loop);
+            gen_block(src, depth + 1, n_stmts, 1 + rand() % 4);
+            if (rand() % 2) {
+                append(src, 4 * (depth + 1), "if v%d > %d:", c, rand() % 100);
+                append(src, 4 * (depth + 2), "break");
+            }
+        } else {
+            append(src, 4 * depth, "v%d = v%d * 0.5 + v%d - %d", a, b, c, rand() % 10);
+        }
+    }
+}
+
+/*****************************************************************************
+ **
+ ** Driver
+ **
+ *****************************************************************************/
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Counts the instructions in a module with the given opcode.
+ */
+static long count_instructions(LLVMModuleRef module, LLVMOpcode opcode) {
+    long n = 0;
+    for (LLVMValueRef f = LLVMGetFirstFunction(module); f; f = LLVMGetNextFunction(f)) {
+        for (LLVMBasicBlockRef bb = LLVMGetFirstBasicBlock(f); bb; bb = LLVMGetNextBasicBlock(bb)) {
+            for (LLVMValueRef inst = LLVMGetFirstInstruction(bb); inst; inst = LLVMGetNextInstruction(inst)) {
+                n += LLVMGetInstructionOpcode(inst) == opcode;
+            }
+        }
+    }
+    return n;
+}
+
+/*
+ * Runs a pass pipeline over a module, exiting on failure.
+ */
+static void run_passes(LLVMModuleRef module, const char* pipeline) {
+    LLVMPassBuilderOptionsRef options = LLVMCreatePassBuilderOptions();
+    LLVMErrorRef err = LLVMRunPasses(module, pipeline, NULL, options);
+    LLVMDisposePassBuilderOptions(options);
+    if (err) {
+        char* msg = LLVMGetErrorMessage(err);
+        fprintf(stderr, "Error: %s: %s\n", pipeline, msg);
+        LLVMDisposeErrorMessage(msg);
+        exit(1);
+    }
+}
+
+/*
+ * Returns the fastest time taken to run a pass pipeline over a fresh copy of
+ * a module.
+ */
+static double time_passes(LLVMModuleRef module, const char* pipeline) {
+    double best = 1e30;
+    for (int run = 0; run < N_RUNS; run++) {
+        LLVMModuleRef copy = LLVMCloneModule(module);
+        double t0 = now();
+        run_passes(copy, pipeline);
+        double t1 = now();
+        LLVMDisposeModule(copy);
+        best = t1 - t0 < best ? t1 - t0 : best;
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    long n_stmts = argc > 1 ? atol(argv[1]) : DEFAULT_N_STMTS;
+    struct source src = { NULL, 0, 0, 0 };
+    srand(1);
+    for (int v = 0; v < N_VARS; v++) {
+        append(&src, 0, "v%d = %d", v, v);
+    }
+    long remaining = n_stmts;
+    while (remaining > 0) {
+        gen_block(&src, 0, &remaining, 1);
+    }
+    append(&src, 0, "return_value = v0");
+
+    /*
+     * Compile at -O0, i.e. with no optimization passes, so the time is that
+     * of parsing and code generation alone.
+     */
+    struct pycompile_options options = { PYCOMPILE_O0, 0 };
+    struct pycompiler* compiler = pycompiler_create(&options);
+    double best_compile = 1e30;
+    for (int run = 0; run < N_RUNS; run++) {
+        double t0 = now();
+        if (pycompile(compiler, src.text, src.len, NULL)) {
+            fprintf(stderr, "Error: generated program didn't compile\n");
+            return 1;
+        }
+        double t1 = now();
+        best_compile = t1 - t0 < best_compile ? t1 - t0 : best_compile;
+    }
+    LLVMModuleRef ssa = pycompile_take_module(compiler);
+    LLVMModuleRef allocas = LLVMCloneModule(ssa);
+    run_passes(allocas, "reg2mem");
+
+    printf("%ld statements, %zu bytes of source, compiled at -O0 in %.2f ms\n",
+        n_stmts, src.len, best_compile * 1e3);
+    printf("SSA form:    %6ld phis, %6ld allocas, %6ld loads, %6ld stores\n",
+        count_instructions(ssa, LLVMPHI), count_instructions(ssa, LLVMAlloca),
+        count_instructions(ssa, LLVMLoad), count_instructions(ssa, LLVMStore));
+    printf("alloca form: %6ld phis, %6ld allocas, %6ld loads, %6ld stores\n",
+        count_instructions(allocas, LLVMPHI), count_instructions(allocas, LLVMAlloca),
+        count_instructions(allocas, LLVMLoad), count_instructions(allocas, LLVMStore));
+
+    const char* pipelines[] = { "sroa,mem2reg", "default<O2>" };
+    for (int p = 0; p < 2; p++) {
+        double t_allocas = time_passes(allocas, pipelines[p]);
+        double t_ssa = time_passes(ssa, pipelines[p]);
+        printf("%-12s alloca form %8.2f ms, SSA form %8.2f ms, saving %8.2f ms (%.2fx)\n",
+            pipelines[p], t_allocas * 1e3, t_ssa * 1e3, (t_allocas - t_ssa) * 1e3,
+            t_allocas / t_ssa);
+    }
+
+    LLVMDisposeModule(ssa);
+    LLVMDisposeModule(allocas);
+    pycompiler_free(compiler);
+    free(src.text);
+    return 0;
+}
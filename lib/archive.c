@@ -0,0 +1,206 @@
+/*
+ * This file contains the implementation of a simple writer for static
+ * libraries in the GNU `ar` format, including the symbol index that linkers
+ * need to resolve symbols from an archive without running `ranlib`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "archive.h"
+
+/*
+ * Magic string at the start of every archive and the size of the fixed
+ * header preceding each member.
+ */
+#define AR_MAGIC "!<arch>\n"
+#define AR_HEADER_SIZE 60
+
+/*
+ * This structure is used to represent a single member of an archive.
+ */
+struct member {
+  char* name;
+  char* symbol;
+  char* data;
+  size_t size;
+};
+
+/*
+ * This structure is used to represent the archive itself, stored as a
+ * dynamic array of members.
+ */
+struct archive {
+  struct member* members;
+  int num_members;
+  int capacity;
+};
+
+
+/*
+ * Create a new, empty archive.
+ */
+struct archive* archive_create() {
+  struct archive* archive = malloc(sizeof(struct archive));
+  assert(archive);
+  archive->members = NULL;
+  archive->num_members = 0;
+  archive->capacity = 0;
+  return archive;
+}
+
+
+/*
+ * Free the memory associated with an archive, including the data of all of
+ * its members.
+ */
+void archive_free(struct archive* archive) {
+  assert(archive);
+  for (int i = 0; i < archive->num_members; i++) {
+    free(archive->members[i].name);
+    free(archive->members[i].symbol);
+    free(archive->members[i].data);
+  }
+  free(archive->members);
+  free(archive);
+}
+
+
+/*
+ * Helper function to duplicate a string into newly allocated memory.
+ */
+static char* _strdup(const char* str) {
+  int l = strlen(str);
+  char* copy = malloc((l + 1) * sizeof(char));
+  strncpy(copy, str, l + 1);
+  return copy;
+}
+
+
+/*
+ * Adds a member to the end of an archive.  The archive takes ownership of
+ * `data`.
+ */
+void archive_add_member(struct archive* archive, const char* name,
+    const char* symbol, char* data, size_t size) {
+  assert(archive);
+  assert(name);
+  assert(symbol);
+
+  if (archive->num_members == archive->capacity) {
+    archive->capacity = archive->capacity ? archive->capacity * 2 : 16;
+    archive->members = realloc(archive->members,
+      archive->capacity * sizeof(struct member));
+    assert(archive->members);
+  }
+
+  struct member* member = &archive->members[archive->num_members++];
+  member->name = _strdup(name);
+  member->symbol = _strdup(symbol);
+  member->data = data;
+  member->size = size;
+}
+
+
+/*
+ * Writes a member header.  `name` is written verbatim into the 16-byte name
+ * field, so it must already be in GNU form (e.g. "/", "//", or "/123").
+ */
+static void _write_header(FILE* f, const char* name, size_t size) {
+  fprintf(f, "%-16s%-12d%-6d%-6d%-8o%-10zu`\n", name, 0, 0, 0, 0644, size);
+}
+
+
+/*
+ * Writes a 32-bit big-endian integer, as used by the symbol index.
+ */
+static void _write_be32(FILE* f, unsigned int val) {
+  unsigned char bytes[4] = {
+    (val >> 24) & 0xff, (val >> 16) & 0xff, (val >> 8) & 0xff, val & 0xff
+  };
+  fwrite(bytes, 1, 4, f);
+}
+
+
+/*
+ * Writes an archive to the file at `path`.  The layout is the global magic
+ * string, then the symbol index member ("/"), then the long file name table
+ * ("//"), then each member in the order it was added.  Member names are
+ * always stored in the long name table, so they may be of any length.
+ */
+int archive_write(struct archive* archive, const char* path) {
+  assert(archive);
+  assert(path);
+
+  /*
+   * Compute the sizes of the symbol index and the long name table.  Member
+   * data is padded to an even number of bytes.
+   */
+  size_t symtab_size = 4 + 4 * archive->num_members;
+  size_t names_size = 0;
+  for (int i = 0; i < archive->num_members; i++) {
+    symtab_size += strlen(archive->members[i].symbol) + 1;
+    names_size += strlen(archive->members[i].name) + 2;
+  }
+  size_t symtab_padded = symtab_size + (symtab_size & 1);
+  size_t names_padded = names_size + (names_size & 1);
+
+  FILE* f = fopen(path, "wb");
+  if (!f) {
+    return 1;
+  }
+  fputs(AR_MAGIC, f);
+
+  /*
+   * Symbol index: a count, the file offset of each member's header, and the
+   * symbol names.
+   */
+  _write_header(f, "/", symtab_size);
+  _write_be32(f, archive->num_members);
+  size_t offset = strlen(AR_MAGIC) + 2 * AR_HEADER_SIZE + symtab_padded
+    + names_padded;
+  for (int i = 0; i < archive->num_members; i++) {
+    _write_be32(f, offset);
+    offset += AR_HEADER_SIZE + archive->members[i].size
+      + (archive->members[i].size & 1);
+  }
+  for (int i = 0; i < archive->num_members; i++) {
+    fwrite(archive->members[i].symbol, 1,
+      strlen(archive->members[i].symbol) + 1, f);
+  }
+  if (symtab_size & 1) {
+    fputc('\n', f);
+  }
+
+  /*
+   * Long name table: each name is terminated by "/\n".
+   */
+  _write_header(f, "//", names_size);
+  for (int i = 0; i < archive->num_members; i++) {
+    fprintf(f, "%s/\n", archive->members[i].name);
+  }
+  if (names_size & 1) {
+    fputc('\n', f);
+  }
+
+  /*
+   * Members, each named by its offset into the long name table.
+   */
+  size_t name_offset = 0;
+  for (int i = 0; i < archive->num_members; i++) {
+    struct member* member = &archive->members[i];
+    char name_field[17];
+    snprintf(name_field, sizeof(name_field), "/%zu", name_offset);
+    name_offset += strlen(member->name) + 2;
+
+    _write_header(f, name_field, member->size);
+    fwrite(member->data, 1, member->size, f);
+    if (member->size & 1) {
+      fputc('\n', f);
+    }
+  }
+
+  return fclose(f) ? 1 : 0;
+}
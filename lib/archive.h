@@ -0,0 +1,45 @@
+/*
+ * This file contains the declarations for a simple writer for static
+ * libraries in the GNU `ar` format.  See archive.c for implementation details.
+ */
+
+#ifndef __ARCHIVE_H
+#define __ARCHIVE_H
+
+#include <stddef.h>
+
+/*
+ * Structure used to represent an archive being built in memory.
+ */
+struct archive;
+
+/*
+ * Create a new, empty archive.
+ */
+struct archive* archive_create();
+
+/*
+ * Free the memory associated with an archive, including the data of all of
+ * its members.
+ */
+void archive_free(struct archive* archive);
+
+/*
+ * Adds a member to the end of an archive.  `name` is the member's file name
+ * and `symbol` is the single global symbol it defines, which is recorded in
+ * the archive's symbol index so linkers can find it.  The archive takes
+ * ownership of `data`, which must have been allocated with malloc().  The
+ * name and symbol strings are copied.
+ */
+void archive_add_member(struct archive* archive, const char* name,
+  const char* symbol, char* data, size_t size);
+
+/*
+ * Writes an archive to the file at `path`.  The output depends only on the
+ * members added, in order (timestamps and owners are zeroed), so identical
+ * inputs always produce identical archives.  Returns 0 on success or nonzero
+ * if the file could not be written.
+ */
+int archive_write(struct archive* archive, const char* path);
+
+#endif
@@ -0,0 +1,155 @@
+/*
+ * This file contains the implementation of a simple arena (bump) allocator.
+ * An arena is a linked list of chunks.  Allocations are served from the
+ * current chunk by advancing an offset, and when it runs out, a new chunk is
+ * added to the front of the list.  Chunks grow geometrically up to a cap, so
+ * large inputs need few heap allocations while small ones stay cheap.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "arena.h"
+
+/*
+ * The size of the first chunk in an arena and the size beyond which chunks
+ * stop growing.  Objects too big for a regular chunk get a chunk of their own.
+ */
+#define INITIAL_CHUNK_SIZE (16 * 1024)
+#define MAX_CHUNK_SIZE (1024 * 1024)
+
+/*
+ * The alignment of every object handed out by an arena: that of the most
+ * strictly aligned basic type.
+ */
+#define ARENA_ALIGN sizeof(union { long double d; long long l; void* p; })
+
+/*
+ * This structure is used to represent one chunk of an arena's memory.  The
+ * usable memory follows the header, starting at `data`.
+ */
+struct chunk {
+  struct chunk* next;
+  size_t size;
+  size_t used;
+  union {
+    long double d;
+    long long l;
+    void* p;
+  } data[];
+};
+
+
+/*
+ * This structure is used to represent the arena itself.  `chunks` is the
+ * chunk currently being allocated from, followed by all older chunks.
+ */
+struct arena {
+  struct chunk* chunks;
+  size_t next_chunk_size;
+  struct arena_stats stats;
+};
+
+
+/*
+ * Create a new, empty arena.
+ */
+struct arena* arena_create() {
+  struct arena* arena = malloc(sizeof(struct arena));
+  assert(arena);
+  arena->chunks = NULL;
+  arena->next_chunk_size = INITIAL_CHUNK_SIZE;
+  memset(&arena->stats, 0, sizeof(struct arena_stats));
+  return arena;
+}
+
+
+/*
+ * Free an arena along with all of its chunks.
+ */
+void arena_free(struct arena* arena) {
+  if (!arena) {
+    return;
+  }
+  struct chunk* cur = arena->chunks;
+  while (cur != NULL) {
+    struct chunk* next = cur->next;
+    free(cur);
+    cur = next;
+  }
+  free(arena);
+}
+
+
+/*
+ * Helper function to add a new chunk of at least `min_size` usable bytes to
+ * the front of an arena's chunk list.
+ */
+static void _arena_add_chunk(struct arena* arena, size_t min_size) {
+  size_t size = arena->next_chunk_size;
+  if (size < min_size) {
+    size = min_size;
+  } else if (arena->next_chunk_size < MAX_CHUNK_SIZE) {
+    arena->next_chunk_size *= 2;
+  }
+
+  struct chunk* chunk = malloc(sizeof(struct chunk) + size);
+  assert(chunk);
+  chunk->size = size;
+  chunk->used = 0;
+  chunk->next = arena->chunks;
+  arena->chunks = chunk;
+
+  arena->stats.n_chunks++;
+  arena->stats.bytes_reserved += size;
+}
+
+
+/*
+ * Allocates memory from an arena, adding a new chunk if the current one is
+ * too full.
+ */
+void* arena_alloc(struct arena* arena, size_t size) {
+  assert(arena);
+
+  /*
+   * Round the size up so the next object is also aligned.
+   */
+  size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+  if (size == 0) {
+    size = ARENA_ALIGN;
+  }
+
+  struct chunk* chunk = arena->chunks;
+  if (!chunk || chunk->size - chunk->used < size) {
+    _arena_add_chunk(arena, size);
+    chunk = arena->chunks;
+  }
+
+  void* ptr = (char*)chunk->data + chunk->used;
+  chunk->used += size;
+
+  arena->stats.n_allocs++;
+  arena->stats.bytes_used += size;
+  return ptr;
+}
+
+
+/*
+ * Copies a string into an arena.
+ */
+char* arena_strdup(struct arena* arena, const char* str) {
+  size_t len = strlen(str);
+  char* copy = arena_alloc(arena, len + 1);
+  memcpy(copy, str, len + 1);
+  return copy;
+}
+
+
+/*
+ * Reports an arena's usage statistics.
+ */
+void arena_get_stats(struct arena* arena, struct arena_stats* stats) {
+  *stats = arena->stats;
+}
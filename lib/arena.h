@@ -0,0 +1,63 @@
+/*
+ * This file contains the declarations for a simple arena (bump) allocator.
+ * Objects are carved out of large chunks of memory and are never freed
+ * individually; instead, everything allocated from an arena is released at
+ * once when the arena is freed.  See arena.c for implementation details.
+ */
+
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Structure used to represent an arena.
+ */
+struct arena;
+
+/*
+ * Structure reporting how an arena has been used.
+ *
+ * @var n_allocs The number of objects allocated from the arena, i.e. the
+ *   number of heap allocations the arena has replaced.
+ * @var n_chunks The number of heap allocations actually made by the arena.
+ * @var bytes_used The number of bytes handed out to objects, including
+ *   alignment padding.
+ * @var bytes_reserved The total size of the arena's chunks.
+ */
+struct arena_stats {
+  size_t n_allocs;
+  size_t n_chunks;
+  size_t bytes_used;
+  size_t bytes_reserved;
+};
+
+/*
+ * Create a new, empty arena.  No memory is reserved until the first
+ * allocation.
+ */
+struct arena* arena_create();
+
+/*
+ * Free an arena along with every object allocated from it.
+ */
+void arena_free(struct arena* arena);
+
+/*
+ * Allocates `size` bytes from an arena.  The memory is suitably aligned for
+ * any type and is not initialized.  It remains valid until the arena is
+ * freed.
+ */
+void* arena_alloc(struct arena* arena, size_t size);
+
+/*
+ * Copies a null-terminated string into an arena and returns the copy.
+ */
+char* arena_strdup(struct arena* arena, const char* str);
+
+/*
+ * Fills `stats` with usage statistics for an arena.
+ */
+void arena_get_stats(struct arena* arena, struct arena_stats* stats);
+
+#endif
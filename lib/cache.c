@@ -0,0 +1,445 @@
+/*
+ * This file contains the implementation of a content-addressed cache of
+ * compiler outputs on disk.  Each output is a file named after its key and
+ * kind, e.g. `<key>.o`, directly in the cache's directory, alongside a file
+ * named `stats` holding the counts of hits, misses, and evictions.
+ *
+ * Several processes may use the same cache at once.  A file is stored by
+ * writing it under a temporary name and renaming it into place, so no process
+ * ever sees a partly written one, and the last of two processes storing the
+ * same key simply wins.  The counts in `stats` are updated under a lock on
+ * that file.
+ *
+ * A file's modification time records when it was last used, so the least
+ * recently used files are the ones evicted when the cache grows past its
+ * size limit.  That's checked by listing the directory each time a file is
+ * stored, which is cheap next to the compilation that produced the file.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "strutils.h"
+
+/*
+ * The name of the file holding the cache's statistics, and the prefix of the
+ * temporary names files are written under before they're renamed into place.
+ */
+#define STATS_FILE "stats"
+#define TMP_PREFIX "tmp."
+
+/*
+ * This structure is used to represent an open cache.
+ *
+ * @var dir The path of the cache's directory.
+ * @var max_bytes The most the files in the cache may take up, or 0 for no
+ *   limit.
+ * @var n_tmp The number of temporary files this process has created, used to
+ *   give each a unique name.
+ */
+struct cache {
+  char* dir;
+  long long max_bytes;
+  unsigned n_tmp;
+};
+
+/*
+ * This structure describes one file in the cache, for eviction.
+ */
+struct cache_file {
+  char* name;
+  struct timespec mtime;
+  long long size;
+};
+
+
+struct cache* cache_open(const char* dir, long long max_bytes) {
+  if (mkdir(dir, 0777) && errno != EEXIST) {
+    return NULL;
+  }
+  struct stat st;
+  if (stat(dir, &st) || !S_ISDIR(st.st_mode)) {
+    return NULL;
+  }
+  struct cache* cache = malloc(sizeof(struct cache));
+  cache->dir = concat_strings(1, dir);
+  cache->max_bytes = max_bytes > 0 ? max_bytes : 0;
+  cache->n_tmp = 0;
+  return cache;
+}
+
+
+void cache_close(struct cache* cache) {
+  if (cache) {
+    free(cache->dir);
+    free(cache);
+  }
+}
+
+
+/*
+ * Returns the path of the file stored under a key with an extension.  Memory
+ * is allocated for the path, which must be freed by the caller.
+ */
+static char* entry_path(struct cache* cache, const char* key, const char* ext) {
+  return concat_strings(5, cache->dir, "/", key, ".", ext);
+}
+
+
+/*
+ * Returns a new temporary path in the directory `dir`, unique to this process
+ * and call, so a file written there can be renamed to another path in the
+ * same directory.  Memory is allocated for the path, which must be freed by
+ * the caller.
+ */
+static char* tmp_path(struct cache* cache, const char* dir) {
+  char suffix[48];
+  snprintf(suffix, sizeof(suffix), "%ld.%u", (long)getpid(), cache->n_tmp++);
+  return concat_strings(4, dir, "/", TMP_PREFIX, suffix);
+}
+
+
+/*
+ * Returns the directory part of a path, or "." if it has none.  Memory is
+ * allocated for the result, which must be freed by the caller.
+ */
+static char* dir_name(const char* path) {
+  const char* slash = strrchr(path, '/');
+  if (!slash) {
+    return concat_strings(1, ".");
+  }
+  if (slash == path) {
+    return concat_strings(1, "/");
+  }
+  char* dir = concat_strings(1, path);
+  dir[slash - path] = '\0';
+  return dir;
+}
+
+
+/*
+ * Writes all of `size` bytes from `data` to a file descriptor.  Returns 0 on
+ * success or nonzero otherwise.
+ */
+static int write_all(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t n = write(fd, data, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return 1;
+    }
+    data += n;
+    size -= n;
+  }
+  return 0;
+}
+
+
+/*
+ * Copies the file at `from` to a new file at `to`, which must not exist.
+ * Returns 0 on success or nonzero otherwise.
+ */
+static int copy_file(const char* from, const char* to) {
+  int in = open(from, O_RDONLY);
+  if (in < 0) {
+    return 1;
+  }
+  int out = open(to, O_WRONLY | O_CREAT | O_EXCL, 0666);
+  if (out < 0) {
+    close(in);
+    return 1;
+  }
+  char buffer[65536];
+  ssize_t n;
+  int status = 0;
+  while (!status && (n = read(in, buffer, sizeof(buffer))) != 0) {
+    if (n < 0) {
+      status = errno != EINTR;
+    } else {
+      status = write_all(out, buffer, n);
+    }
+  }
+  close(in);
+  status |= close(out) != 0;
+  return status;
+}
+
+
+/*
+ * Marks a file in the cache as just used, so it's the last to be evicted.
+ */
+static void touch(const char* path) {
+  utimensat(AT_FDCWD, path, NULL, 0);
+}
+
+
+int cache_contains(struct cache* cache, const char* key, const char* ext) {
+  char* path = entry_path(cache, key, ext);
+  int found = !access(path, R_OK);
+  free(path);
+  return found;
+}
+
+
+int cache_print(struct cache* cache, const char* key, const char* ext,
+    FILE* stream) {
+  char* path = entry_path(cache, key, ext);
+  FILE* input = fopen(path, "rb");
+  if (!input) {
+    free(path);
+    return 1;
+  }
+  touch(path);
+  free(path);
+
+  char buffer[65536];
+  size_t n;
+  int status = 0;
+  while (!status && (n = fread(buffer, 1, sizeof(buffer), input)) > 0) {
+    status = fwrite(buffer, 1, n, stream) != n;
+  }
+  status |= ferror(input);
+  fclose(input);
+  return status;
+}
+
+
+/*
+ * The file is linked or copied under a temporary name next to `path` and
+ * then renamed over it, so `path` always holds either its old contents or
+ * the whole of the new ones.
+ */
+int cache_export(struct cache* cache, const char* key, const char* ext,
+    const char* path, int hardlink) {
+  char* from = entry_path(cache, key, ext);
+  char* dir = dir_name(path);
+  char* tmp = tmp_path(cache, dir);
+  int status = 1;
+  if (hardlink && !link(from, tmp)) {
+    status = 0;
+  } else if (!copy_file(from, tmp)) {
+    status = 0;
+  }
+  if (!status) {
+    touch(from);
+    status = rename(tmp, path) != 0;
+  }
+  if (status) {
+    unlink(tmp);
+  }
+  free(tmp);
+  free(dir);
+  free(from);
+  return status;
+}
+
+
+/*
+ * Opens the statistics file and locks it, for writing if `write_lock` is
+ * nonzero or for reading otherwise.  Returns its file descriptor, or -1 if
+ * it can't be opened.  The lock is released when the descriptor is closed.
+ */
+static int lock_stats(struct cache* cache, int write_lock) {
+  char* path = concat_strings(3, cache->dir, "/", STATS_FILE);
+  int fd = open(path, write_lock ? O_RDWR | O_CREAT : O_RDONLY, 0666);
+  free(path);
+  if (fd < 0) {
+    return -1;
+  }
+  struct flock lock;
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type = write_lock ? F_WRLCK : F_RDLCK;
+  lock.l_whence = SEEK_SET;
+  while (fcntl(fd, F_SETLKW, &lock) && errno == EINTR);
+  return fd;
+}
+
+
+/*
+ * Reads the counts of hits, misses, and evictions from a locked statistics
+ * file into `stats`.  A missing or malformed count is 0.
+ */
+static void read_stats(int fd, struct cache_stats* stats) {
+  char text[256];
+  ssize_t n = pread(fd, text, sizeof(text) - 1, 0);
+  text[n > 0 ? n : 0] = '\0';
+  stats->hits = stats->misses = stats->evictions = 0;
+  sscanf(text, "hits %lld\nmisses %lld\nevictions %lld\n", &stats->hits,
+    &stats->misses, &stats->evictions);
+}
+
+
+/*
+ * Adds to the counts of hits, misses, and evictions in the statistics file.
+ */
+static void update_stats(struct cache* cache, long long hits, long long misses,
+    long long evictions) {
+  int fd = lock_stats(cache, 1);
+  if (fd < 0) {
+    return;
+  }
+  struct cache_stats stats;
+  read_stats(fd, &stats);
+  char text[256];
+  int len = snprintf(text, sizeof(text), "hits %lld\nmisses %lld\nevictions %lld\n",
+    stats.hits + hits, stats.misses + misses, stats.evictions + evictions);
+  if (!ftruncate(fd, 0)) {
+    lseek(fd, 0, SEEK_SET);
+    write_all(fd, text, len);
+  }
+  close(fd);
+}
+
+
+void cache_record(struct cache* cache, int hit) {
+  update_stats(cache, hit != 0, hit == 0, 0);
+}
+
+
+/*
+ * Lists the files in the cache other than the statistics file, including
+ * any temporary files left behind by processes that died before renaming
+ * them, so they're evicted in time too.  Sets `n_files` to the number of
+ * files and `bytes` to their total size.  Returns the files, which must be
+ * freed with free_files(), or NULL if the directory can't be read.
+ */
+static struct cache_file* list_files(struct cache* cache, size_t* n_files,
+    long long* bytes) {
+  DIR* dir = opendir(cache->dir);
+  if (!dir) {
+    return NULL;
+  }
+  size_t capacity = 64;
+  struct cache_file* files = malloc(capacity * sizeof(struct cache_file));
+  *n_files = 0;
+  *bytes = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir))) {
+    if (entry->d_name[0] == '.' || !strcmp(entry->d_name, STATS_FILE)) {
+      continue;
+    }
+    char* path = concat_strings(3, cache->dir, "/", entry->d_name);
+    struct stat st;
+    if (!stat(path, &st) && S_ISREG(st.st_mode)) {
+      if (*n_files == capacity) {
+        capacity *= 2;
+        files = realloc(files, capacity * sizeof(struct cache_file));
+      }
+      files[*n_files].name = path;
+      files[*n_files].mtime = st.st_mtim;
+      files[*n_files].size = st.st_size;
+      *bytes += st.st_size;
+      (*n_files)++;
+    } else {
+      free(path);
+    }
+  }
+  closedir(dir);
+  return files;
+}
+
+
+static void free_files(struct cache_file* files, size_t n_files) {
+  for (size_t i = 0; i < n_files; i++) {
+    free(files[i].name);
+  }
+  free(files);
+}
+
+
+/*
+ * Orders files from the least to the most recently used.
+ */
+static int compare_mtimes(const void* a, const void* b) {
+  const struct cache_file* x = a;
+  const struct cache_file* y = b;
+  if (x->mtime.tv_sec != y->mtime.tv_sec) {
+    return x->mtime.tv_sec < y->mtime.tv_sec ? -1 : 1;
+  }
+  return (x->mtime.tv_nsec > y->mtime.tv_nsec) - (x->mtime.tv_nsec < y->mtime.tv_nsec);
+}
+
+
+/*
+ * Removes the least recently used files until the cache is within its size
+ * limit.  Another process may be evicting at the same time, so a file that's
+ * already gone doesn't count as evicted.
+ */
+static void evict(struct cache* cache) {
+  if (!cache->max_bytes) {
+    return;
+  }
+  size_t n_files;
+  long long bytes;
+  struct cache_file* files = list_files(cache, &n_files, &bytes);
+  if (!files) {
+    return;
+  }
+  long long evictions = 0;
+  if (bytes > cache->max_bytes) {
+    qsort(files, n_files, sizeof(struct cache_file), compare_mtimes);
+    for (size_t i = 0; i < n_files && bytes > cache->max_bytes; i++) {
+      if (!unlink(files[i].name)) {
+        evictions++;
+      }
+      bytes -= files[i].size;
+    }
+  }
+  free_files(files, n_files);
+  if (evictions) {
+    update_stats(cache, 0, 0, evictions);
+  }
+}
+
+
+char* cache_begin_store(struct cache* cache) {
+  return tmp_path(cache, cache->dir);
+}
+
+
+int cache_end_store(struct cache* cache, const char* tmp, const char* key,
+    const char* ext) {
+  if (!key) {
+    unlink(tmp);
+    return 0;
+  }
+  char* path = entry_path(cache, key, ext);
+  int status = rename(tmp, path) != 0;
+  free(path);
+  if (status) {
+    unlink(tmp);
+  } else {
+    evict(cache);
+  }
+  return status;
+}
+
+
+int cache_get_stats(struct cache* cache, struct cache_stats* stats) {
+  int fd = lock_stats(cache, 0);
+  if (fd >= 0) {
+    read_stats(fd, stats);
+    close(fd);
+  } else {
+    stats->hits = stats->misses = stats->evictions = 0;
+  }
+  size_t n_files;
+  struct cache_file* files = list_files(cache, &n_files, &stats->bytes);
+  if (!files) {
+    return 1;
+  }
+  stats->files = n_files;
+  free_files(files, n_files);
+  return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * This file contains the declarations for a content-addressed cache of
+ * compiler outputs kept in a directory on disk.  See cache.c for
+ * implementation details.
+ */
+
+#ifndef __CACHE_H
+#define __CACHE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Structure used to represent an open cache.
+ */
+struct cache;
+
+/*
+ * Structure reporting on a cache.  The counts of hits, misses, and evictions
+ * are kept in the cache itself, so they cover every process that has used
+ * it.
+ *
+ * @var hits The number of lookups recorded as hits.
+ * @var misses The number of lookups recorded as misses.
+ * @var evictions The number of files removed to keep the cache within its
+ *   size limit.
+ * @var files The number of files in the cache now.
+ * @var bytes The total size of those files.
+ */
+struct cache_stats {
+  long long hits;
+  long long misses;
+  long long evictions;
+  long long files;
+  long long bytes;
+};
+
+/*
+ * Opens the cache in the directory at `dir`, creating the directory if it
+ * doesn't exist.  Whenever a file is stored, the least recently used files
+ * are evicted until the cache takes up no more than `max_bytes`.  Returns
+ * NULL if the directory can't be created.
+ */
+struct cache* cache_open(const char* dir, long long max_bytes);
+
+/*
+ * Closes a cache and frees the memory associated with it.
+ */
+void cache_close(struct cache* cache);
+
+/*
+ * Returns 1 if the cache holds the file stored under `key` with the
+ * extension `ext` (e.g. "o"), or 0 otherwise.  Keys are hexadecimal digests
+ * (see sha256.h).
+ */
+int cache_contains(struct cache* cache, const char* key, const char* ext);
+
+/*
+ * Copies the file stored under `key` with the extension `ext` to `stream`.
+ * Returns 0 on success or nonzero otherwise.
+ */
+int cache_print(struct cache* cache, const char* key, const char* ext,
+  FILE* stream);
+
+/*
+ * Places the file stored under `key` with the extension `ext` at `path`,
+ * replacing any file there.  If `hardlink` is nonzero, the file is linked
+ * rather than copied where possible, in which case it must never be modified
+ * in place, since that would modify the cached file too.  Returns 0 on
+ * success or nonzero otherwise.
+ */
+int cache_export(struct cache* cache, const char* key, const char* ext,
+  const char* path, int hardlink);
+
+/*
+ * These functions store a file in the cache.  cache_begin_store() returns a
+ * new temporary path in the cache's directory, which must be freed by the
+ * caller, to write the file to.  cache_end_store() then stores it under
+ * `key` with the extension `ext`, replacing any file already stored there,
+ * and evicts files as needed to keep within the cache's size limit, or if
+ * `key` is NULL, deletes it.  It returns 0 on success or nonzero otherwise.
+ */
+char* cache_begin_store(struct cache* cache);
+int cache_end_store(struct cache* cache, const char* tmp, const char* key,
+  const char* ext);
+
+/*
+ * Records the outcome of a lookup in the cache's statistics: a hit if `hit`
+ * is nonzero, or a miss otherwise.
+ */
+void cache_record(struct cache* cache, int hit);
+
+/*
+ * Fills `stats` with statistics about a cache.  Returns 0 on success or
+ * nonzero otherwise.
+ */
+int cache_get_stats(struct cache* cache, struct cache_stats* stats);
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ * This file contains the implementation of a monotonic clock, which reads
+ * CLOCK_MONOTONIC, so intervals are unaffected by changes to the system time.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
+
+#include "clock.h"
+
+/*
+ * Returns the current time in seconds on the monotonic clock.
+ */
+double clock_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,16 @@
+/*
+ * This file contains the declaration of a monotonic clock used to time the
+ * phases of compilation.  See clock.c for implementation details.
+ */
+
+#ifndef __CLOCK_H
+#define __CLOCK_H
+
+/*
+ * Returns the current time in seconds on a clock that never goes backwards
+ * (e.g. when the system time is changed).  Only differences between its
+ * values are meaningful.
+ */
+double clock_now();
+
+#endif
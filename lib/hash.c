@@ -1,261 +1,401 @@
 /*
- * This file contains the implementation of a simple chained hash table.  For
- * simplicity, the hash table is set up to store void* values.
+ * This file contains the implementation of an open-addressing hash table laid
+ * out like a "Swiss table".  For simplicity, the hash table is set up to store
+ * void* values.
+ *
+ * Entries live directly in a single array of slots, and alongside it is an
+ * array of control bytes, one per slot.  A control byte says whether its slot
+ * is empty, deleted, or full, and for a full slot, it holds 7 bits of the
+ * key's hash.  Lookups probe a group of 16 control bytes at a time (with a
+ * single SSE2 comparison where available), so only slots whose 7 hash bits
+ * match are ever looked at, and the full hash stored in each slot is compared
+ * before the key itself.
+ *
+ * https://abseil.io/about/design/swisstables
  */
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "hash.h"
 
 /*
- * The initial capacity of the hash table array.
+ * The initial capacity of the hash table.  Capacities are always powers of 2
+ * and never smaller than a group.
+ */
+#define INITIAL_CAPACITY 16
+
+/*
+ * The number of control bytes probed at once.
  */
-#define INITIAL_CAPACITY 128
+#define GROUP_SIZE 16
 
 /*
- * Threshold on load factor over which we double the capacity of the table.
+ * Control byte values for empty and deleted slots.  Full slots hold the low 7
+ * bits of their key's hash, so they're never negative, while both of these
+ * have their high bit set.
  */
-#define LOAD_FACTOR_THR 5
+#define CTRL_EMPTY ((int8_t)-128)
+#define CTRL_DELETED ((int8_t)-2)
 
 /*
- * This structure is used to represent key/value pairs in the hash table.  We
- * also store a link to the next link in a chain directly in the association,
- * making it double as a linked list node.
+ * This structure is used to represent key/value pairs in the hash table,
+ * along with the full hash of the key, so it never needs to be recomputed.
  */
 struct association {
   char* key;
   void* value;
-  struct association* next;
+  size_t hashval;
 };
 
 
 /*
  * This structure is used to represent the hash table itself.
+ *
+ * `ctrl` has `capacity + GROUP_SIZE` entries: the last GROUP_SIZE mirror the
+ * first ones, so a group can be loaded starting at any slot without wrapping
+ * around.  `growth_left` is the number of empty slots that may still be
+ * filled before the table must be resized, which keeps the load (counting
+ * deleted slots) at or below 7/8.  `owns_keys` is set if the table copies
+ * the keys it's given, and so frees them.
  */
 struct hash {
-  struct association** table;
-  unsigned int capacity;
-  unsigned int num_elems;
+  struct association* slots;
+  int8_t* ctrl;
+  size_t capacity;
+  size_t num_elems;
+  size_t growth_left;
+  int owns_keys;
 };
 
+
+/*****************************************************************************
+ **
+ ** Group operations
+ **
+ ** Each of these returns a bit mask with bit i set if control byte i of the
+ ** group starting at `ctrl` satisfies some condition.
+ **
+ *****************************************************************************/
+
+#ifdef __SSE2__
+
+static uint32_t _group_match(const int8_t* ctrl, int8_t byte) {
+  __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(byte)));
+}
+
+static uint32_t _group_match_empty_or_deleted(const int8_t* ctrl) {
+  __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+  return _mm_movemask_epi8(group);
+}
+
+#else
+
+static uint32_t _group_match(const int8_t* ctrl, int8_t byte) {
+  uint32_t mask = 0;
+  for (int i = 0; i < GROUP_SIZE; i++) {
+    mask |= (uint32_t)(ctrl[i] == byte) << i;
+  }
+  return mask;
+}
+
+static uint32_t _group_match_empty_or_deleted(const int8_t* ctrl) {
+  uint32_t mask = 0;
+  for (int i = 0; i < GROUP_SIZE; i++) {
+    mask |= (uint32_t)(ctrl[i] < 0) << i;
+  }
+  return mask;
+}
+
+#endif
+
+static uint32_t _group_match_empty(const int8_t* ctrl) {
+  return _group_match(ctrl, CTRL_EMPTY);
+}
+
+
 /*
- * Helper function to initialize a hash table's table array to a given capacity.
+ * Returns the index of the lowest set bit in a nonzero mask.
  */
-void _hash_table_init(struct hash* hash, unsigned int capacity) {
-  hash->table = malloc(capacity * sizeof(struct association*));
-  assert(hash->table);
-  memset(hash->table, 0, capacity * sizeof(struct association*));
-  hash->capacity = capacity;
-  hash->num_elems = 0;
+static int _lowest_bit(uint32_t mask) {
+  int i = 0;
+  while (!(mask & 1)) {
+    mask >>= 1;
+    i++;
+  }
+  return i;
 }
 
 
+/*****************************************************************************
+ **
+ ** Hashing and probing
+ **
+ *****************************************************************************/
+
 /*
- * Create a new hash table.
+ * Hashes a string 8 bytes at a time, multiplying and rotating each word into
+ * the state, and finishes with the MurmurHash3 64-bit mixer so every bit of
+ * the result depends on every bit of the key.
  */
-struct hash* hash_create() {
-  struct hash* hash = malloc(sizeof(struct hash));
-  assert(hash);
-  _hash_table_init(hash, INITIAL_CAPACITY);
-  return hash;
+static size_t _hash_key(const char* key) {
+  const uint64_t k = 0x9e3779b97f4a7c15ULL;
+  size_t len = strlen(key);
+  uint64_t h = len * k;
+  uint64_t word;
+
+  while (len >= 8) {
+    memcpy(&word, key, 8);
+    h = (h ^ word) * k;
+    h = (h << 31) | (h >> 33);
+    key += 8;
+    len -= 8;
+  }
+  if (len > 0) {
+    word = 0;
+    memcpy(&word, key, len);
+    h = (h ^ word) * k;
+  }
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return (size_t)h;
+}
+
+/*
+ * The parts of a hash value used to find a slot (H1) and stored in its
+ * control byte (H2).
+ */
+static size_t _h1(size_t hashval) {
+  return hashval >> 7;
+}
+
+static int8_t _h2(size_t hashval) {
+  return (int8_t)(hashval & 0x7f);
 }
 
 
 /*
- * This function frees all memory allocated to an association structure.
+ * Sets the control byte of a slot, along with its mirror if it has one.
  */
-void _association_free(struct association* assoc) {
-  free(assoc->key);
-  free(assoc);
+static void _hash_set_ctrl(struct hash* hash, size_t i, int8_t ctrl) {
+  hash->ctrl[i] = ctrl;
+  if (i < GROUP_SIZE) {
+    hash->ctrl[hash->capacity + i] = ctrl;
+  }
 }
 
 
 /*
- * Free the memory associated with a hash table.
+ * Returns the index of the slot holding a given key, or -1 if the key isn't
+ * in the table.  Groups are probed in triangular order, which visits every
+ * group exactly once because the number of groups is a power of 2.  A group
+ * containing an empty slot ends the search, since the key would have been
+ * inserted there.
  */
-void hash_free(struct hash* hash) {
-  assert(hash);
+static long _hash_find(struct hash* hash, const char* key, size_t hashval) {
+  size_t mask = hash->capacity - 1;
+  size_t pos = _h1(hashval) & mask;
+  size_t stride = 0;
+  int8_t h2 = _h2(hashval);
+
+  while (1) {
+    const int8_t* group = hash->ctrl + pos;
+    uint32_t match = _group_match(group, h2);
+    while (match) {
+      size_t i = (pos + _lowest_bit(match)) & mask;
+      struct association* slot = hash->slots + i;
+      if (slot->hashval == hashval && !strcmp(key, slot->key)) {
+        return i;
+      }
+      match &= match - 1;
+    }
+    if (_group_match_empty(group)) {
+      return -1;
+    }
+    stride += GROUP_SIZE;
+    pos = (pos + stride) & mask;
+  }
+}
 
-  /*
-   * Free all of the association structs stored in the table.
-   */
-  for (int i = 0; i < hash->capacity; i++) {
-    struct association* next, * cur = hash->table[i];
-    while (cur != NULL) {
-      next = cur->next;
-      _association_free(cur);
-      cur = next;
+
+/*
+ * Returns the index of the first empty or deleted slot in the probe sequence
+ * for a given hash value.  There is always at least one.
+ */
+static size_t _hash_find_free(struct hash* hash, size_t hashval) {
+  size_t mask = hash->capacity - 1;
+  size_t pos = _h1(hashval) & mask;
+  size_t stride = 0;
+
+  while (1) {
+    uint32_t match = _group_match_empty_or_deleted(hash->ctrl + pos);
+    if (match) {
+      return (pos + _lowest_bit(match)) & mask;
     }
+    stride += GROUP_SIZE;
+    pos = (pos + stride) & mask;
   }
+}
 
-  free(hash->table);
-  free(hash);
+
+/*****************************************************************************
+ **
+ ** Table management
+ **
+ *****************************************************************************/
+
+/*
+ * Helper function to initialize a hash table's arrays to a given capacity,
+ * with every slot empty.  The slots and control bytes share one allocation.
+ */
+static void _hash_table_init(struct hash* hash, size_t capacity) {
+  hash->slots = malloc(capacity * sizeof(struct association)
+    + capacity + GROUP_SIZE);
+  assert(hash->slots);
+  hash->ctrl = (int8_t*)(hash->slots + capacity);
+  memset(hash->ctrl, CTRL_EMPTY, capacity + GROUP_SIZE);
+  hash->capacity = capacity;
+  hash->num_elems = 0;
+  hash->growth_left = capacity - capacity / 8;
 }
 
 
-float _hash_load_factor(struct hash* hash) {
-  return hash->num_elems / (float)hash->capacity;
+/*
+ * Create a new hash table.
+ */
+struct hash* hash_create() {
+  struct hash* hash = malloc(sizeof(struct hash));
+  assert(hash);
+  _hash_table_init(hash, INITIAL_CAPACITY);
+  hash->owns_keys = 1;
+  return hash;
 }
 
 
 /*
- * The DJB hash function: http://www.cse.yorku.ca/~oz/hash.html.
+ * Create a new hash table that doesn't copy its keys.
  */
-unsigned int _djb_hash(char* key) {
-  unsigned long hash = 5381;
-  int c;
-  while ((c = *key++)) {
-    hash = ((hash << 5) + hash) + c;  // hash * 33 + c
-  }
+struct hash* hash_create_borrowed() {
+  struct hash* hash = hash_create();
+  hash->owns_keys = 0;
   return hash;
 }
 
 
 /*
- * Helper function to double the capacity of a hash table if it gets too full.
+ * Free the memory associated with a hash table.
  */
-void _hash_resize(struct hash* hash) {
-
-  /*
-   * Remember the old table array and its capacity and re-initialize the
-   * hash with a new table array with twice the capacity.
-   */
-  struct association** old_table = hash->table;
-  unsigned int old_capacity = hash->capacity;
-  _hash_table_init(hash, old_capacity * 2);
-
-  /*
-   * Loop through the old table and re-hash all the old elements via
-   * hash_insert().  This will handle updating the table's size for us.  By
-   * definition, this will not cause a recursive call to _hash_resize(),
-   * since the new table's capacity is doubled.  Free all the old assocation
-   * structures.
-   */
-  for (int i = 0; i < old_capacity; i++) {
-    struct association* cur = old_table[i];
-    while (cur != NULL) {
-      struct association* tmp = cur;
-      hash_insert(hash, cur->key, cur->value);
-      cur = cur->next;
-      _association_free(tmp);
+void hash_free(struct hash* hash) {
+  assert(hash);
+  for (size_t i = 0; i < hash->capacity && hash->owns_keys; i++) {
+    if (hash->ctrl[i] >= 0) {
+      free(hash->slots[i].key);
     }
   }
-
-  free(old_table);
-
+  free(hash->slots);
+  free(hash);
 }
 
 
 /*
- * This function allocates an association structure and initializes it with
- * a given key and value.  Memory is allocated and a copy of the key is made.
+ * Helper function to rebuild a hash table once it has no room left for new
+ * entries.  If most of the used slots hold deleted entries, the table keeps
+ * its capacity, and they're simply dropped.  Otherwise, its capacity is
+ * doubled.  Entries are moved using their stored hash values, and their keys
+ * are moved rather than copied.
  */
-struct association* _association_create(char* key, void* value) {
-  struct association* assoc = malloc(sizeof(struct association));
-  int l = strlen(key);
-  assoc->key = malloc((l + 1) * sizeof(char));
-  strncpy(assoc->key, key, l + 1);
-  assoc->value = value;
-  return assoc;
+static void _hash_resize(struct hash* hash) {
+  struct association* old_slots = hash->slots;
+  int8_t* old_ctrl = hash->ctrl;
+  size_t old_capacity = hash->capacity;
+  size_t num_elems = hash->num_elems;
+
+  size_t capacity = old_capacity;
+  if (num_elems >= old_capacity / 2 - old_capacity / 16) {
+    capacity *= 2;
+  }
+  _hash_table_init(hash, capacity);
+
+  for (size_t i = 0; i < old_capacity; i++) {
+    if (old_ctrl[i] >= 0) {
+      size_t j = _hash_find_free(hash, old_slots[i].hashval);
+      hash->slots[j] = old_slots[i];
+      _hash_set_ctrl(hash, j, old_ctrl[i]);
+    }
+  }
+  hash->num_elems = num_elems;
+  hash->growth_left -= num_elems;
+
+  free(old_slots);
 }
 
 
 /*
- * Inserts (or updates) a value with a given key into a hash table.
+ * Inserts (or updates) a value with a given key into a hash table.  The key
+ * is copied, unless the table was created by hash_create_borrowed().
  */
 void hash_insert(struct hash* hash, char* key, void* value) {
   assert(hash);
   assert(key);
 
-  /*
-   * Double capacity of hash table if needed.
-   */
-  if (_hash_load_factor(hash) > LOAD_FACTOR_THR) {
-    _hash_resize(hash);
+  size_t hashval = _hash_key(key);
+  long found = _hash_find(hash, key, hashval);
+  if (found >= 0) {
+    hash->slots[found].value = value;
+    return;
   }
 
-  /*
-   * Compute a hash value for the given key and mod to convert it to an index.
-   */
-  unsigned int hashval = _djb_hash(key);
-  unsigned int idx = hashval % hash->capacity;
-
-  /*
-   * Find the key if it already exists in the table.
-   */
-  struct association* cur = hash->table[idx];
-  struct association* prev = NULL;
-  while (cur != NULL) {
-    if (!strcmp(key, cur->key)) {
-      break;
-    }
-    prev = cur;
-    cur = cur->next;
+  size_t i = _hash_find_free(hash, hashval);
+  if (hash->growth_left == 0 && hash->ctrl[i] == CTRL_EMPTY) {
+    _hash_resize(hash);
+    i = _hash_find_free(hash, hashval);
+  }
+  if (hash->ctrl[i] == CTRL_EMPTY) {
+    hash->growth_left--;
   }
 
-  if (cur != NULL) {
-    /*
-     * If the key we're looking for exists in the table, assign the new value.
-     */
-    cur->value = value;
+  struct association* slot = hash->slots + i;
+  if (hash->owns_keys) {
+    size_t l = strlen(key);
+    slot->key = malloc(l + 1);
+    assert(slot->key);
+    memcpy(slot->key, key, l + 1);
   } else {
-    /*
-     * If the user wants to add a new key/value pair into the table, allocate
-     * a new association structure for it and put the new association at the
-     * head of the chain for its bucket.
-     */
-    cur = _association_create(key, value);
-    if (hash->table[idx] != NULL) {
-      cur->next = hash->table[idx];
-    } else {
-      cur->next = NULL;
-    }
-    hash->table[idx] = cur;
-    hash->num_elems++;
+    slot->key = key;
   }
+  slot->value = value;
+  slot->hashval = hashval;
+  _hash_set_ctrl(hash, i, _h2(hashval));
+  hash->num_elems++;
 }
 
 
 /*
  * Removes a value with a given key from a hash table, if it exists there.
+ * Its slot is marked deleted rather than empty, so probes for other keys
+ * continue past it.
  */
 void hash_remove(struct hash* hash, char* key) {
   assert(hash);
   assert(key);
 
-  /*
-   * Compute a hash value for the given key and mod to convert it to an index.
-   */
-  unsigned int hashval = _djb_hash(key);
-  unsigned int idx = hashval % hash->capacity;
-
-  /*
-   * Find the key if it already exists in the table.
-   */
-  struct association* cur = hash->table[idx];
-  struct association* prev = NULL;
-  while (cur != NULL) {
-    if (!strcmp(key, cur->key)) {
-      break;
+  long i = _hash_find(hash, key, _hash_key(key));
+  if (i >= 0) {
+    if (hash->owns_keys) {
+      free(hash->slots[i].key);
     }
-    prev = cur;
-    cur = cur->next;
-  }
-
-  /*
-   * If the key we're looking for exists in the table, then remove the
-   * association from the table by updating link pointers.
-   */
-  if (cur != NULL) {
-    if (prev != NULL) {
-      prev->next = cur->next;
-    } else {
-      hash->table[idx] = cur->next;
-    }
-
-    _association_free(cur);
+    _hash_set_ctrl(hash, i, CTRL_DELETED);
     hash->num_elems--;
   }
 }
@@ -269,27 +409,8 @@ void* hash_get(struct hash* hash, char* key) {
   assert(hash);
   assert(key);
 
-  /*
-   * Compute a hash value for the given key and mod to convert it to an index.
-   */
-  unsigned int hashval = _djb_hash(key);
-  unsigned int idx = hashval % hash->capacity;
-
-  /*
-   * Find the key if it exists in the table.
-   */
-  struct association* cur = hash->table[idx];
-  while (cur != NULL) {
-    if (!strcmp(key, cur->key)) {
-      return cur->value;
-    }
-    cur = cur->next;
-  }
-
-  /*
-   * If we made it here, we haven't found the key we're looking for.
-   */
-  return 0;
+  long i = _hash_find(hash, key, _hash_key(key));
+  return i >= 0 ? hash->slots[i].value : 0;
 }
 
 
@@ -300,27 +421,7 @@ int hash_contains(struct hash* hash, char* key) {
   assert(hash);
   assert(key);
 
-  /*
-   * Compute a hash value for the given key and mod to convert it to an index.
-   */
-  unsigned int hashval = _djb_hash(key);
-  unsigned int idx = hashval % hash->capacity;
-
-  /*
-   * Find the key if it exists in the table.
-   */
-  struct association* cur = hash->table[idx];
-  while (cur != NULL) {
-    if (!strcmp(key, cur->key)) {
-      return 1;
-    }
-    cur = cur->next;
-  }
-
-  /*
-   * If we made it here, we haven't found the key we're looking for.
-   */
-  return 0;
+  return _hash_find(hash, key, _hash_key(key)) >= 0;
 }
 
 
@@ -331,33 +432,25 @@ int hash_contains(struct hash* hash, char* key) {
  *****************************************************************************/
 
 /*
- * This is the structure representing a hash table iterator.
+ * This is the structure representing a hash table iterator.  `next_idx` is
+ * the index of the next full slot, or the table's capacity if there are no
+ * more.
  */
 struct hash_iter {
   struct hash* hash;
-  struct association* next;
-  int next_idx;
+  size_t next_idx;
 };
 
 
 /*
- * Utility function to update the `next` pointer for the hash table iterator to
- * point to the next element in the hash table.
+ * Utility function to advance an iterator's `next_idx` to the first full
+ * slot at or after index `i`.
  */
-void _update_hash_iter_next(struct hash_iter* iter) {
-  if (iter->next != NULL) {
-    iter->next = iter->next->next;
-  }
-  if (iter->next == NULL) {
-    int i = iter->next_idx + 1;
-    while (i < iter->hash->capacity && iter->hash->table[i] == NULL) {
-      i++;
-    }
-    if (i < iter->hash->capacity) {
-      iter->next_idx = i;
-      iter->next = iter->hash->table[i];
-    }
+static void _update_hash_iter_next(struct hash_iter* iter, size_t i) {
+  while (i < iter->hash->capacity && iter->hash->ctrl[i] < 0) {
+    i++;
   }
+  iter->next_idx = i;
 }
 
 
@@ -368,9 +461,7 @@ struct hash_iter* hash_iter_create(struct hash* hash) {
   assert(hash);
   struct hash_iter* iter = malloc(sizeof(struct hash_iter));
   iter->hash = hash;
-  iter->next = NULL;
-  iter->next_idx = -1;
-  _update_hash_iter_next(iter);
+  _update_hash_iter_next(iter, 0);
   return iter;
 }
 
@@ -388,7 +479,7 @@ void hash_iter_free(struct hash_iter* iter) {
  */
 int hash_iter_has_next(struct hash_iter* iter) {
   assert(iter);
-  return iter->next != NULL;
+  return iter->next_idx < iter->hash->capacity;
 }
 
 /*
@@ -399,9 +490,9 @@ int hash_iter_has_next(struct hash_iter* iter) {
  */
 void* hash_iter_next(struct hash_iter* iter, char** key_ptr) {
   assert(iter);
-  assert(iter->next);
-  struct association* curr = iter->next;
-  _update_hash_iter_next(iter);
+  assert(hash_iter_has_next(iter));
+  struct association* curr = iter->hash->slots + iter->next_idx;
+  _update_hash_iter_next(iter, iter->next_idx + 1);
   if (key_ptr != NULL) {
     *key_ptr = curr->key;
   }
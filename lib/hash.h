@@ -1,5 +1,5 @@
 /*
- * This file contains the declarations for a simple chained hash table.  For
+ * This file contains the declarations for an open-addressing hash table.  For
  * simplicity, the hash table is set up to store void* values.  See hash.c for
  * implementation details.
  */
@@ -22,6 +22,13 @@ struct hash_iter;
  */
 struct hash* hash_create();
 
+/*
+ * Create a new hash table that stores the keys it's given as they are,
+ * instead of copying them.  Each key must stay unchanged for as long as it's
+ * in the table.
+ */
+struct hash* hash_create_borrowed();
+
 /*
  * Free the memory associated with a hash table.
  */
@@ -0,0 +1,47 @@
+/*
+ * This file contains the declarations for an implementation of the SHA-256
+ * hash function (FIPS 180-4), used to name the entries of the compile cache
+ * by their contents.  See sha256.c for implementation details.
+ */
+
+#ifndef __SHA256_H
+#define __SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The length of a digest in bytes, and of its hexadecimal form in characters
+ * (not counting the terminating '\0').
+ */
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_HEX_SIZE (2 * SHA256_DIGEST_SIZE)
+
+/*
+ * Structure holding the state of a hash being computed.  Its fields are
+ * internal to sha256.c.
+ */
+struct sha256 {
+  uint32_t state[8];
+  uint64_t len;
+  unsigned char block[64];
+};
+
+/*
+ * Starts a new hash.
+ */
+void sha256_init(struct sha256* sha);
+
+/*
+ * Adds `size` bytes from `data` to a hash.
+ */
+void sha256_update(struct sha256* sha, const void* data, size_t size);
+
+/*
+ * Finishes a hash and writes its digest to `hex` as a string of
+ * SHA256_HEX_SIZE lowercase hexadecimal digits, so `hex` must have room for
+ * SHA256_HEX_SIZE + 1 characters.
+ */
+void sha256_final_hex(struct sha256* sha, char* hex);
+
+#endif
@@ -1,41 +1,1153 @@
 /*
- * This is the driver program for the compiler.  It runs the scanner/parser
- * combination by calling yylex(), and if an AST is successfully generated,
- * it generates GraphViz code for that AST and prints it to stdout.
+ * This is the driver program for the compiler.  It is a thin client of
+ * libpycompile (see pycompile.h): it reads the source program from stdin, or
+ * maps the file given with -i into memory, compiles it in place with
+ * pycompile_in_place(), and if that succeeds, prints the generated LLVM IR to
+ * stdout.  If an output file is given on the command line, object code is
+ * also written there.  With --run, the generated code is instead JIT-compiled
+ * and executed, and only the value returned by target() is printed.  With
+ * --alloc-stats, the number of objects allocated for the AST and the number
+ * of heap allocations made for them are reported on stderr.  With --stream,
+ * each top-level statement is compiled as soon as it has been parsed and then
+ * freed, so the AST never holds more than one of them.  --mcpu and --mattr
+ * select the CPU and target features to generate code for, like llc's options
+ * of the same names; `--mcpu native` tunes the code for the host's CPU and
+ * features.  With --time-report, the time spent in each phase of compilation
+ * and statistics about the program are reported on stderr, as text or, with
+ * --time-report=json, as JSON; with --time-trace, the phases are also written
+ * to a file in the Chrome trace event format (see write_time_trace()).  With
+ * --profile-generate, the generated code counts which way each of its
+ * branches goes, and writes the counts to a profile (pycompile.profile, or
+ * the file given with --profile-generate=FILE) when it's run; compiling the
+ * same program again with --profile-use FILE optimizes it for the branches
+ * taken most (see pycompile.h).
+ *
+ * --emit=KINDS chooses the outputs instead, as a comma-separated list of
+ * "ir" (LLVM IR), "bc" (LLVM bitcode), "asm" (assembly), "obj" (object
+ * code), and "gv" (a GraphViz digraph of the AST, to visualize with `dot`),
+ * or "none".  A single kind is written to the output file, or to
+ * stdout if none is given; with several, each is written to the output file
+ * with its extension replaced by the kind's (see plan_outputs()).  Every
+ * output is streamed to its destination as it's generated, without building
+ * it as a string in memory first.
+ *
+ * With --cache-dir DIR, the outputs are kept in a cache in DIR
+ * (see lib/cache.h), under a SHA-256 hash of the source and of everything
+ * else that determines them (see pycompile_fingerprint()).  When all of the
+ * outputs asked for are found there, they're copied out, or with
+ * --cache-hardlink, linked, without compiling anything, not even creating a
+ * compiler.  The cache is kept within --cache-max-size bytes (which may end
+ * in K, M, or G) by evicting the least recently used outputs.  --run has
+ * nothing to cache, so it doesn't use the cache.  `--cache-dir DIR
+ * --cache-stats` reports how many lookups hit and missed and what the cache
+ * holds.
+ *
+ * With --batch, each remaining argument is instead the path of a source file,
+ * which is likewise mapped into memory.
+ * All of them are compiled in this one process, reusing a single LLVM context
+ * and target machine per thread, and each gets an entry point named after its
+ * file (see make_entry_stem()).  Each program is written to its own object
+ * file in the current directory, or all of them to a single static library
+ * with --archive.  With -j N, the programs are compiled on N threads.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 
+#include "lib/archive.h"
+#include "lib/cache.h"
+#include "lib/clock.h"
 #include "lib/hash.h"
-#include "ast/ast.h"
+#include "lib/sha256.h"
+#include "lib/strutils.h"
+#include "pycompile.h"
+
 
 /*
- * These symbols are needed in main() but are defined elsewhere.
+ * Translates an optimization flag (e.g. "-O2" or "-Os") into a value from
+ * `enum pycompile_opt_level`.  Returns -1 if the flag isn't a valid
+ * optimization level.
  */
-extern int yylex();
-extern struct ast_node* ast;
+int parse_opt_level(const char* flag) {
+    if (!strcmp(flag, "-O0")) return PYCOMPILE_O0;
+    if (!strcmp(flag, "-O1")) return PYCOMPILE_O1;
+    if (!strcmp(flag, "-O2")) return PYCOMPILE_O2;
+    if (!strcmp(flag, "-O3")) return PYCOMPILE_O3;
+    if (!strcmp(flag, "-Os")) return PYCOMPILE_OS;
+    return -1;
+}
+
 
 /*
- * This symbol table is used by the parser to keep track of valid variable
- * names.  Once parsing is done, you could repurpose this symbol table to use
- * during LLVM code generation if you wanted to.
+ * Prints a summary of the command-line options to stderr.
  */
-struct hash* symbols;
+void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-O0|-O1|-O2|-O3|-Os] [--mcpu CPU|native] [--mattr FEATURES] [--run] [--alloc-stats] [--time-report[=json]] [--time-trace trace.json] [--stream] [--profile-generate[=FILE] | --profile-use FILE] [--cache-dir DIR [--cache-max-size SIZE] [--cache-hardlink]] [--emit=ir,bc,asm,obj,gv|none] [-i input.py] [output_file] [< input.py]\n", prog);
+    fprintf(stderr, "       %s [-O0|-O1|-O2|-O3|-Os] [--mcpu CPU|native] [--mattr FEATURES] [--stream] --batch [-j N] [--archive lib.a] input.py...\n", prog);
+    fprintf(stderr, "       %s --cache-dir DIR --cache-stats\n", prog);
+}
 
 
-int main(int argc, char const *argv[]) {
-    symbols = hash_create();
-    if (!yylex()) {
-        if (ast) {
-            char* llvm_ir = generate_llvm_ir(ast);
-            printf("%s", llvm_ir);
-            if (argc > 1)
-                generate_object_code(llvm_ir, argv[1]);
-            free(llvm_ir);
-            ast_node_free(ast);
-        }
-    }
-    hash_free(symbols);
+/*
+ * Derives a unique name stem for a source file from its path, used to name
+ * both the program's entry point and its object file.  The stem is the file's
+ * base name without its extension, with any character that isn't valid in a C
+ * identifier replaced by '_' (e.g. "tests/python/while_4.py" becomes
+ * "while_4").  If the stem is already in `used_stems`, a numeric suffix is
+ * added to make it unique.  The new stem is recorded in `used_stems`.
+ *
+ * @return Returns the stem.  Memory is allocated for the returned string,
+ *   which must be freed by the caller.
+ */
+char* make_entry_stem(const char* path, struct hash* used_stems) {
+    const char* base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    const char* ext = strrchr(base, '.');
+    int len = ext && ext != base ? ext - base : strlen(base);
+
+    char* base_stem = malloc((len + 1) * sizeof(char));
+    for (int i = 0; i < len; i++) {
+        char c = base[i];
+        int valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+            || (c >= '0' && c <= '9') || c == '_';
+        base_stem[i] = valid ? c : '_';
+    }
+    base_stem[len] = '\0';
+
+    char* stem = concat_strings(1, base_stem);
+    for (int n = 2; hash_contains(used_stems, stem); n++) {
+        char* n_str = int_to_str(n);
+        free(stem);
+        stem = concat_strings(3, base_stem, "_", n_str);
+        free(n_str);
+    }
+    free(base_stem);
+    hash_insert(used_stems, stem, NULL);
+    return stem;
+}
+
+
+/*
+ * Reads the entire contents of a stream into memory.
+ *
+ * @param size Set to the number of bytes read.
+ *
+ * @return Returns the contents, which must be freed by the caller, or NULL
+ *   if the stream couldn't be read.
+ */
+char* read_stream(FILE* stream, size_t* size) {
+    size_t capacity = 4096;
+    char* data = malloc(capacity);
+    size_t n;
+
+    *size = 0;
+    while ((n = fread(data + *size, 1, capacity - *size, stream)) > 0) {
+        *size += n;
+        if (*size == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+    }
+    if (ferror(stream)) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+
+/*
+ * This structure represents a source program loaded so it can be compiled in
+ * place with pycompile_in_place().
+ *
+ * @var data The source, followed by two '\0' bytes.
+ * @var len The length of the source in bytes.
+ * @var mapped_size The size of the mapping if `data` is the source file mapped
+ *   into memory, or 0 if `data` was read into a heap buffer instead.
+ */
+struct source {
+    char* data;
+    size_t len;
+    size_t mapped_size;
+};
+
+
+/*
+ * Loads the source program in the file at `path`, or on stdin if `path` is
+ * NULL.  A regular file is mapped into memory rather than read.  The mapping
+ * is private and writable, so the scanner's in-place token terminators only
+ * ever copy the pages they touch and never reach the file.  The two '\0'
+ * bytes after the source come from the zero-filled remainder of the file's
+ * last page, so a file that ends less than two bytes before a page boundary
+ * (or is empty) is read into a heap buffer instead.
+ *
+ * @return Returns 0 on success or nonzero otherwise.
+ */
+int load_source(const char* path, struct source* source) {
+    source->data = NULL;
+    source->len = 0;
+    source->mapped_size = 0;
+
+    FILE* input = path ? fopen(path, "rb") : stdin;
+    if (!input) {
+        return 1;
+    }
+
+    struct stat st;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    if (path && !fstat(fileno(input), &st) && S_ISREG(st.st_mode)
+            && st.st_size % page_size > 0
+            && st.st_size % page_size <= page_size - 2) {
+        void* data = mmap(NULL, st.st_size + 2, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE, fileno(input), 0);
+        if (data != MAP_FAILED) {
+            posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+            source->data = data;
+            source->len = st.st_size;
+            source->mapped_size = st.st_size + 2;
+        }
+    }
+
+    if (!source->data) {
+        char* data = read_stream(input, &source->len);
+        source->data = data ? realloc(data, source->len + 2) : NULL;
+        if (source->data) {
+            source->data[source->len] = source->data[source->len + 1] = '\0';
+        }
+    }
+
+    if (path) {
+        fclose(input);
+    }
+    return source->data == NULL;
+}
+
+
+/*
+ * Frees or unmaps a source program loaded with load_source().
+ */
+void unload_source(struct source* source) {
+    if (source->mapped_size) {
+        munmap(source->data, source->mapped_size);
+    } else {
+        free(source->data);
+    }
+    source->data = NULL;
+}
+
+
+/*
+ * Writes `size` bytes from `data` to the file at `path`, replacing it if it
+ * exists.  Returns 0 on success or nonzero otherwise.
+ */
+int write_file(const char* path, const char* data, size_t size) {
+    FILE* output = fopen(path, "wb");
+    if (!output) {
+        fprintf(stderr, "Error: could not open %s for writing\n", path);
+        return 1;
+    }
+    int status = fwrite(data, 1, size, output) != size;
+    status |= fclose(output) != 0;
+    if (status) {
+        fprintf(stderr, "Error: could not write %s\n", path);
+    }
+    return status;
+}
+
+
+
+
+/*
+ * This structure represents the timing of one phase of compilation.
+ *
+ * @var name The name of the phase.
+ * @var start The time at which it began on clock_now().
+ * @var seconds The time spent in it.
+ */
+struct phase_time {
+    const char* name;
+    double start;
+    double seconds;
+};
+
+
+/*
+ * The number of phases timed by the driver itself before compiling: loading
+ * the source, looking it up in the cache, and creating the compiler, which
+ * sets up its LLVM state.  The cache lookup only runs with --cache-dir, and
+ * the compiler isn't created if the lookup hits.
+ */
+#define N_DRIVER_PHASES 3
+
+/*
+ * Collects the phases that ran into `phases`, in the order they ran, starting
+ * with those the driver timed itself.  `phases` must have room for
+ * N_DRIVER_PHASES + PYCOMPILE_N_PHASES entries.  Returns the number
+ * collected.
+ */
+int collect_phases(const struct pycompile_stats* stats,
+        const struct phase_time* driver_phases, struct phase_time* phases) {
+    int n = 0;
+    for (int p = 0; p < N_DRIVER_PHASES; p++) {
+        if (driver_phases[p].start > 0) {
+            phases[n++] = driver_phases[p];
+        }
+    }
+    for (int p = 0; p < PYCOMPILE_N_PHASES; p++) {
+        if (stats->phase_start[p] > 0) {
+            phases[n].name = pycompile_phase_name(p);
+            phases[n].start = stats->phase_start[p];
+            phases[n++].seconds = stats->phase_seconds[p];
+        }
+    }
+    return n;
+}
+
+
+/*
+ * Returns the peak resident set size of this process in KiB.
+ */
+long peak_rss_kib() {
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) ? 0 : usage.ru_maxrss;
+}
+
+
+/*
+ * Reports the time spent in each phase of compilation and statistics about
+ * the program on stderr, as a table or, if `json` is nonzero, as a JSON
+ * object.  Times are in milliseconds, and each phase's start is relative to
+ * the start of the first.
+ */
+void print_time_report(const struct pycompile_stats* stats,
+        const struct phase_time* driver_phases, int json) {
+    struct phase_time phases[N_DRIVER_PHASES + PYCOMPILE_N_PHASES];
+    int n = collect_phases(stats, driver_phases, phases);
+    double t0 = phases[0].start;
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        total += phases[i].seconds;
+    }
+
+    if (json) {
+        fprintf(stderr, "{\n  \"phases\": [\n");
+        for (int i = 0; i < n; i++) {
+            fprintf(stderr, "    {\"name\": \"%s\", \"start_ms\": %.3f, \"ms\": %.3f}%s\n",
+                phases[i].name, (phases[i].start - t0) * 1e3,
+                phases[i].seconds * 1e3, i + 1 < n ? "," : "");
+        }
+        fprintf(stderr, "  ],\n  \"total_ms\": %.3f,\n", total * 1e3);
+        fprintf(stderr, "  \"counters\": {\n");
+        fprintf(stderr, "    \"tokens\": %zu,\n", stats->tokens);
+        fprintf(stderr, "    \"symbols\": %zu,\n", stats->symbols);
+        fprintf(stderr, "    \"ast_nodes\": %zu,\n", stats->ast_nodes);
+        fprintf(stderr, "    \"ast_nodes_by_type\": {");
+        for (int t = 0; t < PYCOMPILE_N_NODE_TYPES; t++) {
+            fprintf(stderr, "%s\"%s\": %zu", t ? ", " : "",
+                pycompile_node_type_name(t), stats->ast_nodes_by_type[t]);
+        }
+        fprintf(stderr, "},\n");
+        fprintf(stderr, "    \"ir_blocks\": %zu,\n", stats->ir_blocks);
+        fprintf(stderr, "    \"ir_blocks_optimized\": %zu,\n", stats->ir_blocks_optimized);
+        fprintf(stderr, "    \"ir_instructions\": %zu,\n", stats->ir_instructions);
+        fprintf(stderr, "    \"ir_instructions_optimized\": %zu,\n", stats->ir_instructions_optimized);
+        fprintf(stderr, "    \"peak_rss_kib\": %ld\n", peak_rss_kib());
+        fprintf(stderr, "  }\n}\n");
+        return;
+    }
+
+    fprintf(stderr, "===== Compile time report =====\n");
+    fprintf(stderr, "%-24s %12s %8s\n", "Phase", "Time (ms)", "Share");
+    for (int i = 0; i < n; i++) {
+        fprintf(stderr, "%-24s %12.3f %7.1f%%\n", phases[i].name,
+            phases[i].seconds * 1e3,
+            total > 0 ? 100 * phases[i].seconds / total : 0.0);
+    }
+    fprintf(stderr, "%-24s %12.3f\n", "total", total * 1e3);
+    fprintf(stderr, "===== Compile statistics =====\n");
+    fprintf(stderr, "%-24s %12zu\n", "tokens", stats->tokens);
+    fprintf(stderr, "%-24s %12zu\n", "symbols", stats->symbols);
+    fprintf(stderr, "%-24s %12zu\n", "AST nodes", stats->ast_nodes);
+    for (int t = 0; t < PYCOMPILE_N_NODE_TYPES; t++) {
+        fprintf(stderr, "  %-22s %12zu\n", pycompile_node_type_name(t),
+            stats->ast_nodes_by_type[t]);
+    }
+    fprintf(stderr, "%-24s %12zu -> %zu after optimization\n", "IR basic blocks",
+        stats->ir_blocks, stats->ir_blocks_optimized);
+    fprintf(stderr, "%-24s %12zu -> %zu after optimization\n", "IR instructions",
+        stats->ir_instructions, stats->ir_instructions_optimized);
+    fprintf(stderr, "%-24s %12ld\n", "peak RSS (KiB)", peak_rss_kib());
+}
+
+
+/*
+ * Writes the phases of compilation to the file at `path` as complete ("X")
+ * events in the Chrome trace event format, which chrome://tracing and
+ * Perfetto can load.  Returns 0 on success or nonzero otherwise.
+ */
+int write_time_trace(const char* path, const struct pycompile_stats* stats,
+        const struct phase_time* driver_phases) {
+    FILE* output = fopen(path, "w");
+    if (!output) {
+        fprintf(stderr, "Error: could not open %s for writing\n", path);
+        return 1;
+    }
+    struct phase_time phases[N_DRIVER_PHASES + PYCOMPILE_N_PHASES];
+    int n = collect_phases(stats, driver_phases, phases);
+    fprintf(output, "{\"traceEvents\": [\n");
+    for (int i = 0; i < n; i++) {
+        fprintf(output, "  {\"name\": \"%s\", \"cat\": \"compile\", \"ph\": \"X\", "
+            "\"pid\": %ld, \"tid\": 1, \"ts\": %.3f, \"dur\": %.3f},\n",
+            phases[i].name, (long)getpid(), (phases[i].start - phases[0].start) * 1e6,
+            phases[i].seconds * 1e6);
+    }
+    fprintf(output, "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %ld, "
+        "\"args\": {\"name\": \"compile\"}}\n", (long)getpid());
+    fprintf(output, "], \"displayTimeUnit\": \"ms\"}\n");
+    if (fclose(output)) {
+        fprintf(stderr, "Error: could not write %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+ * The size the cache is kept within if --cache-max-size isn't given.
+ */
+#define DEFAULT_CACHE_MAX_BYTES (256LL << 20)
+
+/*
+ * Translates a size given on the command line, in bytes or with a K, M, or G
+ * suffix for KiB, MiB, or GiB, into bytes.  Returns -1 if it isn't a valid
+ * size.
+ */
+long long parse_size(const char* text) {
+    char* end;
+    long long size = strtoll(text, &end, 10);
+    if (end == text || size < 0) {
+        return -1;
+    }
+    int shift = 0;
+    if (*end == 'K') shift = 10;
+    else if (*end == 'M') shift = 20;
+    else if (*end == 'G') shift = 30;
+    else if (*end) return -1;
+    if (shift && end[1]) {
+        return -1;
+    }
+    return size << shift;
+}
+
+
+/*
+ * Computes the key a program's outputs are cached under: the SHA-256 digest
+ * of the compiler's fingerprint for `options` and of the source, in
+ * hexadecimal.
+ *
+ * @param key Set to the key.  It must have room for SHA256_HEX_SIZE + 1
+ *   characters.
+ */
+void make_cache_key(const struct pycompile_options* options,
+        const struct source* source, char* key) {
+    char* fingerprint = pycompile_fingerprint(options);
+    struct sha256 sha;
+    sha256_init(&sha);
+    sha256_update(&sha, fingerprint, strlen(fingerprint) + 1);
+    sha256_update(&sha, source->data, source->len);
+    sha256_final_hex(&sha, key);
+    free(fingerprint);
+}
+
+
+/*
+ * This structure describes a kind of output that --emit can select.
+ *
+ * @var name The kind's name in the --emit option.
+ * @var ext The extension of the files it's written to and cached under.
+ * @var kind Its value in `enum pycompile_output`, or OUTPUT_GRAPHVIZ for a
+ *   GraphViz digraph of the AST, which is written by pycompile_graphviz()
+ *   rather than from the module.
+ */
+#define OUTPUT_GRAPHVIZ -1
+
+struct output_kind {
+    const char* name;
+    const char* ext;
+    int kind;
+};
+
+static const struct output_kind output_kinds[] = {
+    { "ir", "ll", PYCOMPILE_OUTPUT_IR },
+    { "bc", "bc", PYCOMPILE_OUTPUT_BITCODE },
+    { "asm", "s", PYCOMPILE_OUTPUT_ASM },
+    { "obj", "o", PYCOMPILE_OUTPUT_OBJECT },
+    { "gv", "gv", OUTPUT_GRAPHVIZ }
+};
+
+#define N_OUTPUT_KINDS (sizeof(output_kinds) / sizeof(output_kinds[0]))
+
+/*
+ * This structure represents one output the driver writes.
+ *
+ * @var kind The kind of output.
+ * @var path The path of the file it's written to, or NULL for stdout.
+ */
+struct output {
+    const struct output_kind* kind;
+    char* path;
+};
+
+
+/*
+ * Translates the comma-separated list of kinds given to --emit (e.g.
+ * "ir,obj") into a bit mask with bit i set if output_kinds[i] is in the
+ * list.  "none" selects nothing, e.g. to only check that a program compiles.
+ * Returns -1 if the list names an unknown kind.
+ */
+int parse_emit(const char* list) {
+    int mask = 0;
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        int found = len == 4 && !strncmp(list, "none", 4);
+        for (size_t k = 0; k < N_OUTPUT_KINDS && !found; k++) {
+            if (strlen(output_kinds[k].name) == len
+                    && !strncmp(list, output_kinds[k].name, len)) {
+                mask |= 1 << k;
+                found = 1;
+            }
+        }
+        if (!found) {
+            return -1;
+        }
+        list += len + (list[len] == ',');
+    }
+    return mask;
+}
+
+
+/*
+ * Returns `path` with its extension, if it has one, replaced by `ext`.
+ * Memory is allocated for the returned string, which must be freed by the
+ * caller.
+ */
+char* replace_extension(const char* path, const char* ext) {
+    const char* base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    const char* dot = strrchr(base, '.');
+    size_t len = dot && dot != base ? (size_t)(dot - path) : strlen(path);
+    char* stem = malloc(len + 1);
+    memcpy(stem, path, len);
+    stem[len] = '\0';
+    char* result = concat_strings(3, stem, ".", ext);
+    free(stem);
+    return result;
+}
+
+
+/*
+ * Works out where each kind of output in `emit_mask` (see parse_emit()) is
+ * written.  Without an output file, a single kind is written to stdout.  With
+ * one, a single kind is written to it, or each of several kinds to a file
+ * named like it, with the kind's extension (e.g. prog.ll and prog.o for
+ * "--emit=ir,obj prog.o").  Without --emit, i.e. if `emit_mask` is -1, the
+ * IR is written to stdout and, if there's an output file, object code to it.
+ *
+ * @param outputs Set to the outputs.  It must have room for N_OUTPUT_KINDS
+ *   of them, whose paths must be freed by the caller.
+ *
+ * @return Returns the number of outputs, or -1 if there are several with no
+ *   output file to name them after.
+ */
+int plan_outputs(int emit_mask, const char* output_file, struct output* outputs) {
+    if (emit_mask < 0) {
+        outputs[0].kind = &output_kinds[0];
+        outputs[0].path = NULL;
+        outputs[1].kind = &output_kinds[PYCOMPILE_OUTPUT_OBJECT];
+        outputs[1].path = output_file ? concat_strings(1, output_file) : NULL;
+        return output_file ? 2 : 1;
+    }
+
+    int n = 0;
+    for (size_t k = 0; k < N_OUTPUT_KINDS; k++) {
+        if (emit_mask & (1 << k)) {
+            outputs[n++].kind = &output_kinds[k];
+        }
+    }
+    if (n > 1 && !output_file) {
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        if (!output_file) {
+            outputs[i].path = NULL;
+        } else if (n == 1) {
+            outputs[i].path = concat_strings(1, output_file);
+        } else {
+            outputs[i].path = replace_extension(output_file, outputs[i].kind->ext);
+        }
+    }
+    return n;
+}
+
+
+void free_outputs(struct output* outputs, int n_outputs) {
+    for (int i = 0; i < n_outputs; i++) {
+        free(outputs[i].path);
+    }
+}
+
+
+/*
+ * Copies an output from the cache to its destination.  Returns 0 on success
+ * or nonzero otherwise.
+ */
+int export_output(struct cache* cache, const char* key,
+        const struct output* output, int hardlink) {
+    if (output->path) {
+        return cache_export(cache, key, output->kind->ext, output->path, hardlink);
+    }
+    return cache_print(cache, key, output->kind->ext, stdout);
+}
+
+
+/*
+ * Produces the outputs of a compilation from the cache.  Returns 0 on
+ * success, or nonzero, having written nothing to stdout, if they aren't all
+ * cached.  They can be evicted by another process at any time, but each file
+ * is used all at once, and whatever goes to stdout is written last, so by
+ * then there's nothing left to fail.
+ */
+int use_cached_outputs(struct cache* cache, const char* key,
+        const struct output* outputs, int n_outputs, int hardlink) {
+    for (int i = 0; i < n_outputs; i++) {
+        if (!cache_contains(cache, key, outputs[i].kind->ext)) {
+            return 1;
+        }
+    }
+    for (int to_stdout = 0; to_stdout <= 1; to_stdout++) {
+        for (int i = 0; i < n_outputs; i++) {
+            if ((outputs[i].path == NULL) == to_stdout
+                    && export_output(cache, key, &outputs[i], hardlink)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Writes an output of the program in `source` to `path`, from the compiled
+ * module, or for GraphViz, by parsing the source again.
+ */
+int write_output(struct pycompiler* compiler, struct source* source,
+        const struct output_kind* kind, const char* path) {
+    if (kind->kind == OUTPUT_GRAPHVIZ) {
+        return pycompile_graphviz(compiler, source->data, source->len, path);
+    }
+    return pycompile_emit(compiler, kind->kind, path);
+}
+
+
+/*
+ * Writes an output of the compiled program.  With a cache, it's written into
+ * the cache first and then copied out, like on a hit.  A cache that can't be
+ * written to doesn't stop the compilation from succeeding, though: the
+ * output is then written straight to its destination.  Returns 0 on success
+ * or nonzero otherwise.
+ */
+int emit_output(struct pycompiler* compiler, struct source* source,
+        struct cache* cache, const char* key, const struct output* output,
+        int hardlink) {
+    if (cache) {
+        char* tmp = cache_begin_store(cache);
+        int status = write_output(compiler, source, output->kind, tmp);
+        if (status) {
+            cache_end_store(cache, tmp, NULL, NULL);
+            free(tmp);
+            return status;
+        }
+        status = cache_end_store(cache, tmp, key, output->kind->ext)
+            || export_output(cache, key, output, hardlink);
+        free(tmp);
+        if (!status) {
+            return 0;
+        }
+        fprintf(stderr, "Warning: could not store the output in the cache\n");
+    }
+    return write_output(compiler, source, output->kind,
+        output->path ? output->path : "-");
+}
+
+
+/*
+ * Prints statistics about the cache to stdout, in the same format as the
+ * time report.  Returns 0 on success or nonzero otherwise.
+ */
+int print_cache_stats(struct cache* cache, long long max_bytes) {
+    struct cache_stats stats;
+    if (cache_get_stats(cache, &stats)) {
+        fprintf(stderr, "Error: could not read the cache\n");
+        return 1;
+    }
+    long long lookups = stats.hits + stats.misses;
+    printf("===== Compile cache statistics =====\n");
+    printf("%-24s %12lld\n", "hits", stats.hits);
+    printf("%-24s %12lld\n", "misses", stats.misses);
+    printf("%-24s %11.1f%%\n", "hit rate", lookups ? 100.0 * stats.hits / lookups : 0.0);
+    printf("%-24s %12lld\n", "evictions", stats.evictions);
+    printf("%-24s %12lld\n", "files", stats.files);
+    printf("%-24s %12lld of %lld\n", "bytes", stats.bytes, max_bytes);
     return 0;
 }
+
+
+/*
+ * This structure represents one source file compiled in batch mode.
+ *
+ * @var path The path of the source file.
+ * @var stem The name stem derived from the file name by make_entry_stem().
+ * @var entry_name The symbol name of the program's entry point.
+ * @var data When building an archive, the program's object code.
+ * @var size The size of `data` in bytes.
+ * @var status 0 if the program was compiled successfully or nonzero
+ *   otherwise.
+ */
+struct batch_job {
+    const char* path;
+    char* stem;
+    char* entry_name;
+    char* data;
+    size_t size;
+    int status;
+};
+
+/*
+ * This structure holds the state shared by all of the worker threads in
+ * batch mode.  Workers claim jobs in order by incrementing `next_job` under
+ * `lock`.
+ */
+struct batch {
+    struct batch_job* jobs;
+    int n_jobs;
+    int next_job;
+    pthread_mutex_t lock;
+    const struct pycompile_options* options;
+    int to_archive;
+};
+
+
+/*
+ * This is the body of a batch mode worker thread.  It repeatedly claims the
+ * next program, compiles it, and keeps its object code in the job's buffer
+ * (when building an archive) or writes it to `<stem>.o`.  The worker owns its
+ * own compiler instance, so nothing here is shared with other workers.
+ */
+void* batch_worker(void* arg) {
+    struct batch* batch = arg;
+    struct pycompiler* compiler = pycompiler_create(batch->options);
+
+    while (1) {
+        pthread_mutex_lock(&batch->lock);
+        int i = batch->next_job++;
+        pthread_mutex_unlock(&batch->lock);
+        if (i >= batch->n_jobs) {
+            break;
+        }
+
+        struct batch_job* job = &batch->jobs[i];
+        struct source source;
+        if (load_source(job->path, &source)) {
+            fprintf(stderr, "Error: could not read %s\n", job->path);
+            job->status = 1;
+            continue;
+        }
+
+        if (pycompile_in_place(compiler, source.data, source.len,
+                job->entry_name)) {
+            fprintf(stderr, "Error: could not compile %s\n", job->path);
+            job->status = 1;
+        } else {
+            job->status = pycompile_object(compiler, &job->data, &job->size);
+            if (!job->status && !batch->to_archive) {
+                char* output_file = concat_strings(2, job->stem, ".o");
+                job->status = write_file(output_file, job->data, job->size);
+                free(output_file);
+                free(job->data);
+                job->data = NULL;
+            }
+        }
+        unload_source(&source);
+    }
+
+    pycompiler_free(compiler);
+    return NULL;
+}
+
+
+/*
+ * Compiles each of the source files in `paths` within this process.  Each
+ * program's entry point is named `target_<stem>`, where the stem is derived
+ * from the file name by make_entry_stem().  If `archive_path` is NULL, each
+ * program is written to `<stem>.o`; otherwise all of them are written to a
+ * single static library at `archive_path`.
+ *
+ * The programs are spread over `n_threads` worker threads, each with its own
+ * LLVM context and target machine.  Every program is compiled independently
+ * and archive members are written in input order, so the output doesn't
+ * depend on the number of threads.
+ *
+ * @return Returns 0 if every file was compiled successfully or nonzero
+ *   otherwise.
+ */
+int compile_batch(const char** paths, int n_paths,
+        const struct pycompile_options* options, const char* archive_path,
+        int n_threads) {
+    int status = 0;
+    struct hash* used_stems = hash_create();
+    struct batch_job* jobs = calloc(n_paths, sizeof(struct batch_job));
+
+    /*
+     * Names are assigned up front, in input order, so they don't depend on
+     * which worker compiles which program.
+     */
+    for (int i = 0; i < n_paths; i++) {
+        jobs[i].path = paths[i];
+        jobs[i].stem = make_entry_stem(paths[i], used_stems);
+        jobs[i].entry_name = concat_strings(2, "target_", jobs[i].stem);
+    }
+
+    struct batch batch;
+    batch.jobs = jobs;
+    batch.n_jobs = n_paths;
+    batch.next_job = 0;
+    pthread_mutex_init(&batch.lock, NULL);
+    batch.options = options;
+    batch.to_archive = archive_path != NULL;
+
+    if (n_threads > n_paths) {
+        n_threads = n_paths;
+    }
+    if (n_threads <= 1) {
+        batch_worker(&batch);
+    } else {
+        pthread_t threads[n_threads];
+        for (int i = 0; i < n_threads; i++) {
+            pthread_create(&threads[i], NULL, batch_worker, &batch);
+        }
+        for (int i = 0; i < n_threads; i++) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    pthread_mutex_destroy(&batch.lock);
+
+    struct archive* archive = archive_path ? archive_create() : NULL;
+    for (int i = 0; i < n_paths; i++) {
+        status |= jobs[i].status;
+        if (archive && !jobs[i].status) {
+            char* member_name = concat_strings(2, jobs[i].stem, ".o");
+            archive_add_member(archive, member_name, jobs[i].entry_name,
+                jobs[i].data, jobs[i].size);
+            free(member_name);
+        } else {
+            free(jobs[i].data);
+        }
+        free(jobs[i].stem);
+        free(jobs[i].entry_name);
+    }
+
+    if (archive) {
+        if (archive_write(archive, archive_path)) {
+            fprintf(stderr, "Error: could not write archive %s\n", archive_path);
+            status = 1;
+        }
+        archive_free(archive);
+    }
+    free(jobs);
+    hash_free(used_stems);
+    return status;
+}
+
+
+int main(int argc, char const *argv[]) {
+    int status = 0;
+    struct pycompile_options options = { PYCOMPILE_O0, 0, NULL, NULL, NULL, NULL };
+    const char* profile_use = NULL;
+    const char* cache_dir = NULL;
+    long long cache_max_bytes = DEFAULT_CACHE_MAX_BYTES;
+    int cache_hardlink = 0;
+    int cache_stats = 0;
+    int emit_mask = -1;
+    int run = 0;
+    int alloc_stats = 0;
+    int time_report = 0;
+    int time_report_json = 0;
+    const char* time_trace = NULL;
+    int batch = 0;
+    const char* archive_path = NULL;
+    int n_threads = 1;
+    const char* input_file = NULL;
+    const char* output_file = NULL;
+    const char* inputs[argc];
+    int n_inputs = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--run")) {
+            run = 1;
+        } else if (!strcmp(argv[i], "--alloc-stats")) {
+            alloc_stats = 1;
+        } else if (!strcmp(argv[i], "--time-report")) {
+            time_report = 1;
+        } else if (!strcmp(argv[i], "--time-report=json")) {
+            time_report = time_report_json = 1;
+        } else if (!strcmp(argv[i], "--time-trace") && i + 1 < argc) {
+            time_trace = argv[++i];
+        } else if (!strcmp(argv[i], "--stream")) {
+            options.stream = 1;
+        } else if (!strcmp(argv[i], "--batch")) {
+            batch = 1;
+        } else if (!strcmp(argv[i], "--archive") && i + 1 < argc) {
+            archive_path = argv[++i];
+        } else if (!strcmp(argv[i], "--mcpu") && i + 1 < argc) {
+            options.cpu = argv[++i];
+        } else if (!strncmp(argv[i], "--mcpu=", 7)) {
+            options.cpu = argv[i] + 7;
+        } else if (!strcmp(argv[i], "--mattr") && i + 1 < argc) {
+            options.features = argv[++i];
+        } else if (!strncmp(argv[i], "--mattr=", 8)) {
+            options.features = argv[i] + 8;
+        } else if (!strcmp(argv[i], "--profile-generate")) {
+            options.profile_generate = "pycompile.profile";
+        } else if (!strncmp(argv[i], "--profile-generate=", 19)) {
+            options.profile_generate = argv[i] + 19;
+        } else if (!strcmp(argv[i], "--profile-use") && i + 1 < argc) {
+            profile_use = argv[++i];
+        } else if (!strncmp(argv[i], "--profile-use=", 14)) {
+            profile_use = argv[i] + 14;
+        } else if (!strcmp(argv[i], "--cache-dir") && i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else if (!strncmp(argv[i], "--cache-dir=", 12)) {
+            cache_dir = argv[i] + 12;
+        } else if (!strcmp(argv[i], "--cache-max-size") && i + 1 < argc) {
+            cache_max_bytes = parse_size(argv[++i]);
+            if (cache_max_bytes < 0) {
+                fprintf(stderr, "Error: invalid cache size '%s'\n", argv[i]);
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--cache-hardlink")) {
+            cache_hardlink = 1;
+        } else if (!strcmp(argv[i], "--cache-stats")) {
+            cache_stats = 1;
+        } else if (!strncmp(argv[i], "--emit=", 7)) {
+            emit_mask = parse_emit(argv[i] + 7);
+            if (emit_mask < 0) {
+                fprintf(stderr, "Error: unknown output kind in '%s'\n", argv[i]);
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+            input_file = argv[++i];
+        } else if (!strncmp(argv[i], "-j", 2)) {
+            const char* n = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+            n_threads = atoi(n);
+            if (n_threads < 1) {
+                fprintf(stderr, "Error: invalid thread count '%s'\n", n);
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (!strncmp(argv[i], "-O", 2)) {
+            options.opt_level = parse_opt_level(argv[i]);
+            if (options.opt_level < 0) {
+                fprintf(stderr, "Error: unknown optimization level '%s'\n", argv[i]);
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Error: unknown option '%s'\n", argv[i]);
+            usage(argv[0]);
+            return 1;
+        } else {
+            inputs[n_inputs++] = argv[i];
+        }
+    }
+
+    if (options.profile_generate && profile_use) {
+        fprintf(stderr, "Error: --profile-generate cannot be combined with --profile-use\n");
+        return 1;
+    }
+
+    if (batch) {
+        if (run || alloc_stats || time_report || time_trace || input_file
+                || options.profile_generate || profile_use || cache_dir || cache_stats
+                || emit_mask >= 0 || n_inputs == 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        return compile_batch(inputs, n_inputs, &options, archive_path, n_threads);
+    }
+
+    if (n_inputs > 1 || archive_path || (cache_stats && (!cache_dir || n_inputs || input_file))) {
+        usage(argv[0]);
+        return 1;
+    }
+    output_file = n_inputs ? inputs[0] : NULL;
+
+    if (run && output_file) {
+        fprintf(stderr, "Error: --run cannot be combined with an output file\n");
+        return 1;
+    }
+    if (run && emit_mask >= 0) {
+        fprintf(stderr, "Error: --run cannot be combined with --emit\n");
+        return 1;
+    }
+
+    struct output outputs[N_OUTPUT_KINDS];
+    int n_outputs = run ? 0 : plan_outputs(emit_mask, output_file, outputs);
+    if (n_outputs < 0) {
+        fprintf(stderr, "Error: more than one kind of output needs an output file to name them after\n");
+        return 1;
+    }
+
+    /*
+     * With nothing to write, e.g. with --run or --emit=none, there's nothing
+     * to cache either.
+     */
+    struct cache* cache = NULL;
+    if (cache_dir && (n_outputs > 0 || cache_stats)) {
+        cache = cache_open(cache_dir, cache_max_bytes);
+        if (!cache) {
+            fprintf(stderr, "Error: could not open the cache %s\n", cache_dir);
+            free_outputs(outputs, n_outputs);
+            return 1;
+        }
+    }
+    if (cache_stats) {
+        status = print_cache_stats(cache, cache_max_bytes);
+        free_outputs(outputs, n_outputs);
+        cache_close(cache);
+        return status;
+    }
+
+    /*
+     * The profile is only needed until the compiler has been created.
+     */
+    char* profile = NULL;
+    if (profile_use) {
+        FILE* input = fopen(profile_use, "rb");
+        size_t size;
+        profile = input ? read_stream(input, &size) : NULL;
+        if (input) {
+            fclose(input);
+        }
+        if (!profile) {
+            fprintf(stderr, "Error: could not read the profile %s\n", profile_use);
+            free_outputs(outputs, n_outputs);
+            cache_close(cache);
+            return 1;
+        }
+        profile = realloc(profile, size + 1);
+        profile[size] = '\0';
+        options.profile_use = profile;
+    }
+
+    struct source source;
+    struct phase_time driver_phases[N_DRIVER_PHASES] = {
+        { "load", clock_now(), 0 }, { "cache_lookup", 0, 0 }, { "create_compiler", 0, 0 }
+    };
+    if (load_source(input_file, &source)) {
+        fprintf(stderr, "Error: could not read the source program\n");
+        free(profile);
+        free_outputs(outputs, n_outputs);
+        cache_close(cache);
+        return 1;
+    }
+    driver_phases[0].seconds = clock_now() - driver_phases[0].start;
+
+    /*
+     * The key is computed before compiling, while the profile is still around
+     * and the scanner hasn't touched the source.
+     */
+    char cache_key[SHA256_HEX_SIZE + 1];
+    int cache_hit = 0;
+    if (cache) {
+        driver_phases[1].start = clock_now();
+        make_cache_key(&options, &source, cache_key);
+        cache_hit = !use_cached_outputs(cache, cache_key, outputs, n_outputs, cache_hardlink);
+        cache_record(cache, cache_hit);
+        driver_phases[1].seconds = clock_now() - driver_phases[1].start;
+    }
+
+    struct pycompiler* compiler = NULL;
+    if (!cache_hit) {
+        driver_phases[2].start = clock_now();
+        compiler = pycompiler_create(&options);
+        driver_phases[2].seconds = clock_now() - driver_phases[2].start;
+
+        /*
+         * The GraphViz of the AST comes from the source alone, so if it's
+         * all that was asked for, there's nothing to compile.
+         */
+        int compile = run || n_outputs == 0;
+        for (int i = 0; i < n_outputs; i++) {
+            compile |= outputs[i].kind->kind != OUTPUT_GRAPHVIZ;
+        }
+        if (compile) {
+            status = pycompile_in_place(compiler, source.data, source.len, NULL);
+        }
+    }
+    free(profile);
+
+    /*
+     * Nothing was compiled on a cache hit, so all of the statistics are 0.
+     */
+    struct pycompile_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (alloc_stats) {
+        if (compiler) {
+            pycompile_get_stats(compiler, &stats);
+        }
+        fprintf(stderr, "AST: %zu nodes, %zu objects, %zu bytes, %zu heap allocations\n",
+            stats.ast_nodes, stats.ast_allocs, stats.ast_bytes,
+            stats.ast_heap_allocs);
+    }
+    if (!status && run) {
+        /*
+         * In run mode, JIT-compile the module and print the value
+         * returned by target() exactly like target.c does.
+         */
+        float return_value;
+        status = pycompile_run(compiler, &return_value);
+        if (!status)
+            printf("%.3f\n", return_value);
+    } else if (!status && !cache_hit) {
+        for (int i = 0; i < n_outputs && !status; i++) {
+            status = emit_output(compiler, &source, cache, cache_key, &outputs[i],
+                cache_hardlink);
+        }
+    }
+    if (time_report || time_trace) {
+        if (compiler) {
+            pycompile_get_stats(compiler, &stats);
+        }
+        if (time_report) {
+            print_time_report(&stats, driver_phases, time_report_json);
+        }
+        if (time_trace) {
+            status |= write_time_trace(time_trace, &stats, driver_phases);
+        }
+    }
+    free_outputs(outputs, n_outputs);
+    pycompiler_free(compiler);
+    cache_close(cache);
+    unload_source(&source);
+    return status;
+}
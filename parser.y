@@ -3,29 +3,119 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "lib/hash.h"
 #include "ast/ast.h"
 #include "parser.h"
 
-void yyerror(YYLTYPE* loc, const char* err);
-int py_bool_to_int(char* py_bool);
+void yyerror(YYLTYPE* loc, struct parse_context* ctx, const char* err);
+int py_bool_to_int(const char* py_bool, uint32_t len);
+static float lexeme_to_float(struct parse_context* ctx, struct lexeme lexeme);
+static int lexeme_to_int(struct parse_context* ctx, struct lexeme lexeme);
+static void mark_assigned(struct parse_context* ctx, uint32_t symbol);
+static int is_assigned(struct parse_context* ctx, uint32_t symbol);
+static void push_stmt(struct parse_context* ctx, uint32_t stmt);
+static uint32_t pop_block(struct parse_context* ctx, uint32_t start);
+static void add_top_level_stmt(struct parse_context* ctx, uint32_t stmt);
+%}
 
 /*
- * Here, `ast` is an AST node that will represent the root of the generated
- * AST for the source program.
+ * All of the state belonging to a single parse lives in a `parse_context`
+ * that is passed to every push parse call, so any number of programs can be
+ * parsed at once (e.g. on different threads).  These definitions are also
+ * exported in parser.h.
  */
-struct ast_node* ast = NULL;
+%code requires {
+#include <stdio.h>
+#include <stdint.h>
+
+struct ast;
+struct hash;
+struct arena;
+struct codegen;
 
 /*
- * Here, symbols is a hash table used to keep track of all unique identifiers.
- * It will be used to figure out what variables to initialize in the final
- * generated C program.  This is just an `extern` reference to symbols, which
- * is actually defined in main.c.
+ * This structure represents the lexeme of a token as a slice of the source
+ * buffer, so lexemes are never copied out of it.
+ *
+ * @var offset The offset of the lexeme's first character in the source.
+ * @var len The length of the lexeme in bytes.
  */
-extern struct hash* symbols;
+struct lexeme {
+    uint32_t offset;
+    uint32_t len;
+};
 
-int have_err = 0;
-%}
+/*
+ * This structure holds the state of one parse.
+ *
+ * @var source The source buffer being parsed.  Lexemes are slices of it.
+ * @var ast The AST to which nodes are added.  Its root is set once the whole
+ *   program has been parsed.
+ * @var arena The arena from which lexeme strings are allocated.
+ * @var symbols A hash table mapping the text of each distinct identifier seen
+ *   so far to its symbol ID.  The scanner uses it to intern identifiers, so
+ *   the parser and code generator only ever deal with symbol IDs.
+ * @var assigned An array indexed by symbol ID, with a nonzero entry for each
+ *   identifier assigned so far, so uses of unknown identifiers can be
+ *   reported.
+ * @var assigned_capacity The allocated length of `assigned`.
+ * @var stmts A stack holding the statements of every block still being
+ *   parsed.  Blocks nest, so the statements of the innermost one are always
+ *   on top, and each block's statements are contiguous.  A block's
+ *   statements are popped off in one piece when it is complete.  The stack
+ *   grows by doubling.
+ * @var n_stmts The number of statements on `stmts`.
+ * @var stmts_capacity The allocated length of `stmts`.
+ * @var cg If not NULL, the code generator to which each top-level statement
+ *   is sent as soon as it has been parsed, after which it is removed from
+ *   `ast`.  Only the statement being parsed is ever held in `ast`, and its
+ *   root is left as an empty block.
+ * @var have_err Set to 1 if any error was reported during the parse.
+ * @var n_tokens The number of tokens the scanner has sent to the parser.
+ */
+struct parse_context {
+    const char* source;
+    struct ast* ast;
+    struct arena* arena;
+    struct hash* symbols;
+    char* assigned;
+    uint32_t assigned_capacity;
+    uint32_t* stmts;
+    uint32_t n_stmts;
+    uint32_t stmts_capacity;
+    struct codegen* cg;
+    int have_err;
+    size_t n_tokens;
+};
+}
+
+%code provides {
+/*
+ * Scans and parses a complete source program held in memory.  The program is
+ * scanned in place, without being copied.  This is defined in scanner.l.
+ *
+ * @param buffer The text of the source program, followed by two '\0'
+ *   bytes.  It must be writable, since the scanner temporarily terminates
+ *   each token in place, and must remain valid for the whole parse.
+ * @param len The length of the source program in bytes, not counting the
+ *   two '\0' bytes.  It may be at most UINT32_MAX.
+ * @param arena The arena in which to store the identifier strings referred
+ *   to by the AST.
+ * @param ast The AST to which to add the program's nodes.  Its root is left
+ *   as AST_NONE if no AST was generated.
+ * @param cg If not NULL, a code generator on which codegen_begin() has been
+ *   called.  Each top-level statement is compiled with it as soon as it has
+ *   been parsed and is then cleared from `ast`, so the AST's size is bounded
+ *   by the largest top-level statement rather than by the whole program.  No
+ *   more statements are compiled once an error has been reported.
+ * @param n_tokens If not NULL, set to the number of tokens scanned.
+ *
+ * @return Returns 0 if the program was parsed without errors or nonzero
+ *   otherwise.  An AST may still be generated when the parser recovers from
+ *   an error.
+ */
+int parse_program(char* buffer, size_t len, struct arena* arena,
+    struct ast* ast, struct codegen* cg, size_t* n_tokens);
+}
 
 /*
  * Enable location tracking and verbose error messages.
@@ -35,12 +125,17 @@ int have_err = 0;
 
 
 /*
- * All nonterminals in the grammar will be represented as AST nodes.  All
- * tokens coming from the scanner will be represented as strings.
+ * Almost all nonterminals in the grammar will be represented as AST nodes.
+ * The exception is a list of statements still being parsed, which is
+ * represented by the position of its first statement on the parse context's
+ * statement stack.  Identifiers coming from the scanner will be represented
+ * by their symbol IDs, and literals by their lexemes.
  */
 %union {
-    struct ast_node* node;
-    char* str;
+    struct lexeme lexeme;
+    uint32_t node;
+    uint32_t stmts;
+    uint32_t sym;
 }
 
 /*
@@ -49,28 +144,38 @@ int have_err = 0;
  */
 %define api.pure full
 %define api.push-pull push
+%parse-param {struct parse_context* ctx}
 
 /*
  * These are all of the terminals in our grammar, i.e. the syntactic
- * categories that can be recognized by the lexer.  We assign the `str`
- * type from the %union declaration above to all of them, since we'll send
- * lexemes as strings from the scanner.
+ * categories that can be recognized by the lexer.  Identifiers have the
+ * `sym` type from the %union declaration above, and literals have the
+ * `lexeme` type, since the scanner sends them as slices of the source.  The
+ * other tokens carry no value.
  */
-%token <str> IDENTIFIER
-%token <str> FLOAT INTEGER BOOLEAN
-%token <str> INDENT DEDENT NEWLINE
-%token <str> AND BREAK DEF ELIF ELSE FOR IF NOT OR RETURN WHILE
-%token <str> ASSIGN PLUS MINUS TIMES DIVIDEDBY
-%token <str> EQ NEQ GT GTE LT LTE
-%token <str> LPAREN RPAREN COMMA COLON
+%token <sym> IDENTIFIER
+%token <lexeme> FLOAT INTEGER BOOLEAN
+%token INDENT DEDENT NEWLINE
+%token AND BREAK DEF ELIF ELSE FOR IF NOT OR RETURN WHILE
+%token ASSIGN PLUS MINUS TIMES DIVIDEDBY
+%token EQ NEQ GT GTE LT LTE
+%token LPAREN RPAREN COMMA COLON
 
 /*
- * Here we're assigning types to the nonterminals.  All of them will be
- * represented as AST nodes.
+ * Here we're assigning types to the nonterminals.  All of them except
+ * `statements` and `top_level_statements` will be represented as AST nodes.
  */
 %type <node> expression primary_expression condition
 %type <node> statement assign_statement if_statement while_statement break_statement
-%type <node> statements block else_block
+%type <node> block else_block
+%type <stmts> statements top_level_statements
+
+/*
+ * If a list of statements is discarded during error recovery, its statements
+ * are popped off the statement stack, so they don't end up in the enclosing
+ * block.
+ */
+%destructor { ctx->n_stmts = $$; } <stmts>
 
 /*
  * Here, we're defining the precedence of the operators.  The ones that appear
@@ -94,34 +199,55 @@ int have_err = 0;
 /*
  * Each of the CFG rules below generates the relevant AST node and returns
  * it as the semantic value of the rule's left-hand side.  Since each of the
- * various nodes becomes incorporated into its parent node in the AST, we
- * don't free the nodes.  The only things we free below are strings from the
- * scanner that we no longer need (i.e. floats, booleans, and integers).
+ * various nodes becomes incorporated into its parent node in the AST, and
+ * the tokens from the scanner are either symbol IDs or slices of the source,
+ * nothing needs to be freed here.
  */
 
 
 /*
  * This is the goal/start symbol.  Once all of the statements in the entire
  * source program are translated, this symbol receives the string containing
- * all of the translations and assigns it to the global `ast`, so it can be
- * used outside the parser.
+ * all of the translations and makes it the root of the parse context's `ast`,
+ * so it can be used outside the parser.
  */
 program
-  : statements { ast = $1; }
+  : top_level_statements { ast_set_root(ctx->ast, pop_block(ctx, $1)); }
+  ;
+
+/*
+ * The statements of the program itself are collected just like those of any
+ * other block (see `statements` below), except when compiling in streaming
+ * mode, where each one is compiled and dropped from the AST as soon as it is
+ * reduced.  A top-level statement is complete here, so nothing later in the
+ * parse refers to its nodes.
+ */
+top_level_statements
+  : statement {
+        $$ = ctx->n_stmts;
+        add_top_level_stmt(ctx, $1);
+    }
+  | top_level_statements statement {
+        add_top_level_stmt(ctx, $2);
+        $$ = $1;
+    }
   ;
 
 /*
  * The `statements` symbol represents a set of contiguous statements.  It is
- * used to represent the entire program in the rule above and to represent a
- * block of statements in the `block` rule below.  The first production here
- * creates an AST node to represent a new set of statements, and the second
- * production simply appends each new statement into the set represented by
- * that node.
+ * used to represent a block of statements in the `block` rule below.  The
+ * first production here starts a new set of statements on top of the
+ * statement stack, and the second production simply pushes each new
+ * statement onto it.  The block node itself is created once the whole set
+ * has been parsed.
  */
 statements
-  : statement { $$ = block_node_create($1); }
+  : statement {
+        $$ = ctx->n_stmts;
+        push_stmt(ctx, $1);
+    }
   | statements statement {
-        block_node_append_stmt($1, $2);
+        push_stmt(ctx, $2);
         $$ = $1;
     }
   ;
@@ -135,8 +261,8 @@ statement
   | while_statement { $$ = $1; }
   | break_statement { $$ = $1; }
   | error NEWLINE {
-        $$ = NULL;
-        have_err = 1;
+        $$ = AST_NONE;
+        ctx->have_err = 1;
     }
   ;
 
@@ -145,27 +271,25 @@ statement
  */
 primary_expression
   : IDENTIFIER {
-        if (!hash_contains(symbols, $1)) {
+        if (!is_assigned(ctx, $1)) {
             fprintf(stderr,
                 "Error (line %d): unknown symbol '%s' used in expression.\n",
-                @1.first_line, $1);
-            have_err = 1;
-            $$ = NULL;
+                @1.first_line, ast_symbol_name(ctx->ast, $1));
+            ctx->have_err = 1;
+            $$ = AST_NONE;
         } else {
-            $$ = id_expr_node_create($1);
+            $$ = id_expr_node_create(ctx->ast, $1);
         }
     }
   | FLOAT {
-        $$ = float_expr_node_create(atof($1));
-        free($1);
+        $$ = float_expr_node_create(ctx->ast, lexeme_to_float(ctx, $1));
     }
   | INTEGER {
-        $$ = int_expr_node_create(atoi($1));
-        free($1);
+        $$ = int_expr_node_create(ctx->ast, lexeme_to_int(ctx, $1));
     }
   | BOOLEAN {
-        $$ = bool_expr_node_create(py_bool_to_int($1));
-        free($1);
+        $$ = bool_expr_node_create(ctx->ast,
+            py_bool_to_int(ctx->source + $1.offset, $1.len));
     }
   | LPAREN expression RPAREN { $$ = $2; }
   ;
@@ -178,27 +302,27 @@ primary_expression
  */
 expression
   : primary_expression { $$ = $1; }
-  | expression PLUS expression { $$ = binop_expr_node_create(PLUS, $1, $3); }
-  | expression MINUS expression { $$ = binop_expr_node_create(MINUS, $1, $3); }
-  | expression TIMES expression { $$ = binop_expr_node_create(TIMES, $1, $3); }
-  | expression DIVIDEDBY expression { $$ = binop_expr_node_create(DIVIDEDBY, $1, $3); }
-  | expression EQ expression { $$ = binop_expr_node_create(EQ, $1, $3); }
-  | expression NEQ expression { $$ = binop_expr_node_create(NEQ, $1, $3); }
-  | expression GT expression { $$ = binop_expr_node_create(GT, $1, $3); }
-  | expression GTE expression { $$ = binop_expr_node_create(GTE, $1, $3); }
-  | expression LT expression { $$ = binop_expr_node_create(LT, $1, $3); }
-  | expression LTE expression { $$ = binop_expr_node_create(LTE, $1, $3); }
+  | expression PLUS expression { $$ = binop_expr_node_create(ctx->ast, PLUS, $1, $3); }
+  | expression MINUS expression { $$ = binop_expr_node_create(ctx->ast, MINUS, $1, $3); }
+  | expression TIMES expression { $$ = binop_expr_node_create(ctx->ast, TIMES, $1, $3); }
+  | expression DIVIDEDBY expression { $$ = binop_expr_node_create(ctx->ast, DIVIDEDBY, $1, $3); }
+  | expression EQ expression { $$ = binop_expr_node_create(ctx->ast, EQ, $1, $3); }
+  | expression NEQ expression { $$ = binop_expr_node_create(ctx->ast, NEQ, $1, $3); }
+  | expression GT expression { $$ = binop_expr_node_create(ctx->ast, GT, $1, $3); }
+  | expression GTE expression { $$ = binop_expr_node_create(ctx->ast, GTE, $1, $3); }
+  | expression LT expression { $$ = binop_expr_node_create(ctx->ast, LT, $1, $3); }
+  | expression LTE expression { $$ = binop_expr_node_create(ctx->ast, LTE, $1, $3); }
   ;
 
 /*
  * This symbol represents an assignment statement.  For each assignment
- * statement, we first make sure to insert the LHS identifier into the global
- * symbol table, since it is potentially a new symbol.
+ * statement, we first make sure to mark the LHS identifier as assigned, since
+ * it is potentially a new variable.
  */
 assign_statement
   : IDENTIFIER ASSIGN expression NEWLINE {
-        hash_insert(symbols, $1, NULL);
-        $$ = assign_stmt_node_create($1, $3);
+        mark_assigned(ctx, $1);
+        $$ = assign_stmt_node_create(ctx->ast, $1, $3);
     }
   ;
 
@@ -207,7 +331,7 @@ assign_statement
  * elif, else, or while statement.
  */
 block
-  : INDENT statements DEDENT { $$ = $2; }
+  : INDENT statements DEDENT { $$ = pop_block(ctx, $2); }
   ;
 
 /*
@@ -225,7 +349,7 @@ condition
  */
 if_statement
   : IF condition COLON NEWLINE block else_block {
-        $$ = if_stmt_node_create($2, $5, $6);
+        $$ = if_stmt_node_create(ctx->ast, $2, $5, $6);
     }
   ;
 
@@ -233,7 +357,7 @@ if_statement
  * This symbol represents an if statement's optional else block.
  */
 else_block
-  : %empty { $$ = NULL; }
+  : %empty { $$ = AST_NONE; }
   | ELSE COLON NEWLINE block { $$ = $4; }
 
 
@@ -242,7 +366,7 @@ else_block
  * while condition in parentheses.
  */
 while_statement
-  : WHILE condition COLON NEWLINE block { $$ = while_stmt_node_create($2, $5); }
+  : WHILE condition COLON NEWLINE block { $$ = while_stmt_node_create(ctx->ast, $2, $5); }
   ;
 
 /*
@@ -250,7 +374,7 @@ while_statement
  * a semicolon.
  */
 break_statement
-  : BREAK NEWLINE { $$ = break_stmt_node_create(); }
+  : BREAK NEWLINE { $$ = break_stmt_node_create(ctx->ast); }
   ;
 
 %%
@@ -259,19 +383,141 @@ break_statement
  * This is our simple error reporting function.  It prints the line number
  * and text of each error.
  */
-void yyerror(YYLTYPE* loc, const char* err) {
+void yyerror(YYLTYPE* loc, struct parse_context* ctx, const char* err) {
     fprintf(stderr, "Error (line %d): %s\n", loc->first_line, err);
 }
 
 
 /*
- * This function translates a Python boolean value into the corresponding
- * integer value
+ * This function marks the identifier with the given symbol ID as assigned,
+ * growing the parse context's `assigned` array if needed.
+ */
+static void mark_assigned(struct parse_context* ctx, uint32_t symbol) {
+    if (symbol >= ctx->assigned_capacity) {
+        uint32_t capacity = ctx->assigned_capacity ? ctx->assigned_capacity : 64;
+        while (capacity <= symbol) {
+            capacity *= 2;
+        }
+        ctx->assigned = realloc(ctx->assigned, capacity);
+        if (!ctx->assigned) {
+            fprintf(stderr, "FATAL ERROR: out of memory\n");
+            exit(1);
+        }
+        memset(ctx->assigned + ctx->assigned_capacity, 0,
+            capacity - ctx->assigned_capacity);
+        ctx->assigned_capacity = capacity;
+    }
+    ctx->assigned[symbol] = 1;
+}
+
+
+/*
+ * This function returns 1 if the identifier with the given symbol ID has been
+ * assigned or 0 otherwise.
+ */
+static int is_assigned(struct parse_context* ctx, uint32_t symbol) {
+    return symbol < ctx->assigned_capacity && ctx->assigned[symbol];
+}
+
+
+/*
+ * This function pushes a statement onto the parse context's statement stack,
+ * growing it if needed.  AST_NONE statements (i.e. ones containing errors)
+ * are ignored.
+ */
+static void push_stmt(struct parse_context* ctx, uint32_t stmt) {
+    if (stmt == AST_NONE) {
+        return;
+    }
+    if (ctx->n_stmts == ctx->stmts_capacity) {
+        ctx->stmts_capacity = ctx->stmts_capacity ? 2 * ctx->stmts_capacity : 64;
+        ctx->stmts = realloc(ctx->stmts, ctx->stmts_capacity * sizeof(uint32_t));
+        if (!ctx->stmts) {
+            fprintf(stderr, "FATAL ERROR: out of memory\n");
+            exit(1);
+        }
+    }
+    ctx->stmts[ctx->n_stmts++] = stmt;
+}
+
+
+/*
+ * This function creates a block node containing all of the statements on the
+ * parse context's statement stack from position `start` up, and pops them.
  */
-int py_bool_to_int(char* py_bool) {
-    if (strcmp(py_bool, "True") == 0) {
+static uint32_t pop_block(struct parse_context* ctx, uint32_t start) {
+    uint32_t block = block_node_create(ctx->ast, ctx->stmts + start,
+        ctx->n_stmts - start);
+    ctx->n_stmts = start;
+    return block;
+}
+
+
+/*
+ * This function handles a complete top-level statement.  Normally it is just
+ * pushed onto the statement stack, but in streaming mode it is folded and
+ * compiled straight away, and the AST is then cleared for the next statement.
+ */
+static void add_top_level_stmt(struct parse_context* ctx, uint32_t stmt) {
+    if (!ctx->cg) {
+        push_stmt(ctx, stmt);
+        return;
+    }
+    if (stmt != AST_NONE && !ctx->have_err) {
+        ast_fold(ctx->ast);
+        codegen_stmt(ctx->cg, ctx->ast, stmt);
+    }
+    ast_clear(ctx->ast);
+}
+
+
+/*
+ * This function translates a Python boolean value of the given length into
+ * the corresponding integer value
+ */
+int py_bool_to_int(const char* py_bool, uint32_t len) {
+    if (len == 4 && strncmp(py_bool, "True", 4) == 0) {
         return 1;
     } else {
         return 0;
     }
 }
+
+
+/*
+ * This function copies a lexeme into `buf` as a null-terminated string, so
+ * it can be converted to a number.  If it's too long for `buf`, memory is
+ * allocated for it instead, and must be freed by the caller.
+ */
+static char* lexeme_text(struct parse_context* ctx, struct lexeme lexeme,
+        char* buf, size_t size) {
+    char* text = lexeme.len < size ? buf : malloc(lexeme.len + 1);
+    memcpy(text, ctx->source + lexeme.offset, lexeme.len);
+    text[lexeme.len] = '\0';
+    return text;
+}
+
+
+/*
+ * These functions convert the lexemes of float and integer literals to their
+ * values.
+ */
+static float lexeme_to_float(struct parse_context* ctx, struct lexeme lexeme) {
+    char buf[64];
+    char* text = lexeme_text(ctx, lexeme, buf, sizeof(buf));
+    float val = atof(text);
+    if (text != buf) {
+        free(text);
+    }
+    return val;
+}
+
+static int lexeme_to_int(struct parse_context* ctx, struct lexeme lexeme) {
+    char buf[64];
+    char* text = lexeme_text(ctx, lexeme, buf, sizeof(buf));
+    int val = atoi(text);
+    if (text != buf) {
+        free(text);
+    }
+    return val;
+}
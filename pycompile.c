@@ -0,0 +1,362 @@
+/*
+ * This file contains the implementation of libpycompile.  It ties together
+ * the scanner/parser combination and the LLVM code generator: each call to
+ * pycompile() parses a program from memory into a fresh AST (with its
+ * identifier strings in an arena), folds its constants, infers the types of
+ * its variables, generates and optimizes its module, and frees the AST and
+ * arena, leaving the module in the code generator for the output functions
+ * to use.  In streaming mode, types can't be inferred, since that needs the
+ * whole program, so every variable is a float.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <llvm-c/Core.h>
+
+#include "pycompile.h"
+#include "lib/arena.h"
+#include "lib/clock.h"
+#include "lib/strutils.h"
+#include "ast/ast.h"
+#include "parser.h"
+
+/*
+ * The code generator's optimization level for each level in
+ * `enum pycompile_opt_level`.
+ */
+static const int codegen_opt_levels[] = {
+  [PYCOMPILE_O0] = OPT_O0,
+  [PYCOMPILE_O1] = OPT_O1,
+  [PYCOMPILE_O2] = OPT_O2,
+  [PYCOMPILE_O3] = OPT_O3,
+  [PYCOMPILE_OS] = OPT_OS
+};
+
+/*
+ * Fail to compile if the AST gains node types the statistics have no room
+ * for.
+ */
+typedef char node_types_check[
+  PYCOMPILE_N_NODE_TYPES == AST_N_NODE_TYPES ? 1 : -1];
+
+/*
+ * Structure representing a compiler instance.
+ *
+ * @var cg The code generator holding the instance's LLVM state and its
+ *   current module.
+ * @var stream Whether to compile each top-level statement as it is parsed.
+ * @var stats Statistics about the most recent compilation.
+ */
+struct pycompiler {
+  struct codegen* cg;
+  int stream;
+  struct pycompile_stats stats;
+};
+
+
+/*
+ * Translates the options given to pycompiler_create() (or NULL, for the
+ * defaults) into those of the code generator.
+ */
+static struct codegen_options make_codegen_options(
+    const struct pycompile_options* options) {
+  struct codegen_options cg_options = { OPT_O0, NULL, NULL, NULL, NULL };
+  if (options && options->opt_level >= PYCOMPILE_O0
+      && options->opt_level <= PYCOMPILE_OS) {
+    cg_options.opt_level = codegen_opt_levels[options->opt_level];
+  }
+  if (options) {
+    cg_options.cpu = options->cpu;
+    cg_options.features = options->features;
+    cg_options.profile_generate = options->profile_generate;
+    cg_options.profile_use = options->profile_use;
+  }
+  return cg_options;
+}
+
+
+struct pycompiler* pycompiler_create(const struct pycompile_options* options) {
+  struct codegen_options cg_options = make_codegen_options(options);
+  struct pycompiler* compiler = malloc(sizeof(struct pycompiler));
+  compiler->cg = codegen_create(&cg_options);
+  compiler->stream = options && options->stream;
+  memset(&compiler->stats, 0, sizeof(struct pycompile_stats));
+  return compiler;
+}
+
+
+void pycompiler_free(struct pycompiler* compiler) {
+  if (!compiler) {
+    return;
+  }
+  codegen_free(compiler->cg);
+  free(compiler);
+}
+
+
+char* pycompile_fingerprint(const struct pycompile_options* options) {
+  struct codegen_options cg_options = make_codegen_options(options);
+  char* cg_fingerprint = codegen_fingerprint(&cg_options);
+  char* fingerprint = concat_strings(4, "pycompile " PYCOMPILE_VERSION "\n",
+    cg_fingerprint, "stream ", options && options->stream ? "1\n" : "0\n");
+  free(cg_fingerprint);
+  return fingerprint;
+}
+
+
+int pycompile(struct pycompiler* compiler, const char* source, size_t len,
+    const char* entry_name) {
+  char* buffer = malloc(len + 2);
+  if (!buffer) {
+    return 1;
+  }
+  memcpy(buffer, source, len);
+  buffer[len] = buffer[len + 1] = '\0';
+  int status = pycompile_in_place(compiler, buffer, len, entry_name);
+  free(buffer);
+  return status;
+}
+
+
+/*
+ * Records that a phase of compilation ran from `start` until now.
+ */
+static void end_phase(struct pycompiler* compiler, int phase, double start) {
+  compiler->stats.phase_start[phase] = start;
+  compiler->stats.phase_seconds[phase] = clock_now() - start;
+}
+
+
+int pycompile_in_place(struct pycompiler* compiler, char* buffer, size_t len,
+    const char* entry_name) {
+  /*
+   * Drop the previous module up front so it can't be mistaken for the
+   * result of this call if compilation fails.
+   */
+  LLVMModuleRef previous = codegen_take_module(compiler->cg);
+  if (previous) {
+    LLVMDisposeModule(previous);
+  }
+
+  memset(&compiler->stats, 0, sizeof(struct pycompile_stats));
+  struct arena* arena = arena_create();
+  struct ast* ast = ast_create();
+  double start = clock_now();
+  int status;
+  if (compiler->stream) {
+    /*
+     * In streaming mode, the parser generates code for each top-level
+     * statement itself, so all that's left here is to finish the module, or
+     * throw away the part of it that was built before an error.
+     */
+    status = codegen_begin(compiler->cg, entry_name);
+    if (!status) {
+      status = parse_program(buffer, len, arena, ast, compiler->cg,
+        &compiler->stats.tokens);
+    }
+    end_phase(compiler, PYCOMPILE_PHASE_PARSE, start);
+    if (!status && ast_get_root(ast) == AST_NONE) {
+      status = 1;
+    }
+    if (!status) {
+      status = codegen_end(compiler->cg, ast);
+    } else {
+      codegen_discard(compiler->cg);
+    }
+  } else {
+    status = parse_program(buffer, len, arena, ast, NULL,
+      &compiler->stats.tokens);
+    end_phase(compiler, PYCOMPILE_PHASE_PARSE, start);
+    if (!status && ast_get_root(ast) == AST_NONE) {
+      status = 1;
+    }
+    if (!status) {
+      start = clock_now();
+      ast_fold(ast);
+      end_phase(compiler, PYCOMPILE_PHASE_FOLD, start);
+      start = clock_now();
+      ast_infer_types(ast);
+      end_phase(compiler, PYCOMPILE_PHASE_INFER_TYPES, start);
+      start = clock_now();
+      status = generate_llvm_ir(compiler->cg, ast, entry_name);
+    }
+  }
+
+  /*
+   * Code generation is timed by the code generator itself, since in
+   * streaming mode it's spread over the whole parse, which it's then
+   * subtracted from.  The two are reported back to back.
+   */
+  if (!status) {
+    struct codegen_stats cg_stats;
+    codegen_get_stats(compiler->cg, &cg_stats);
+    double* phase_start = compiler->stats.phase_start;
+    double* phase_seconds = compiler->stats.phase_seconds;
+    if (compiler->stream) {
+      phase_seconds[PYCOMPILE_PHASE_PARSE] -= cg_stats.generate_seconds;
+      start = phase_start[PYCOMPILE_PHASE_PARSE]
+        + phase_seconds[PYCOMPILE_PHASE_PARSE];
+    }
+    phase_start[PYCOMPILE_PHASE_CODEGEN] = start;
+    phase_seconds[PYCOMPILE_PHASE_CODEGEN] = cg_stats.generate_seconds;
+    phase_start[PYCOMPILE_PHASE_OPTIMIZE] = cg_stats.optimize_start;
+    phase_seconds[PYCOMPILE_PHASE_OPTIMIZE] = cg_stats.optimize_seconds;
+    compiler->stats.ir_blocks = cg_stats.n_blocks;
+    compiler->stats.ir_instructions = cg_stats.n_instructions;
+    compiler->stats.ir_blocks_optimized = cg_stats.n_blocks_optimized;
+    compiler->stats.ir_instructions_optimized =
+      cg_stats.n_instructions_optimized;
+  }
+
+  /*
+   * Both the nodes and the identifier strings referred to by the AST used to
+   * take a heap allocation apiece; count them against the allocations
+   * actually made.
+   */
+  struct ast_stats ast_stats;
+  struct arena_stats arena_stats;
+  ast_get_stats(ast, &ast_stats);
+  arena_get_stats(arena, &arena_stats);
+  compiler->stats.ast_nodes = ast_stats.n_nodes;
+  compiler->stats.ast_allocs = ast_stats.n_nodes + arena_stats.n_allocs;
+  compiler->stats.ast_heap_allocs = ast_stats.n_heap_allocs
+    + arena_stats.n_chunks;
+  compiler->stats.ast_bytes = ast_stats.bytes + arena_stats.bytes_used;
+  memcpy(compiler->stats.ast_nodes_by_type, ast_stats.n_nodes_by_type,
+    sizeof(compiler->stats.ast_nodes_by_type));
+  compiler->stats.symbols = ast_stats.n_symbols;
+  ast_free(ast);
+  arena_free(arena);
+  return status;
+}
+
+
+char* pycompile_ir(struct pycompiler* compiler) {
+  double start = clock_now();
+  char* ir = generate_llvm_ir_string(compiler->cg);
+  end_phase(compiler, PYCOMPILE_PHASE_PRINT_IR, start);
+  return ir;
+}
+
+
+int pycompile_object(struct pycompiler* compiler, char** data, size_t* size) {
+  double start = clock_now();
+  int status = generate_object_code_buffer(compiler->cg, data, size);
+  end_phase(compiler, PYCOMPILE_PHASE_EMIT_OBJECT, start);
+  return status;
+}
+
+
+int pycompile_emit(struct pycompiler* compiler, int kind, const char* path) {
+  /*
+   * The code generator's kind of output and the phase it's timed in, for
+   * each kind in `enum pycompile_output`.
+   */
+  static const int output_kinds[] = {
+    [PYCOMPILE_OUTPUT_IR] = OUTPUT_IR,
+    [PYCOMPILE_OUTPUT_BITCODE] = OUTPUT_BITCODE,
+    [PYCOMPILE_OUTPUT_ASM] = OUTPUT_ASM,
+    [PYCOMPILE_OUTPUT_OBJECT] = OUTPUT_OBJECT
+  };
+  static const int output_phases[] = {
+    [PYCOMPILE_OUTPUT_IR] = PYCOMPILE_PHASE_PRINT_IR,
+    [PYCOMPILE_OUTPUT_BITCODE] = PYCOMPILE_PHASE_EMIT_BITCODE,
+    [PYCOMPILE_OUTPUT_ASM] = PYCOMPILE_PHASE_EMIT_ASM,
+    [PYCOMPILE_OUTPUT_OBJECT] = PYCOMPILE_PHASE_EMIT_OBJECT
+  };
+  if (kind < PYCOMPILE_OUTPUT_IR || kind > PYCOMPILE_OUTPUT_OBJECT) {
+    return 1;
+  }
+
+  /*
+   * LLVM writes to stdout's file descriptor directly, so anything still in
+   * C's buffer has to go first.
+   */
+  if (!strcmp(path, "-")) {
+    fflush(stdout);
+  }
+  double start = clock_now();
+  int status = generate_output_file(compiler->cg, output_kinds[kind], path);
+  end_phase(compiler, output_phases[kind], start);
+  return status;
+}
+
+
+int pycompile_graphviz(struct pycompiler* compiler, char* buffer, size_t len,
+    const char* path) {
+  double start = clock_now();
+  struct arena* arena = arena_create();
+  struct ast* ast = ast_create();
+  int status = parse_program(buffer, len, arena, ast, NULL, NULL);
+  if (!status && ast_get_root(ast) == AST_NONE) {
+    status = 1;
+  }
+  if (!status) {
+    int to_stdout = !strcmp(path, "-");
+    FILE* stream = to_stdout ? stdout : fopen(path, "w");
+    if (stream) {
+      status = write_graphviz(ast, stream);
+      status = (to_stdout ? fflush(stream) : fclose(stream)) || status;
+    } else {
+      status = 1;
+    }
+    if (status) {
+      fprintf(stderr, "Error: could not write %s\n", to_stdout ? "stdout" : path);
+    }
+  }
+  ast_free(ast);
+  arena_free(arena);
+  end_phase(compiler, PYCOMPILE_PHASE_EMIT_GRAPHVIZ, start);
+  return status;
+}
+
+
+int pycompile_run(struct pycompiler* compiler, float* return_value) {
+  double start = clock_now();
+  int status = run_target(compiler->cg, return_value);
+  end_phase(compiler, PYCOMPILE_PHASE_RUN, start);
+  return status;
+}
+
+
+pycompile_entry pycompile_jit(struct pycompiler* compiler) {
+  double start = clock_now();
+  pycompile_entry entry = jit_target(compiler->cg);
+  end_phase(compiler, PYCOMPILE_PHASE_RUN, start);
+  return entry;
+}
+
+
+void pycompile_get_stats(struct pycompiler* compiler,
+    struct pycompile_stats* stats) {
+  *stats = compiler->stats;
+}
+
+
+const char* pycompile_phase_name(int phase) {
+  static const char* names[] = {
+    [PYCOMPILE_PHASE_PARSE] = "parse",
+    [PYCOMPILE_PHASE_FOLD] = "fold",
+    [PYCOMPILE_PHASE_INFER_TYPES] = "infer_types",
+    [PYCOMPILE_PHASE_CODEGEN] = "codegen",
+    [PYCOMPILE_PHASE_OPTIMIZE] = "optimize",
+    [PYCOMPILE_PHASE_PRINT_IR] = "print_ir",
+    [PYCOMPILE_PHASE_EMIT_BITCODE] = "emit_bitcode",
+    [PYCOMPILE_PHASE_EMIT_ASM] = "emit_asm",
+    [PYCOMPILE_PHASE_EMIT_OBJECT] = "emit_object",
+    [PYCOMPILE_PHASE_EMIT_GRAPHVIZ] = "emit_graphviz",
+    [PYCOMPILE_PHASE_RUN] = "jit_run"
+  };
+  return phase >= 0 && phase < PYCOMPILE_N_PHASES ? names[phase] : NULL;
+}
+
+
+const char* pycompile_node_type_name(int type) {
+  return ast_node_type_name(type);
+}
+
+
+LLVMModuleRef pycompile_take_module(struct pycompiler* compiler) {
+  return codegen_take_module(compiler->cg);
+}
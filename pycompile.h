@@ -0,0 +1,303 @@
+/*
+ * This file contains the public interface of libpycompile, the compiler
+ * packaged as a library.  It compiles a program held in memory into an LLVM
+ * module, from which textual IR, object code, or a JIT-compiled call can be
+ * produced.  Nothing here reads from stdin, writes to stdout, or touches the
+ * filesystem, except pycompile_emit() and pycompile_graphviz(), which write
+ * where they're told to; diagnostics are printed to stderr.  See pycompile.c
+ * for implementation details.
+ */
+
+#ifndef __PYCOMPILE_H
+#define __PYCOMPILE_H
+
+#include <stddef.h>
+#include <llvm-c/Types.h>
+
+/*
+ * The version of the compiler.  It's part of pycompile_fingerprint(), so it
+ * must change whenever the code generated for some program does, or outputs
+ * cached by an older compiler would be reused.
+ */
+#define PYCOMPILE_VERSION "1.1"
+
+/*
+ * Optimization levels accepted in `struct pycompile_options`, corresponding
+ * to the -O0, -O1, -O2, -O3, and -Os command-line options.
+ */
+enum pycompile_opt_level {
+  PYCOMPILE_O0,
+  PYCOMPILE_O1,
+  PYCOMPILE_O2,
+  PYCOMPILE_O3,
+  PYCOMPILE_OS
+};
+
+/*
+ * Options controlling compilation.
+ *
+ * @var opt_level A value from `enum pycompile_opt_level` selecting the LLVM
+ *   pass pipeline run on each module and the code generation level used for
+ *   object code.
+ * @var stream If nonzero, each top-level statement is compiled as soon as it
+ *   has been parsed and its AST nodes are freed straight away, so the memory
+ *   used by the frontend is bounded by the largest top-level statement
+ *   rather than by the size of the whole program.  Variables' types can't be
+ *   inferred before the whole program has been seen, though, so they are
+ *   all floats in this mode, which only changes results where integer
+ *   arithmetic would exceed a float's precision.
+ * @var cpu The name of the CPU to generate code for (e.g. "skylake"),
+ *   "native" for the host's CPU, or NULL for a generic CPU of the host's
+ *   architecture.  It must be one LLVM knows for that architecture (see
+ *   `llc -mcpu=help`).  It applies to object code and to code run with
+ *   pycompile_run(), and is recorded in the module's IR.
+ * @var features The target features to enable or disable, in LLVM's syntax
+ *   (e.g. "+avx2,-avx512f"), "native" for exactly the host's features, or
+ *   NULL for those of `cpu`.  When `cpu` is "native", NULL means the host's
+ *   features.
+ * @var profile_generate If not NULL, the generated code is instrumented to
+ *   count how often each of its conditional branches goes each way, and
+ *   writes the counts to the file at this path each time its entry function
+ *   returns (whether it's run with pycompile_run() or linked into a program).
+ *   The file is overwritten each time, with counts accumulated over every
+ *   call so far.
+ * @var profile_use If not NULL, the text of a profile written by a program
+ *   compiled with `profile_generate` from the same source, whose counts
+ *   become weights on the branches, so the optimizer can favor the paths
+ *   taken most and estimate how many times loops run.  A profile that is
+ *   malformed or doesn't match the program is ignored with a warning.  It's
+ *   ignored if `profile_generate` is also given.  It's parsed by
+ *   pycompiler_create(), so it needn't outlive that call.
+ */
+struct pycompile_options {
+  int opt_level;
+  int stream;
+  const char* cpu;
+  const char* features;
+  const char* profile_generate;
+  const char* profile_use;
+};
+
+/*
+ * The phases of compilation timed in `struct pycompile_stats`, in the order
+ * they run.  Scanning, parsing, and building the AST happen together in a
+ * single pass over the source, so they are one phase.  In streaming mode,
+ * code generation is interleaved with that pass too, and is timed
+ * separately.
+ */
+enum pycompile_phase {
+  PYCOMPILE_PHASE_PARSE,
+  PYCOMPILE_PHASE_FOLD,
+  PYCOMPILE_PHASE_INFER_TYPES,
+  PYCOMPILE_PHASE_CODEGEN,
+  PYCOMPILE_PHASE_OPTIMIZE,
+  PYCOMPILE_PHASE_PRINT_IR,
+  PYCOMPILE_PHASE_EMIT_BITCODE,
+  PYCOMPILE_PHASE_EMIT_ASM,
+  PYCOMPILE_PHASE_EMIT_OBJECT,
+  PYCOMPILE_PHASE_EMIT_GRAPHVIZ,
+  PYCOMPILE_PHASE_RUN,
+  PYCOMPILE_N_PHASES
+};
+
+/*
+ * The number of different types of AST node counted in `struct
+ * pycompile_stats`.
+ */
+#define PYCOMPILE_N_NODE_TYPES 10
+
+/*
+ * Structure reporting statistics about the most recent call to pycompile(),
+ * along with the output functions called on its module since.
+ *
+ * @var ast_nodes The number of nodes created in the AST.
+ * @var ast_allocs The number of objects (AST nodes and identifier strings)
+ *   created while parsing.  Each would need its own heap allocation if
+ *   allocated individually.
+ * @var ast_heap_allocs The number of heap allocations actually made for them.
+ * @var ast_bytes The peak number of bytes taken up by those objects.
+ * @var phase_start The time at which each phase in `enum pycompile_phase`
+ *   began, in seconds on a monotonic clock whose zero is arbitrary, or 0 for
+ *   a phase that hasn't run.
+ * @var phase_seconds The time spent in each phase.  In streaming mode, the
+ *   parse phase doesn't include the code generation interleaved with it.
+ * @var tokens The number of tokens scanned.
+ * @var ast_nodes_by_type The number of AST nodes created of each type, whose
+ *   names are given by pycompile_node_type_name().
+ * @var symbols The number of distinct identifiers in the program.
+ * @var ir_blocks The number of basic blocks in the module as generated.
+ * @var ir_instructions The number of IR instructions in the module as
+ *   generated.
+ * @var ir_blocks_optimized The number of basic blocks after optimization.
+ * @var ir_instructions_optimized The number of IR instructions after
+ *   optimization.
+ */
+struct pycompile_stats {
+  size_t ast_nodes;
+  size_t ast_allocs;
+  size_t ast_heap_allocs;
+  size_t ast_bytes;
+  double phase_start[PYCOMPILE_N_PHASES];
+  double phase_seconds[PYCOMPILE_N_PHASES];
+  size_t tokens;
+  size_t ast_nodes_by_type[PYCOMPILE_N_NODE_TYPES];
+  size_t symbols;
+  size_t ir_blocks;
+  size_t ir_instructions;
+  size_t ir_blocks_optimized;
+  size_t ir_instructions_optimized;
+};
+
+/*
+ * Structure used to represent a compiler instance.  It owns an LLVM context
+ * and target machine that are reused for every program it compiles, along
+ * with the module most recently compiled.  Nothing is shared between
+ * instances, so different threads may each use their own concurrently.
+ */
+struct pycompiler;
+
+/*
+ * Create a new compiler instance.  The options are copied.
+ */
+struct pycompiler* pycompiler_create(const struct pycompile_options* options);
+
+/*
+ * Free the memory associated with a compiler instance, including its current
+ * module.
+ */
+void pycompiler_free(struct pycompiler* compiler);
+
+/*
+ * Returns a description of everything besides the source program that
+ * determines the IR and object code compiled with the given options: the
+ * versions of the compiler and of LLVM, the target (with "native" resolved
+ * to the host's CPU and features), and every option that affects code
+ * generation, including the text of `profile_use`.  Compiling the same source
+ * with the same entry name and options whose fingerprints are equal gives the
+ * same output, so a hash of the source and the fingerprint can identify it,
+ * e.g. in a cache.  No compiler instance needs to be created.  The string
+ * must be freed by the caller.
+ */
+char* pycompile_fingerprint(const struct pycompile_options* options);
+
+/*
+ * Compiles a source program held in memory into an optimized LLVM module
+ * containing a single function named `entry_name` (or `target` if that is
+ * NULL).  The module replaces any previously compiled by the same instance
+ * and is used by the functions below.  Returns 0 on success or nonzero if the
+ * program could not be compiled.
+ *
+ * `source` need not be null-terminated; `len` is its length in bytes.
+ * `entry_name` must outlive the module.
+ */
+int pycompile(struct pycompiler* compiler, const char* source, size_t len,
+  const char* entry_name);
+
+/*
+ * Like pycompile(), but scans the source directly out of the caller's buffer
+ * instead of copying it first, e.g. for a source file mapped into memory.
+ * `buffer` must hold the `len` bytes of the source followed by two '\0'
+ * bytes, and must be writable: tokens are temporarily terminated in place
+ * while they're scanned.  It isn't used after this function returns.
+ */
+int pycompile_in_place(struct pycompiler* compiler, char* buffer, size_t len,
+  const char* entry_name);
+
+/*
+ * Returns the textual LLVM IR of the current module, or NULL if there is
+ * none.  The string must be freed by the caller.
+ */
+char* pycompile_ir(struct pycompiler* compiler);
+
+/*
+ * Emits object code for the host machine from the current module into
+ * memory.  On success, `data` is set to a buffer that must be freed by the
+ * caller and `size` to its length in bytes.  Returns 0 on success or nonzero
+ * otherwise.
+ */
+int pycompile_object(struct pycompiler* compiler, char** data, size_t* size);
+
+/*
+ * The kinds of output pycompile_emit() can write, corresponding to the ir,
+ * bc, asm, and obj kinds of the --emit command-line option.
+ */
+enum pycompile_output {
+  PYCOMPILE_OUTPUT_IR,
+  PYCOMPILE_OUTPUT_BITCODE,
+  PYCOMPILE_OUTPUT_ASM,
+  PYCOMPILE_OUTPUT_OBJECT
+};
+
+/*
+ * Writes the current module, as a kind of output from `enum
+ * pycompile_output`, to the file at `path`, replacing it if it exists, or to
+ * stdout if `path` is "-".  Each kind is written by LLVM as it's generated,
+ * without building it in memory first, so unlike pycompile_ir() and
+ * pycompile_object(), this needs no more memory for a large module than for
+ * a small one.  The time taken is counted in the phase for the kind of
+ * output.  Returns 0 on success or nonzero otherwise.
+ */
+int pycompile_emit(struct pycompiler* compiler, int kind, const char* path);
+
+/*
+ * Parses a source program held in `buffer`, as for pycompile_in_place(), and
+ * writes a GraphViz digraph of its AST, as parsed, to the file at `path`,
+ * replacing it if it exists, or to stdout if `path` is "-".  Nothing is
+ * compiled: the current module and the statistics of the most recent call to
+ * pycompile() are left alone, except that the time taken is counted in the
+ * emit_graphviz phase.  The whole AST is built even in streaming mode.  The
+ * digraph is written as it's generated, in time linear in the size of the
+ * AST.  Returns 0 on success or nonzero otherwise.
+ */
+int pycompile_graphviz(struct pycompiler* compiler, char* buffer, size_t len,
+  const char* path);
+
+/*
+ * JIT-compiles the current module and calls its entry function in-process,
+ * setting `return_value` to the value it returns.  The module is consumed.
+ * Returns 0 on success or nonzero otherwise.
+ */
+int pycompile_run(struct pycompiler* compiler, float* return_value);
+
+/*
+ * The type of a compiled program's entry function, which returns the value
+ * of `return_value`.
+ */
+typedef float (*pycompile_entry)(void);
+
+/*
+ * JIT-compiles the current module like pycompile_run(), but returns its entry
+ * function instead of calling it, so it can be called any number of times
+ * (e.g. to benchmark it).  The module is consumed, and the time taken is
+ * counted in the jit_run phase.  The function stays valid until the next
+ * call to pycompile(), pycompile_in_place(), or pycompile_jit() on the same
+ * instance, or until the instance is freed.  Returns NULL on failure.
+ */
+pycompile_entry pycompile_jit(struct pycompiler* compiler);
+
+/*
+ * Fills `stats` with statistics about the most recent call to pycompile().
+ */
+void pycompile_get_stats(struct pycompiler* compiler,
+  struct pycompile_stats* stats);
+
+/*
+ * Returns the name of a phase from `enum pycompile_phase` (e.g. "parse").
+ */
+const char* pycompile_phase_name(int phase);
+
+/*
+ * Returns the name of an AST node type counted in `struct pycompile_stats`
+ * (e.g. "while_stmt").
+ */
+const char* pycompile_node_type_name(int type);
+
+/*
+ * Releases the current module to the caller, who becomes responsible for
+ * disposing of it with LLVMDisposeModule().  The module belongs to the
+ * instance's LLVM context, so it must be disposed of before the instance is
+ * freed.  Returns NULL if there is no current module.
+ */
+LLVMModuleRef pycompile_take_module(struct pycompiler* compiler);
+
+#endif
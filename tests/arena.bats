@@ -0,0 +1,41 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+PYTHON_DIR="${BATS_TEST_DIRNAME}/python/"
+
+
+@test "AST objects are served from far fewer heap allocations" {
+	for pyfile in "${PYTHON_DIR}"/*.py; do
+		stats=$("${COMPILER}" --alloc-stats < "${pyfile}" 2>&1 >/dev/null)
+		echo "$(basename "${pyfile}"): ${stats}"
+		objects=$(echo "${stats}" | sed -E 's/.* ([0-9]+) objects.*/\1/')
+		heap_allocs=$(echo "${stats}" | sed -E 's/.* ([0-9]+) heap allocations$/\1/')
+		[ "${objects}" -gt 0 ]
+		[ "${heap_allocs}" -ge 1 ]
+		[ "${heap_allocs}" -le "${objects}" ]
+	done
+}
+
+
+@test "Heap allocations don't grow with the size of the program" {
+	program="${BATS_TMPDIR}/arena_large.py"
+	{
+		echo "x = 0"
+		for n in $(seq 1 20000); do
+			echo "x = x + 1"
+		done
+	} > "${program}"
+
+	stats=$("${COMPILER}" --alloc-stats -i "${program}" 2>&1 >/dev/null)
+	echo "${stats}"
+	objects=$(echo "${stats}" | sed -E 's/.* ([0-9]+) objects.*/\1/')
+	heap_allocs=$(echo "${stats}" | sed -E 's/.* ([0-9]+) heap allocations$/\1/')
+	[ "$((heap_allocs * 1000))" -lt "${objects}" ]
+}
+
+
+
+@test "Allocation statistics are rejected in batch mode" {
+	run "${COMPILER}" --batch --alloc-stats "${PYTHON_DIR}/straightline_1.py"
+	[ "$status" -ne 0 ]
+}
@@ -0,0 +1,101 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+PYTHON_DIR="${BATS_TEST_DIRNAME}/python/"
+RETURN_VALUE_DIR="${BATS_TEST_DIRNAME}/return_value/"
+
+
+#
+# This function generates a C driver program (at the path given by argument $1)
+# that calls the batch-compiled entry point of every test program and prints
+# each return value on its own line, in the same order as the test programs.
+#
+generate_driver() {
+	local driver_c="$1"
+
+	echo "#include <stdio.h>" > "${driver_c}"
+	for pyfile in "${PYTHON_DIR}"/*.py; do
+		echo "extern float target_$(basename "${pyfile}" .py)();" >> "${driver_c}"
+	done
+	echo "int main() {" >> "${driver_c}"
+	for pyfile in "${PYTHON_DIR}"/*.py; do
+		echo "    printf(\"%.3f\\n\", target_$(basename "${pyfile}" .py)());" >> "${driver_c}"
+	done
+	echo "}" >> "${driver_c}"
+}
+
+
+#
+# This function prints the expected return values of all test programs, in the
+# same order as the driver program generated above.
+#
+expected_values() {
+	for pyfile in "${PYTHON_DIR}"/*.py; do
+		cat "${RETURN_VALUE_DIR}/$(basename "${pyfile}" .py)"
+	done
+}
+
+
+@test "Batch compilation writes one correct object per input" {
+	local workdir="${BATS_TMPDIR}/batch_objects"
+	rm -rf "${workdir}" && mkdir -p "${workdir}"
+	generate_driver "${workdir}/driver.c"
+
+	cd "${workdir}"
+	"${COMPILER}" --batch "${PYTHON_DIR}"/*.py
+	gcc driver.c *.o -o driver
+	run ./driver
+	expected=$(expected_values)
+	echo "output: $output"
+	echo "expected: $expected"
+	[ "$output" = "$expected" ]
+	rm -rf "${workdir}"
+}
+
+
+
+@test "Batch compilation writes a linkable static archive" {
+	local workdir="${BATS_TMPDIR}/batch_archive"
+	rm -rf "${workdir}" && mkdir -p "${workdir}"
+	generate_driver "${workdir}/driver.c"
+
+	cd "${workdir}"
+	"${COMPILER}" -O2 --batch --archive libprograms.a "${PYTHON_DIR}"/*.py
+	gcc driver.c -L. -lprograms -o driver
+	run ./driver
+	expected=$(expected_values)
+	echo "output: $output"
+	echo "expected: $expected"
+	[ "$output" = "$expected" ]
+	rm -rf "${workdir}"
+}
+
+
+
+@test "Batch compilation gives duplicate file names distinct entry points" {
+	local workdir="${BATS_TMPDIR}/batch_duplicates"
+	rm -rf "${workdir}" && mkdir -p "${workdir}"
+
+	cd "${workdir}"
+	"${COMPILER}" --batch "${PYTHON_DIR}/while_1.py" "${PYTHON_DIR}/while_1.py"
+	[ -f while_1.o ]
+	[ -f while_1_2.o ]
+	rm -rf "${workdir}"
+}
+
+
+
+@test "Parallel batch compilation output is identical to serial output" {
+	local workdir="${BATS_TMPDIR}/batch_parallel"
+	rm -rf "${workdir}" && mkdir -p "${workdir}/serial" "${workdir}/parallel"
+
+	cd "${workdir}/serial"
+	"${COMPILER}" -O2 --batch "${PYTHON_DIR}"/*.py
+	"${COMPILER}" -O2 --batch --archive libprograms.a "${PYTHON_DIR}"/*.py
+	cd "${workdir}/parallel"
+	"${COMPILER}" -O2 --batch -j 4 "${PYTHON_DIR}"/*.py
+	"${COMPILER}" -O2 --batch -j 4 --archive libprograms.a "${PYTHON_DIR}"/*.py
+
+	diff -r "${workdir}/serial" "${workdir}/parallel"
+	rm -rf "${workdir}"
+}
@@ -0,0 +1,27 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+
+
+@test "Blocks may contain any number of statements" {
+	program="${BATS_TMPDIR}/blocks.py"
+	{
+		echo "x = 0"
+		echo "i = 0"
+		echo "while i < 2:"
+		echo "    i = i + 1"
+		echo "    if i > 0:"
+		for n in $(seq 1 100); do
+			echo "        x = x + 1"
+		done
+		echo "    x = x + 1"
+		for n in $(seq 1 10000); do
+			echo "x = x + 1"
+		done
+		echo "return_value = x"
+	} > "${program}"
+
+	run "${COMPILER}" --run < "${program}"
+	[ "$status" -eq 0 ]
+	[ "$output" = "10202.000" ]
+}
@@ -0,0 +1,116 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+PYTHON_DIR="${BATS_TEST_DIRNAME}/python/"
+
+
+#
+# This function prints the value of the row labeled $1 in the statistics of
+# the cache in ${CACHE_DIR}.  Each test starts with a cache of its own.
+#
+cache_stat() {
+	"${COMPILER}" --cache-dir "${CACHE_DIR}" --cache-stats | grep -E "^$1 " | awk '{ print $2 }'
+}
+
+
+@test "A second compile of the same program is a hit with the same outputs" {
+	CACHE_DIR="${BATS_TMPDIR}/cache_hit"
+	rm -rf "${CACHE_DIR}"
+	program="${PYTHON_DIR}/while_4.py"
+	"${COMPILER}" -O2 --cache-dir "${CACHE_DIR}" -i "${program}" "${BATS_TMPDIR}/cache_1.o" > "${BATS_TMPDIR}/cache_1.ll"
+	report=$("${COMPILER}" -O2 --cache-dir "${CACHE_DIR}" --time-report -i "${program}" "${BATS_TMPDIR}/cache_2.o" 2>&1 > "${BATS_TMPDIR}/cache_2.ll")
+	echo "${report}"
+	cmp "${BATS_TMPDIR}/cache_1.ll" "${BATS_TMPDIR}/cache_2.ll"
+	cmp "${BATS_TMPDIR}/cache_1.o" "${BATS_TMPDIR}/cache_2.o"
+	"${COMPILER}" -O2 -i "${program}" | cmp - "${BATS_TMPDIR}/cache_2.ll"
+
+	# Nothing was compiled, and no compiler was even created.
+	echo "${report}" | grep -qE "^cache_lookup +[0-9]"
+	! echo "${report}" | grep -qE "^(create_compiler|parse|codegen) "
+	[ "$(cache_stat hits)" -eq 1 ]
+	[ "$(cache_stat misses)" -eq 1 ]
+}
+
+
+@test "Anything that changes the output misses the cache" {
+	CACHE_DIR="${BATS_TMPDIR}/cache_miss"
+	rm -rf "${CACHE_DIR}"
+	program="${BATS_TMPDIR}/cache.py"
+	profile="${BATS_TMPDIR}/cache.profile"
+	echo "return_value = 1" > "${program}"
+	"${COMPILER}" --cache-dir "${CACHE_DIR}" < "${program}" > /dev/null
+	"${COMPILER}" -O2 --cache-dir "${CACHE_DIR}" < "${program}" > /dev/null
+	"${COMPILER}" --mcpu x86-64 --cache-dir "${CACHE_DIR}" < "${program}" > /dev/null
+	"${COMPILER}" --stream --cache-dir "${CACHE_DIR}" < "${program}" > /dev/null
+	"${COMPILER}" --profile-generate="${profile}" --cache-dir "${CACHE_DIR}" < "${program}" > /dev/null
+	echo "return_value = 2" > "${program}"
+	"${COMPILER}" --cache-dir "${CACHE_DIR}" < "${program}" > /dev/null
+	[ "$(cache_stat hits)" -eq 0 ]
+	[ "$(cache_stat misses)" -eq 6 ]
+
+	# Object code that wasn't asked for the first time isn't cached yet.
+	"${COMPILER}" --cache-dir "${CACHE_DIR}" < "${program}" "${BATS_TMPDIR}/cache.o" > /dev/null
+	[ "$(cache_stat misses)" -eq 7 ]
+	"${COMPILER}" --cache-dir "${CACHE_DIR}" < "${program}" "${BATS_TMPDIR}/cache.o" > /dev/null
+	[ "$(cache_stat hits)" -eq 1 ]
+}
+
+
+@test "--cache-hardlink links the cached object code" {
+	CACHE_DIR="${BATS_TMPDIR}/cache_hardlink"
+	rm -rf "${CACHE_DIR}"
+	program="${PYTHON_DIR}/while_1.py"
+	"${COMPILER}" --cache-dir "${CACHE_DIR}" --cache-hardlink -i "${program}" "${BATS_TMPDIR}/cache_link.o" > /dev/null
+	rm -f "${BATS_TMPDIR}/cache_link.o"
+	"${COMPILER}" --cache-dir "${CACHE_DIR}" --cache-hardlink -i "${program}" "${BATS_TMPDIR}/cache_link.o" > /dev/null
+	[ "$(stat -c %h "${BATS_TMPDIR}/cache_link.o")" -eq 2 ]
+	gcc "${BATS_TEST_DIRNAME}/../target.c" "${BATS_TMPDIR}/cache_link.o" -o "${BATS_TMPDIR}/cache_link"
+	[ "$("${BATS_TMPDIR}/cache_link")" = "$("${COMPILER}" --run -i "${program}")" ]
+}
+
+
+@test "The cache is kept within its size limit" {
+	CACHE_DIR="${BATS_TMPDIR}/cache_evict"
+	rm -rf "${CACHE_DIR}"
+	for pyfile in "${PYTHON_DIR}"/*.py; do
+		"${COMPILER}" --cache-dir "${CACHE_DIR}" --cache-max-size 2K -i "${pyfile}" "${BATS_TMPDIR}/cache_evict.o" > /dev/null
+	done
+	"${COMPILER}" --cache-dir "${CACHE_DIR}" --cache-stats
+	[ "$(cache_stat bytes)" -le 2048 ]
+	[ "$(cache_stat evictions)" -gt 0 ]
+	[ "$(ls "${CACHE_DIR}" | grep -vc '^stats$')" -eq "$(cache_stat files)" ]
+}
+
+
+@test "Compiles running at once share the cache" {
+	CACHE_DIR="${BATS_TMPDIR}/cache_parallel"
+	rm -rf "${CACHE_DIR}"
+	for i in $(seq 1 8); do
+		"${COMPILER}" --cache-dir "${CACHE_DIR}" -i "${PYTHON_DIR}/while_4.py" "${BATS_TMPDIR}/cache_par_$i.o" > "${BATS_TMPDIR}/cache_par_$i.ll" &
+	done
+	wait
+	"${COMPILER}" -i "${PYTHON_DIR}/while_4.py" "${BATS_TMPDIR}/cache_par.o" > "${BATS_TMPDIR}/cache_par.ll"
+	for i in $(seq 1 8); do
+		cmp "${BATS_TMPDIR}/cache_par.ll" "${BATS_TMPDIR}/cache_par_$i.ll"
+		cmp "${BATS_TMPDIR}/cache_par.o" "${BATS_TMPDIR}/cache_par_$i.o"
+	done
+	[ "$(( $(cache_stat hits) + $(cache_stat misses) ))" -eq 8 ]
+	! ls "${CACHE_DIR}" | grep -q "^tmp\."
+}
+
+
+@test "Cache options are rejected where they can't apply" {
+	CACHE_DIR="${BATS_TMPDIR}/cache_options"
+	rm -rf "${CACHE_DIR}"
+	run "${COMPILER}" --cache-stats
+	[ "$status" -eq 1 ]
+	run "${COMPILER}" --cache-dir "${CACHE_DIR}" --cache-max-size 10X < "${PYTHON_DIR}/while_1.py"
+	[ "$status" -eq 1 ]
+	echo "$output" | grep -q "invalid cache size"
+	run "${COMPILER}" --cache-dir "${CACHE_DIR}" --batch "${PYTHON_DIR}/while_1.py"
+	[ "$status" -eq 1 ]
+
+	# --run has nothing to cache.
+	[ "$("${COMPILER}" --cache-dir "${CACHE_DIR}" --run < "${PYTHON_DIR}/while_1.py")" = "110.000" ]
+	[ ! -e "${CACHE_DIR}" ]
+}
@@ -0,0 +1,87 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+PYTHON_DIR="${BATS_TEST_DIRNAME}/python/"
+
+
+@test "Each kind of output can be emitted on its own" {
+	program="${PYTHON_DIR}/while_4.py"
+	"${COMPILER}" -i "${program}" "${BATS_TMPDIR}/emit_default.o" > "${BATS_TMPDIR}/emit_default.ll"
+	"${COMPILER}" --emit=ir -i "${program}" | cmp - "${BATS_TMPDIR}/emit_default.ll"
+	"${COMPILER}" --emit=obj -i "${program}" | cmp - "${BATS_TMPDIR}/emit_default.o"
+	"${COMPILER}" --emit=bc -i "${program}" "${BATS_TMPDIR}/emit.bc"
+	[ "$(head -c 2 "${BATS_TMPDIR}/emit.bc")" = "BC" ]
+	"${COMPILER}" --emit=asm -i "${program}" | grep -q "^target:"
+}
+
+
+@test "Several kinds of output are named after the output file" {
+	rm -f "${BATS_TMPDIR}"/emit_all.*
+	program="${PYTHON_DIR}/while_1.py"
+	"${COMPILER}" --emit=ir,bc,asm,obj -i "${program}" "${BATS_TMPDIR}/emit_all.o"
+	for ext in ll bc s o; do
+		[ -s "${BATS_TMPDIR}/emit_all.${ext}" ]
+	done
+	"${COMPILER}" -i "${program}" | cmp - "${BATS_TMPDIR}/emit_all.ll"
+	gcc "${BATS_TEST_DIRNAME}/../target.c" "${BATS_TMPDIR}/emit_all.s" -o "${BATS_TMPDIR}/emit_all"
+	[ "$("${BATS_TMPDIR}/emit_all")" = "$("${COMPILER}" --run -i "${program}")" ]
+}
+
+
+@test "--emit=none checks the program without writing anything" {
+	[ -z "$("${COMPILER}" --emit=none -i "${PYTHON_DIR}/while_1.py")" ]
+	run "${COMPILER}" --emit=none <<< "x = "
+	[ "$status" -ne 0 ]
+}
+
+
+@test "Invalid uses of --emit are rejected" {
+	run "${COMPILER}" --emit=exe < "${PYTHON_DIR}/while_1.py"
+	[ "$status" -eq 1 ]
+	echo "$output" | grep -q "unknown output kind"
+	run "${COMPILER}" --emit=ir,obj < "${PYTHON_DIR}/while_1.py"
+	[ "$status" -eq 1 ]
+	run "${COMPILER}" --emit=obj --run < "${PYTHON_DIR}/while_1.py"
+	[ "$status" -eq 1 ]
+	run "${COMPILER}" --emit=obj --batch "${PYTHON_DIR}/while_1.py"
+	[ "$status" -eq 1 ]
+}
+
+
+@test "Emitted outputs are cached by kind" {
+	CACHE_DIR="${BATS_TMPDIR}/cache_emit"
+	rm -rf "${CACHE_DIR}"
+	program="${PYTHON_DIR}/while_4.py"
+	for kind in ir bc asm obj; do
+		"${COMPILER}" --cache-dir "${CACHE_DIR}" --emit=${kind} -i "${program}" > "${BATS_TMPDIR}/emit_1.${kind}"
+		"${COMPILER}" --cache-dir "${CACHE_DIR}" --emit=${kind} -i "${program}" > "${BATS_TMPDIR}/emit_2.${kind}"
+		cmp "${BATS_TMPDIR}/emit_1.${kind}" "${BATS_TMPDIR}/emit_2.${kind}"
+	done
+	stats=$("${COMPILER}" --cache-dir "${CACHE_DIR}" --cache-stats)
+	echo "${stats}" | grep -qE "^hits +4$"
+	echo "${stats}" | grep -qE "^files +4$"
+}
+
+
+@test "--emit=gv writes a GraphViz digraph of the AST without compiling it" {
+	program="${PYTHON_DIR}/while_1.py"
+	gv=$("${COMPILER}" --emit=gv --time-report -i "${program}" 2> "${BATS_TMPDIR}/emit_gv.report")
+	[ "$(echo "${gv}" | head -n 1)" = "digraph AST {" ]
+	[ "$(echo "${gv}" | tail -n 1)" = "}" ]
+	echo "${gv}" | grep -qF '[label="WHILE"];'
+	echo "${gv}" | grep -qF '[taillabel="cond"];'
+	grep -qE "^emit_graphviz +[0-9]" "${BATS_TMPDIR}/emit_gv.report"
+	! grep -qE "^(parse|codegen) " "${BATS_TMPDIR}/emit_gv.report"
+
+	# Every edge joins two declared nodes.
+	nodes=$(echo "${gv}" | grep -oE '^	n[0-9]+ \[' | grep -oE 'n[0-9]+' | sort -u)
+	for node in $(echo "${gv}" | grep -oE 'n[0-9]+ -> n[0-9]+' | sed 's/ -> /\n/' | sort -u); do
+		echo "${nodes}" | grep -qx "${node}"
+	done
+
+	# It's the same alongside other outputs and in streaming mode.
+	"${COMPILER}" --emit=gv,ir -i "${program}" "${BATS_TMPDIR}/emit_gv.o"
+	[ "$(cat "${BATS_TMPDIR}/emit_gv.gv")" = "${gv}" ]
+	"${COMPILER}" -i "${program}" | cmp - "${BATS_TMPDIR}/emit_gv.ll"
+	[ "$("${COMPILER}" --stream --emit=gv -i "${program}")" = "${gv}" ]
+}
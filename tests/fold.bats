@@ -0,0 +1,123 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+
+
+@test "Constant expressions are folded at -O0" {
+	program="${BATS_TMPDIR}/fold_const.py"
+	{
+		echo "a = 2 * 3.5"
+		echo "b = (2 + 3) * (4 - 1)"
+		echo "c = True == 1"
+		echo "return_value = a + b + c"
+	} > "${program}"
+	ir=$("${COMPILER}" -O0 < "${program}")
+	echo "${ir}"
+	echo "${ir}" | grep -q "ret float 2.300000e+01"
+	! echo "${ir}" | grep -q "fmul"
+	! echo "${ir}" | grep -q "fcmp"
+	[ "$("${COMPILER}" --run < "${program}")" = "23.000" ]
+}
+
+
+@test "Only identities that hold for every value are applied" {
+	program="${BATS_TMPDIR}/fold_identity.py"
+	{
+		echo "x = 1.0"
+		echo "i = 0"
+		echo "while i < 1:"
+		echo "    x = 0.0 * (0 - 1)"
+		echo "    i = i + 1"
+		echo "a = x * 1"
+		echo "b = 1 * a"
+		echo "c = (b / 2) / 1"
+		echo "d = c - 0"
+		echo "e = 0 + d"
+		echo "return_value = e"
+	} > "${program}"
+	ir=$("${COMPILER}" -O0 < "${program}")
+	echo "${ir}"
+	! echo "${ir}" | grep -q "fmul"
+	[ "$(echo "${ir}" | grep -c "fdiv")" -eq 1 ]
+	! echo "${ir}" | grep -q "fsub"
+	echo "${ir}" | grep -q "fadd"
+	[ "$("${COMPILER}" --run < "${program}")" = "0.000" ]
+}
+
+
+@test "Constant conditions remove dead branches and loops" {
+	program="${BATS_TMPDIR}/fold_branches.py"
+	{
+		echo "x = 1"
+		echo "if 1 > 2:"
+		echo "    x = 100"
+		echo "else:"
+		echo "    x = x + 1"
+		echo "while False:"
+		echo "    x = x + 1000"
+		echo "if x == x:"
+		echo "    x = x * 3"
+		echo "return_value = x"
+	} > "${program}"
+	ir=$("${COMPILER}" -O0 < "${program}")
+	echo "${ir}"
+	! echo "${ir}" | grep -q "ifBlock"
+	! echo "${ir}" | grep -q "whileBlock"
+	[ "$("${COMPILER}" --run < "${program}")" = "6.000" ]
+}
+
+
+#
+# Folding must compute exactly what the generated code would have, so each
+# of these expressions is compared with the same expression over variables,
+# which can't be folded.
+#
+@test "Folded expressions match the unfolded code" {
+	for expr in "1 / 3" "16777217 + 0" "0 / 0 == 0 / 0" "0 / 0 != 1" "1 / 0 - 1 / 0 > 0" \
+			"2147483647 * 2" "65536 * 65536" "0 - 2147483647 - 2" "True + True" "3 <= 3.0" "(7 - 2) / (1 + 1)"; do
+		folded="${BATS_TMPDIR}/fold_folded.py"
+		unfolded="${BATS_TMPDIR}/fold_unfolded.py"
+		echo "return_value = ${expr}" > "${folded}"
+		{
+			echo "zero = 0"
+			echo "one = 1"
+			echo "return_value = ${expr}" | sed -E 's/([0-9]+(\.[0-9]+)?|True)/(zero + \1 * one)/g'
+		} > "${unfolded}"
+		echo "${expr}: $("${COMPILER}" --run < "${folded}") $("${COMPILER}" --run < "${unfolded}")"
+		[ "$("${COMPILER}" --run < "${folded}")" = "$("${COMPILER}" --run < "${unfolded}")" ]
+	done
+}
+
+
+#
+# An integer variable times a float constant is a float, so `x * 1.0` can't
+# become `x`, or it would be exact where the float rounds.
+#
+@test "Identities with float constants keep integers as floats" {
+	program="${BATS_TMPDIR}/fold_float_identity.py"
+	for expr in "x * 1.0" "1.0 * x" "x - 0.0"; do
+		{
+			echo "x = 16777217"
+			echo "y = ${expr}"
+			echo "return_value = y - 16777216"
+		} > "${program}"
+		echo "${expr}: $("${COMPILER}" --run < "${program}")"
+		[ "$("${COMPILER}" --run < "${program}")" = "0.000" ]
+		[ "$("${COMPILER}" -O2 --run < "${program}")" = "0.000" ]
+	done
+
+	# A division is always a float, so it still loses the identities.
+	{
+		echo "a = 3"
+		echo "i = 0"
+		echo "while i < 1:"
+		echo "    a = a + 1"
+		echo "    i = i + 1"
+		echo "return_value = (a / 2) * 1.0 - 0.0"
+	} > "${program}"
+	ir=$("${COMPILER}" -O0 < "${program}")
+	echo "${ir}"
+	echo "${ir}" | grep -q "fdiv"
+	! echo "${ir}" | grep -qE "fmul|fsub"
+	[ "$("${COMPILER}" --run < "${program}")" = "2.000" ]
+}
@@ -0,0 +1,36 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+GEN="${BATS_TEST_DIRNAME}/../gen_program"
+
+
+@test "Generated programs of every shape compile and give the same result at every optimization level" {
+	for shape in straight nested vars chain; do
+		program="${BATS_TMPDIR}/gen_${shape}.py"
+		"${GEN}" "${shape}" 500 > "${program}"
+		expected=$("${COMPILER}" -O0 --run -i "${program}")
+		[ -n "${expected}" ]
+		[ "$("${COMPILER}" -O2 --run -i "${program}")" = "${expected}" ]
+		[ "$("${COMPILER}" --stream --run -i "${program}")" = "${expected}" ]
+	done
+}
+
+
+@test "The nested shape nests blocks 100 levels deep" {
+	"${GEN}" nested 1000 > "${BATS_TMPDIR}/gen_nested.py"
+	grep -q "^$(printf '    %.0s' $(seq 100))v[0-9]* = " "${BATS_TMPDIR}/gen_nested.py"
+	"${COMPILER}" -O0 -i "${BATS_TMPDIR}/gen_nested.py" > /dev/null
+}
+
+
+@test "The same shape, size, and seed give the same program" {
+	[ "$("${GEN}" straight 100 7)" = "$("${GEN}" straight 100 7)" ]
+	[ "$("${GEN}" straight 100 7)" != "$("${GEN}" straight 100 8)" ]
+}
+
+
+@test "An unknown shape is rejected" {
+	run "${GEN}" spiral 100
+	[ "$status" -ne 0 ]
+	[[ "$output" == *"unknown shape"* ]]
+}
@@ -0,0 +1,25 @@
+#!/usr/bin/env bats
+
+HASH_STRESS="${BATS_TEST_DIRNAME}/../hash_stress"
+HASH_STRESS_SCALAR="${BATS_TEST_DIRNAME}/../hash_stress_scalar"
+
+
+@test "The hash table matches a reference model under random operations" {
+	for seed in 1 2 3; do
+		run "${HASH_STRESS}" "${seed}"
+		echo "${output}"
+		[ "$status" -eq 0 ]
+		echo "${output}" | grep -qE " 0 failures$"
+	done
+}
+
+
+@test "The hash table's scalar probing matches a reference model too" {
+	for seed in 1 2 3; do
+		run "${HASH_STRESS_SCALAR}" "${seed}"
+		echo "${output}"
+		[ "$status" -eq 0 ]
+		[ "$(echo "${output}" | cut -d: -f1)" = "scalar" ]
+	done
+}
+
@@ -0,0 +1,210 @@
+/*
+ * This is a randomized stress test of the hash table in lib/hash.c.  It runs
+ * a long random sequence of inserts, updates, removes, and lookups against
+ * both kinds of table, one that copies its keys and one that borrows them,
+ * and checks every result against a simple reference model: an array with a
+ * slot per possible key.  Every so often, and at the end, it also iterates
+ * over the whole table and checks that it holds exactly the model's entries.
+ *
+ * The sequence goes through phases that grow the table well past its initial
+ * capacity, churn it at a steady size, and then drain it, so the table is
+ * resized both by doubling and by dropping deleted entries in place.
+ *
+ * The hash table probes its control bytes with SSE2 where it's available and
+ * with portable scalar code otherwise, and which one this was built with is
+ * printed along with a summary.  Anything that doesn't match the model is
+ * reported, and the exit status is nonzero.
+ *
+ * Usage: hash_stress [seed [n_ops]]
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../lib/hash.h"
+
+/*
+ * The number of distinct keys used.  Keys are drawn from a space small
+ * enough that inserts and removes keep hitting the same keys.
+ */
+#define N_KEYS 16384
+
+/*
+ * The number of operations between checks of the whole table.
+ */
+#define CHECK_INTERVAL 4096
+
+/*
+ * The reference model: for each key, whether it's in the table and, if so,
+ * its value.  `keys` holds the text of each key, which the borrowing table
+ * uses directly.
+ */
+static char* keys[N_KEYS];
+static int present[N_KEYS];
+static uintptr_t values[N_KEYS];
+static size_t n_present;
+
+/*
+ * The number of mismatches with the model found so far.  Only the first few
+ * are reported.
+ */
+static long n_failures;
+
+static void fail(const char* format, ...) {
+    if (n_failures++ < 10) {
+        va_list args;
+        va_start(args, format);
+        fputs("Error: ", stderr);
+        vfprintf(stderr, format, args);
+        fputc('\n', stderr);
+        va_end(args);
+    }
+}
+
+/*
+ * Makes the text of each key.  Keys have varied lengths and share long
+ * prefixes, so comparisons can't stop at the first few characters.
+ */
+static void make_keys(void) {
+    for (int i = 0; i < N_KEYS; i++) {
+        keys[i] = malloc(64);
+        assert(keys[i]);
+        snprintf(keys[i], 64, "%.*skey_%d", i % 23, "prefix_prefix_prefix_pr",
+            i);
+    }
+}
+
+/*
+ * Checks that iterating over the table gives exactly the model's entries,
+ * each once.
+ */
+static void check_all(struct hash* hash) {
+    static int seen[N_KEYS];
+    memset(seen, 0, sizeof(seen));
+    size_t n_seen = 0;
+    struct hash_iter* iter = hash_iter_create(hash);
+    while (hash_iter_has_next(iter)) {
+        char* key;
+        uintptr_t value = (uintptr_t)hash_iter_next(iter, &key);
+        int i = (int)(value % N_KEYS);
+        if (strcmp(key, keys[i])) {
+            fail("iteration gave unknown key \"%s\"", key);
+            continue;
+        }
+        if (!present[i] || values[i] != value) {
+            fail("iteration gave removed key or stale value \"%s\"", key);
+        }
+        if (seen[i]++) {
+            fail("iteration gave key \"%s\" twice", key);
+        }
+        n_seen++;
+    }
+    hash_iter_free(iter);
+    if (n_seen != n_present) {
+        fail("iteration gave %zu keys instead of %zu", n_seen, n_present);
+    }
+}
+
+/*
+ * Runs `n_ops` random operations on `hash`, checking each against the model.
+ * If the table copies its keys, they're passed in a scratch buffer that's
+ * clobbered right after, so a table that kept the pointer would be caught.
+ * Returns the most keys the table held at once.
+ */
+static size_t run(struct hash* hash, int owns_keys, long n_ops) {
+    static uint32_t generation;
+    char scratch[64];
+    size_t max_present = 0;
+
+    memset(present, 0, sizeof(present));
+    n_present = 0;
+    for (long op = 0; op < n_ops; op++) {
+        /*
+         * Grow for the first third, churn for the second, and drain for the
+         * last, by changing the odds of an insert versus a remove.
+         */
+        int insert_odds = op < n_ops / 3 ? 70 : op < 2 * n_ops / 3 ? 50 : 20;
+        int i = rand() % N_KEYS;
+        char* key = keys[i];
+        if (owns_keys) {
+            strcpy(scratch, keys[i]);
+            key = scratch;
+        }
+
+        int r = rand() % 100;
+        if (r < 40) {
+            uintptr_t value = (uintptr_t)hash_get(hash, key);
+            if (present[i] ? value != values[i] : value != 0) {
+                fail("hash_get() gave the wrong value for \"%s\"", key);
+            }
+            if (hash_contains(hash, key) != present[i]) {
+                fail("hash_contains() was wrong for \"%s\"", key);
+            }
+        } else if (r < 40 + 60 * insert_odds / 100) {
+            /*
+             * A value is never 0, and is the key's index modulo N_KEYS, so
+             * iteration can tell which key it belongs to.
+             */
+            generation = generation % 200000 + 1;
+            uintptr_t value = i + (uintptr_t)N_KEYS * generation;
+            hash_insert(hash, key, (void*)value);
+            n_present += !present[i];
+            present[i] = 1;
+            values[i] = value;
+        } else {
+            hash_remove(hash, key);
+            n_present -= present[i];
+            present[i] = 0;
+        }
+        memset(scratch, 'x', sizeof(scratch) - 1);
+        scratch[sizeof(scratch) - 1] = '\0';
+
+        if (n_present > max_present) {
+            max_present = n_present;
+        }
+        if ((op + 1) % CHECK_INTERVAL == 0) {
+            check_all(hash);
+        }
+    }
+    check_all(hash);
+
+    for (int i = 0; i < N_KEYS; i++) {
+        uintptr_t value = (uintptr_t)hash_get(hash, keys[i]);
+        if (value != (present[i] ? values[i] : 0)) {
+            fail("the final table has the wrong value for \"%s\"", keys[i]);
+        }
+    }
+    return max_present;
+}
+
+int main(int argc, char** argv) {
+    unsigned seed = argc > 1 ? (unsigned)strtoul(argv[1], NULL, 10) : 1;
+    long n_ops = argc > 2 ? strtol(argv[2], NULL, 10) : 1000000;
+    srand(seed);
+    make_keys();
+
+    struct hash* owned = hash_create();
+    size_t owned_max = run(owned, 1, n_ops);
+    hash_free(owned);
+
+    struct hash* borrowed = hash_create_borrowed();
+    size_t borrowed_max = run(borrowed, 0, n_ops);
+    hash_free(borrowed);
+
+    for (int i = 0; i < N_KEYS; i++) {
+        free(keys[i]);
+    }
+
+#ifdef __SSE2__
+    const char* path = "sse2";
+#else
+    const char* path = "scalar";
+#endif
+    printf("%s: %ld operations per table, up to %zu and %zu keys, "
+        "%ld failures\n", path, n_ops, owned_max, borrowed_max, n_failures);
+    return n_failures != 0;
+}
@@ -0,0 +1,43 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+PYTHON_DIR="${BATS_TEST_DIRNAME}/python/"
+
+
+@test "Programs given with -i compile the same as on stdin" {
+	for pyfile in "${PYTHON_DIR}"/*.py; do
+		echo "$(basename "${pyfile}")"
+		diff <("${COMPILER}" -O2 -i "${pyfile}") <("${COMPILER}" -O2 < "${pyfile}")
+	done
+}
+
+
+#
+# The source file is mapped into memory when its last page has room for two
+# terminating '\0' bytes and read otherwise, so this tries sizes on both sides
+# of a page boundary.
+#
+@test "Programs ending near a page boundary compile with -i" {
+	page_size=$(getconf PAGESIZE)
+	program="${BATS_TMPDIR}/page.py"
+	for size in $((page_size - 3)) $((page_size - 2)) $((page_size - 1)) ${page_size} $((page_size + 1)); do
+		{
+			echo "x = 2"
+			echo "return_value = x * 21"
+		} > "${program}"
+		padding=$((size - $(wc -c < "${program}") - 2))
+		printf '#%*s\n' "${padding}" "" >> "${program}"
+		[ "$(wc -c < "${program}")" -eq "${size}" ]
+
+		run "${COMPILER}" --run -i "${program}"
+		echo "${size}: $output"
+		[ "$status" -eq 0 ]
+		[ "$output" = "42.000" ]
+	done
+}
+
+
+@test "A missing input file is an error" {
+	run "${COMPILER}" -i "${BATS_TMPDIR}/does_not_exist.py"
+	[ "$status" -ne 0 ]
+}
@@ -0,0 +1,42 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+PYTHON_DIR="${BATS_TEST_DIRNAME}/python/"
+RETURN_VALUE_DIR="${BATS_TEST_DIRNAME}/return_value/"
+
+
+#
+# This function runs every test program through the compiler's JIT mode at
+# the optimization level given by argument $1 and compares the printed value
+# against the expected return value.
+#
+check_all_programs() {
+	local opt_flag="$1"
+
+	for pyfile in "${PYTHON_DIR}"/*.py; do
+		filename=$(basename "${pyfile}" .py)
+		run "${COMPILER}" "${opt_flag}" --run < "${pyfile}"
+		expected=$(cat "${RETURN_VALUE_DIR}/${filename}")
+		echo "${filename} ${opt_flag} output: $output expected: $expected"
+		[ "$status" -eq 0 ]
+		[ "$output" = "$expected" ]
+	done
+}
+
+
+@test "JIT run mode computes correct values at -O0" {
+	check_all_programs -O0
+}
+
+
+
+@test "JIT run mode computes correct values at -O2" {
+	check_all_programs -O2
+}
+
+
+
+@test "JIT run mode rejects an output file" {
+	run "${COMPILER}" --run "${BATS_TMPDIR}/target.o" < "${PYTHON_DIR}/straightline_1.py"
+	[ "$status" -ne 0 ]
+}
@@ -0,0 +1,99 @@
+#!/usr/bin/env bats
+
+LIBRARY="${BATS_TEST_DIRNAME}/../libpycompile.a"
+INCLUDE_DIR="${BATS_TEST_DIRNAME}/.."
+PYTHON_DIR="${BATS_TEST_DIRNAME}/python/"
+RETURN_VALUE_DIR="${BATS_TEST_DIRNAME}/return_value/"
+LLVM_CONFIG="$(which llvm-config-13 || echo llvm-config)"
+
+
+#
+# This function generates and builds a client of libpycompile (at the path
+# given by argument $1).  The client compiles every file named on its command
+# line with a single compiler instance, entirely in memory, and prints one
+# line per file: the value returned by the JIT-compiled program, whether the
+# IR and object code could be produced, whether the module taken from the
+# compiler verifies, and whether the entry function returned by pycompile_jit()
+# gives the same value each time it's called.
+#
+build_client() {
+	local client="$1"
+
+	cat > "${client}.c" <<'EOF'
+#include <stdio.h>
+#include <stdlib.h>
+#include <llvm-c/Analysis.h>
+#include <llvm-c/Core.h>
+#include "pycompile.h"
+
+int main(int argc, char** argv) {
+    struct pycompile_options options = { PYCOMPILE_O2 };
+    struct pycompiler* compiler = pycompiler_create(&options);
+    for (int i = 1; i < argc; i++) {
+        static char source[65536];
+        FILE* f = fopen(argv[i], "r");
+        size_t len = fread(source, 1, sizeof(source), f);
+        fclose(f);
+
+        float value = 0;
+        char* data = NULL;
+        size_t size = 0;
+        if (pycompile(compiler, source, len, NULL))
+            return 1;
+        char* ir = pycompile_ir(compiler);
+        int obj_status = pycompile_object(compiler, &data, &size);
+        LLVMModuleRef module = pycompile_take_module(compiler);
+        int valid = module && !LLVMVerifyModule(module, LLVMReturnStatusAction, NULL)
+            && LLVMGetNamedFunction(module, "target");
+        LLVMDisposeModule(module);
+
+        if (pycompile(compiler, source, len, NULL) || pycompile_run(compiler, &value))
+            return 1;
+        if (pycompile(compiler, source, len, NULL))
+            return 1;
+        pycompile_entry entry = pycompile_jit(compiler);
+        int jit = entry && entry() == value && entry() == value;
+        printf("%.3f %s %s %s %s\n", value, ir ? "ir" : "-",
+            !obj_status && size > 0 ? "obj" : "-", valid ? "module" : "-", jit ? "jit" : "-");
+        free(ir);
+        free(data);
+    }
+    pycompiler_free(compiler);
+    return 0;
+}
+EOF
+	g++ -x c "${client}.c" -I"${INCLUDE_DIR}" $("${LLVM_CONFIG}" --cflags) -x none \
+		"${LIBRARY}" $("${LLVM_CONFIG}" --ldflags --libs --system-libs all) \
+		-pthread -o "${client}"
+}
+
+
+@test "Library compiles programs from memory to IR, object code, a module, and JIT calls" {
+	local workdir="${BATS_TMPDIR}/library"
+	rm -rf "${workdir}" && mkdir -p "${workdir}"
+	build_client "${workdir}/client"
+
+	run "${workdir}/client" "${PYTHON_DIR}"/*.py
+	echo "$output"
+	[ "$status" -eq 0 ]
+
+	local expected=""
+	for pyfile in "${PYTHON_DIR}"/*.py; do
+		expected+="$(cat "${RETURN_VALUE_DIR}/$(basename "${pyfile}" .py)") ir obj module jit"$'\n'
+	done
+	[ "$output" = "${expected%$'\n'}" ]
+	rm -rf "${workdir}"
+}
+
+
+
+@test "Library reports a syntax error without producing a module" {
+	local workdir="${BATS_TMPDIR}/library_error"
+	rm -rf "${workdir}" && mkdir -p "${workdir}"
+	build_client "${workdir}/client"
+
+	printf 'a = = 1\n' > "${workdir}/bad.py"
+	run "${workdir}/client" "${workdir}/bad.py"
+	[ "$status" -ne 0 ]
+	rm -rf "${workdir}"
+}
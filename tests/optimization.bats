@@ -0,0 +1,85 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+TARGET_C="${BATS_TEST_DIRNAME}/../target.c"
+PYTHON_DIR="${BATS_TEST_DIRNAME}/python/"
+RETURN_VALUE_DIR="${BATS_TEST_DIRNAME}/return_value/"
+
+
+#
+# This function uses the compiler toolchain to generate an object code file
+# (objfile, from argument $3) from the input python file (pyfile, from argument
+# $2) at the optimization level given by argument $1.  Then, it compiles that
+# object file along with target.c to generate an executable (target_exe, from
+# argument $4).
+#
+do_compilation() {
+	local opt_flag="$1"
+	local pyfile="$2"
+	local objfile="$3"
+	local target_exe="$4"
+
+	"${COMPILER}" "${opt_flag}" "${objfile}" < "${pyfile}" > /dev/null
+	gcc "${TARGET_C}" "${objfile}" -o "${target_exe}"
+}
+
+
+#
+# This function compiles every test program at the optimization level given
+# by argument $1 and compares the output of each against its expected return
+# value.
+#
+check_all_programs() {
+	local opt_flag="$1"
+	local objfile="${BATS_TMPDIR}/optimized.o"
+	local target_exe="${BATS_TMPDIR}/target"
+
+	for pyfile in "${PYTHON_DIR}"/*.py; do
+		filename=$(basename "${pyfile}" .py)
+		do_compilation "${opt_flag}" "${pyfile}" "${objfile}" "${target_exe}"
+		run "${target_exe}"
+		expected=$(cat "${RETURN_VALUE_DIR}/${filename}")
+		echo "${filename} ${opt_flag} output: $output expected: $expected"
+		[ "$output" = "$expected" ]
+	done
+	rm -f "${objfile}" "${target_exe}"
+}
+
+
+@test "Correct computation for all programs at -O1" {
+	check_all_programs -O1
+}
+
+
+
+@test "Correct computation for all programs at -O2" {
+	check_all_programs -O2
+}
+
+
+
+@test "Correct computation for all programs at -O3" {
+	check_all_programs -O3
+}
+
+
+
+@test "Correct computation for all programs at -Os" {
+	check_all_programs -Os
+}
+
+
+
+@test "Variables in while_4 live in registers at -O2" {
+	run "${COMPILER}" -O2 < "${PYTHON_DIR}/while_4.py"
+	[ "$status" -eq 0 ]
+	allocas=$(echo "$output" | grep -c "alloca" || true)
+	[ "$allocas" -eq 0 ]
+}
+
+
+
+@test "Unknown optimization level is rejected" {
+	run "${COMPILER}" -O7 < "${PYTHON_DIR}/straightline_1.py"
+	[ "$status" -ne 0 ]
+}
@@ -0,0 +1,113 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+PYTHON_DIR="${BATS_TEST_DIRNAME}/python/"
+RETURN_VALUE_DIR="${BATS_TEST_DIRNAME}/return_value/"
+
+
+#
+# This function writes a program with a loop that runs 10 times and an if
+# whose branch is taken on its last 3 iterations to the file named by $1.
+#
+write_program() {
+	{
+		echo "i = 0"
+		echo "x = 0"
+		echo "while i < 10:"
+		echo "    i = i + 1"
+		echo "    if i > 7:"
+		echo "        x = x + i"
+		echo "return_value = x"
+	} > "$1"
+}
+
+
+@test "--profile-generate counts which way each branch goes" {
+	program="${BATS_TMPDIR}/pgo.py"
+	profile="${BATS_TMPDIR}/pgo.profile"
+	write_program "${program}"
+	rm -f "${profile}"
+	[ "$("${COMPILER}" --profile-generate="${profile}" --run < "${program}")" = "27.000" ]
+	cat "${profile}"
+	[ "$(sed -n 1p "${profile}")" = "# pycompile profile" ]
+	[ "$(sed -n 2p "${profile}" | cut -d' ' -f2-)" = "2 1" ]
+	[ "$(sed -n 3p "${profile}")" = "10 1" ]
+	[ "$(sed -n 4p "${profile}")" = "3 7" ]
+}
+
+
+@test "An object file built with --profile-generate writes the profile" {
+	program="${BATS_TMPDIR}/pgo.py"
+	write_program "${program}"
+	cd "${BATS_TMPDIR}"
+	rm -f pycompile.profile
+	"${COMPILER}" --profile-generate pgo.o < "${program}" > /dev/null
+	gcc "${BATS_TEST_DIRNAME}/../target.c" pgo.o -o pgo
+	[ "$(./pgo)" = "27.000" ]
+	[ "$(sed -n 3p pycompile.profile)" = "10 1" ]
+}
+
+
+@test "--profile-use attaches branch weights and the entry count" {
+	program="${BATS_TMPDIR}/pgo.py"
+	profile="${BATS_TMPDIR}/pgo.profile"
+	write_program "${program}"
+	"${COMPILER}" --profile-generate="${profile}" --run < "${program}" > /dev/null
+	ir=$("${COMPILER}" --profile-use "${profile}" < "${program}")
+	echo "${ir}"
+	echo "${ir}" | grep -q '!{!"function_entry_count", i64 1}'
+	echo "${ir}" | grep -q '!{!"branch_weights", i32 11, i32 2}'
+	echo "${ir}" | grep -q '!{!"branch_weights", i32 4, i32 8}'
+	! echo "${ir}" | grep -q "branch_counter"
+	[ "$("${COMPILER}" -O3 --profile-use="${profile}" --run < "${program}")" = "27.000" ]
+}
+
+
+@test "A profile of a different program isn't used" {
+	program="${BATS_TMPDIR}/pgo.py"
+	profile="${BATS_TMPDIR}/pgo.profile"
+	write_program "${program}"
+	"${COMPILER}" --profile-generate="${profile}" --run < "${program}" > /dev/null
+	run "${COMPILER}" --profile-use "${profile}" < "${PYTHON_DIR}/while_1.py"
+	echo "$output"
+	[ "$status" -eq 0 ]
+	echo "$output" | grep -q "^Warning: the profile doesn't match the program"
+	! echo "$output" | grep -q "branch_weights"
+
+	echo "not a profile" > "${profile}"
+	run "${COMPILER}" --profile-use "${profile}" < "${program}"
+	[ "$status" -eq 0 ]
+	echo "$output" | grep -q "^Warning: the profile is malformed"
+}
+
+
+@test "Instrumented and profile-guided code computes correct values" {
+	profile="${BATS_TMPDIR}/pgo_all.profile"
+	for pyfile in "${PYTHON_DIR}"/*.py; do
+		filename=$(basename "${pyfile}" .py)
+		expected=$(cat "${RETURN_VALUE_DIR}/${filename}")
+		rm -f "${profile}"
+		run "${COMPILER}" -O2 --profile-generate="${profile}" --run < "${pyfile}"
+		echo "${filename} output: $output expected: $expected"
+		[ "$status" -eq 0 ]
+		[ "$output" = "$expected" ]
+		run "${COMPILER}" -O2 --profile-use="${profile}" --run < "${pyfile}"
+		echo "${filename} output: $output expected: $expected"
+		[ "$status" -eq 0 ]
+		[ "$output" = "$expected" ]
+	done
+}
+
+
+@test "Profile options are rejected where they can't apply" {
+	run "${COMPILER}" --profile-generate --profile-use x.profile < "${PYTHON_DIR}/while_1.py"
+	[ "$status" -eq 1 ]
+	echo "$output" | grep -q "cannot be combined"
+
+	run "${COMPILER}" --profile-use "${BATS_TMPDIR}/no_such.profile" < "${PYTHON_DIR}/while_1.py"
+	[ "$status" -eq 1 ]
+	echo "$output" | grep -q "^Error: could not read the profile"
+
+	run "${COMPILER}" --batch --profile-use x.profile "${PYTHON_DIR}/while_1.py"
+	[ "$status" -eq 1 ]
+}
@@ -0,0 +1,104 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+PYTHON_DIR="${BATS_TEST_DIRNAME}/python/"
+
+
+@test "Variables are kept in registers even at -O0" {
+	for py in "${PYTHON_DIR}"/*.py; do
+		ir=$("${COMPILER}" -O0 < "${py}")
+		! echo "${ir}" | grep -qE "alloca|load|store"
+	done
+}
+
+
+@test "Values from both branches of an if meet in a phi" {
+	program="${BATS_TMPDIR}/ssa_if.py"
+	{
+		echo "i = 0"
+		echo "x = 0"
+		echo "y = 0"
+		echo "while i < 10:"
+		echo "    i = i + 1"
+		echo "    if i > 5:"
+		echo "        x = x + i"
+		echo "    else:"
+		echo "        y = y + i"
+		echo "return_value = x * 100 + y"
+	} > "${program}"
+	ir=$("${COMPILER}" -O0 < "${program}")
+	echo "${ir}"
+	echo "${ir}" | grep -qE "%x[0-9]* = phi i32 .*%ifBlock.*%elseBlock"
+	[ "$("${COMPILER}" -O0 --run < "${program}")" = "4015.000" ]
+}
+
+
+#
+# The values of the loop's variables when it exits depend on which of its
+# breaks, if any, was taken.
+#
+@test "Values at each break reach the end of the loop" {
+	program="${BATS_TMPDIR}/ssa_break.py"
+	{
+		echo "i = 0"
+		echo "x = 0"
+		echo "while i < 100:"
+		echo "    i = i + 1"
+		echo "    if i == 7:"
+		echo "        x = 1"
+		echo "        break"
+		echo "    j = 0"
+		echo "    while True:"
+		echo "        j = j + 1"
+		echo "        if j > i:"
+		echo "            break"
+		echo "        x = x + j"
+		echo "return_value = x * 1000 + i"
+	} > "${program}"
+	[ "$("${COMPILER}" -O0 --run < "${program}")" = "1007.000" ]
+	[ "$("${COMPILER}" -O2 --run < "${program}")" = "1007.000" ]
+	[ "$("${COMPILER}" -O0 --stream --run < "${program}")" = "1007.000" ]
+}
+
+
+@test "Variables a loop never changes get no phi" {
+	program="${BATS_TMPDIR}/ssa_trivial.py"
+	{
+		echo "c = 5"
+		echo "d = 2"
+		echo "i = 0"
+		echo "while i < 3:"
+		echo "    c = c"
+		echo "    if i > 1:"
+		echo "        d = d"
+		echo "    i = i + 1"
+		echo "return_value = c + d + i"
+	} > "${program}"
+	ir=$("${COMPILER}" -O0 < "${program}")
+	echo "${ir}"
+	[ "$(echo "${ir}" | grep -c "phi")" -eq 1 ]
+	[ "$("${COMPILER}" --run < "${program}")" = "10.000" ]
+}
+
+
+#
+# A variable first assigned in a loop inside an if is defined by the loop's
+# phi, which doesn't dominate the end of the if, so it still needs a phi
+# there, with undef from the path that skipped the if.
+#
+@test "A variable assigned on only one path is merged with undef" {
+	program="${BATS_TMPDIR}/ssa_undef.py"
+	{
+		echo "x = 1"
+		echo "if x > 0:"
+		echo "    n = 0"
+		echo "    while n < 3:"
+		echo "        n = n + 1"
+		echo "return_value = n"
+	} > "${program}"
+	ir=$("${COMPILER}" -O0 < "${program}")
+	echo "${ir}"
+	echo "${ir}" | grep -qE "%n[0-9]+ = phi i32 \[ %n, %whileContinueBlock \], \[ undef, %entry \]"
+	[ "$("${COMPILER}" -O0 --run < "${program}")" = "3.000" ]
+	[ "$("${COMPILER}" -O2 --run < "${program}")" = "3.000" ]
+}
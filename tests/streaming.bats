@@ -0,0 +1,87 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+PYTHON_DIR="${BATS_TEST_DIRNAME}/python/"
+
+
+@test "Programs compute the same with --stream" {
+	for pyfile in "${PYTHON_DIR}"/*.py; do
+		echo "$(basename "${pyfile}")"
+		[ "$("${COMPILER}" -O0 --stream --run < "${pyfile}")" = "$("${COMPILER}" -O0 --run < "${pyfile}")" ]
+		[ "$("${COMPILER}" -O2 --stream --run < "${pyfile}")" = "$("${COMPILER}" -O2 --run < "${pyfile}")" ]
+	done
+}
+
+
+@test "Programs run the same with --stream" {
+	program="${BATS_TMPDIR}/stream_run.py"
+	{
+		echo "x = 0"
+		echo "i = 0"
+		echo "while i < 100:"
+		echo "    if i > 50:"
+		echo "        break"
+		echo "    x = x + i"
+		echo "    i = i + 1"
+		echo "y = x * 2"
+		echo "return_value = y"
+	} > "${program}"
+	result=$("${COMPILER}" --stream --run < "${program}")
+	[ "${result}" = "2550.000" ]
+}
+
+
+#
+# In streaming mode only one top-level statement is held in the AST at a
+# time, so its peak size must not grow with the number of statements.
+#
+@test "The AST's peak size doesn't grow with the program with --stream" {
+	small="${BATS_TMPDIR}/stream_small.py"
+	large="${BATS_TMPDIR}/stream_large.py"
+	echo "x = 0" > "${small}"
+	echo "x = 0" > "${large}"
+	for n in $(seq 1 10); do
+		echo "x = x + 1" >> "${small}"
+	done
+	for n in $(seq 1 20000); do
+		echo "x = x + 1" >> "${large}"
+	done
+
+	small_bytes=$("${COMPILER}" --stream --alloc-stats < "${small}" 2>&1 >/dev/null | sed -E 's/.* ([0-9]+) bytes.*/\1/')
+	large_stats=$("${COMPILER}" --stream --alloc-stats < "${large}" 2>&1 >/dev/null)
+	full_stats=$("${COMPILER}" --alloc-stats < "${large}" 2>&1 >/dev/null)
+	echo "${small_bytes} / ${large_stats} / ${full_stats}"
+	large_bytes=$(echo "${large_stats}" | sed -E 's/.* ([0-9]+) bytes.*/\1/')
+	full_bytes=$(echo "${full_stats}" | sed -E 's/.* ([0-9]+) bytes.*/\1/')
+	[ "${large_bytes}" -eq "${small_bytes}" ]
+	[ "$((large_bytes * 100))" -lt "${full_bytes}" ]
+	[ "$(echo "${large_stats}" | sed -E 's/AST: ([0-9]+) nodes.*/\1/')" -eq 80003 ]
+}
+
+
+@test "Errors are still reported with --stream" {
+	program="${BATS_TMPDIR}/stream_error.py"
+	{
+		echo "x = 1"
+		echo "y = z + 1"
+		echo "return_value = x"
+	} > "${program}"
+	run "${COMPILER}" --stream < "${program}"
+	[ "$status" -ne 0 ]
+}
+
+
+#
+# Variables' types can't be inferred in streaming mode, so integers are
+# floats there, but integer arithmetic doesn't wrap around without --stream
+# either.
+#
+@test "Integer overflow doesn't wrap around with or without --stream" {
+	program="${BATS_TMPDIR}/stream_overflow.py"
+	{
+		echo "x = 65536"
+		echo "return_value = x * x"
+	} > "${program}"
+	[ "$("${COMPILER}" --run < "${program}")" = "4294967296.000" ]
+	[ "$("${COMPILER}" --stream --run < "${program}")" = "4294967296.000" ]
+}
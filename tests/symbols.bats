@@ -0,0 +1,31 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+
+
+@test "Using an identifier before it is assigned is an error" {
+	run "${COMPILER}" <<-EOF
+		a = 1
+		return_value = a + b
+		b = 2
+	EOF
+	echo "$output"
+	[ "$status" -ne 0 ]
+	[[ "$output" == *"unknown symbol 'b'"* ]]
+}
+
+
+@test "Programs may use many distinct identifiers" {
+	program="${BATS_TMPDIR}/symbols.py"
+	{
+		echo "v0 = 0"
+		for n in $(seq 1 2000); do
+			echo "v${n} = v$((n - 1)) + 1"
+		done
+		echo "return_value = v2000 + v1000"
+	} > "${program}"
+
+	run "${COMPILER}" --run < "${program}"
+	[ "$status" -eq 0 ]
+	[ "$output" = "3000.000" ]
+}
@@ -0,0 +1,49 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+PYTHON_DIR="${BATS_TEST_DIRNAME}/python/"
+RETURN_VALUE_DIR="${BATS_TEST_DIRNAME}/return_value/"
+
+
+@test "Code is generated for a generic CPU by default" {
+	ir=$("${COMPILER}" < "${PYTHON_DIR}/while_1.py")
+	echo "${ir}"
+	! echo "${ir}" | grep -q "target-cpu"
+	! echo "${ir}" | grep -q "target-features"
+}
+
+
+@test "--mcpu native records the host's CPU and features in the IR" {
+	ir=$("${COMPILER}" --mcpu native < "${PYTHON_DIR}/while_1.py")
+	echo "${ir}"
+	echo "${ir}" | grep -qE '"target-cpu"="[^"]+"'
+	! echo "${ir}" | grep -q '"target-cpu"="native"'
+	echo "${ir}" | grep -qE '"target-features"="[+-]'
+}
+
+
+@test "--mattr overrides the features of --mcpu" {
+	if [ "$(uname -m)" != "x86_64" ]; then
+		skip "needs an x86-64 host"
+	fi
+	ir=$("${COMPILER}" --mcpu=x86-64 --mattr=+avx2 < "${PYTHON_DIR}/while_1.py")
+	echo "${ir}"
+	echo "${ir}" | grep -q '"target-cpu"="x86-64"'
+	echo "${ir}" | grep -q '"target-features"="+avx2"'
+}
+
+
+@test "Host-tuned code computes correct values" {
+	for pyfile in "${PYTHON_DIR}"/*.py; do
+		filename=$(basename "${pyfile}" .py)
+		expected=$(cat "${RETURN_VALUE_DIR}/${filename}")
+		run "${COMPILER}" -O3 --mcpu native --run < "${pyfile}"
+		echo "${filename} output: $output expected: $expected"
+		[ "$status" -eq 0 ]
+		[ "$output" = "$expected" ]
+
+		"${COMPILER}" -O3 --mcpu native "${BATS_TMPDIR}/${filename}_native.o" < "${pyfile}" > /dev/null
+		gcc "${BATS_TEST_DIRNAME}/../target.c" "${BATS_TMPDIR}/${filename}_native.o" -o "${BATS_TMPDIR}/${filename}_native"
+		[ "$("${BATS_TMPDIR}/${filename}_native")" = "$expected" ]
+	done
+}
@@ -0,0 +1,88 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+PYTHON_DIR="${BATS_TEST_DIRNAME}/python/"
+
+
+#
+# This function prints the value of the row labeled $1 in a text time
+# report given on stdin.
+#
+report_value() {
+	grep -E "^ *$1  " | awk '{ print $NF }'
+}
+
+
+@test "The time report lists each phase and counts the program's parts" {
+	program="${BATS_TMPDIR}/time_report.py"
+	{
+		echo "x = 1"
+		echo "return_value = x"
+	} > "${program}"
+	report=$("${COMPILER}" --time-report < "${program}" 2>&1 > /dev/null)
+	echo "${report}"
+	for phase in load create_compiler parse fold infer_types codegen optimize print_ir total; do
+		echo "${report}" | grep -qE "^${phase} +[0-9]+\.[0-9]{3}"
+	done
+	! echo "${report}" | grep -q "^jit_run"
+	[ "$(echo "${report}" | report_value tokens)" -eq 8 ]
+	[ "$(echo "${report}" | report_value symbols)" -eq 2 ]
+	[ "$(echo "${report}" | report_value "AST nodes")" -eq 5 ]
+	[ "$(echo "${report}" | report_value assign_stmt)" -eq 2 ]
+	[ "$(echo "${report}" | report_value id_expr)" -eq 1 ]
+	[ "$(echo "${report}" | report_value int_expr)" -eq 1 ]
+	echo "${report}" | grep -qE "^peak RSS \(KiB\) +[1-9][0-9]*$"
+}
+
+
+@test "The time report counts IR before and after optimization" {
+	report=$("${COMPILER}" -O2 --time-report < "${PYTHON_DIR}/while_4.py" 2>&1 > /dev/null)
+	echo "${report}"
+	echo "${report}" | grep -qE "^IR basic blocks +11 -> 1 after optimization"
+	echo "${report}" | grep -qE "^IR instructions +[0-9]+ -> 1 after optimization"
+}
+
+
+@test "The time report doesn't change the output" {
+	for pyfile in "${PYTHON_DIR}"/*.py; do
+		[ "$("${COMPILER}" --time-report < "${pyfile}" 2> /dev/null)" = "$("${COMPILER}" < "${pyfile}")" ]
+		[ "$("${COMPILER}" --run --time-report=json < "${pyfile}" 2> /dev/null)" = "$("${COMPILER}" --run < "${pyfile}")" ]
+	done
+}
+
+
+@test "The time report and trace are valid JSON" {
+	if ! command -v python3 > /dev/null; then
+		skip "needs python3 to check JSON"
+	fi
+	trace="${BATS_TMPDIR}/time_trace.json"
+	report=$("${COMPILER}" --run --stream --time-report=json --time-trace "${trace}" < "${PYTHON_DIR}/while_4.py" 2>&1 > /dev/null)
+	echo "${report}"
+	echo "${report}" | python3 -c '
+import json, sys
+report = json.load(sys.stdin)
+names = [p["name"] for p in report["phases"]]
+assert names == ["load", "create_compiler", "parse", "codegen", "optimize", "jit_run"], names
+assert report["counters"]["ast_nodes"] == sum(report["counters"]["ast_nodes_by_type"].values())
+'
+	python3 -c '
+import json, sys
+events = json.load(open(sys.argv[1]))["traceEvents"]
+phases = [e for e in events if e["ph"] == "X"]
+assert [e["name"] for e in phases][-1] == "jit_run"
+assert all(e["dur"] >= 0 and e["ts"] >= 0 for e in phases)
+assert all(a["ts"] + a["dur"] <= b["ts"] + 1 for a, b in zip(phases, phases[1:]))
+' "${trace}"
+}
+
+
+@test "Object emission is timed" {
+	report=$("${COMPILER}" --time-report "${BATS_TMPDIR}/time_report.o" < "${PYTHON_DIR}/while_4.py" 2>&1 > /dev/null)
+	echo "${report}" | grep -qE "^emit_object +[0-9]+\.[0-9]{3}"
+}
+
+
+@test "Batch mode rejects --time-report" {
+	run "${COMPILER}" --batch --time-report "${PYTHON_DIR}/while_4.py"
+	[ "$status" -ne 0 ]
+}
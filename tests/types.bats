@@ -0,0 +1,127 @@
+#!/usr/bin/env bats
+
+COMPILER="${BATS_TEST_DIRNAME}/../compile"
+PYTHON_DIR="${BATS_TEST_DIRNAME}/python/"
+
+
+@test "Integer variables use i32 arithmetic and i1 branch conditions" {
+	ir=$("${COMPILER}" -O0 < "${PYTHON_DIR}/while_1.py")
+	echo "${ir}"
+	echo "${ir}" | grep -q "%i = phi i32"
+	echo "${ir}" | grep -q "%k = phi i32"
+	echo "${ir}" | grep -q "icmp slt i32"
+	echo "${ir}" | grep -q "br i1 %lttmp"
+	! echo "${ir}" | grep -q "fcmp"
+	! echo "${ir}" | grep -q "fadd"
+	[ "$(echo "${ir}" | grep -c "sitofp")" -eq 1 ]
+}
+
+
+@test "Boolean variables are i1 and branched on directly" {
+	ir=$("${COMPILER}" -O0 < "${PYTHON_DIR}/ifelse_5.py")
+	echo "${ir}"
+	echo "${ir}" | grep -q "br i1 true, label %ifBlock"
+	echo "${ir}" | grep -q "br i1 false, label %ifBlock"
+	! echo "${ir}" | grep -q "ifcond"
+}
+
+
+@test "A variable that is ever assigned a float is a float" {
+	program="${BATS_TMPDIR}/types_mixed.py"
+	{
+		echo "x = 1"
+		echo "y = 2"
+		echo "i = 0"
+		echo "while i < 3:"
+		echo "    x = y"
+		echo "    y = 0.5"
+		echo "    i = i + 1"
+		echo "b = x > 0"
+		echo "n = b + b"
+		echo "return_value = x + n"
+	} > "${program}"
+	ir=$("${COMPILER}" -O0 < "${program}")
+	echo "${ir}"
+	echo "${ir}" | grep -q "%x = phi float"
+	echo "${ir}" | grep -q "%y = phi float"
+	echo "${ir}" | grep -q "%i = phi i32"
+	echo "${ir}" | grep -q "zext i1 %gttmp to i32"
+	echo "${ir}" | grep -q "add i32 %inttmp"
+	[ "$("${COMPILER}" --run < "${program}")" = "2.500" ]
+}
+
+
+#
+# Types flow backwards through this chain of variables one step per loop
+# iteration, so this checks that they're propagated all the way, not just
+# over one pass through the program.
+#
+@test "Types are propagated through long chains of variables" {
+	program="${BATS_TMPDIR}/types_chain.py"
+	{
+		for n in $(seq 1 2000); do
+			echo "v${n} = 0"
+		done
+		echo "i = 0"
+		echo "while i < 2001:"
+		for n in $(seq 1 1999); do
+			echo "    v${n} = v$((n + 1))"
+		done
+		echo "    v2000 = 0.5"
+		echo "    i = i + 1"
+		echo "return_value = v1"
+	} > "${program}"
+	ir=$("${COMPILER}" -O0 < "${program}")
+	echo "${ir}" | grep -q "%v1 = phi float"
+	[ "$("${COMPILER}" --run < "${program}")" = "0.500" ]
+}
+
+
+@test "Integer arithmetic is exact" {
+	program="${BATS_TMPDIR}/types_exact.py"
+	{
+		echo "x = 16777217"
+		echo "y = 16777216"
+		echo "return_value = x - y"
+	} > "${program}"
+	[ "$("${COMPILER}" --run < "${program}")" = "1.000" ]
+	[ "$("${COMPILER}" -O2 --run < "${program}")" = "1.000" ]
+}
+
+
+#
+# Arithmetic that might not fit in 32 bits is done on floats, whether or not
+# a loop's trip count bounds it, rather than wrapping around.
+#
+@test "Integer arithmetic that might overflow is done on floats" {
+	program="${BATS_TMPDIR}/types_overflow.py"
+	{
+		echo "x = 65536"
+		echo "return_value = x * x"
+	} > "${program}"
+	[ "$("${COMPILER}" --run < "${program}")" = "4294967296.000" ]
+	[ "$("${COMPILER}" -O2 --run < "${program}")" = "4294967296.000" ]
+
+	{
+		echo "i = 0"
+		echo "k = 1"
+		echo "while i < 40:"
+		echo "    k = k * 2"
+		echo "    i = i + 1"
+		echo "return_value = k"
+	} > "${program}"
+	ir=$("${COMPILER}" -O0 < "${program}")
+	echo "${ir}"
+	echo "${ir}" | grep -q "%i = phi i32"
+	echo "${ir}" | grep -q "%k = phi float"
+	[ "$("${COMPILER}" --run < "${program}")" = "1099511627776.000" ]
+
+	{
+		echo "x = 1"
+		echo "while x < 1000000000:"
+		echo "    x = x * 10"
+		echo "return_value = x * 10"
+	} > "${program}"
+	[ "$("${COMPILER}" --run < "${program}")" = "10000000000.000" ]
+	[ "$("${COMPILER}" -O2 --run < "${program}")" = "10000000000.000" ]
+}